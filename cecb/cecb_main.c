@@ -26,6 +26,7 @@ static char const * const helpMessage[] =
 	"     -f <n>    = Set bit delineation frequency (for WAV files).\n",
 	"     -p <e|o>  = Set even or odd WAV file parity (for WAV files).\n",
 	"     -s <n>    = Start at sample/bit n in WAV/CAS file.\n",
+	"     -n        = Don't use or keep a tape index (" CECB_INDEX_EXTENSION " file).\n",
 	"\n",
 	"     % is a decimal number between 0 and 1.\n",
 	NULL
@@ -48,6 +49,7 @@ static struct cmdtbl table[] =
 	{decblist,		"list"},
 	{cecbbulkerase,	"bulkerase"},
 	{cecbcopy,		"copy"},
+	{cecbconvert,	"convert"},
 	{NULL,			NULL}
 };
 
@@ -103,6 +105,10 @@ int main(int argc, char *argv[])
 							cecb_start_sample = strtol( &(argv[i][2]), NULL, 0 );
 						break;
 					
+					case 'n':
+						cecb_tape_index = 0;
+						break;
+					
 					case 'p':
 						if( strlen(argv[i]) == 2 )
 						{
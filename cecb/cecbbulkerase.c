@@ -109,12 +109,35 @@ int cecbbulkerase(int argc, char *argv[])
 	
 
 static int do_bulkerase(char **argv, char *p)
+{
+	error_code	ec;
+
+	ec = cecb_erase_image(p, sample_rate, bits_per_sample, silence_length, 1);
+
+	if (ec != 0)
+	{
+		fprintf(stderr, "%s: cannot open virtual cassette\n", argv[0]);
+	}
+
+	return ec;
+}
+
+
+/*
+ * cecb_erase_image()
+ *
+ * Create or empty a cassette image.  A WAV image gets a header and
+ * 'silence_length' seconds of silence.
+ */
+
+int cecb_erase_image(char *p, int sample_rate, int bits_per_sample, double silence_length, int verbose)
 {
 	error_code	ec = 0;
 	native_path_id nativepath;
 	int i, headers_size, bytes_per_sample, silent_samples_count, silent_samples_bytes;
 
 	_native_truncate(p, 0);
+	_cecb_index_remove(p);
 	
 	/* 1. Open a path to the cassette image. */
 	
@@ -126,8 +149,6 @@ static int do_bulkerase(char **argv, char *p)
 
 		if (ec != 0)
 		{
-			fprintf(stderr, "%s: cannot open virtual cassette\n", argv[0]);
-
 			return(ec);
 		}
 	}
@@ -135,12 +156,19 @@ static int do_bulkerase(char **argv, char *p)
 	_native_seek(nativepath, 0, SEEK_SET);
 	
 	if( strendcasecmp( p, CAS_FILE_EXTENSION ) == 0 )
+	{
+		_native_close(nativepath);
+
 		return 0;
+	}
 		
-	printf( "Creating WAV file: %s\n", p );
-	printf( "      Sample Rate: %d\n", sample_rate );
-	printf( "  Bits Per Sample: %d\n", bits_per_sample );
-	printf( "   Silence Length: %f\n", silence_length );
+	if( verbose )
+	{
+		printf( "Creating WAV file: %s\n", p );
+		printf( "      Sample Rate: %d\n", sample_rate );
+		printf( "  Bits Per Sample: %d\n", bits_per_sample );
+		printf( "   Silence Length: %f\n", silence_length );
+	}
 	
 
 	bytes_per_sample = bits_per_sample / 8;
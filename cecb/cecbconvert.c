@@ -0,0 +1,411 @@
+/********************************************************************
+ * cecbconvert.c - CAS to WAV conversion for Cassette BASIC
+ *
+ * $Id$
+ ********************************************************************/
+#include <util.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <cocotypes.h>
+#include <cecbpath.h>
+
+#define WAV_HEADER_SIZE 44
+
+static int convert_images(int argc, char *argv[]);
+static error_code convert_image(char *cas);
+static error_code wav_filename(char *cas, char *wav, size_t size);
+static int add_image(char ***list, int *count, char *name);
+static int compare_names(const void *a, const void *b);
+
+static int convert_rate = 22050;
+static int convert_bits = 8;
+
+/* Help message */
+static char const * const helpMessage[] =
+{
+	"Syntax: convert {[<opts>]} {<file> | <directory> [<...>]} {[<opts>]}\n",
+	"Usage:  Convert CAS images to WAV images, with the same names ending in .wav.\n",
+	"        A directory converts every CAS image in it.\n",
+	"Options:\n",
+	"     -s<num>  = Sample rate of WAV file (11025, 22050, 44100, etc. Default: 22050).\n",
+	"     -b<num>  = Bits per sample of WAV file (8 or 16, default: 8).\n",
+	"     -j<num>  = Convert up to <num> images at once (default: one per processor).\n",
+	NULL
+};
+
+
+int cecbconvert(int argc, char *argv[])
+{
+	error_code ec = 0;
+	char *p = NULL, **list = NULL, **job_argv;
+	char rate[32], bits[32], wav[1024];
+	int i, count = 0, jobs = 0;
+	struct timeval start, stop;
+	struct stat statbuf;
+	double elapsed, seconds = 0;
+
+
+	/* 1. Walk command line for options. */
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			for (p = &argv[i][1]; *p != '\0'; p++)
+			{
+				switch (*p)
+				{
+					case 's':
+						convert_rate = atoi(p + 1);
+						while (*(p + 1) != '\0') p++;
+						break;
+
+					case 'b':
+						convert_bits = atoi(p + 1);
+						while (*(p + 1) != '\0') p++;
+
+						if( (convert_bits != 8) && (convert_bits != 16 ) )
+							convert_bits = 8;
+
+						break;
+
+					case 'j':
+						jobs = parse_jobs(p + 1);
+						while (*(p + 1) != '\0') p++;
+						break;
+
+					case 'h':
+					case '?':
+						show_help(helpMessage);
+						return(0);
+
+					default:
+						fprintf(stderr, "%s: unknown option '%c'\n", argv[0], *p);
+						return(0);
+				}
+			}
+		}
+	}
+
+	if (jobs == 0)
+	{
+		jobs = parse_jobs(NULL);
+	}
+
+
+	/* 2. Gather the images, looking inside directories. */
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			continue;
+		}
+
+		if (stat(argv[i], &statbuf) == 0 && S_ISDIR(statbuf.st_mode))
+		{
+			DIR *dir = opendir(argv[i]);
+			struct dirent *entry;
+			int first = count;
+
+			if (dir == NULL)
+			{
+				fprintf(stderr, "%s: cannot read directory '%s'\n", argv[0], argv[i]);
+				continue;
+			}
+
+			while ((entry = readdir(dir)) != NULL)
+			{
+				char name[1024];
+
+				if (strendcasecmp(entry->d_name, CAS_FILE_EXTENSION) != 0)
+				{
+					continue;
+				}
+
+				snprintf(name, sizeof(name), "%s/%s", argv[i], entry->d_name);
+
+				if (add_image(&list, &count, name) != 0)
+				{
+					closedir(dir);
+					return(EOS_OM);
+				}
+			}
+
+			closedir(dir);
+
+			qsort(list + first, count - first, sizeof(char *), compare_names);
+		}
+		else if (add_image(&list, &count, argv[i]) != 0)
+		{
+			return(EOS_OM);
+		}
+	}
+
+	if (count == 0)
+	{
+		show_help(helpMessage);
+		return(0);
+	}
+
+
+	/* 3. Convert them, several at a time. */
+
+	job_argv = malloc((count + 4) * sizeof(char *));
+
+	if (job_argv == NULL)
+	{
+		return(EOS_OM);
+	}
+
+	snprintf(rate, sizeof(rate), "-s%d", convert_rate);
+	snprintf(bits, sizeof(bits), "-b%d", convert_bits);
+
+	job_argv[0] = argv[0];
+	job_argv[1] = rate;
+	job_argv[2] = bits;
+
+	for (i = 0; i < count; i++)
+	{
+		job_argv[i + 3] = list[i];
+	}
+
+	job_argv[count + 3] = NULL;
+
+	gettimeofday(&start, NULL);
+
+	ec = run_jobs(convert_images, count + 3, job_argv, jobs);
+
+	gettimeofday(&stop, NULL);
+
+
+	/* 4. Report the tape time made. */
+
+	for (i = 0; i < count; i++)
+	{
+		if (wav_filename(list[i], wav, sizeof(wav)) == 0 && stat(wav, &statbuf) == 0 && statbuf.st_size > WAV_HEADER_SIZE)
+		{
+			seconds += (statbuf.st_size - WAV_HEADER_SIZE) / ((double)convert_rate * (convert_bits / 8));
+		}
+
+		free(list[i]);
+	}
+
+	elapsed = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0;
+
+	printf("%d images, %.1f tape seconds written in %.2f seconds", count, seconds, elapsed);
+	if (elapsed > 0)
+	{
+		printf(" (%.1f tape seconds per second)", seconds / elapsed);
+	}
+	printf("\n");
+
+	free(job_argv);
+	free(list);
+
+
+	return(ec);
+}
+
+
+/* Convert each image named in 'argv'; run once per worker by run_jobs */
+
+static int convert_images(int argc, char *argv[])
+{
+	error_code ec = 0, ec2;
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			if (argv[i][1] == 's')
+				convert_rate = atoi(&argv[i][2]);
+			else if (argv[i][1] == 'b')
+				convert_bits = atoi(&argv[i][2]);
+
+			continue;
+		}
+
+		ec2 = convert_image(argv[i]);
+
+		if (ec2 != 0)
+		{
+			fprintf(stderr, "%s: error %d converting '%s'\n", argv[0], ec2, argv[i]);
+
+			if (ec == 0)
+				ec = ec2;
+		}
+	}
+
+	return ec;
+}
+
+
+/*
+ * convert_image()
+ *
+ * Read each file off a CAS image and write it to a new WAV image,
+ * holding the WAV image open for the whole tape.
+ */
+
+static error_code convert_image(char *cas)
+{
+	error_code ec;
+	cecb_path_id in, out = NULL;
+	cecb_dir_entry entry;
+	unsigned char data[256], block_type, block_length;
+	char wav[1024], pathlist[1040], name[9];
+	int files = 0, i;
+	u_int size;
+
+
+	/* 1. Open the CAS image, and start a blank WAV image. */
+
+	ec = wav_filename(cas, wav, sizeof(wav));
+
+	if (ec != 0)
+	{
+		return ec;
+	}
+
+	cecb_tape_index = 0;
+
+	snprintf(pathlist, sizeof(pathlist), "%s,", cas);
+
+	ec = _cecb_open(&in, pathlist, FAM_READ);
+
+	if (ec != 0)
+	{
+		return ec;
+	}
+
+	ec = cecb_erase_image(wav, convert_rate, convert_bits, 0.5, 0);
+
+	if (ec != 0)
+	{
+		_cecb_close(in);
+		return ec;
+	}
+
+
+	/* 2. Copy each file's header and data blocks. */
+
+	while ((ec = _cecb_read_next_dir_entry(in, &entry)) == 0)
+	{
+		int load = (entry.ml_load_address1 << 8) | entry.ml_load_address2;
+		int exec = (entry.ml_exec_address1 << 8) | entry.ml_exec_address2;
+
+		memcpy(name, entry.filename, 8);
+		name[8] = '\0';
+
+		for (i = 7; i >= 0 && name[i] == ' '; i--)
+			name[i] = '\0';
+
+		if (out == NULL)
+		{
+			snprintf(pathlist, sizeof(pathlist), "%s,%s", wav, name);
+
+			ec = _cecb_create(&out, pathlist, FAM_WRITE, entry.file_type, entry.ascii_flag, entry.gap_flag, load, exec);
+
+			if (ec != 0)
+			{
+				out = NULL;
+				break;
+			}
+		}
+		else
+		{
+			ec = _cecb_create_next(out, name, entry.file_type, entry.ascii_flag, entry.gap_flag, load, exec);
+
+			if (ec != 0)
+			{
+				break;
+			}
+		}
+
+		while ((ec = _cecb_read_next_block(in, &block_type, &block_length, data)) == 0 && block_type == 1)
+		{
+			size = block_length;
+			_cecb_write(out, data, &size);
+		}
+
+		if (ec != 0)
+		{
+			break;
+		}
+
+		files++;
+	}
+
+	if (ec == EOS_EOF)
+	{
+		ec = 0;
+	}
+
+	_cecb_close(in);
+
+	if (out != NULL)
+	{
+		error_code ec2 = _cecb_close(out);
+
+		if (ec == 0)
+			ec = ec2;
+	}
+
+	printf("%s: %d file%s\n", wav, files, files == 1 ? "" : "s");
+
+
+	return ec;
+}
+
+
+/* The WAV image name for a CAS image */
+
+static error_code wav_filename(char *cas, char *wav, size_t size)
+{
+	size_t length = strlen(cas);
+
+	if (strendcasecmp(cas, CAS_FILE_EXTENSION) != 0 || length >= size)
+	{
+		return EOS_BPNAM;
+	}
+
+	strcpy(wav, cas);
+	strcpy(wav + length - strlen(CAS_FILE_EXTENSION), WAV_FILE_EXTENSION);
+
+
+	return 0;
+}
+
+
+static int add_image(char ***list, int *count, char *name)
+{
+	char **bigger = realloc(*list, (*count + 1) * sizeof(char *));
+
+	if (bigger == NULL)
+	{
+		return -1;
+	}
+
+	*list = bigger;
+
+	if ((bigger[*count] = strdup(name)) == NULL)
+	{
+		return -1;
+	}
+
+	(*count)++;
+
+
+	return 0;
+}
+
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
@@ -8,6 +8,7 @@
 #include <cococonv.h>
 #include <cecbpath.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 
 #define YES 1
@@ -18,8 +19,10 @@
 //static char *buffer;
 
 static error_code CopyCECBFile(char *srcfile, char *dstfile, int eolTranslate, int tokTranslate, int s_record,
-					int binary_concat, int file_type, int data_type, int gap, int ml_load_address, int ml_exec_address);
+					int binary_concat, int file_type, int data_type, int gap, int ml_load_address, int ml_exec_address,
+					coco_path_id *tape);
 static char *GetFilename(char *path);
+static long ImageSize(char *pathlist);
 
 
 /* Help message */
@@ -43,6 +46,9 @@ static char const * const helpMessage[] =
 	"     -s         perform S Record encode of machine language loadables\n",
 	"     -f         perform S Record decode of ASCII text file\n",
 	"     -c         perform segment concatenation on machine language loadables\n",
+	"\n",
+	"     Several files copied to a cassette image are written with the image\n",
+	"     held open, and the tape time written per second is reported.\n",
     NULL
 };
 
@@ -54,6 +60,12 @@ int cecbcopy(int argc, char *argv[])
     char *p = NULL, *desttarget = NULL;
     int i, j;
     int targetDirectory = NO;
+    int batch = NO, files = 0;
+    coco_path_id tape = NULL;
+    _path_type type;
+    long start_size = 0;
+    double tape_rate = 0;
+    struct timeval start, stop;
     int	count = 0;
     int	eolTranslate = 0, tokTranslate = 0, s_record = 0, binary_concat = 0, ml_exec_address = -1, ml_load_address = -1;
 	int file_type = -1, data_type = -1, gap = -1;
@@ -218,6 +230,15 @@ int cecbcopy(int argc, char *argv[])
         return(0);
     }
 
+    /* Several files to a tape: keep it open and write them one after another */
+
+    if( targetDirectory == YES && count > 2 && _coco_identify_image(desttarget, &type) == 0 && type == CECB )
+    {
+        batch = YES;
+        start_size = ImageSize(desttarget);
+        gettimeofday(&start, NULL);
+    }
+
     /* Now look for the source files  */
     for (j = 1 ; j < i; j++)
     {
@@ -257,12 +278,54 @@ int cecbcopy(int argc, char *argv[])
 		}
 
 
-        ec = CopyCECBFile(argv[j], df, eolTranslate, tokTranslate, s_record, binary_concat, file_type, data_type, gap, ml_load_address, ml_exec_address);
+        ec = CopyCECBFile(argv[j], df, eolTranslate, tokTranslate, s_record, binary_concat, file_type, data_type, gap, ml_load_address, ml_exec_address,
+			batch == YES ? &tape : NULL);
 
         if (ec != 0)
         {
             fprintf(stderr, "%s: error %d\n", argv[0], ec);
         }
+        else
+        {
+            files++;
+        }
+    }
+
+    if (tape != NULL)
+    {
+        cecb_path_id cecb = tape->path.cecb;
+
+        if (cecb->tape_type == WAV)
+        {
+            tape_rate = (double)cecb->wav_sample_rate * (cecb->wav_bits_per_sample / 8);
+        }
+
+        _coco_close(tape);
+    }
+
+    if (batch == YES)
+    {
+        double elapsed, seconds = 0;
+
+        gettimeofday(&stop, NULL);
+        elapsed = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0;
+
+        printf("%d files", files);
+
+        if (tape_rate > 0)
+        {
+            seconds = (ImageSize(desttarget) - start_size) / tape_rate;
+            printf(", %.1f tape seconds", seconds);
+        }
+
+        printf(" written in %.2f seconds", elapsed);
+
+        if (tape_rate > 0 && elapsed > 0)
+        {
+            printf(" (%.1f tape seconds per second)", seconds / elapsed);
+        }
+
+        printf("\n");
     }
 
 
@@ -302,10 +365,36 @@ static char *GetFilename(char *path)
 }
 
 
+/* Size of the image named in a pathlist */
+
+static long ImageSize(char *pathlist)
+{
+	char image[1024];
+	char *p;
+	struct stat statbuf;
+
+	strncpy(image, pathlist, sizeof(image) - 1);
+	image[sizeof(image) - 1] = '\0';
+
+	if ((p = strchr(image, ',')) != NULL)
+	{
+		*p = '\0';
+	}
+
+	if (stat(image, &statbuf) != 0)
+	{
+		return 0;
+	}
+
+	return statbuf.st_size;
+}
+
+
 
 #define BLOCKSIZE 256
 
-static error_code CopyCECBFile(char *srcfile, char *dstfile, int eolTranslate, int tokTranslate, int s_record, int binary_concat, int file_type, int data_type, int gap, int ml_load_address, int ml_exec_address )
+static error_code CopyCECBFile(char *srcfile, char *dstfile, int eolTranslate, int tokTranslate, int s_record, int binary_concat, int file_type, int data_type, int gap, int ml_load_address, int ml_exec_address,
+	coco_path_id *tape)
 {
     error_code	ec = 0;
     coco_path_id path, destpath;
@@ -465,9 +554,19 @@ static error_code CopyCECBFile(char *srcfile, char *dstfile, int eolTranslate, i
 		fstat.ml_exec_address = ml_exec_address;
 
 
-    /* 3. Attempt to create the destfile. */
+    /* 3. Attempt to create the destfile, or start it after the last one on a held tape. */
 
-	ec = _coco_create(&destpath, dstfile, mode, &fstat);
+	if (tape != NULL && *tape != NULL)
+	{
+		destpath = *tape;
+
+		ec = _cecb_create_next(destpath->path.cecb, strchr(dstfile, ',') + 1, fstat.file_type, fstat.data_type,
+			fstat.gap_flag, fstat.ml_load_address, fstat.ml_exec_address);
+	}
+	else
+	{
+		ec = _coco_create(&destpath, dstfile, mode, &fstat);
+	}
 
     if (ec != 0)
     {
@@ -476,6 +575,11 @@ static error_code CopyCECBFile(char *srcfile, char *dstfile, int eolTranslate, i
         return ec;
     }
 
+	if (tape != NULL && destpath->type == CECB)
+	{
+		*tape = destpath;
+	}
+
 
 	if( tokTranslate != 0 )
 	{
@@ -557,7 +661,11 @@ static error_code CopyCECBFile(char *srcfile, char *dstfile, int eolTranslate, i
 		free( buffer );
 
     _coco_close(path);
-    _coco_close(destpath);
+
+	if (tape == NULL || *tape != destpath)
+	{
+		_coco_close(destpath);
+	}
 
 	if (ec != 0)
 		return -1;
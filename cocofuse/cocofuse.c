@@ -4,9 +4,12 @@
  * $Id$
  ********************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <cocopath.h>
 
 #define _FILE_OFFSET_BITS 64
@@ -35,6 +38,95 @@ static int coco_open(const char *path, struct fuse_file_info *fi);
 /* DSK image filename pointer */
 static char dsk[1024];
 
+/* Seconds the kernel may keep attributes and names it has looked up */
+#define COCOFUSE_TIMEOUT	"5"
+
+/* Bytes of writes an open file gathers before passing them on */
+#define WRITE_BUFFER_SIZE	(64 * 1024)
+
+/* Seconds a file's metadata may be held back before it is written */
+#define WRITE_BACK_SECONDS	5
+
+#define ATTR_BUCKETS	1024
+
+/* Attributes of a file, as last returned by getattr or readdir */
+typedef struct _attr_entry
+{
+	struct _attr_entry	*next;
+	struct stat		st;
+	char			path[1];
+} attr_entry;
+
+/*
+ * An open file; 'lock' keeps calls on one handle from interleaving.
+ *
+ * Writes to a file are gathered in 'buffer' while they run on from one
+ * another, and its path holds its metadata (FD sector, FAT, directory
+ * entry) back until the file is flushed, synced or released, until the
+ * write-back thread finds it has been held for WRITE_BACK_SECONDS, or
+ * until some other call is about to look at the image.  A read of the
+ * file through any handle first passes on what every handle on it is
+ * holding.  What reaches the image is the same as writing each call
+ * straight through.
+ */
+typedef struct _coco_file
+{
+	struct _coco_file	*next;		/* next open file on the volume */
+	coco_path_id	path;
+	pthread_mutex_t	lock;
+	char		*buffer;	/* gathered writes (writable files only) */
+	off_t		buffer_offset;	/* file offset of buffer[0] */
+	size_t		buffer_length;
+	int		dirty;		/* path is holding metadata back */
+	time_t		dirty_since;
+	int		error;		/* from writes passed on by another call */
+	char		name[1];	/* the file's path in the mount */
+} coco_file;
+
+/*
+ * The mounted image.  A path to the root directory is held open for
+ * the lifetime of the mount, so that the OS-9 volume (LSN0, bitmap and
+ * directory lookup cache) is shared by every call instead of being
+ * loaded again for each one.
+ *
+ * FUSE calls us from several threads at once.  Reads of open files
+ * share 'lock'; anything that opens or closes a path, or changes the
+ * bitmap, FAT or a directory, holds it exclusively.  The library's
+ * image reads are positional, so shared readers never disturb each
+ * other.
+ */
+static struct
+{
+	_path_type	type;
+	coco_path_id	root;
+	pthread_rwlock_t	lock;
+	pthread_mutex_t	attr_lock;	/* guards 'attr' */
+	attr_entry	*attr[ATTR_BUCKETS];
+	coco_file	*files;		/* open files */
+	pthread_t	write_back;	/* writes out metadata held too long */
+	int		unmounting;	/* tells write_back to stop */
+} volume;
+
+#define FILE_OF(fi)	((coco_file *)(uintptr_t)(fi)->fh)
+
+static void fill_stat(struct stat *stbuf, coco_file_stat *fdbuf, u_int filesize);
+static int attr_lookup(const char *path, struct stat *stbuf);
+static void attr_store(const char *path, struct stat *stbuf);
+static void attr_forget(const char *path);
+static void attr_forget_parent(const char *path);
+static void attr_free(void);
+static int file_new(struct fuse_file_info *fi, coco_path_id p, int writable, const char *name);
+static void file_free(coco_file *f);
+static int file_flush(coco_file *f);
+static int file_sync(coco_file *f);
+static void volume_sync(void);
+static int file_pending(const char *name);
+static void file_sync_all(const char *name);
+static void *write_back(void *arg);
+static void attr_grow(const char *path, off_t size);
+static int os9_entry_stat(coco_path_id p, os9_dir_entry *e, struct stat *stbuf);
+static int decb_entry_stat(coco_path_id p, decb_dir_entry *e, struct stat *stbuf);
+
 
 
 /*
@@ -42,23 +134,21 @@ static char dsk[1024];
  */
 static int coco_statfs(const char *path, struct statvfs *stbuf)
 {
-	_path_type type;
-	char buff[1024], dname[32];
-	u_int month, day, year, bps, total_sectors, bytes_free, free_sectors;
-	u_int largest_free_block, sectors_per_cluster, largest_count, sector_count;
-	
-	sprintf(buff, "%s,%s", dsk, path);
-	_coco_identify_image(buff, &type);
+	pthread_rwlock_wrlock(&volume.lock);
+	volume_sync();
+
 	/* Here we revert to RBF or Disk BASIC to get details about the disk */
-	switch (type)
+	switch (volume.type)
 	{
 		case OS9:
-			if (TSRBFFree(buff, dname, &month, &day, &year, &bps, &total_sectors, &bytes_free, &free_sectors, &largest_free_block, &sectors_per_cluster, &largest_count, &sector_count) == 0)
 			{
-				stbuf->f_bsize = stbuf->f_frsize = bps;
-				stbuf->f_blocks = total_sectors;
-				stbuf->f_bfree = free_sectors;
-				stbuf->f_bavail = free_sectors;
+				os9_volume_id vol = volume.root->path.os9->vol;
+
+				/* The volume keeps its free count up to date as clusters are allocated. */
+				stbuf->f_bsize = stbuf->f_frsize = vol->bps;
+				stbuf->f_blocks = int3(vol->lsn0->dd_tot);
+				stbuf->f_bfree = _os9_volume_free(vol) * vol->spc;
+				stbuf->f_bavail = stbuf->f_bfree;
 				stbuf->f_files = 1000;
 				stbuf->f_ffree = 1000;
 				stbuf->f_favail = 1000;
@@ -69,11 +159,25 @@ static int coco_statfs(const char *path, struct statvfs *stbuf)
 			
 		case DECB:
 			{
-				/* TODO: Put values here that make sense */
+				decb_drive *view = volume.root->path.decb->view;
+				int i, free_granules = 0;
+
+				/* Every path on the drive shares this view's FAT, so it is
+				 * current.  Only the drive's own granules are counted.
+				 */
+
+				for (i = 0; i < view->granules; i++)
+				{
+					if (view->FAT[i] == 0xFF)
+					{
+						free_granules++;
+					}
+				}
+
 				stbuf->f_bsize = stbuf->f_frsize = 256;
-				stbuf->f_blocks = 68;
-				stbuf->f_bfree = 68;
-				stbuf->f_bavail = 68;
+				stbuf->f_blocks = view->granules * 9;
+				stbuf->f_bfree = free_granules * 9;
+				stbuf->f_bavail = free_granules * 9;
 				stbuf->f_files = 1000;
 				stbuf->f_ffree = 1000;
 				stbuf->f_favail = 1000;
@@ -85,12 +189,14 @@ static int coco_statfs(const char *path, struct statvfs *stbuf)
                default:
                         break;
 	}
+
+	pthread_rwlock_unlock(&volume.lock);
 	
 #ifdef DEBUG
 # if defined(__APPLE__)
-	NSLog(@"coco_statfs(%s) = %d", path, type);
+	NSLog(@"coco_statfs(%s) = %d", path, volume.type);
 # else
-	syslog(LOG_DEBUG,"coco_statfs(%s) = %d", path, type);
+	syslog(LOG_DEBUG,"coco_statfs(%s) = %d", path, volume.type);
 # endif
 #endif
 	return 0;
@@ -106,7 +212,7 @@ static int coco_statfs(const char *path, struct statvfs *stbuf)
 static int coco_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
 {
 	error_code ec = 0;
-	coco_path_id p = (coco_path_id)(int32_t)fi->fh;
+	coco_path_id p = FILE_OF(fi)->path;
 	
         memset(stbuf, 0, sizeof(struct stat));
 
@@ -167,32 +273,30 @@ static int coco_getattr(const char *path, struct stat *stbuf)
 	coco_file_stat fdbuf;
 	char buff[1024];
 	
-    memset(stbuf, 0, sizeof(struct stat));
+	if (attr_lookup(path, stbuf) == 0)
+	{
+		return 0;
+	}
+
+	pthread_rwlock_wrlock(&volume.lock);
+	volume_sync();
+
 	sprintf(buff, "%s,%s", dsk, path);
 	if ((ec = -CoCoToUnixError(_coco_gs_fd_pathlist(buff, &fdbuf))) == 0)
 	{
 		u_int filesize;
 
-		stbuf->st_mode |= CoCoToUnixPerms(fdbuf.attributes);
-
-       	stbuf->st_nlink = 1;
-
-		if (_coco_gs_size_pathlist(buff, &filesize) == 0)
+		if (_coco_gs_size_pathlist(buff, &filesize) != 0)
 		{
-			stbuf->st_size = filesize;
+			filesize = 0;
 		}
 
-#ifdef __linux__
-		stbuf->st_ctime = fdbuf.create_time;
-		stbuf->st_mtime = fdbuf.last_modified_time;
-#else
-		stbuf->st_ctimespec.tv_sec = fdbuf.create_time;
-		stbuf->st_mtimespec.tv_sec = fdbuf.last_modified_time;
-#endif
-		stbuf->st_uid = getuid();
-		stbuf->st_gid = getgid();
+		fill_stat(stbuf, &fdbuf, filesize);
+		attr_store(path, stbuf);
     }
 
+	pthread_rwlock_unlock(&volume.lock);
+
 #ifdef DEBUG
 # if defined(__APPLE__)
 	NSLog(@"coco_getattr(%s) = %d", path, ec);
@@ -214,7 +318,11 @@ static int coco_mkdir(const char *path, mode_t mode)
 	char buff[1024];
 
 	sprintf(buff, "%s,%s", dsk, path);
+	pthread_rwlock_wrlock(&volume.lock);
+	volume_sync();
 	ec = -CoCoToUnixError(_coco_makdir(buff));
+	attr_forget_parent(path);
+	pthread_rwlock_unlock(&volume.lock);
 
 #ifdef DEBUG
 # if defined(__APPLE__)
@@ -237,7 +345,12 @@ static int coco_unlink(const char *path)
 	char buff[1024];
 
 	sprintf(buff, "%s,%s", dsk, path);
+	pthread_rwlock_wrlock(&volume.lock);
+	volume_sync();
 	ec = -CoCoToUnixError(_coco_delete(buff));
+	attr_forget(path);
+	attr_forget_parent(path);
+	pthread_rwlock_unlock(&volume.lock);
 
 #ifdef DEBUG
 # if defined(__APPLE__)
@@ -334,11 +447,15 @@ static int coco_chmod(const char *path, mode_t mode)
 	coco_path_id p;
 
 	sprintf(buff, "%s,%s", dsk, path);
+	pthread_rwlock_wrlock(&volume.lock);
+	volume_sync();
 	if ((ec = -CoCoToUnixError(_coco_open(&p, buff, FAM_WRITE))) == 0)
 	{
 		ec = -CoCoToUnixError(_coco_ss_attr(p, UnixToCoCoPerms(mode)));
 		_coco_close(p);
+		attr_forget(path);
 	}
+	pthread_rwlock_unlock(&volume.lock);
 	
 #ifdef DEBUG
 # if defined(__APPLE__)
@@ -362,12 +479,16 @@ static int coco_truncate(const char *path, off_t size)
 	coco_path_id p;
 
 	sprintf(buff, "%s,%s", dsk, path);
+	pthread_rwlock_wrlock(&volume.lock);
+	volume_sync();
 	ec = -CoCoToUnixError(_coco_open(&p, buff, FAM_WRITE));
 	if (ec == 0)
 	{
 		ec = -CoCoToUnixError(_coco_ss_size(p, size));
 		_coco_close(p);
+		attr_forget(path);
 	}
+	pthread_rwlock_unlock(&volume.lock);
 	
 #ifdef DEBUG
 # if defined(__APPLE__)
@@ -394,10 +515,13 @@ static int coco_open(const char *path, struct fuse_file_info *fi)
 	{
 		mflags |= FAM_WRITE;
 	}
+	pthread_rwlock_wrlock(&volume.lock);
+	volume_sync();
 	if ((ec =  -CoCoToUnixError(_coco_open(&p, buff, mflags))) == 0)
 	{
-		fi->fh = (uint32_t)p;
+		ec = file_new(fi, p, mflags & FAM_WRITE, path);
 	}
+	pthread_rwlock_unlock(&volume.lock);
 
 #ifdef DEBUG
 # if defined(__APPLE__)
@@ -416,9 +540,25 @@ static int coco_read(const char *path, char *buf, size_t size, off_t offset, str
 	error_code ec;
 	uint32_t _size = size;
 
-	coco_path_id p = (coco_path_id)(uint32_t)fi->fh;
-	_coco_seek(p, offset, SEEK_SET);
-	if ((ec = -CoCoToUnixError(_coco_read(p, buf, &_size))) != 0)
+	coco_file *f = FILE_OF(fi);
+
+	/* Reads of different files run side by side, unless some handle on
+	 * this file has writes or metadata to pass on first.
+	 */
+	pthread_rwlock_rdlock(&volume.lock);
+	if (file_pending(f->name))
+	{
+		pthread_rwlock_unlock(&volume.lock);
+		pthread_rwlock_wrlock(&volume.lock);
+		file_sync_all(f->name);
+	}
+	pthread_mutex_lock(&f->lock);
+	_coco_seek(f->path, offset, SEEK_SET);
+	ec = -CoCoToUnixError(_coco_read(f->path, buf, &_size));
+	pthread_mutex_unlock(&f->lock);
+	pthread_rwlock_unlock(&volume.lock);
+
+	if (ec != 0)
 	{
 		return ec;
 	}
@@ -440,9 +580,49 @@ static int coco_write(const char *path, const char *buf, size_t size, off_t offs
 	error_code ec;
 	uint32_t _size = size;
 
-	coco_path_id p = (coco_path_id)(uint32_t)fi->fh;
-	_coco_seek(p, offset, SEEK_SET);
-	if ((ec = -CoCoToUnixError(_coco_write(p, (char *)buf, &_size))) != 0)
+	coco_file *f = FILE_OF(fi);
+
+	/* A write may allocate space, so it has the volume to itself. */
+	pthread_rwlock_wrlock(&volume.lock);
+
+	/* 1. Pass on what was gathered if this write doesn't follow on from it. */
+	ec = 0;
+	if (f->buffer_length > 0 &&
+		(offset != f->buffer_offset + (off_t)f->buffer_length || f->buffer_length + size > WRITE_BUFFER_SIZE))
+	{
+		ec = file_flush(f);
+	}
+
+	if (ec == 0)
+	{
+		if (f->buffer == NULL || size > WRITE_BUFFER_SIZE)
+		{
+			/* 2. Too big to gather; write it now. */
+			_coco_seek(f->path, offset, SEEK_SET);
+			ec = -CoCoToUnixError(_coco_write(f->path, (char *)buf, &_size));
+		}
+		else
+		{
+			/* 3. Gather it. */
+			if (f->buffer_length == 0)
+			{
+				f->buffer_offset = offset;
+			}
+			memcpy(f->buffer + f->buffer_length, buf, size);
+			f->buffer_length += size;
+		}
+
+		if (f->dirty == 0)
+		{
+			f->dirty = 1;
+			f->dirty_since = time(NULL);
+		}
+	}
+
+	attr_grow(path, offset + size);
+	pthread_rwlock_unlock(&volume.lock);
+
+	if (ec != 0)
 	{
 		return ec;
 	}
@@ -468,8 +648,20 @@ static int coco_write(const char *path, const char *buf, size_t size, off_t offs
 static int coco_release(const char *path, struct fuse_file_info *fi)
 {
 	error_code ec;
+	coco_file *f = FILE_OF(fi);
 	
-	ec = -CoCoToUnixError(_coco_close((coco_path_id)(int32_t)fi->fh));
+	pthread_rwlock_wrlock(&volume.lock);
+	ec = file_sync(f);
+	if (ec == 0)
+	{
+		ec = -CoCoToUnixError(_coco_close(f->path));
+	}
+	else
+	{
+		_coco_close(f->path);
+	}
+	file_free(f);
+	pthread_rwlock_unlock(&volume.lock);
 	
 #ifdef DEBUG
 # if defined(__APPLE__)
@@ -483,6 +675,52 @@ static int coco_release(const char *path, struct fuse_file_info *fi)
 }
 
 
+/*
+ * coco_flush - writes out what an open file is holding back
+ *
+ * Notes: called on each close(2) of the file, so that an error in
+ * gathered writes can still be reported.
+ */
+static int coco_flush(const char *path, struct fuse_file_info *fi)
+{
+	error_code ec;
+
+	pthread_rwlock_wrlock(&volume.lock);
+	ec = file_sync(FILE_OF(fi));
+	pthread_rwlock_unlock(&volume.lock);
+
+#ifdef DEBUG
+# if defined(__APPLE__)
+	NSLog(@"coco_flush(%s) = %d", path, ec);
+# else
+	syslog(LOG_DEBUG,"coco_flush(%s) = %d", path, ec);
+# endif
+#endif
+
+	return ec;
+}
+
+
+static int coco_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	error_code ec;
+
+	pthread_rwlock_wrlock(&volume.lock);
+	ec = file_sync(FILE_OF(fi));
+	pthread_rwlock_unlock(&volume.lock);
+
+#ifdef DEBUG
+# if defined(__APPLE__)
+	NSLog(@"coco_fsync(%s) = %d", path, ec);
+# else
+	syslog(LOG_DEBUG,"coco_fsync(%s) = %d", path, ec);
+# endif
+#endif
+
+	return ec;
+}
+
+
 static int coco_create(const char *path, mode_t perms, struct fuse_file_info * fi)
 {
 	error_code ec = 0;
@@ -500,12 +738,21 @@ static int coco_create(const char *path, mode_t perms, struct fuse_file_info * f
 		fstat.perms |= FAM_WRITE;
 	}
 
+	pthread_rwlock_wrlock(&volume.lock);
+	volume_sync();
+
 	if ((ec = -CoCoToUnixError(_coco_create(&p, buff, mflags, &fstat))) != 0)
 	{
+		pthread_rwlock_unlock(&volume.lock);
 		return ec;
 	}
 
-	fi->fh = (uint32_t)p;
+	attr_forget(path);
+	attr_forget_parent(path);
+
+	ec = file_new(fi, p, 1, path);
+
+	pthread_rwlock_unlock(&volume.lock);
 
 #ifdef DEBUG
 # if defined(__APPLE__)
@@ -534,10 +781,13 @@ static int coco_opendir(const char *path, struct fuse_file_info *fi)
 	{
 		mflags |= FAM_WRITE;
 	}
+	pthread_rwlock_wrlock(&volume.lock);
+	volume_sync();
 	if ((ec =  -CoCoToUnixError(_coco_open(&p, buff, mflags))) == 0)
 	{
-		fi->fh = (uint32_t)p;
+		ec = file_new(fi, p, 0, path);
 	}
+	pthread_rwlock_unlock(&volume.lock);
 
 #ifdef DEBUG
 # if defined(__APPLE__)
@@ -558,6 +808,9 @@ static int coco_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off
 	coco_dir_entry e;
 	char buff[1024];
 
+	pthread_rwlock_wrlock(&volume.lock);
+	volume_sync();
+
 #if !0
 	sprintf(buff, "%s,%s", dsk, path);
 	if (_coco_open(&p, buff, FAM_READ | FAM_DIR) != 0)
@@ -565,22 +818,42 @@ static int coco_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off
 		/* DECB doesn't use FAM_DIR */
 		if (_coco_open(&p, buff, FAM_READ) != 0)
 		{
+			pthread_rwlock_unlock(&volume.lock);
 			return -ENOENT;
 		}
 	}
 #else
-	p = (coco_path_id)fi->fh;
+	p = FILE_OF(fi)->path;
 #endif
 
 	while (_coco_readdir(p, &e) == 0)
 	{
+		struct stat st;
+		char *name;
+
+		/* Each entry's attributes are cached as it is listed, so that
+		 * the getattr calls that follow (e.g. from 'ls -l') need not
+		 * open every file.
+		 */
+
 		switch (e.type)
 		{
 			case OS9:
 				if (e.dentry.os9.name[0] != '\0')
 				{
 					/* entry is not empty, add it */
-					filler(buf, (char *)OS9StringToCString(e.dentry.os9.name), NULL, 0);
+					name = (char *)OS9StringToCString(e.dentry.os9.name);
+
+					if (strcmp(name, ".") != 0 && strcmp(name, "..") != 0 && os9_entry_stat(p, &e.dentry.os9, &st) == 0)
+					{
+						snprintf(buff, sizeof(buff), "%s/%s", strcmp(path, "/") == 0 ? "" : path, name);
+						attr_store(buff, &st);
+						filler(buf, name, &st, 0);
+					}
+					else
+					{
+						filler(buf, name, NULL, 0);
+					}
 				}
 				break;
 
@@ -590,7 +863,18 @@ static int coco_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off
 					u_char cstring[24];
 
 					DECBStringToCString(e.dentry.decb.filename, e.dentry.decb.file_extension, cstring);
-					filler(buf, (char *)cstring, NULL, 0);
+					name = (char *)cstring;
+
+					if (decb_entry_stat(p, &e.dentry.decb, &st) == 0)
+					{
+						snprintf(buff, sizeof(buff), "%s/%s", strcmp(path, "/") == 0 ? "" : path, name);
+						attr_store(buff, &st);
+						filler(buf, name, &st, 0);
+					}
+					else
+					{
+						filler(buf, name, NULL, 0);
+					}
 				}
 				break;
 
@@ -603,6 +887,8 @@ static int coco_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off
 	_coco_close(p);
 #endif
 
+	pthread_rwlock_unlock(&volume.lock);
+
 #ifdef DEBUG
 # if defined(__APPLE__)
 	NSLog(@"coco_readdir(%s) = %d", path, ec);
@@ -620,9 +906,490 @@ static int coco_utimens(const char *path, const struct timespec *tv)
 	return 0;
 }
 
+/*
+ * coco_init - opens the image for the lifetime of the mount, and starts
+ * the thread that writes out what open files hold back too long
+ */
+static void *coco_init(struct fuse_conn_info *conn)
+{
+	char buff[1024];
+
+	pthread_rwlock_init(&volume.lock, NULL);
+	pthread_mutex_init(&volume.attr_lock, NULL);
+
+	snprintf(buff, sizeof(buff), "%s,", dsk);
+	_coco_identify_image(buff, &volume.type);
+
+	if (_coco_open(&volume.root, buff, FAM_READ | FAM_DIR) != 0)
+	{
+		/* DECB doesn't use FAM_DIR */
+		if (_coco_open(&volume.root, buff, FAM_READ) != 0)
+		{
+			volume.root = NULL;
+			volume.type = NATIVE;
+		}
+	}
+
+	pthread_create(&volume.write_back, NULL, write_back, NULL);
+
+	return NULL;
+}
+
+
+/*
+ * coco_destroy - closes the image when it is unmounted
+ */
+static void coco_destroy(void *private_data)
+{
+	pthread_rwlock_wrlock(&volume.lock);
+	volume.unmounting = 1;
+	pthread_rwlock_unlock(&volume.lock);
+	pthread_join(volume.write_back, NULL);
+
+	if (volume.root != NULL)
+	{
+		_coco_close(volume.root);
+		volume.root = NULL;
+	}
+
+	attr_free();
+}
+
+
+/*
+ * fill_stat - converts coco_file_stat values into a struct stat
+ */
+static void fill_stat(struct stat *stbuf, coco_file_stat *fdbuf, u_int filesize)
+{
+	memset(stbuf, 0, sizeof(struct stat));
+
+	stbuf->st_mode |= CoCoToUnixPerms(fdbuf->attributes);
+	stbuf->st_nlink = 1;
+	stbuf->st_size = filesize;
+
+#ifdef __linux__
+	stbuf->st_ctime = fdbuf->create_time;
+	stbuf->st_mtime = fdbuf->last_modified_time;
+#else
+	stbuf->st_ctimespec.tv_sec = fdbuf->create_time;
+	stbuf->st_mtimespec.tv_sec = fdbuf->last_modified_time;
+#endif
+	stbuf->st_uid = getuid();
+	stbuf->st_gid = getgid();
+}
+
+
+/*
+ * os9_entry_stat - attributes of an OS-9 directory entry, read straight
+ * from its FD sector through the open directory 'p'
+ */
+static int os9_entry_stat(coco_path_id p, os9_dir_entry *e, struct stat *stbuf)
+{
+	fd_stats fd;
+	coco_file_stat fdbuf;
+	struct tm timepak;
+	os9_path_id dir = p->path.os9;
+
+	if (_image_read_at(dir->image, int3(e->lsn) * dir->bps, &fd, sizeof(fd)) != sizeof(fd))
+	{
+		return -1;
+	}
+
+	/* Same conversion as _coco_gs_fd */
+	memset(&fdbuf, 0, sizeof(fdbuf));
+	fdbuf.attributes = fd.fd_att;
+	memset(&timepak, 0, sizeof(timepak));
+	timepak.tm_year = fd.fd_creat[0];
+	timepak.tm_mon = fd.fd_creat[1] - 1;
+	timepak.tm_mday = fd.fd_creat[2];
+	fdbuf.create_time = mktime(&timepak);
+	timepak.tm_year = fd.fd_dat[0];
+	timepak.tm_mon = fd.fd_dat[1] - 1;
+	timepak.tm_mday = fd.fd_dat[2];
+	timepak.tm_hour = fd.fd_dat[3];
+	timepak.tm_min = fd.fd_dat[4];
+	fdbuf.last_modified_time = mktime(&timepak);
+
+	fill_stat(stbuf, &fdbuf, int4(fd.fd_siz));
+
+	return 0;
+}
+
+
+/*
+ * decb_entry_stat - attributes of a Disk BASIC directory entry, sized
+ * from the FAT already loaded by the open directory 'p'
+ */
+static int decb_entry_stat(coco_path_id p, decb_dir_entry *e, struct stat *stbuf)
+{
+	u_char *FAT = p->path.decb->FAT;
+	coco_file_stat fdbuf;
+	int granule = e->first_granule, granules = 0, sectors;
+	time_t tp;
+
+	/* 1. Walk the granule chain to the last granule, as _decb_gs_size does. */
+
+	while (FAT[granule] < 0xC0)
+	{
+		granule = FAT[granule];
+
+		if (++granules >= 256)
+		{
+			return -1;
+		}
+	}
+
+	sectors = (FAT[granule] & 0x3f) - 1;
+	sectors = sectors < 0 ? 0 : sectors;
+
+
+	/* 2. Make up the rest, as _coco_gs_fd does. */
+
+	memset(&fdbuf, 0, sizeof(fdbuf));
+	fdbuf.attributes = FAP_READ | FAP_WRITE | FAP_PREAD;
+	time(&tp);
+	fdbuf.create_time = tp;
+	fdbuf.last_modified_time = tp;
+
+	fill_stat(stbuf, &fdbuf, granules * 2304 + 256 * sectors + int2(e->last_sector_size));
+
+	return 0;
+}
+
+
+static unsigned int attr_hash(const char *path)
+{
+	unsigned int h = 5381;
+
+	while (*path != '\0')
+	{
+		h = h * 33 + (u_char)*path++;
+	}
+
+	return h % ATTR_BUCKETS;
+}
+
+
+static int attr_lookup(const char *path, struct stat *stbuf)
+{
+	attr_entry *a;
+	int result = -1;
+
+	pthread_mutex_lock(&volume.attr_lock);
+
+	for (a = volume.attr[attr_hash(path)]; a != NULL; a = a->next)
+	{
+		if (strcmp(a->path, path) == 0)
+		{
+			memcpy(stbuf, &a->st, sizeof(struct stat));
+			result = 0;
+
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&volume.attr_lock);
+
+	return result;
+}
+
+
+static void attr_store(const char *path, struct stat *stbuf)
+{
+	attr_entry *a;
+	unsigned int h = attr_hash(path);
+
+	pthread_mutex_lock(&volume.attr_lock);
+
+	for (a = volume.attr[h]; a != NULL; a = a->next)
+	{
+		if (strcmp(a->path, path) == 0)
+		{
+			memcpy(&a->st, stbuf, sizeof(struct stat));
+			break;
+		}
+	}
+
+	if (a == NULL && (a = malloc(sizeof(attr_entry) + strlen(path))) != NULL)
+	{
+		strcpy(a->path, path);
+		memcpy(&a->st, stbuf, sizeof(struct stat));
+		a->next = volume.attr[h];
+		volume.attr[h] = a;
+	}
+
+	pthread_mutex_unlock(&volume.attr_lock);
+}
+
+
+static void attr_forget(const char *path)
+{
+	attr_entry **a, *dead;
+
+	pthread_mutex_lock(&volume.attr_lock);
+
+	for (a = &volume.attr[attr_hash(path)]; *a != NULL; a = &(*a)->next)
+	{
+		if (strcmp((*a)->path, path) == 0)
+		{
+			dead = *a;
+			*a = dead->next;
+			free(dead);
+
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&volume.attr_lock);
+}
+
+
+/* Forget the directory holding 'path', whose size changes as entries come and go */
+static void attr_forget_parent(const char *path)
+{
+	char parent[1024];
+	char *p;
+
+	strncpy(parent, path, sizeof(parent) - 1);
+	parent[sizeof(parent) - 1] = '\0';
+
+	p = strrchr(parent, '/');
+
+	if (p == NULL)
+	{
+		return;
+	}
+
+	if (p == parent)
+	{
+		p++;
+	}
+
+	*p = '\0';
+
+	attr_forget(parent);
+}
+
+
+static void attr_free(void)
+{
+	int i;
+	attr_entry *a;
+
+	for (i = 0; i < ATTR_BUCKETS; i++)
+	{
+		while ((a = volume.attr[i]) != NULL)
+		{
+			volume.attr[i] = a->next;
+			free(a);
+		}
+	}
+}
+
+
+/* Wrap an open path in a handle for 'fi'; called with the volume held */
+static int file_new(struct fuse_file_info *fi, coco_path_id p, int writable, const char *name)
+{
+	coco_file *f = calloc(1, sizeof(coco_file) + strlen(name));
+
+	if (f == NULL)
+	{
+		_coco_close(p);
+
+		return -ENOMEM;
+	}
+
+	f->path = p;
+	strcpy(f->name, name);
+	pthread_mutex_init(&f->lock, NULL);
+
+	/* A file that can't get a buffer is simply written through. */
+	if (writable && (f->buffer = malloc(WRITE_BUFFER_SIZE)) != NULL)
+	{
+		_coco_ss_writeback(p, 1);
+	}
+
+	f->next = volume.files;
+	volume.files = f;
+	fi->fh = (uintptr_t)f;
+
+	return 0;
+}
+
+
+/* Unlink and free a handle whose path has been closed */
+static void file_free(coco_file *f)
+{
+	coco_file **p;
+
+	for (p = &volume.files; *p != NULL; p = &(*p)->next)
+	{
+		if (*p == f)
+		{
+			*p = f->next;
+			break;
+		}
+	}
+
+	pthread_mutex_destroy(&f->lock);
+	free(f->buffer);
+	free(f);
+}
+
+
+/* Pass gathered writes on to the file's path */
+static int file_flush(coco_file *f)
+{
+	error_code ec = 0;
+	u_int size = f->buffer_length;
+
+	if (size > 0)
+	{
+		_coco_seek(f->path, f->buffer_offset, SEEK_SET);
+		ec = -CoCoToUnixError(_coco_write(f->path, f->buffer, &size));
+		f->buffer_length = 0;
+	}
+
+	return ec;
+}
+
+
+/*
+ * Pass on gathered writes and write out the metadata the path holds,
+ * returning any error from writes passed on earlier
+ */
+static int file_sync(coco_file *f)
+{
+	error_code ec = file_flush(f);
+
+	if (f->dirty)
+	{
+		_coco_ss_sync(f->path);
+		f->dirty = 0;
+	}
+
+	if (ec == 0)
+	{
+		ec = f->error;
+	}
+
+	f->error = 0;
+
+	return ec;
+}
+
+
+/* Bring the image up to date before another path looks at it */
+static void volume_sync(void)
+{
+	coco_file *f;
+
+	for (f = volume.files; f != NULL; f = f->next)
+	{
+		f->error = file_sync(f);
+	}
+}
+
+
+/* Whether any handle on a file holds writes or metadata back */
+static int file_pending(const char *name)
+{
+	coco_file *f;
+
+	for (f = volume.files; f != NULL; f = f->next)
+	{
+		if ((f->buffer_length > 0 || f->dirty) && strcmp(f->name, name) == 0)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Bring one file up to date in the image, through every handle on it */
+static void file_sync_all(const char *name)
+{
+	coco_file *f;
+
+	for (f = volume.files; f != NULL; f = f->next)
+	{
+		if ((f->buffer_length > 0 || f->dirty) && strcmp(f->name, name) == 0)
+		{
+			f->error = file_sync(f);
+		}
+	}
+}
+
+
+/*
+ * Every second, write out what each open file has held back for
+ * WRITE_BACK_SECONDS, so that a writer that goes quiet doesn't keep
+ * its data and metadata out of the image
+ */
+static void *write_back(void *arg)
+{
+	coco_file *f;
+	time_t now;
+
+	for (;;)
+	{
+		sleep(1);
+
+		pthread_rwlock_wrlock(&volume.lock);
+
+		if (volume.unmounting)
+		{
+			pthread_rwlock_unlock(&volume.lock);
+			break;
+		}
+
+		now = time(NULL);
+
+		for (f = volume.files; f != NULL; f = f->next)
+		{
+			if (f->dirty && now - f->dirty_since >= WRITE_BACK_SECONDS)
+			{
+				f->error = file_sync(f);
+			}
+		}
+
+		pthread_rwlock_unlock(&volume.lock);
+	}
+
+	return NULL;
+}
+
+
+/* Note that a file written through a handle is now at least 'size' long */
+static void attr_grow(const char *path, off_t size)
+{
+	attr_entry *a;
+
+	pthread_mutex_lock(&volume.attr_lock);
+
+	for (a = volume.attr[attr_hash(path)]; a != NULL; a = a->next)
+	{
+		if (strcmp(a->path, path) == 0)
+		{
+			if (a->st.st_size < size)
+			{
+				a->st.st_size = size;
+			}
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&volume.attr_lock);
+}
+
+
 #ifndef COCOFUSE_MAC
 static struct fuse_operations coco_filesystem_operations =
 {
+        .init = coco_init,
+        .destroy = coco_destroy,
         .statfs = coco_statfs,
         .truncate = coco_truncate,
 	.getattr = coco_getattr,
@@ -636,6 +1403,8 @@ static struct fuse_operations coco_filesystem_operations =
 	.read = coco_read,
 	.write = coco_write,
 	.release = coco_release,
+	.flush = coco_flush,
+	.fsync = coco_fsync,
 	.create = coco_create,
 	.opendir = coco_opendir,
 	.releasedir = coco_release,
@@ -686,8 +1455,15 @@ int main(int argc, char **argv)
 #ifdef DEBUG
                 openlog("cocofuse", LOG_PID, LOG_DAEMON);
 #endif        
+                struct fuse_args args = FUSE_ARGS_INIT(argc - 1, &argv[1]);
+
                 argv[1] = argv[0];
-                rc = fuse_main(argc - 1, &argv[1], &coco_filesystem_operations, NULL);
+
+                /* Let the kernel cache what it looks up; every change goes through us. */
+                fuse_opt_add_arg(&args, "-oattr_timeout=" COCOFUSE_TIMEOUT ",entry_timeout=" COCOFUSE_TIMEOUT);
+
+                rc = fuse_main(args.argc, args.argv, &coco_filesystem_operations, NULL);
+                fuse_opt_free_args(&args);
 #ifdef DEBUG
                 closelog();
 #endif
@@ -4,6 +4,7 @@
  * $Id$
  ********************************************************************/
 #include <string.h>
+#include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -13,7 +14,7 @@
 
 
 static void show_decb_help(char const * const *helpMessage);
-static int do_command(int argc, char **argv);
+static int do_command(int argc, char **argv, int jobs);
 
 /* Help message */
 static char const * const helpMessage[] =
@@ -22,6 +23,8 @@ static char const * const helpMessage[] =
 	"Syntax: decb {[<opts>]} <command> {[<opts>]}\n",
 	"Usage:  Disk BASIC File Tools Executive\n",
 	"Options:\n",
+	"     -j<n>   list or check up to <n> images at a time\n",
+	"              (0 = one per processor)\n",
 	NULL
 };
 
@@ -31,22 +34,24 @@ struct cmdtbl
 	int(*func)(int, char **);
 	char *keyword;
 	char *synopsis;
+	int multi;		/* each image argument can be run on its own */
 };
 
 
 static struct cmdtbl table[] =
 {
 	{decbattr,	"attr"},
+	{decbcheck,	"check",	NULL, 1},
 	{decbcopy,	"copy"},
-	{decbdir,	"dir"},
+	{decbdir,	"dir",		NULL, 1},
 	{decbdsave,     "dsave"},
 	{decbdskini,	"dskini"},
 	{os9dump,       "dump"},
-	{decbfree,	"free"},
-	{decbfstat,	"fstat"},
+	{decbfree,	"free",		NULL, 1},
+	{decbfstat,	"fstat",	NULL, 1},
 	{decbhdbconv,	"hdbconv"},
 	{decbkill,	"kill"},
-	{decblist,	"list"},
+	{decblist,	"list",		NULL, 1},
 	{decbrename,	"rename"},
 	{NULL,		NULL}
 };
@@ -55,7 +60,7 @@ static struct cmdtbl table[] =
 int main(int argc, char *argv[])
 {
 	error_code ec = 0;
-	int i;
+	int i, jobs = 1;
 	char *p, *command = NULL;
 
 	/* walk command line for options */
@@ -71,6 +76,22 @@ int main(int argc, char *argv[])
 					case '?':
 						show_decb_help(helpMessage);
 						return(0);
+
+					case 'j':
+						if (*(p + 1) != '\0')
+						{
+							jobs = parse_jobs(p + 1);
+						}
+						else if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+						{
+							jobs = parse_jobs(argv[++i]);
+						}
+						else
+						{
+							jobs = parse_jobs(NULL);
+						}
+						p += strlen(p) - 1;
+						break;
 				}
 			}
 		}
@@ -88,14 +109,14 @@ int main(int argc, char *argv[])
 	}
 	else
 	{
-		ec = do_command(argc - i, &argv[i]);
+		ec = do_command(argc - i, &argv[i], jobs);
 	}
 
 	return(ec);
 }
 
 
-static int do_command(int argc, char **argv)
+static int do_command(int argc, char **argv, int jobs)
 {
     struct cmdtbl *x = table;
     
@@ -103,6 +124,11 @@ static int do_command(int argc, char **argv)
     {
         if (strcmp(argv[0], x->keyword) == 0)
         {
+            if (x->multi && jobs > 1)
+            {
+                return(run_jobs(x->func, argc, argv, jobs));
+            }
+
             return(x->func(argc, argv));
         }
         x++;
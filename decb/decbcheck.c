@@ -0,0 +1,269 @@
+/********************************************************************
+ * decbcheck.c - Disk structure check utility for Disk BASIC
+ *
+ * $Id$
+ ********************************************************************/
+#include <util.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <cococonv.h>
+#include <decbpath.h>
+
+
+static int do_check(char **argv, char *p, int all, int jobs);
+static int check_drive(decb_volume_id vol, int drive, void *arg);
+
+
+/* Help message */
+static char const * const helpMessage[] =
+{
+	"Syntax: check {[<opts>]} {<disk> [<...>]} {[<opts>]}\n",
+	"Usage:  Verify the FAT and directory of a disk image.\n",
+	"Options:\n",
+	"     -a         check every drive of an HDB-DOS image\n",
+	"     -j<num>    with -a, check up to <num> drives at once (default: one per processor)\n",
+	NULL
+};
+
+
+int decbcheck(int argc, char *argv[])
+{
+	error_code	ec = 0;
+	char		*p = NULL;
+	int			i, all = 0, jobs = 0;
+
+
+	/* 1. Walk command line for options. */
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			for (p = &argv[i][1]; *p != '\0'; p++)
+			{
+				switch(*p)
+				{
+					case 'a':
+						all = 1;
+						break;
+
+					case 'j':
+						jobs = parse_jobs(p + 1);
+						while (*(p + 1) != '\0') p++;
+						break;
+
+					case '?':
+					case 'h':
+						show_help(helpMessage);
+						return(0);
+
+					default:
+						fprintf(stderr, "%s: unknown option '%c'\n", argv[0], *p);
+						return(0);
+				}
+			}
+		}
+	}
+
+	if (jobs == 0)
+	{
+		jobs = parse_jobs(NULL);
+	}
+
+
+	/* 2. Walk command line for pathnames. */
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			continue;
+		}
+
+		p = argv[i];
+
+		ec = do_check(argv, p, all, jobs);
+
+		if (ec != 0)
+		{
+			fprintf(stderr, "%s: error %d checking '%s'\n", argv[0], ec, p);
+			return(ec);
+		}
+	}
+
+	if (p == NULL)
+	{
+		show_help(helpMessage);
+	}
+
+
+	return(0);
+}
+
+
+
+static int do_check(char **argv, char *p, int all, int jobs)
+{
+	error_code		ec;
+	decb_volume_id	vol;
+	int				drive;
+
+
+	ec = _decb_volume_pathlist(&vol, p, FAM_READ, &drive);
+
+	if (ec != 0)
+	{
+		return ec;
+	}
+
+	if (all)
+	{
+		ec = _decb_volume_scan(vol, check_drive, NULL, jobs);
+	}
+	else
+	{
+		ec = check_drive(vol, drive < 0 ? 0 : drive, NULL);
+	}
+
+	_decb_volume_release(vol);
+
+
+	return ec;
+}
+
+
+
+/*
+ * check_drive()
+ *
+ * Follow every file's FAT chain, making sure each granule belongs to
+ * one file only and that every granule in use belongs to some file.
+ */
+
+static int check_drive(decb_volume_id vol, int drive, void *arg)
+{
+	error_code	ec;
+	decb_drive	*view;
+	int			owner[256];
+	int			files = 0, used = 0, free_granules = 0, lost = 0, errors = 0;
+	int			i, g;
+	u_char		name[13], other[13];
+
+
+	ec = _decb_volume_drive(vol, drive, &view);
+
+	if (ec != 0)
+	{
+		return ec;
+	}
+
+	printf("Drive %d of %s\n", drive, vol->imgfile);
+
+
+	/* 1. Every FAT entry must be free, a link, or the end of a chain. */
+
+	for (g = 0; g < view->granules; g++)
+	{
+		u_char v = view->FAT[g];
+
+		owner[g] = -1;
+
+		if (v == 0xFF)
+		{
+			free_granules++;
+		}
+		else if (v >= view->granules && (v < 0xC1 || v > 0xC9))
+		{
+			printf("  Granule %d has a bad FAT entry $%02X\n", g, v);
+			errors++;
+		}
+	}
+
+
+	/* 2. Follow each file's chain. */
+
+	for (i = 0; i < 72; i++)
+	{
+		decb_dir_entry *de = &view->dir[i];
+
+		if (de->filename[0] == 0 || de->filename[0] == 0xFF)
+		{
+			continue;
+		}
+
+		files++;
+
+		DECBStringToCString(de->filename, de->file_extension, name);
+
+		for (g = de->first_granule; ; g = view->FAT[g])
+		{
+			if (g >= view->granules)
+			{
+				printf("  %s: granule %d is past the end of the disk\n", name, g);
+				errors++;
+				break;
+			}
+
+			if (view->FAT[g] == 0xFF)
+			{
+				printf("  %s: granule %d is marked free\n", name, g);
+				errors++;
+				break;
+			}
+
+			if (owner[g] == i)
+			{
+				printf("  %s: chain loops back to granule %d\n", name, g);
+				errors++;
+				break;
+			}
+
+			if (owner[g] >= 0)
+			{
+				DECBStringToCString(view->dir[owner[g]].filename, view->dir[owner[g]].file_extension, other);
+				printf("  %s: granule %d is also in %s\n", name, g, other);
+				errors++;
+				break;
+			}
+
+			owner[g] = i;
+			used++;
+
+			if (view->FAT[g] >= 0xC0)
+			{
+				break;
+			}
+		}
+	}
+
+
+	/* 3. Anything else in use belongs to no file. */
+
+	for (g = 0; g < view->granules; g++)
+	{
+		if (view->FAT[g] != 0xFF && owner[g] < 0)
+		{
+			lost++;
+		}
+	}
+
+	printf("%d file%s, %d granules in use, %d free\n", files, files == 1 ? "" : "s", used, free_granules);
+
+	if (lost > 0)
+	{
+		printf("%d granules allocated but not in any file\n", lost);
+	}
+
+	if (errors > 0 || lost > 0)
+	{
+		printf("'%s,:%d' file structure is NOT intact\n", vol->imgfile, drive);
+	}
+	else
+	{
+		printf("'%s,:%d' file structure is intact\n", vol->imgfile, drive);
+	}
+
+
+	return 0;
+}
@@ -14,6 +14,9 @@
 #include "decbpath.h"
 
 static int do_dir(char **argv, char *p);
+static int do_dir_all(char **argv, char *p, int jobs);
+static int dir_drive(decb_volume_id vol, int drive, void *arg);
+static void print_entry(decb_dir_entry *de, u_char *FAT);
 
 
 /* Help Message */
@@ -22,6 +25,8 @@ static char const * const helpMessage[] =
 	"Syntax: dir {[<opts>]} {<dir> [<...>]} {[<opts>]}\n",
 	"Usage:  Display the contents of a directory.\n",
 	"Options:\n",
+	"     -a         list every drive of an HDB-DOS image\n",
+	"     -j<num>    with -a, list up to <num> drives at once (default: one per processor)\n",
 	NULL
 };
 
@@ -30,7 +35,7 @@ int decbdir(int argc, char *argv[])
 {
 	error_code	ec = 0;
 	char *p = NULL;
-	int i;
+	int i, all = 0, jobs = 0;
 
 
 	if (argv[1] == NULL)
@@ -49,6 +54,15 @@ int decbdir(int argc, char *argv[])
 			{
 				switch(*p)
 				{
+					case 'a':
+						all = 1;
+						break;
+
+					case 'j':
+						jobs = parse_jobs(p + 1);
+						while (*(p + 1) != '\0') p++;
+						break;
+
 					case '?':
 					case 'h':
 						show_help(helpMessage);
@@ -62,6 +76,11 @@ int decbdir(int argc, char *argv[])
 		}
 	}
 
+	if (jobs == 0)
+	{
+		jobs = parse_jobs(NULL);
+	}
+
 	/* walk command line for pathnames */
 	for (i = 1; i < argc; i++)
 	{
@@ -74,7 +93,14 @@ int decbdir(int argc, char *argv[])
 			p = argv[i];
 		}
 
-		ec = do_dir(argv, p);
+		if (all)
+		{
+			ec = do_dir_all(argv, p, jobs);
+		}
+		else
+		{
+			ec = do_dir(argv, p);
+		}
 
 		if (ec != 0)
 		{
@@ -154,73 +180,141 @@ static int do_dir(char **argv, char *p)
 	
 	while (_decb_readdir(path, &de) == 0)
 	{
-		char	asciiflag;
-		int		granule_size = 1, i;
-		int		curr_granule;
+		print_entry(&de, path->FAT);
+	}
+
+	
+	return 0;
+}
 
 
-		if (de.filename[0] == 0 || de.filename[0] == 255)
-		{
-			continue;
-		}
-		
+
+/* List every drive of an image, one volume shared by all of them */
+
+static int do_dir_all(char **argv, char *p, int jobs)
+{
+	error_code		ec;
+	decb_volume_id	vol;
+	int				drive;
+
+
+	ec = _decb_volume_pathlist(&vol, p, FAM_READ, &drive);
+
+	if (ec != 0)
+	{
+		fprintf(stderr, "%s: error %d opening '%s'\n", argv[0], ec, p);
+
+		return ec;
+	}
+
+	ec = _decb_volume_scan(vol, dir_drive, NULL, jobs);
+
+	_decb_volume_release(vol);
+
+
+	return ec;
+}
+
+
+
+static int dir_drive(decb_volume_id vol, int drive, void *arg)
+{
+	error_code	ec;
+	decb_drive	*view;
+	int			i;
+
+
+	ec = _decb_volume_drive(vol, drive, &view);
+
+	if (ec != 0)
+	{
+		return ec;
+	}
+
+	printf("Directory of: %s,:%d\n\n", vol->imgfile, drive);
+
+	if (view->name[0] != '\xFF')
+	{
+		printf("%.256s\n", view->name);
+	}
+
+	for (i = 0; i < 72; i++)
+	{
+		print_entry(&view->dir[i], view->FAT);
+	}
+
+
+	return 0;
+}
+
+
+
+/* Print one directory entry, if it is in use */
+
+static void print_entry(decb_dir_entry *de, u_char *FAT)
+{
+	char	asciiflag;
+	int		granule_size = 1, i;
+	int		curr_granule;
+
+
+	if (de->filename[0] == 0 || de->filename[0] == 255)
+	{
+		return;
+	}
+	
+	
+	switch(de->ascii_flag)
+	{
+		case 0x00:
+			asciiflag = 'B';
+			break;
+		case 0xFF:
+			asciiflag = 'A';
+			break;
+		default:
+			asciiflag = '?';
+			break;
+	}
+	
+	curr_granule = de->first_granule;
+	
+	while (FAT[curr_granule] < 0xC0 && granule_size < 256)
+	{
+		curr_granule = FAT[curr_granule];
 		
-		switch(de.ascii_flag)
+		granule_size++;
+	}
+	
+	/* print escaped filename */
+	
+	for( i=0; i<8; i++ )
+	{
+		if( isprint(de->filename[i] ) )
 		{
-			case 0x00:
-				asciiflag = 'B';
-				break;
-			case 0xFF:
-				asciiflag = 'A';
-				break;
-			default:
-				asciiflag = '?';
-				break;
+			putchar( de->filename[i] );
 		}
-		
-		curr_granule = de.first_granule;
-		
-		while (path->FAT[curr_granule] < 0xC0)
+		else
 		{
-			curr_granule = path->FAT[curr_granule];
-			
-			granule_size++;
+			printf( "\\%o", de->filename[i] );
 		}
-		
-		/* print escaped filename */
-		
-		for( i=0; i<8; i++ )
+	}
+	
+	putchar( ' ' );
+	
+	/* print escaped extension */
+	
+	for( i=0; i<3; i++ )
+	{
+		if( isprint(de->file_extension[i] ) )
 		{
-			if( isprint(de.filename[i] ) )
-			{
-				putchar( de.filename[i] );
-			}
-			else
-			{
-				printf( "\\%o", de.filename[i] );
-			}
+			putchar( de->file_extension[i] );
 		}
-		
-		putchar( ' ' );
-		
-		/* print escaped extension */
-		
-		for( i=0; i<3; i++ )
+		else
 		{
-			if( isprint(de.file_extension[i] ) )
-			{
-				putchar( de.file_extension[i] );
-			}
-			else
-			{
-				printf( "\\%o", de.file_extension[i] );
-			}
+			printf( "\\%o", de->file_extension[i] );
 		}
-
-		printf("  %1.1d  %c  %d\n", de.file_type, asciiflag, granule_size);
 	}
 
-	
-	return 0;
+	printf("  %1.1d  %c  %d\n", de->file_type, asciiflag, granule_size);
 }
-
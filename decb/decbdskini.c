@@ -125,7 +125,8 @@ static int do_dskini(char **argv, char *vdisk, int tracks, char *diskName, int h
 	error_code	ec = 0;
 	native_path_id nativepath;
 	int max_s, i;
-	char sector[MAX_BPS];
+	u_char *drive;
+	u_int drive_size;
 
 
 	/* 1. Open a path to the virtual disk. */
@@ -147,137 +148,96 @@ static int do_dskini(char **argv, char *vdisk, int tracks, char *diskName, int h
 	_native_seek(nativepath, 0, SEEK_SET);
 
 
-	for (i = 0; i < hdbdrives; i++)
-	{
-		/* 2. Write 17 tracks of $FF */
+	/* 2. Build one drive in memory: tracks of $FF around track 17. */
 
-		memset(sector, 0xFF, bps);
+	drive_size = tracks * 18 * bps;
+	drive = malloc(drive_size);
 
-		{
-			int t, s;
-		
-			for (t = 0; t < 17; t++)
-			{
-				for (s = 1; s < 19; s++)
-				{
-					u_int size = bps;
-				
-					_native_write(nativepath, sector, &size);
-				}
-			}
-		}
+	if (drive == NULL)
+	{
+		_native_close(nativepath);
 
+		return(EOS_OM);
+	}
 
-		/* 4. Write directory track. */
+	memset(drive, 0xFF, drive_size);
 
-		memset(sector, 0x00, bps);
+	{
+		u_char *track17 = drive + 17 * 18 * bps;
+		int s, min_s = 0;
 
-		{
-			int s;
-			u_int size, min_s = 0;
-		
-		
-			/* 1. Write sector of track 17 (all 0s..). */
-		
-			size = bps;
-				
-			_native_write(nativepath, sector, &size);
-
-
-			/* 2. Write FAT sector. */
-		
-			switch (tracks)
-			{
-				case 40:
-					max_s = 78;
-					break;
-				
-				case 80:
-					max_s = 156;
-					break;
-
-				case 35:
-				default:
-					max_s = 68;
-					break;
-			}
 
-			/* Process skitzo here -- we set the first 34 granules as allocated. */
-			
-			if (skitzo == 1)
-			{
-				min_s = 34; 
-			}
-					
+		/* 1. Sector 1 of track 17 is all 0s. */
 
-			for (s = min_s; s < max_s; s++)
-			{
-				sector[s] = 0xFF;
-			}
-			
-			
-			size = bps;
-				
-			_native_write(nativepath, sector, &size);
+		memset(track17, 0x00, bps);
 
 
-			/* 3. Write 14 sectors of 0xFF. */
-		
-			memset(sector, 0xFF, bps);
+		/* 2. The FAT sector: every granule free. */
 
-			for (s = 0; s < 14; s++)
-			{
-				size = bps;
-				
-				_native_write(nativepath, sector, &size);
-			}
-		
+		switch (tracks)
+		{
+			case 40:
+				max_s = 78;
+				break;
+
+			case 80:
+				max_s = 156;
+				break;
+
+			case 35:
+			default:
+				max_s = 68;
+				break;
+		}
 
-			/* 4. If disk name was provided, copy it to sector. */
-		
-			if (diskName != NULL)
-			{
-				strcpy(sector, diskName);
-			}
+		/* Process skitzo here -- we set the first 34 granules as allocated. */
 
+		if (skitzo == 1)
+		{
+			min_s = 34;
+		}
 
-			/* 5. Write 17th sector. */
+		memset(track17 + bps, 0x00, bps);
 
-			size = bps;
-				
-			_native_write(nativepath, sector, &size);
+		for (s = min_s; s < max_s; s++)
+		{
+			track17[bps + s] = 0xFF;
+		}
 
 
-			memset(sector, 0xFF, bps);
+		/* 3. If disk name was provided, copy it to the 17th sector. */
 
+		if (diskName != NULL)
+		{
+			size_t length = strlen(diskName);
 
-			/* 6. Write 18th sector. */
+			if (length > (size_t)bps - 1)
+			{
+				length = bps - 1;
+			}
 
-			size = bps;
-				
-			_native_write(nativepath, sector, &size);
+			memcpy(track17 + 16 * bps, diskName, length);
+			track17[16 * bps + length] = '\0';
 		}
+	}
+
 
+	/* 3. Write it once per drive. */
 
-		/* 5. Write remaining 17, 22 or 62 tracks of $FF. */
+	for (i = 0; i < hdbdrives && ec == 0; i++)
+	{
+		u_int size = drive_size;
 
-		memset(sector, 0xFF, bps);
+		ec = _native_write(nativepath, drive, &size);
 
+		if (ec == 0 && size != drive_size)
 		{
-			int t, s;
-		
-			for (t = 0; t < tracks - 18; t++)
-			{
-				for (s = 1; s < 19; s++)
-				{
-					u_int size = bps;
-				
-					_native_write(nativepath, sector, &size);
-				}
-			}
+			ec = EOS_WRITE;
 		}
 	}
-	
+
+	free(drive);
+
 
 	_native_close(nativepath);
 
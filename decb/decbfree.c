@@ -12,6 +12,8 @@
 #include <decbpath.h>
 #include <toolshed.h>
 
+static int free_drive(decb_volume_id vol, int drive, void *arg);
+
 
 /* Help message */
 static char const * const helpMessage[] =
@@ -19,6 +21,8 @@ static char const * const helpMessage[] =
 	"Syntax: free {[<opts>]} {<disk> [<...>]} {[<opts>]}\n",
 	"Usage:  Displays the amount of free space on an image.\n",
 	"Options:\n",
+	"     -a         show every drive of an HDB-DOS image\n",
+	"     -j<num>    with -a, do up to <num> drives at once (default: one per processor)\n",
 	NULL
 };
 
@@ -27,7 +31,7 @@ int decbfree(int argc, char *argv[])
 {
 	error_code	ec = 0;
 	char		*p = NULL;
-	int			i;
+	int			i, all = 0, jobs = 0;
 	u_int		free_granules;
 
 	/* walk command line for options */
@@ -39,6 +43,15 @@ int decbfree(int argc, char *argv[])
 			{
 				switch(*p)
 				{
+					case 'a':
+						all = 1;
+						break;
+
+					case 'j':
+						jobs = parse_jobs(p + 1);
+						while (*(p + 1) != '\0') p++;
+						break;
+
 					case '?':
 					case 'h':
 						show_help(helpMessage);
@@ -52,6 +65,11 @@ int decbfree(int argc, char *argv[])
 		}
 	}
 
+	if (jobs == 0)
+	{
+		jobs = parse_jobs(NULL);
+	}
+
 	/* walk command line for pathnames */
 	for (i = 1; i < argc; i++)
 	{
@@ -64,6 +82,29 @@ int decbfree(int argc, char *argv[])
 			p = argv[i];
 		}
 
+		if (all)
+		{
+			decb_volume_id vol;
+			int drive;
+
+			ec = _decb_volume_pathlist(&vol, p, FAM_READ, &drive);
+
+			if (ec == 0)
+			{
+				ec = _decb_volume_scan(vol, free_drive, NULL, jobs);
+
+				_decb_volume_release(vol);
+			}
+
+			if (ec != 0)
+			{
+				fprintf(stderr, "%s: error %d determining free space for '%s'\n", argv[0], ec, p);
+				return(ec);
+			}
+
+			continue;
+		}
+
 
 		ec = TSDECBFree(p, &free_granules);
 
@@ -86,3 +127,33 @@ int decbfree(int argc, char *argv[])
 
 	return(0);
 }
+
+
+
+static int free_drive(decb_volume_id vol, int drive, void *arg)
+{
+	error_code	ec;
+	decb_drive	*view;
+	int			i, free_granules = 0;
+
+
+	ec = _decb_volume_drive(vol, drive, &view);
+
+	if (ec != 0)
+	{
+		return ec;
+	}
+
+	for (i = 0; i < 256; i++)
+	{
+		if (view->FAT[i] == 0xFF)
+		{
+			free_granules++;
+		}
+	}
+
+	printf("%s,:%d  Free granules: %d (%d bytes)\n", vol->imgfile, drive, free_granules, free_granules * (4608 / 2));
+
+
+	return 0;
+}
@@ -13,6 +13,7 @@ extern "C" {
 
 #define CAS_FILE_EXTENSION ".cas"
 #define WAV_FILE_EXTENSION ".wav"
+#define CECB_INDEX_EXTENSION ".idx"
 
 #include "util.h"
 
@@ -76,10 +77,24 @@ typedef struct
 	int		ml_exec_address;
 } cecb_file_stat, *Cecb_file_stat;
 
+/* Tape index entry, one per block read from the tape */
+
+typedef struct
+{
+	long			position;		/* wav_current_sample or cas_current_byte after the block */
+	int				state;			/* wav_ss2, or cas_current_bit << 8 | cas_byte */
+	error_code		ec;				/* _cecb_read_next_block result */
+	unsigned char	block_type;
+	unsigned char	block_length;
+	cecb_dir_entry	dir_entry;		/* For file header blocks */
+} cecb_index_entry;
+
 typedef enum { NONE=0, CAS, WAV } _tape_type;
 typedef enum { AUTO=0, ODD, EVEN } _wave_parity;
 
 #define WAV_SAMPLE_MUL (path->wav_bits_per_sample == 8 ? 1 : 2)
+#define WAV_BUFFER_SAMPLES 32768
+#define WAV_OUT_SIZE (256 * 1024)
 
 typedef struct _cecb_path_id
 {
@@ -113,17 +128,33 @@ typedef struct _cecb_path_id
 	long			wav_start_sample;		/* Sample where file starts. Fist bit of block type. */
 	long			wav_current_sample;		/* Current sample position in WAV file */
 	_wave_parity	wav_parity;				/* Even or Odd wav type */
-	signed int		wav_ss1, wav_ss2;		/* Wave Phase timing */
+	signed int		wav_ss1, wav_ss2;		/* Wave Phase timing (levels of the last samples read) */
+	unsigned char	*wav_buffer;			/* Samples read ahead from the data chunk */
+	signed char		*wav_levels;			/* ... and their levels: -1 low, 0 zero, 1 high */
+	int				wav_buffer_count,		/* Number of samples in the buffer */
+					wav_buffer_index;		/* Next sample to scan */
+	int				wav_zero_lo,			/* Samples in this range are taken as zero */
+					wav_zero_hi;
+	int				wav_bit_threshold;		/* Half periods shorter than this are 2400 Hz */
 	unsigned char	*buffer_1200,			/* WAV data used for writing */
 					*buffer_2400;
 	int             buffer_1200_length,
 					buffer_2400_length;
+	unsigned char	*wav_byte_waves;		/* The waveform of every byte value */
+	int				wav_byte_offset[257];	/* ... and where each one starts */
+	unsigned char	*wav_out;				/* WAV data waiting to be written */
+	int				wav_out_length;
 	long			extra_chunks_buffer_size;
 	char			*extra_chunks_buffer;
+	cecb_index_entry *index;				/* Tape index, if there is one */
+	int				index_count;
+	int				index_next;				/* Next index entry, -1 when not at one */
+#define INDEX_UNLOADED	-2					/* ... or not loaded yet, at the start of the tape */
 	FILE			*fd;					/* file path pointer */
 } *cecb_path_id;
 
 error_code _cecb_create(cecb_path_id *path, char *pathlist, int mode, int file_type, int data_type, int gap, int ml_load_address, int ml_exec_address);
+error_code _cecb_create_next(cecb_path_id path, char *filename, int file_type, int data_type, int gap, int ml_load_address, int ml_exec_address);
 error_code _cecb_open(cecb_path_id *path, char *pathlist, int mode );
 error_code _cecb_close(cecb_path_id path);
 error_code _cecb_parse_cas( cecb_path_id path );
@@ -150,12 +181,17 @@ int _cecb_write_wav_audio(cecb_path_id path, char *buffer, int total_length);
 int _cecb_write_wav_audio_repeat_byte(cecb_path_id path, int length, char byte);
 int _cecb_write_wav_repeat_byte(cecb_path_id path, int length, char byte);
 int _cecb_write_wav_repeat_short(cecb_path_id path, int length, short bytes);
+error_code _cecb_write_wav_flush(cecb_path_id path);
+error_code _cecb_index_load( cecb_path_id path );
+void _cecb_index_remove( char *imgfile );
+error_code _cecb_index_next_dir_entry( cecb_path_id path, cecb_dir_entry *dir_entry );
 
 /* WAV and CAS global settings copied by _cecb_open and _cecb_create */
 extern double cecb_threshold;
 extern double cecb_frequency;
 extern _wave_parity cecb_wave_parity;
 extern long cecb_start_sample;
+extern int cecb_tape_index;
 
 #include <cocopath.h>
 
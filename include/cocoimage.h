@@ -0,0 +1,56 @@
+/********************************************************************
+ * cocoimage.h - Disk image I/O header file
+ *
+ * $Id$
+ ********************************************************************/
+
+#ifndef	_COCOIMAGE_H
+#define	_COCOIMAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <cocotypes.h>
+
+
+/* Image backends */
+#define	IMAGE_AUTO	0	/* map regular files, stdio for anything else */
+#define	IMAGE_STDIO	1	/* stdio only */
+#define	IMAGE_MMAP	2	/* map or fail */
+
+/* Largest image IMAGE_AUTO will map */
+#define	IMAGE_MMAP_LIMIT	(512L * 1024 * 1024)
+
+
+typedef struct _coco_image
+{
+	FILE		*fp;		/* stdio stream (NULL if mapped) */
+	u_char		*map;		/* mapped image (NULL if stdio) */
+	int		fd;		/* descriptor behind the mapping */
+	long		size;		/* length of the image file */
+	long		map_size;	/* length of the mapping (>= size) */
+	long		pos;		/* file position of a mapped image */
+	int		writable;	/* opened for update */
+} *coco_image;
+
+
+coco_image _image_open(char *filename, int writable, int backend);
+int _image_reopen(coco_image image, char *filename, int writable);
+int _image_close(coco_image image);
+int _image_seek(coco_image image, long offset, int whence);
+long _image_tell(coco_image image);
+size_t _image_read(coco_image image, void *buffer, size_t size);
+size_t _image_write(coco_image image, void *buffer, size_t size);
+size_t _image_read_at(coco_image image, long offset, void *buffer, size_t size);
+size_t _image_write_at(coco_image image, long offset, void *buffer, size_t size);
+int _image_flush(coco_image image);
+long _image_size(coco_image image);
+int _image_fileno(coco_image image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* _COCOIMAGE_H */
@@ -143,11 +143,15 @@ error_code _coco_gs_pathtype(coco_path_id, _path_type *);
 error_code _coco_gs_size(coco_path_id path, u_int *size);
 error_code _coco_gs_size_pathlist(char *pathlist, u_int *size);
 error_code _coco_gs_pos(coco_path_id path, u_int *pos);
+error_code _coco_gs_extent(coco_path_id path, int *fd, u_int *offset, u_int *length);
 
 /* ss.c */
 error_code _coco_ss_attr(coco_path_id, int);
 error_code _coco_ss_fd(coco_path_id, coco_file_stat *);
 error_code _coco_ss_size(coco_path_id path, int size);
+error_code _coco_ss_prealloc(coco_path_id path, u_int size);
+error_code _coco_ss_writeback(coco_path_id path, int enable);
+error_code _coco_ss_sync(coco_path_id path);
 
 error_code _coco_identify_image(char *pathlist, _path_type *type);
 
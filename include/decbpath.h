@@ -14,11 +14,15 @@ extern "C" {
 #include <sys/stat.h>
 #include <cocotypes.h>
 #include <cococonv.h>
+#include <cocoimage.h>
 
 #ifndef WIN32
 #include <dirent.h>
 #endif
 
+/* Granule numbers from 0xC0 up would read as the end of a FAT chain */
+#define DECB_MAX_GRANULES	0xC0
+
 typedef struct _decb_dir_entry
 {
 	u_char	filename[8];
@@ -66,6 +70,45 @@ typedef struct _decb_dir_entry
 } decb_dir_entry;
 	
 
+/* Bytes in each drive of an HDB-DOS image: 35 tracks of 18 sectors */
+#define DECB_DRIVE_SIZE		161280
+
+/* One drive of an image, as read through a volume.  Every path open
+ * on the drive works from this copy of its FAT.
+ */
+typedef struct _decb_drive
+{
+	int				loaded;			/* the fields below have been read */
+	int				granules;		/* granules on the drive */
+	u_char			FAT[256];
+	decb_dir_entry	dir[72];
+	char			name[256];		/* HDB-DOS disk name sector */
+	int				fat_dirty;		/* FAT differs from the image */
+	u_char			free_map[DECB_MAX_GRANULES / 8];	/* free granules in FAT */
+	int				free_granules;	/* bits set in free_map */
+	int				free_map_loaded;	/* free_map has been built */
+	int				locks;			/* holders of this process's lock */
+	int				lock_exclusive;	/* the lock is exclusive */
+} decb_drive;
+
+/* An image opened once for work across all of its drives */
+typedef struct _decb_volume_id
+{
+	struct _decb_volume_id	*next;	/* next open volume */
+	int				refcount;		/* users of this volume */
+	char			imgfile[512];	/* image file name */
+	dev_t			st_dev;			/* identity of the image file */
+	ino_t			st_ino;
+	long int		hdbdos_offset;	/* where drive 0 starts */
+	coco_image		image;			/* image file */
+	int				writable;		/* image opened for update */
+	int				drives;			/* drives in the image */
+	int				disk_granules;	/* granules on a one-drive image */
+	int				views;			/* entries in 'drive' */
+	decb_drive		**drive;		/* views of the drives used so far */
+} *decb_volume_id;
+
+
 typedef struct _decb_path_id
 {
 	int				mode;			/* access mode */
@@ -76,12 +119,22 @@ typedef struct _decb_path_id
 	decb_dir_entry  dir_entry;
 	unsigned int	this_directory_entry_index;
 	unsigned int	directory_entry_index;
-	u_char			FAT[256];
+	u_char			*FAT;			/* the drive's FAT, in 'view' */
 	unsigned int	filepos;		/* file position */
-	FILE			*fd;			/* file path pointer */
+	coco_image		image;			/* image file, shared through 'volume' */
+	decb_volume_id	volume;			/* the open image */
+	decb_drive		*view;			/* the drive the path is on */
 	int				israw;			/* No file I/O possible, just get/set sector and granule */
 	long int		disk_offset;	/* Offset for drive number */
 	long int		hdbdos_offset;	/* Offset and flag for HDB-DOS */
+	u_char			chain[256];		/* the file's granules, in order */
+	int				chain_length;	/* granules in chain (0 = not built) */
+	int				cache_granule;	/* granule held in granule_cache, or -1 */
+	char			granule_cache[2304];
+	int				write_back;		/* hold changes until _decb_ss_sync */
+	int				cache_dirty;	/* granule_cache differs from the image */
+	int				dir_dirty;		/* dir_entry differs from the image */
+	int				fat_dirty;		/* this path has changed the FAT */
 } *decb_path_id;
 
 
@@ -112,11 +165,14 @@ error_code _decb_writedir(decb_path_id path, decb_dir_entry *de);
 error_code _decb_seekdir(decb_path_id path, int entry, int mode);
 error_code _decb_seeksector(decb_path_id path, int track, int sector);
 error_code _decb_seekgranule(decb_path_id path, int granule);
+long _decb_sector_offset(decb_path_id path, int track, int sector);
+long _decb_granule_offset(decb_path_id path, int granule);
 error_code _decb_rename(char *pathlist, char *newname);
 error_code _decb_rename_ex(char *pathlist, char *new_name, decb_dir_entry *dirent);
 error_code _decb_gs_size(decb_path_id path, u_int *size);
 error_code _decb_gs_size_pathlist(char *pathlist, u_int *size);
 error_code _decb_gs_pos(decb_path_id path, u_int *pos);
+error_code _decb_gs_extent(decb_path_id path, int *fd, u_int *offset, u_int *length);
 error_code _decb_ss_size(decb_path_id path, int size);
 error_code _decb_gs_eof(decb_path_id path);
 error_code _decb_gs_fd(decb_path_id path, decb_file_stat *stat);
@@ -126,6 +182,23 @@ error_code _decb_gs_sector(decb_path_id path, int track, int sector, char *buffe
 error_code _decb_ss_sector(decb_path_id path, int track, int sector, char *buffer);
 error_code _decb_gs_granule(decb_path_id path, int granule, char *buffer);
 error_code _decb_ss_granule(decb_path_id path, int granule, char *buffer);
+error_code _decb_ss_writeback(decb_path_id path, int enable);
+error_code _decb_ss_sync(decb_path_id path);
+error_code _decb_chain_load(decb_path_id path);
+void _decb_chain_invalidate(decb_path_id path);
+char *_decb_chain_granule(decb_path_id path, int index);
+error_code _decb_volume_acquire(decb_volume_id *volume, char *imgfile, long hdbdos_offset, int mode);
+error_code _decb_volume_pathlist(decb_volume_id *volume, char *pathlist, int mode, int *drive);
+error_code _decb_volume_release(decb_volume_id vol);
+error_code _decb_volume_drive(decb_volume_id vol, int drive, decb_drive **view);
+void _decb_volume_forget(decb_volume_id vol, int drive);
+error_code _decb_volume_lock(decb_volume_id vol, int drive, int exclusive);
+error_code _decb_volume_unlock(decb_volume_id vol, int drive);
+int _decb_volume_scan(decb_volume_id vol, int (*func)(decb_volume_id, int, void *), void *arg, int jobs);
+error_code _decb_fat_allocate(decb_path_id path, int count, int next_to, u_char *granules);
+void _decb_fat_release(decb_path_id path, int granule);
+void _decb_fat_set(decb_path_id path, int granule, int value);
+error_code _decb_fat_write(decb_path_id path);
 error_code _decb_detoken(unsigned char *in_buffer, int in_size, char **out_buffer, u_int *out_size);
 error_code _decb_entoken(unsigned char *in_buffer, int in_size, unsigned char **out_buffer, u_int *out_size, int path_type);
 error_code _decb_buffer_sprintf(u_int *position, char **str, size_t *buffersize, const char *format, ...);
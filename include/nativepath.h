@@ -62,11 +62,13 @@ error_code _native_gs_fd(native_path_id, struct stat *);
 error_code _native_gs_fd_pathlist(char *pathlist, struct stat *statbuf);
 error_code _native_gs_size(native_path_id path, u_int *size);
 error_code _native_gs_pos(native_path_id path, u_int *pos);
+error_code _native_gs_extent(native_path_id path, int *fd, u_int *offset, u_int *length);
 
 /* ss.c */
 error_code _native_ss_attr(native_path_id, int);
 error_code _native_ss_fd(native_path_id, struct stat *);
 error_code _native_ss_size(native_path_id path, int size);
+error_code _native_ss_fill(native_path_id path, off_t length, int physical);
 
 #include "cocopath.h"
 
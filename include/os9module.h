@@ -188,6 +188,25 @@ typedef enum os9_attr_t
 
 #define INT(foo) (foo[0] * 256 + foo[1])
 
+
+/* A module found by _os9_modscan */
+typedef struct os9_modscan_t
+{
+	u_int	offset;		/* where it starts in the buffer */
+	u_int	size;		/* its size, from its header */
+	int		osk;		/* 1 for an OS-9/68K module */
+	u_int	parity;		/* its header parity: $FF, or $FFFF for OS-9/68K, if good */
+	int		status;
+} OS9_MODSCAN_t;
+
+#define MODSCAN_GOOD		0	/* header parity and CRC are good */
+#define MODSCAN_BADCRC		1	/* header parity is good but the CRC isn't */
+#define MODSCAN_BADPARITY	2	/* header parity is bad */
+#define MODSCAN_SHORT		3	/* module runs past the end of the buffer */
+#define MODSCAN_NONE		4	/* no module where one was expected */
+
+#define MODSCAN_SEARCH		0x01	/* look for modules anywhere, not just back to back */
+
 error_code _os9_crc_compute(u_char *ptr, u_int sz, u_char *crc);
 error_code _os9_crc(OS9_MODULE_t *mod);
 u_char  _os9_header(OS9_MODULE_t *mod);
@@ -195,6 +214,8 @@ u_char  _os9_header(OS9_MODULE_t *mod);
 error_code _osk_crc(OSK_MODULE_t *mod);
 unsigned short _osk_header(OSK_MODULE_t *mod);
 
+error_code _os9_modscan(u_char *buffer, u_int length, int flags, OS9_MODSCAN_t **table, int *count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -10,6 +10,7 @@
 #include <sys/stat.h>
 #include <cocotypes.h>
 #include <cococonv.h>
+#include <cocoimage.h>
 #ifndef WIN32
 #include <dirent.h>
 #endif
@@ -93,6 +94,39 @@ typedef struct
 } lsn0_sect, *Lsn0_sect;
 
 
+/* Bits of the allocation map covered by one bitmap_summary entry */
+#define OS9_BITMAP_BLOCK_BITS	4096
+
+
+struct _os9_dircache;
+
+
+/* An image file shared by every path open on it */
+typedef struct _os9_volume_id
+{
+	struct _os9_volume_id	*next;	/* next open volume */
+	int		refcount;	/* paths using this volume */
+	char		imgfile[512];	/* image file name */
+	dev_t		st_dev;		/* identity of the image file */
+	ino_t		st_ino;
+	coco_image	image;		/* image file */
+	int		writable;	/* image opened for update */
+	lsn0_sect	*lsn0;		/* copy of LSN0 */
+	u_char		*bitmap;	/* bitmap */
+	u_char		*bitmap_clean;	/* bitmap as last read/written */
+	int		bitmap_sectors;
+	int		bitmap_bytes;
+	int		bitmap_bits;	/* bits held in memory for the bitmap */
+	int		*bitmap_summary;	/* free bits in each OS9_BITMAP_BLOCK_BITS block */
+	int		free_bits;	/* sum of bitmap_summary */
+	unsigned int	spc;		/* sectors per cluster */
+	unsigned int	bps;		/* bytes per sector */
+	int		cs;		/* cluster size in bytes */
+	unsigned int	fd_generation;	/* bumped whenever an FD sector is written */
+	struct _os9_dircache	*dircache;	/* directory lookup cache */
+} *os9_volume_id;
+
+
 typedef struct _os9_path_id
 {
 	int		mode;		/* access mode */
@@ -100,15 +134,23 @@ typedef struct _os9_path_id
 	char		pathlist[512];	/* pointer to pathlist */
 	unsigned int	pl_fd_lsn;	/* pathlist's FD LSN */
 	unsigned int	filepos;	/* file position */
-	FILE		*fd;		/* file path pointer */
-	lsn0_sect	*lsn0;		/* copy of LSN0 */
-	u_char		*bitmap;	/* bitmap */
+	os9_volume_id	vol;		/* shared image volume */
+	coco_image	image;		/* image file (vol->image) */
+	lsn0_sect	*lsn0;		/* copy of LSN0 (vol->lsn0) */
+	u_char		*bitmap;	/* bitmap (vol->bitmap) */
 	int		ss;		/* sector size in bytes */
 	unsigned int	spc;		/* sectors per cluster */
 	unsigned int	bps;		/* bytes per sector */
 	int		cs;		/* cluster size in bytes */
 	int		bitmap_bytes;
 	int		israw;		/* raw flag */
+	fd_stats	fdcache;	/* cached copy of the FD sector */
+	unsigned int	fdcache_lsn;	/* LSN of cached FD (0 = not cached) */
+	unsigned int	fdcache_gen;	/* vol->fd_generation when cached */
+	unsigned int	seg_offset[NUM_SEGS + 1];	/* file offset of each segment */
+	int		seg_count;	/* segments in use */
+	int		write_back;	/* hold FD changes until _os9_ss_sync */
+	int		fd_dirty;	/* fdcache differs from the image */
 } *os9_path_id;
 
 #define	DT_os9	1
@@ -129,6 +171,7 @@ int _os9_ckbit( u_char *bitmap, int LSN );
 int _os9_getfreebit( u_char *bitmap, int bitmap_bytes );
 int _os9_maximum_file_size( fd_stats fd_sector, int cluster_size );
 error_code _os9_getSASSegment( os9_path_id path, int *cluster, int *size );
+error_code _os9_getBestSegment( os9_path_id path, int want, int *cluster, int *size );
 int read_lsn(os9_path_id path, int lsn, void *buffer);
 error_code _os9_readln(os9_path_id, void *, u_int *);
 error_code _os9_write(os9_path_id, void *, u_int *);
@@ -149,11 +192,37 @@ error_code _os9_gs_fd(os9_path_id, int, fd_stats *);
 error_code _os9_gs_size(os9_path_id path, u_int *size);
 error_code _os9_gs_size_pathlist(char *pathlist, u_int *size);
 error_code _os9_gs_pos(os9_path_id path, u_int *pos);
+error_code _os9_gs_extent(os9_path_id path, int *fd, u_int *offset, u_int *length);
 
 /* ss.c */
 error_code _os9_ss_attr(os9_path_id, int);
 error_code _os9_ss_fd(os9_path_id, int, fd_stats *);
 error_code _os9_ss_size(os9_path_id path, int size);
+error_code _os9_ss_prealloc(os9_path_id path, u_int size);
+error_code _os9_ss_writeback(os9_path_id path, int enable);
+error_code _os9_ss_sync(os9_path_id path);
+
+/* volume.c */
+error_code _os9_volume_acquire(os9_volume_id *volume, char *imgfile, int mode);
+error_code _os9_volume_release(os9_volume_id vol);
+error_code _os9_volume_flush(os9_volume_id vol);
+void _os9_volume_raw_written(os9_volume_id vol, unsigned int offset, void *buffer, unsigned int size);
+os9_volume_id _os9_volume_for_bitmap(u_char *bitmap);
+void _os9_volume_summarize(os9_volume_id vol, int firstbit, int numbits);
+unsigned int _os9_volume_free(os9_volume_id vol);
+
+/* dircache.c */
+error_code _os9_dircache_lookup(os9_path_id path, char *name, unsigned int *lsn);
+void _os9_dircache_update(os9_volume_id vol, unsigned int dir_lsn, unsigned int slot, os9_dir_entry *dirent);
+void _os9_dircache_invalidate(os9_volume_id vol, unsigned int dir_lsn);
+void _os9_dircache_free(os9_volume_id vol);
+
+/* fd.c */
+error_code _os9_fd_load(os9_path_id path);
+error_code _os9_fd_flush(os9_path_id path);
+void _os9_fd_invalidate(os9_path_id path);
+void _os9_fd_reindex(os9_path_id path);
+int _os9_fd_findseg(os9_path_id path, unsigned int pos);
 
 unsigned int NextHighestMultiple(unsigned int value, unsigned int multiple);
 
@@ -28,6 +28,8 @@ error_code TSMoveFile(char *srcfile, char *dstfile);
 error_code TSCopyFile(char *srcfile, char *dstfile, int eolTranslate, int rewrite, int owner, int owner_set, char *buffer, u_int buffer_size);
 void NativeToCoCo(char *buffer, int size, char **newBuffer, u_int *newSize);
 void CoCoToNative(char *buffer, int size, char **newBuffer, u_int *newSize);
+u_int NativeToCoCoInPlace(char *buffer, u_int size);
+u_int CoCoToNativeInPlace(char *buffer, u_int size);
 EOL_Type DetermineEOLType(char *buffer, int size);
 int TSMakeDirectory(char *p);
 error_code TSRBFFree(char *file, char *dname, u_int *month, u_int *day, u_int *year, u_int *bps, u_int *total_sectors, u_int *bytes_free, u_int *free_sectors, u_int *largest_free_block, u_int *sectors_per_cluster, u_int *largest_count, u_int *sector_count);
@@ -51,9 +51,12 @@ int strncasecmp(char *s1, char *s2, int len);
 #endif
 int strendcasecmp( char *s1, char *s2 );
 void show_help(char const * const *helpMessage);
+int run_jobs(int (*func)(int, char **), int argc, char **argv, int jobs);
+int parse_jobs(const char *arg);
 
 /* Function prototypes for supported Disk BASIC commands are here */
 int decbattr(int, char **);
+int decbcheck(int, char **);
 int decbcopy(int, char **);
 int decbdir(int, char **);
 int decbdskini(int, char **);
@@ -71,6 +74,8 @@ int cecbdir(int, char **);
 int cecbfstat(int, char **);
 int cecbbulkerase(int, char **);
 int cecbcopy(int, char **);
+int cecbconvert(int, char **);
+int cecb_erase_image(char *, int, int, double, int);
 
 #ifdef __cplusplus
 }
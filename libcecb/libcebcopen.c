@@ -6,6 +6,8 @@
 
 #include "cecbpath.h"
 
+#define MIN(X,Y) ((X) < (Y) ? (X) : (Y))
+
 double cecb_threshold = 0.1;
 double cecb_frequency = 0;
 _wave_parity cecb_wave_parity = AUTO;
@@ -15,6 +17,9 @@ static error_code parse_header( cecb_path_id path  );
 static error_code validate_pathlist(cecb_path_id path, char *pathlist);
 static int init_pd(cecb_path_id *path, int mode);
 static int term_pd(cecb_path_id path);
+static void fill_dir_entry(cecb_path_id path, int file_type, int data_type, int gap, int ml_load_address, int ml_exec_address);
+static error_code start_file(cecb_path_id path);
+static error_code finish_file(cecb_path_id path);
 
 /*
  * _cecb_create()
@@ -49,7 +54,9 @@ error_code _cecb_create(cecb_path_id *path, char *pathlist, int mode, int file_t
 
 	(*path)->mode = mode;
 	
-	/* 3. Open a path to the image file. */
+	/* 3. Open a path to the image file, whose index will be out of date. */
+	
+	_cecb_index_remove( (*path)->imgfile );
 	
 	if (mode & FAM_WRITE)
 	{
@@ -129,18 +136,12 @@ error_code _cecb_create(cecb_path_id *path, char *pathlist, int mode, int file_t
 	
 	/* 6. Fill in dir_entry */
 	
-	strncpy( (char *)(*path)->dir_entry.filename, (*path)->filename, 8 );
-	(*path)->dir_entry.file_type = file_type;
-	(*path)->dir_entry.ascii_flag = data_type;
-	(*path)->dir_entry.gap_flag = gap;
-	(*path)->dir_entry.ml_load_address1 = ml_load_address >> 8;
-	(*path)->dir_entry.ml_load_address2 = ml_load_address & 0x0f;
-	(*path)->dir_entry.ml_exec_address1 = ml_exec_address >> 8;
-	(*path)->dir_entry.ml_exec_address2 = ml_exec_address & 0x0f;
+	fill_dir_entry( *path, file_type, data_type, gap, ml_load_address, ml_exec_address );
 
-	/* 7. Write half second of silence */
+	
+	/* 7. Write the file's header */
 
-	ec = _cecb_write_silence( *path, 0.50 );
+	ec = start_file( *path );
 
 	if (ec != 0)
 	{
@@ -148,54 +149,46 @@ error_code _cecb_create(cecb_path_id *path, char *pathlist, int mode, int file_t
 
 		return ec;
 	}
+	
+	return ec;
+}
 
-	/* 8. Write leader, dir_entry */
-
-	ec = _cecb_write_leader( *path );
+/*
+ * _cecb_create_next()
+ *
+ * Finish the file being written on a path from _cecb_create and start
+ * another after it on the same tape, so that many files can be put on
+ * a tape with one open and one header update.
+ */
 
-	if (ec != 0)
-	{
-		term_pd(*path);
+error_code _cecb_create_next(cecb_path_id path, char *filename, int file_type, int data_type, int gap, int ml_load_address, int ml_exec_address)
+{
+	error_code	ec;
+	int			i;
 
-		return ec;
-	}
+	if( (path->mode & FAM_WRITE) == 0 )
+		return EOS_BMODE;
 
-	ec = _cecb_write_block( *path, 0, (unsigned char *)&((*path)->dir_entry), sizeof(cecb_dir_entry) );
+	/* 1. Write out the end of the current file */
 
-	if (ec != 0)
-	{
-		term_pd(*path);
+	ec = finish_file( path );
 
+	if( ec != 0 )
 		return ec;
-	}
-
-	/* 9. Write gap, leader */
 
-	ec = _cecb_write_silence( *path, 0.58 );
+	/* 2. Set up and write the header of the next */
 
-	if (ec != 0)
-	{
-		term_pd(*path);
+	i = MIN( strlen(filename), 8 );
+	memcpy( path->filename, filename, i );
+	memset( path->filename + i, ' ', 8 - i );
 
-		return ec;
-	}
-	
-	if( (*path)->dir_entry.gap_flag == 0 )
-	{
-		ec = _cecb_write_leader( *path );
+	path->block_type = 0;
+	path->length = 0;
+	path->current_pointer = 0;
 
-		if (ec != 0)
-		{
-			term_pd(*path);
+	fill_dir_entry( path, file_type, data_type, gap, ml_load_address, ml_exec_address );
 
-			return ec;
-		}
-	}
-	
-	/* Get ready for data blocks */
-	(*path)->block_type = 1;
-	
-	return ec;
+	return start_file( path );
 }
 
 /*
@@ -302,6 +295,10 @@ error_code _cecb_open(cecb_path_id *path, char *pathlist, int mode )
 		return ec;
 	}
 	
+	/* The tape index is loaded by the first directory read */
+	
+	(*path)->index_next = INDEX_UNLOADED;
+	
 	/* if raw, exit */
 	
 	if( (*path)->israw == 1 )
@@ -348,19 +345,7 @@ error_code _cecb_close(cecb_path_id path)
 	/* if data was written, write last data block and end block */
 	if( (path->mode & FAM_WRITE) == FAM_WRITE )
 	{
-		if( path->length > 0 )
-		{
-			ec = _cecb_write_block( path, path->block_type, path->data, path->length );
-			path->length = 0;
-			path->current_pointer = 0;
-		}
-		
-		path->block_type = 0xff;
-		ec = _cecb_write_block( path, path->block_type, path->data, path->length );
-		
-		/* Write half second of silence */
-
-		ec = _cecb_write_silence( path, 0.58 );
+		ec = finish_file( path );
 
 		if (ec != 0)
 		{
@@ -371,6 +356,16 @@ error_code _cecb_close(cecb_path_id path)
 		
 		if( path->tape_type == WAV )
 		{
+			ec = _cecb_write_wav_flush( path );
+
+			if (ec != 0)
+			{
+				fclose(path->fd);
+				term_pd(path);
+
+				return ec;
+			}
+
 			/* Update RIFF chunk lengths */
 			fseek( path->fd, 4, SEEK_SET );
 			fwrite_le_int( path->wav_riff_size, path->fd);
@@ -381,7 +376,7 @@ error_code _cecb_close(cecb_path_id path)
 			{
 				/* Write end of WAV file chunks */
 				fseek( path->fd, path->wav_data_length, SEEK_CUR );
-				fwrite( path->extra_chunks_buffer, 1, path->wav_data_length, path->fd );
+				fwrite( path->extra_chunks_buffer, 1, path->extra_chunks_buffer_size, path->fd );
 			}
 		}
 	}
@@ -490,6 +485,7 @@ static int init_pd(cecb_path_id *path, int mode)
 	memset(*path, 0, sizeof(struct _cecb_path_id));
 	
 	(*path)->mode = mode;
+	(*path)->index_next = -1;
 
 	/* 3. Return. */
 	
@@ -503,6 +499,11 @@ static int term_pd(cecb_path_id path)
 	if( path->extra_chunks_buffer_size > 0 )
 		free( path->extra_chunks_buffer );
 		
+	free( path->wav_buffer );
+	free( path->wav_byte_waves );
+	free( path->wav_out );
+	free( path->index );
+		
 	/* 1. Deallocate path structure. */
 	
 	free(path);
@@ -512,3 +513,83 @@ static int term_pd(cecb_path_id path)
 	return 0;
 }
 
+
+static void fill_dir_entry(cecb_path_id path, int file_type, int data_type, int gap, int ml_load_address, int ml_exec_address)
+{
+	strncpy( (char *)path->dir_entry.filename, path->filename, 8 );
+	path->dir_entry.file_type = file_type;
+	path->dir_entry.ascii_flag = data_type;
+	path->dir_entry.gap_flag = gap;
+	path->dir_entry.ml_load_address1 = ml_load_address >> 8;
+	path->dir_entry.ml_load_address2 = ml_load_address & 0xff;
+	path->dir_entry.ml_exec_address1 = ml_exec_address >> 8;
+	path->dir_entry.ml_exec_address2 = ml_exec_address & 0xff;
+}
+
+/* Write the silence, leader and header block that begin a file */
+static error_code start_file(cecb_path_id path)
+{
+	error_code	ec;
+
+	/* 1. Write half second of silence */
+
+	ec = _cecb_write_silence( path, 0.50 );
+
+	if (ec != 0)
+		return ec;
+
+	/* 2. Write leader, dir_entry */
+
+	ec = _cecb_write_leader( path );
+
+	if (ec != 0)
+		return ec;
+
+	ec = _cecb_write_block( path, 0, (unsigned char *)&(path->dir_entry), sizeof(cecb_dir_entry) );
+
+	if (ec != 0)
+		return ec;
+
+	/* 3. Write gap, leader */
+
+	ec = _cecb_write_silence( path, 0.58 );
+
+	if (ec != 0)
+		return ec;
+	
+	if( path->dir_entry.gap_flag == 0 )
+	{
+		ec = _cecb_write_leader( path );
+
+		if (ec != 0)
+			return ec;
+	}
+	
+	/* 4. Get ready for data blocks */
+
+	path->block_type = 1;
+	
+	return 0;
+}
+
+/* Write the last data block, end block and trailing silence of a file */
+static error_code finish_file(cecb_path_id path)
+{
+	error_code	ec;
+
+	if( path->length > 0 )
+	{
+		ec = _cecb_write_block( path, path->block_type, path->data, path->length );
+		path->length = 0;
+		path->current_pointer = 0;
+	}
+	
+	path->block_type = 0xff;
+	ec = _cecb_write_block( path, path->block_type, path->data, path->length );
+	
+	/* Write half second of silence */
+
+	ec = _cecb_write_silence( path, 0.58 );
+
+	return ec;
+}
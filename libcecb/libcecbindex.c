@@ -0,0 +1,335 @@
+/********************************************************************
+ * libcecbindex.c - Cassette BASIC tape index routines
+ *
+ * Demodulating a tape is slow, and every open used to start over from
+ * the beginning to find a file.  The first directory read on a tape
+ * decodes all of it once and records where each block ends, what it
+ * was and, for file headers, the directory entry.  The index is kept next to the image
+ * in a sidecar file, keyed by the image's size and modification time
+ * and the decoding settings.  _cecb_read_next_dir_entry loads it on
+ * first use, then replays the index and seeks straight past the header
+ * it returns.
+ *
+ * $Id$
+ ********************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "cecbpath.h"
+
+int cecb_tape_index = 1;
+
+#define INDEX_MAGIC		"CIDX"
+#define INDEX_VERSION	1
+
+typedef struct
+{
+	char			magic[4];
+	int				version;
+	int				entry_size;
+	long			image_size;
+	long			image_mtime;
+	long			play_at;
+	double			threshold;
+	double			frequency_limit;
+	int				parity;
+	long			start_position;		/* Where decoding starts after the header and leader */
+	int				start_state;
+	int				count;
+} cecb_index_header;
+
+static void index_filename( cecb_path_id path, char *name, size_t size );
+static error_code index_key( cecb_path_id path, cecb_index_header *header );
+static error_code index_read( cecb_path_id path, cecb_index_header *key );
+static error_code index_build( cecb_path_id path, cecb_index_header *key );
+static void get_position( cecb_path_id path, long *position, int *state );
+static void set_position( cecb_path_id path, long position, int state );
+
+
+/*
+ * _cecb_index_load()
+ *
+ * Load the tape's index, building it if there is none or it is stale.
+ * Called before anything has been read from the tape; leaves the path
+ * where it was.
+ */
+
+error_code _cecb_index_load( cecb_path_id path )
+{
+	error_code ec;
+	cecb_index_header key;
+
+	path->index_next = -1;
+
+	if( cecb_tape_index == 0 )
+		return 0;
+
+
+	/* 1. Work out what the index must match. */
+
+	ec = index_key( path, &key );
+
+	if( ec != 0 )
+		return 0;
+
+
+	/* 2. Use the sidecar if it is current, otherwise build one. */
+
+	if( index_read( path, &key ) != 0 )
+	{
+		ec = index_build( path, &key );
+
+		if( ec != 0 )
+			return 0;
+	}
+
+	path->index_next = 0;
+
+	return 0;
+}
+
+/*
+ * _cecb_index_remove()
+ *
+ * Remove the index of an image that is about to be written.
+ */
+
+void _cecb_index_remove( char *imgfile )
+{
+	char name[520];
+
+	snprintf( name, sizeof(name), "%s%s", imgfile, CECB_INDEX_EXTENSION );
+	remove( name );
+}
+
+/*
+ * _cecb_index_next_dir_entry()
+ *
+ * Replay the index in the same way _cecb_read_next_dir_entry reads the
+ * tape, and position the path where the tape would have been left.
+ */
+
+error_code _cecb_index_next_dir_entry( cecb_path_id path, cecb_dir_entry *dir_entry )
+{
+	error_code ec = 0;
+	cecb_index_entry *e = NULL;
+
+	while( ec == 0 && path->index_next < path->index_count )
+	{
+		e = &path->index[path->index_next++];
+		ec = e->ec;
+
+		if( (ec == EOS_CRC) || (ec == 0) )
+		{
+			if( (e->block_type == 0) && (e->block_length == sizeof(cecb_dir_entry)) )
+			{
+				memcpy( dir_entry, &e->dir_entry, sizeof(cecb_dir_entry) );
+				break;
+			}
+		}
+	}
+
+	if( e != NULL )
+		set_position( path, e->position, e->state );
+
+	if( path->index_next >= path->index_count )
+		path->index_next = -1;
+
+	return ec;
+}
+
+/* Name of the sidecar file */
+static void index_filename( cecb_path_id path, char *name, size_t size )
+{
+	snprintf( name, size, "%s%s", path->imgfile, CECB_INDEX_EXTENSION );
+}
+
+/* Fill in the header an index must have to be used */
+static error_code index_key( cecb_path_id path, cecb_index_header *header )
+{
+	struct stat statbuf;
+
+	if( fstat( fileno( path->fd ), &statbuf ) != 0 )
+		return EOS_SE;
+
+	memset( header, 0, sizeof(cecb_index_header) );
+
+	memcpy( header->magic, INDEX_MAGIC, 4 );
+	header->version = INDEX_VERSION;
+	header->entry_size = sizeof(cecb_index_entry);
+	header->image_size = statbuf.st_size;
+	header->image_mtime = statbuf.st_mtime;
+	header->play_at = path->play_at;
+
+	if( path->tape_type == WAV )
+	{
+		header->threshold = path->wav_threshold;
+		header->frequency_limit = path->wav_frequency_limit;
+		header->parity = path->wav_parity;
+	}
+
+	get_position( path, &header->start_position, &header->start_state );
+
+	return 0;
+}
+
+/* Read the sidecar if it matches 'key' */
+static error_code index_read( cecb_path_id path, cecb_index_header *key )
+{
+	char name[520];
+	cecb_index_header header;
+	FILE *fp;
+
+	index_filename( path, name, sizeof(name) );
+
+	fp = fopen( name, "rb" );
+
+	if( fp == NULL )
+		return EOS_PNNF;
+
+	if( fread( &header, sizeof(header), 1, fp ) != 1 )
+	{
+		fclose( fp );
+		return EOS_SE;
+	}
+
+	key->count = header.count;
+
+	if( memcmp( &header, key, sizeof(header) ) != 0 || header.count <= 0 )
+	{
+		fclose( fp );
+		return EOS_SE;
+	}
+
+	path->index = malloc( header.count * sizeof(cecb_index_entry) );
+
+	if( path->index == NULL )
+	{
+		fclose( fp );
+		return EOS_OM;
+	}
+
+	if( fread( path->index, sizeof(cecb_index_entry), header.count, fp ) != (size_t)header.count )
+	{
+		free( path->index );
+		path->index = NULL;
+		fclose( fp );
+		return EOS_SE;
+	}
+
+	path->index_count = header.count;
+
+	fclose( fp );
+
+	return 0;
+}
+
+/* Decode the whole tape once, then write and keep the index */
+static error_code index_build( cecb_path_id path, cecb_index_header *key )
+{
+	error_code ec = 0;
+	char name[520];
+	unsigned char data[256];
+	cecb_index_entry *e;
+	int size = 0;
+	FILE *fp;
+
+	/* 1. Don't decode the tape if the index can't be kept. */
+
+	index_filename( path, name, sizeof(name) );
+
+	fp = fopen( name, "wb" );
+
+	if( fp == NULL )
+		return EOS_WRITE;
+
+
+	/* 2. Read every block, up to and including the one that ends the tape. */
+
+	while( ec == 0 || ec == EOS_CRC )
+	{
+		if( path->index_count == size )
+		{
+			size = size == 0 ? 64 : size * 2;
+			e = realloc( path->index, size * sizeof(cecb_index_entry) );
+
+			if( e == NULL )
+			{
+				ec = EOS_OM;
+				break;
+			}
+
+			path->index = e;
+		}
+
+		e = &path->index[path->index_count++];
+		memset( e, 0, sizeof(cecb_index_entry) );
+
+		e->ec = ec = _cecb_read_next_block( path, &e->block_type, &e->block_length, data );
+		get_position( path, &e->position, &e->state );
+
+		if( e->block_type == 0 && e->block_length == sizeof(cecb_dir_entry) )
+			memcpy( &e->dir_entry, data, sizeof(cecb_dir_entry) );
+	}
+
+	set_position( path, key->start_position, key->start_state );
+
+
+	/* 3. Save it. */
+
+	key->count = path->index_count;
+
+	if( ec == EOS_OM ||
+		fwrite( key, sizeof(cecb_index_header), 1, fp ) != 1 ||
+		fwrite( path->index, sizeof(cecb_index_entry), path->index_count, fp ) != (size_t)path->index_count )
+	{
+		fclose( fp );
+		remove( name );
+
+		free( path->index );
+		path->index = NULL;
+		path->index_count = 0;
+
+		return EOS_WT;
+	}
+
+	fclose( fp );
+
+	return 0;
+}
+
+/* Where decoding is on the tape, and the state needed to carry on from there */
+static void get_position( cecb_path_id path, long *position, int *state )
+{
+	if( path->tape_type == WAV )
+	{
+		*position = path->wav_current_sample;
+		*state = path->wav_ss2;
+	}
+	else
+	{
+		*position = path->cas_current_byte;
+		*state = (path->cas_current_bit << 8) | path->cas_byte;
+	}
+}
+
+static void set_position( cecb_path_id path, long position, int state )
+{
+	if( path->tape_type == WAV )
+	{
+		path->wav_current_sample = position;
+		path->wav_ss2 = state;
+		path->wav_buffer_count = path->wav_buffer_index = 0;
+
+		fseek( path->fd, path->wav_data_start + position * WAV_SAMPLE_MUL, SEEK_SET );
+	}
+	else
+	{
+		path->cas_current_byte = position;
+		path->cas_current_bit = state >> 8;
+		path->cas_byte = state & 0xFF;
+
+		fseek( path->fd, position, SEEK_SET );
+	}
+}
@@ -111,6 +111,12 @@ error_code _cecb_read_next_dir_entry( cecb_path_id path, cecb_dir_entry *dir_ent
 	unsigned char data[256];
 	unsigned char block_type, block_length;
 	
+	if( path->index_next == INDEX_UNLOADED )
+		_cecb_index_load( path );
+	
+	if( path->index_next >= 0 )
+		return _cecb_index_next_dir_entry( path, dir_entry );
+	
 	while( ec == 0 )
 	{
 		ec = _cecb_read_next_block( path, &block_type, &block_length, data  );
@@ -149,6 +155,8 @@ error_code _cecb_read_next_block( cecb_path_id path, unsigned char *block_type,
 	unsigned char checksum, checksum_ck;
 	int i;
 	
+	path->index_next = -1;
+	
 	find_block = 0;
 
 	while( find_block != 0x3c )
@@ -5,6 +5,7 @@
  ********************************************************************/
 
 #include "math.h"
+#include "limits.h"
 #include "cecbpath.h"
 
 #define PI 3.1415926
@@ -16,6 +17,17 @@ static int numbers_close_signed( int a, int b, double p );
 static error_code advance_to_next_zero_crossing( cecb_path_id path, int *diff );
 static error_code advance_to_next_lo_to_hi( cecb_path_id path, int *diff );
 static error_code advance_to_next_hi_to_lo( cecb_path_id path, int *diff );
+static error_code advance_to_next_crossing( cecb_path_id path, int which, int *diff );
+static error_code fill_wav_buffer( cecb_path_id path );
+static void set_wav_zero_band( cecb_path_id path );
+static void set_wav_bit_threshold( cecb_path_id path );
+static error_code build_byte_waves( cecb_path_id path );
+static error_code queue_space( cecb_path_id path );
+
+#define MIN(X,Y) ((X) < (Y) ? (X) : (Y))
+
+#define CROSS_LO_TO_HI	1
+#define CROSS_HI_TO_LO	2
 static void build_sinusoidal_bufer_8(_wave_parity parity, unsigned char *buffer, int length);
 static void build_sinusoidal_bufer_16(_wave_parity parity, short *buffer, int length);
 
@@ -31,7 +43,6 @@ static void build_sinusoidal_bufer_16(_wave_parity parity, short *buffer, int le
 error_code _cecb_read_bits_wav( cecb_path_id path, int count, unsigned char *result )
 {
 	error_code ec = 0;
-	double freq;
 	int diff;
 	
 	*result = 0;
@@ -56,9 +67,7 @@ error_code _cecb_read_bits_wav( cecb_path_id path, int count, unsigned char *res
 			return EOS_EOF;
 		}
 		
-		freq = ((float)path->wav_sample_rate/(float)diff);
-		
-		if( freq < path->wav_frequency_limit ) /* 1200 Hz range */
+		if( diff >= path->wav_bit_threshold ) /* 1200 Hz range */
 			(*result) >>= 1;
 		else /* 2400 HZ range */
 		{
@@ -186,10 +195,15 @@ error_code _cecb_parse_riff( cecb_path_id path )
 	path->wav_total_samples = path->wav_data_length / WAV_SAMPLE_MUL;
 	fseek( path->fd, path->play_at * WAV_SAMPLE_MUL, SEEK_CUR );
 	path->wav_current_sample = path->play_at;
+	path->wav_buffer_count = path->wav_buffer_index = 0;
+	
+	set_wav_zero_band( path );
 	
 	if( (path->wav_frequency_limit == 0) || (path->wav_parity == NONE) )
 		ec = analyze_wav_leader( path );
 	
+	set_wav_bit_threshold( path );
+	
 	return ec;
 }
 
@@ -396,37 +410,76 @@ static int numbers_close_double( double a, double b, double p )
 /* Advance in audio file looking for a low to high or high to low transisition */
 static error_code advance_to_next_zero_crossing( cecb_path_id path, int *diff )
 {
-	int result;
-	
-	result = 0;
+	return advance_to_next_crossing( path, CROSS_LO_TO_HI | CROSS_HI_TO_LO, diff );
+}
+
+static error_code advance_to_next_lo_to_hi( cecb_path_id path, int *diff )
+{
+	return advance_to_next_crossing( path, CROSS_LO_TO_HI, diff );
+}
+
+static error_code advance_to_next_hi_to_lo( cecb_path_id path, int *diff )
+{
+	return advance_to_next_crossing( path, CROSS_HI_TO_LO, diff );
+}
+
+/*
+ * advance_to_next_crossing()
+ *
+ * Scan the sample buffer for the next crossing of the kind(s) in
+ * 'which', setting 'diff' to the number of samples consumed.  A low
+ * to high crossing is a sample above zero after one at or below it;
+ * high to low is the reverse.
+ */
+
+static error_code advance_to_next_crossing( cecb_path_id path, int which, int *diff )
+{
+	int result = 0, found = 0;
+	signed char last = path->wav_ss2;
 	
-	while( path->wav_current_sample < path->wav_total_samples )
+	while( found == 0 && path->wav_current_sample < path->wav_total_samples )
 	{
-		path->wav_ss1 = path->wav_ss2;
+		signed char *levels;
+		int i, n;
 		
-		if( path->wav_bits_per_sample == 8 )
+		if( path->wav_buffer_index >= path->wav_buffer_count && fill_wav_buffer( path ) != 0 )
 		{
-			path->wav_ss2 = fgetc( path->fd );
-//			printf( "%d\n", path->wav_ss2 );
+			path->wav_ss2 = last;
+			*diff = result;
+			
+			return EOS_EOF;
 		}
-		else
+		
+		levels = path->wav_levels + path->wav_buffer_index;
+		n = path->wav_buffer_count - path->wav_buffer_index;
+		
+		if( n > path->wav_total_samples - path->wav_current_sample )
+			n = path->wav_total_samples - path->wav_current_sample;
+		
+		for( i = 0; i < n; i++ )
 		{
-			short s;
-			if( fread_le_sshort( &s, path->fd ) != 2 )
-				return EOS_EOF;
-			path->wav_ss2 = s;
+			if( ((which & CROSS_LO_TO_HI) && last <= 0 && levels[i] > 0) ||
+				((which & CROSS_HI_TO_LO) && last >= 0 && levels[i] < 0) )
+			{
+				found = 1;
+			}
+			
+			last = levels[i];
+			
+			if( found == 1 )
+			{
+				i++;
+				break;
+			}
 		}
-
-		(path->wav_current_sample)++;
-		result++;
 		
-		if( numbers_close_signed( path->wav_zero_value, path->wav_ss2, path->wav_threshold ) == 1 )
-			path->wav_ss2 = path->wav_zero_value;
-
-		if( (((path->wav_ss1)<=path->wav_zero_value) && ((path->wav_ss2)>path->wav_zero_value)) || (((path->wav_ss1)>=path->wav_zero_value) && ((path->wav_ss2)<path->wav_zero_value)) )
-			break;
+		path->wav_buffer_index += i;
+		path->wav_current_sample += i;
+		result += i;
 	}
 	
+	path->wav_ss1 = path->wav_ss2;
+	path->wav_ss2 = last;
 	*diff = result;
 	
 	if( path->wav_current_sample >= path->wav_total_samples )
@@ -435,109 +488,165 @@ static error_code advance_to_next_zero_crossing( cecb_path_id path, int *diff )
 	return 0;
 }
 
-static error_code advance_to_next_lo_to_hi( cecb_path_id path, int *diff )
+/*
+ * fill_wav_buffer()
+ *
+ * Read the next block of samples and sort each one into low, zero or
+ * high.
+ */
+
+static error_code fill_wav_buffer( cecb_path_id path )
 {
-	int result;
+	size_t count, i;
+	long want;
+	int lo = path->wav_zero_lo, hi = path->wav_zero_hi;
 	
-	result = 0;
-	
-	while( path->wav_current_sample < path->wav_total_samples )
+	if( path->wav_buffer == NULL )
 	{
-		path->wav_ss1 = path->wav_ss2;
+		/* Room for 16 bit samples, followed by their levels */
 		
-		if( path->wav_bits_per_sample == 8 )
-		{
-			path->wav_ss2 = fgetc( path->fd );
-//			printf( "%d\n", path->wav_ss2 );
-		}
-		else
-		{
-			short s;
-			if( fread_le_sshort( &s, path->fd ) != 2 )
-				return EOS_EOF;
-			path->wav_ss2 = s;
-		}
-
-		(path->wav_current_sample)++;
-		result++;
+		path->wav_buffer = malloc( WAV_BUFFER_SAMPLES * 3 );
 		
-		if( numbers_close_signed( path->wav_zero_value, path->wav_ss2, path->wav_threshold ) == 1 )
-			path->wav_ss2 = path->wav_zero_value;
-
-		if( (((path->wav_ss1)<=path->wav_zero_value) && ((path->wav_ss2)>path->wav_zero_value)) )
-			break;
+		if( path->wav_buffer == NULL )
+			return EOS_OM;
+			
+		path->wav_levels = (signed char *)path->wav_buffer + WAV_BUFFER_SAMPLES * 2;
 	}
 	
-	*diff = result;
+	want = path->wav_total_samples - path->wav_current_sample;
 	
-	if( path->wav_current_sample >= path->wav_total_samples )
+	if( want > WAV_BUFFER_SAMPLES )
+		want = WAV_BUFFER_SAMPLES;
+	
+	count = fread( path->wav_buffer, WAV_SAMPLE_MUL, want, path->fd );
+	
+	if( count == 0 )
 		return EOS_EOF;
+	
+	if( path->wav_bits_per_sample == 8 )
+	{
+		unsigned char *samples = path->wav_buffer;
+		
+		for( i = 0; i < count; i++ )
+			path->wav_levels[i] = (samples[i] > hi) - (samples[i] < lo);
+	}
+	else
+	{
+		unsigned char *samples = path->wav_buffer;
 		
+		for( i = 0; i < count; i++ )
+		{
+			int s = (short)(samples[i * 2] | (samples[i * 2 + 1] << 8));
+			
+			path->wav_levels[i] = (s > hi) - (s < lo);
+		}
+	}
+	
+	path->wav_buffer_count = count;
+	path->wav_buffer_index = 0;
+	
 	return 0;
 }
 
-static error_code advance_to_next_hi_to_lo( cecb_path_id path, int *diff )
-{
-	int result;
+/*
+ * set_wav_zero_band()
+ *
+ * Work out once which sample values the noise threshold pulls to zero,
+ * so that samples can be sorted with two integer compares.
+ */
 
-	result = 0;
+static void set_wav_zero_band( cecb_path_id path )
+{
+	int s, lo, hi, first, last;
 	
-	while( path->wav_current_sample < path->wav_total_samples )
+	if( path->wav_bits_per_sample == 8 )
 	{
-		path->wav_ss1 = path->wav_ss2;
-		
-		if( path->wav_bits_per_sample == 8 )
-		{
-			path->wav_ss2 = fgetc( path->fd );
-//			printf( "%d\n", path->wav_ss2 );
-		}
-		else
+		first = 0;
+		last = 255;
+	}
+	else
+	{
+		first = -32768;
+		last = 32767;
+	}
+	
+	lo = path->wav_zero_value;
+	hi = path->wav_zero_value;
+	
+	for( s = first; s <= last; s++ )
+	{
+		if( numbers_close_signed( path->wav_zero_value, s, path->wav_threshold ) == 1 )
 		{
-			short s;
-			if( fread_le_sshort( &s, path->fd ) != 2 )
-				return EOS_EOF;
-			path->wav_ss2 = s;
+			if( s < lo ) lo = s;
+			if( s > hi ) hi = s;
 		}
+	}
+	
+	path->wav_zero_lo = lo;
+	path->wav_zero_hi = hi;
+	
+	/* Level of the sample "before" the first one */
+	
+	path->wav_ss2 = (0 > hi) - (0 < lo);
+}
 
-		(path->wav_current_sample)++;
-		result++;
-		
-		if( numbers_close_signed( path->wav_zero_value, path->wav_ss2, path->wav_threshold ) == 1 )
-			path->wav_ss2 = path->wav_zero_value;
+/*
+ * set_wav_bit_threshold()
+ *
+ * Turn the frequency limit into the shortest half period, in samples,
+ * that reads as a 1200 Hz (zero) bit.
+ */
 
-		if( (((path->wav_ss1)>=path->wav_zero_value) && ((path->wav_ss2)<path->wav_zero_value)) )
-			break;
+static void set_wav_bit_threshold( cecb_path_id path )
+{
+	int diff;
+	
+	if( path->wav_frequency_limit <= 0 )
+	{
+		path->wav_bit_threshold = INT_MAX;
+		return;
 	}
 	
-	*diff = result;
+	diff = path->wav_sample_rate / path->wav_frequency_limit - 2;
 	
-	if( path->wav_current_sample >= path->wav_total_samples )
-		return EOS_EOF;
-		
-	return 0;
+	if( diff < 1 )
+		diff = 1;
+	
+	while( (float)path->wav_sample_rate / (float)diff >= path->wav_frequency_limit )
+		diff++;
+	
+	path->wav_bit_threshold = diff;
 }
 
+/*
+ * _cecb_write_wav_audio()
+ *
+ * Queue the waveform of each byte in 'buffer'.  Returns the number of
+ * bytes of WAV data queued.
+ */
+
 int _cecb_write_wav_audio(cecb_path_id path, char *buffer, int total_length)
 {
 	int result = 0, i;
 
+	if( path->wav_byte_waves == NULL && build_byte_waves( path ) != 0 )
+		return 0;
+
+	if( queue_space( path ) != 0 )
+		return 0;
+
 	for (i = 0; i < total_length; i++)
 	{
-		int j;
+		unsigned char byte = buffer[i];
+		int offset = path->wav_byte_offset[byte];
+		int length = path->wav_byte_offset[byte + 1] - offset;
 
-		for (j = 0; j < 8; j++)
-		{
-			if (((buffer[i] >> j) & 0x01) == 0)
-			{
-				fwrite(path->buffer_1200, path->buffer_1200_length, 1, path->fd);
-				result += path->buffer_1200_length;
-			}
-			else
-			{
-				fwrite(path->buffer_2400, path->buffer_2400_length, 1, path->fd);
-				result += path->buffer_2400_length;
-			}
-		}
+		if( path->wav_out_length + length > WAV_OUT_SIZE && _cecb_write_wav_flush( path ) != 0 )
+			break;
+
+		memcpy( path->wav_out + path->wav_out_length, path->wav_byte_waves + offset, length );
+		path->wav_out_length += length;
+		result += length;
 	}
 
 	return result;
@@ -555,22 +664,132 @@ int _cecb_write_wav_audio_repeat_byte(cecb_path_id path, int length, char byte)
 
 int _cecb_write_wav_repeat_byte(cecb_path_id path, int length, char byte)
 {
-	int i;
+	int count, result = 0;
 
-	for (i = 0; i < length; i++)
-		fwrite_le_char(byte, path->fd);
+	while( result < length )
+	{
+		if( queue_space( path ) != 0 )
+			break;
+
+		count = MIN( length - result, WAV_OUT_SIZE - path->wav_out_length );
+		memset( path->wav_out + path->wav_out_length, byte, count );
+		path->wav_out_length += count;
+		result += count;
+	}
 
-	return length;
+	return result;
 }
 
 int _cecb_write_wav_repeat_short(cecb_path_id path, int length, short bytes)
 {
-	int i;
+	int i, count, result = 0;
 
-	for (i = 0; i < length; i++)
-		fwrite_le_short( bytes, path->fd );
+	while( result < length )
+	{
+		unsigned char *p;
+
+		if( queue_space( path ) != 0 )
+			break;
+
+		count = MIN( length - result, (WAV_OUT_SIZE - path->wav_out_length) / 2 );
+		p = path->wav_out + path->wav_out_length;
+
+		for( i = 0; i < count; i++ )
+		{
+			p[i * 2] = bytes & 0xFF;
+			p[i * 2 + 1] = (bytes >> 8) & 0xFF;
+		}
+
+		path->wav_out_length += count * 2;
+		result += count;
+	}
+
+	return result*2;
+}
+
+/*
+ * _cecb_write_wav_flush()
+ *
+ * Write out the queued WAV data.
+ */
+
+error_code _cecb_write_wav_flush(cecb_path_id path)
+{
+	if( path->wav_out_length > 0 )
+	{
+		if( fwrite( path->wav_out, 1, path->wav_out_length, path->fd ) != (size_t)path->wav_out_length )
+			return EOS_WRITE;
+
+		path->wav_out_length = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * build_byte_waves()
+ *
+ * Lay out the waveform of every byte value, least significant bit
+ * first, from the 1200 and 2400 Hz cycles.
+ */
+
+static error_code build_byte_waves( cecb_path_id path )
+{
+	int byte, j, size = 0;
+	unsigned char *p;
+
+	for( byte = 0; byte < 256; byte++ )
+	{
+		path->wav_byte_offset[byte] = size;
+
+		for( j = 0; j < 8; j++ )
+			size += ((byte >> j) & 0x01) ? path->buffer_2400_length : path->buffer_1200_length;
+	}
+
+	path->wav_byte_offset[256] = size;
 
-	return length*2;
+	path->wav_byte_waves = malloc( size );
+
+	if( path->wav_byte_waves == NULL )
+		return EOS_OM;
+
+	p = path->wav_byte_waves;
+
+	for( byte = 0; byte < 256; byte++ )
+	{
+		for( j = 0; j < 8; j++ )
+		{
+			if( ((byte >> j) & 0x01) == 0 )
+			{
+				memcpy( p, path->buffer_1200, path->buffer_1200_length );
+				p += path->buffer_1200_length;
+			}
+			else
+			{
+				memcpy( p, path->buffer_2400, path->buffer_2400_length );
+				p += path->buffer_2400_length;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Make room in the WAV output queue */
+static error_code queue_space( cecb_path_id path )
+{
+	if( path->wav_out == NULL )
+	{
+		path->wav_out = malloc( WAV_OUT_SIZE );
+
+		if( path->wav_out == NULL )
+			return EOS_OM;
+	}
+
+	if( path->wav_out_length + 2 > WAV_OUT_SIZE )
+		return _cecb_write_wav_flush( path );
+
+	return 0;
 }
 
 static void build_sinusoidal_bufer_8(_wave_parity parity, unsigned char *buffer, int length)
@@ -327,3 +327,42 @@ error_code _coco_gs_pos(coco_path_id path, u_int *pos)
 	
 	return ec;
 }
+
+
+
+/*
+ * _coco_gs_extent()
+ *
+ * Return the host file descriptor, host file offset and contiguous length
+ * of the data at the path's file position.  Cassette paths have no such
+ * thing.
+ */
+error_code _coco_gs_extent(coco_path_id path, int *fd, u_int *offset, u_int *length)
+{
+	error_code		ec = 0;
+	
+	
+    /* 1. Call appropriate function. */
+	
+	switch (path->type)
+	{
+		case NATIVE:
+			ec = _native_gs_extent(path->path.native, fd, offset, length);
+			break;
+			
+		case OS9:
+			ec = _os9_gs_extent(path->path.os9, fd, offset, length);
+			break;
+			
+		case DECB:
+			ec = _decb_gs_extent(path->path.decb, fd, offset, length);
+			break;
+		
+		case CECB:
+			ec = EOS_BMODE;
+			break;
+	}
+	
+	
+	return ec;
+}
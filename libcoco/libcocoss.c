@@ -157,3 +157,102 @@ error_code _coco_ss_size(coco_path_id path, int size)
 	
 	return ec;
 }
+
+
+
+/*
+ * _coco_ss_prealloc()
+ *
+ * Reserve room for a file of 'size' bytes ahead of writing it.  Only
+ * OS-9 files are laid out in advance; elsewhere this is a no-op.
+ */
+error_code _coco_ss_prealloc(coco_path_id path, u_int size)
+{
+	error_code		ec = 0;
+	
+	
+    /* 1. Call appropriate function. */
+	
+	switch (path->type)
+	{
+		case OS9:
+			ec = _os9_ss_prealloc(path->path.os9, size);
+			break;
+			
+		case NATIVE:
+		case DECB:
+		case CECB:
+			break;
+	}
+	
+	
+	return ec;
+}
+
+
+
+/*
+ * _coco_ss_writeback()
+ *
+ * Let a path hold its file's metadata (OS-9 FD sector, Disk BASIC
+ * directory entry, FAT and current granule) in memory while it writes,
+ * until _coco_ss_sync or _coco_close.  Elsewhere this is a no-op.
+ */
+error_code _coco_ss_writeback(coco_path_id path, int enable)
+{
+	error_code		ec = 0;
+	
+	
+    /* 1. Call appropriate function. */
+	
+	switch (path->type)
+	{
+		case OS9:
+			ec = _os9_ss_writeback(path->path.os9, enable);
+			break;
+			
+		case DECB:
+			ec = _decb_ss_writeback(path->path.decb, enable);
+			break;
+			
+		case NATIVE:
+		case CECB:
+			break;
+	}
+	
+	
+	return ec;
+}
+
+
+
+/*
+ * _coco_ss_sync()
+ *
+ * Write out whatever a write-back path is holding.
+ */
+error_code _coco_ss_sync(coco_path_id path)
+{
+	error_code		ec = 0;
+	
+	
+    /* 1. Call appropriate function. */
+	
+	switch (path->type)
+	{
+		case OS9:
+			ec = _os9_ss_sync(path->path.os9);
+			break;
+			
+		case DECB:
+			ec = _decb_ss_sync(path->path.decb);
+			break;
+			
+		case NATIVE:
+		case CECB:
+			break;
+	}
+	
+	
+	return ec;
+}
@@ -0,0 +1,110 @@
+/********************************************************************
+ * chain.c - Disk BASIC granule chain routines
+ *
+ * Each file path keeps the list of its file's granules in chain order,
+ * built from the FAT the first time it is needed, along with a copy of
+ * the last granule it read.  Reads and writes index the chain by file
+ * position instead of following the FAT from the first granule, and
+ * touch the image once per granule rather than once per call.  On a
+ * write-back path the cached granule may hold changes (cache_dirty),
+ * which are written out before another granule takes its place.
+ *
+ * $Id$
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cocotypes.h"
+#include "decbpath.h"
+
+
+/*
+ * _decb_chain_load()
+ *
+ * Make sure path->chain holds the file's granules.
+ */
+error_code _decb_chain_load(decb_path_id path)
+{
+	int granule = path->dir_entry.first_granule;
+	int length = 0;
+
+
+	/* 1. Already built? */
+
+	if (path->chain_length > 0)
+	{
+		return 0;
+	}
+
+
+	/* 2. Follow the FAT to the last granule. */
+
+	while (length < 256)
+	{
+		path->chain[length++] = granule;
+
+		if (path->FAT[granule] >= 0xC0)
+		{
+			path->chain_length = length;
+
+			return 0;
+		}
+
+		granule = path->FAT[granule];
+	}
+
+
+	/* 3. The chain loops back on itself. */
+
+	return EOS_SE;
+}
+
+
+
+/*
+ * _decb_chain_invalidate()
+ *
+ * Forget the chain after the FAT links change.
+ */
+void _decb_chain_invalidate(decb_path_id path)
+{
+	path->chain_length = 0;
+}
+
+
+
+/*
+ * _decb_chain_granule()
+ *
+ * Return the contents of granule 'index' of the file, reading it into
+ * the path's granule cache if it isn't there already.  Returns NULL if
+ * the file has no such granule.
+ */
+char *_decb_chain_granule(decb_path_id path, int index)
+{
+	int granule;
+
+
+	if (_decb_chain_load(path) != 0 || index < 0 || index >= path->chain_length)
+	{
+		return NULL;
+	}
+
+	granule = path->chain[index];
+
+	if (path->cache_granule != granule)
+	{
+		if (path->cache_dirty)
+		{
+			_decb_ss_granule(path, path->cache_granule, path->granule_cache);
+			path->cache_dirty = 0;
+		}
+
+		_decb_gs_granule(path, granule, path->granule_cache);
+		path->cache_granule = granule;
+	}
+
+
+	return path->granule_cache;
+}
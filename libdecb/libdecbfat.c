@@ -0,0 +1,299 @@
+/********************************************************************
+ * fat.c - Disk BASIC granule allocation routines
+ *
+ * Each drive keeps a bitmap of the free granules in its FAT, built the
+ * first time a path on it allocates and kept current as granules are
+ * taken and given back, whichever path does it.  A file that grows
+ * reserves all of the granules it needs in one call, as a single run
+ * when there is one.  The run is the first one after the granule the
+ * file is growing from, so that files written one after another on a
+ * fresh disk run forward from the directory track as they always have;
+ * only when nothing ahead will do is a run behind it taken.
+ *
+ * $Id$
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cocotypes.h"
+#include "decbpath.h"
+
+
+static void load_map(decb_drive *d);
+static int is_free(decb_drive *d, int granule);
+static void set_used(decb_drive *d, int granule);
+static int find_run(decb_drive *d, int count, int next_to, int *start);
+static int longest_run(decb_drive *d);
+
+
+
+/*
+ * _decb_fat_allocate()
+ *
+ * Reserve 'count' granules for a file growing from 'next_to', storing
+ * them in 'granules' in the order they are to be chained.  The caller
+ * links them in the FAT.  Nothing is reserved unless all of them can be.
+ */
+error_code _decb_fat_allocate(decb_path_id path, int count, int next_to, u_char *granules)
+{
+	decb_drive *d = path->view;
+	int taken = 0;
+
+
+	/* 1. Make sure there is room for all of them. */
+
+	load_map(d);
+
+	if (count > d->free_granules)
+	{
+		return EOS_DF;
+	}
+
+
+	/* 2. Take the first run ahead that holds what is left, or failing
+	 *    that the first of the longest runs, until we have enough.
+	 */
+
+	while (taken < count)
+	{
+		int length = count - taken;
+		int longest = longest_run(d);
+		int start, i;
+
+
+		if (length > longest)
+		{
+			length = longest;
+		}
+
+		if (find_run(d, length, next_to, &start) != 0)
+		{
+			return EOS_DF;
+		}
+
+		for (i = 0; i < length; i++)
+		{
+			set_used(d, start + i);
+
+			granules[taken++] = start + i;
+		}
+
+		next_to = start + length - 1;
+	}
+
+
+	return 0;
+}
+
+
+
+/*
+ * _decb_fat_release()
+ *
+ * Give a granule back.
+ */
+void _decb_fat_release(decb_path_id path, int granule)
+{
+	decb_drive *d = path->view;
+
+
+	_decb_fat_set(path, granule, 0xFF);
+
+	if (d->free_map_loaded && granule < DECB_MAX_GRANULES && !is_free(d, granule))
+	{
+		d->free_map[granule / 8] |= 1 << (granule % 8);
+		d->free_granules++;
+	}
+}
+
+
+
+/*
+ * _decb_fat_set()
+ *
+ * Change a FAT entry, noting that the FAT must be written out.
+ */
+void _decb_fat_set(decb_path_id path, int granule, int value)
+{
+	path->FAT[granule] = value;
+
+	path->fat_dirty = 1;
+	path->view->fat_dirty = 1;
+}
+
+
+
+/*
+ * _decb_fat_write()
+ *
+ * Write the FAT sector out if this path has changed the FAT.  The
+ * sector carries every other path's changes along with it.
+ */
+error_code _decb_fat_write(decb_path_id path)
+{
+	error_code ec;
+
+
+	if (path->fat_dirty == 0)
+	{
+		return 0;
+	}
+
+	ec = _decb_ss_sector(path, 17, 2, (char *)path->FAT);
+
+	if (ec == 0)
+	{
+		path->fat_dirty = 0;
+		path->view->fat_dirty = 0;
+	}
+
+
+	return ec;
+}
+
+
+
+/* Build the bitmap from the FAT, if it hasn't been already */
+
+static void load_map(decb_drive *d)
+{
+	int i;
+
+
+	if (d->free_map_loaded)
+	{
+		return;
+	}
+
+	memset(d->free_map, 0, sizeof(d->free_map));
+	d->free_granules = 0;
+
+	for (i = 0; i < DECB_MAX_GRANULES; i++)
+	{
+		if (d->FAT[i] == 0xFF)
+		{
+			d->free_map[i / 8] |= 1 << (i % 8);
+			d->free_granules++;
+		}
+	}
+
+	d->free_map_loaded = 1;
+}
+
+
+
+static int is_free(decb_drive *d, int granule)
+{
+	return (d->free_map[granule / 8] & (1 << (granule % 8))) != 0;
+}
+
+
+
+static void set_used(decb_drive *d, int granule)
+{
+	d->free_map[granule / 8] &= ~(1 << (granule % 8));
+	d->free_granules--;
+}
+
+
+
+/*
+ * find_run()
+ *
+ * Find 'count' free granules in a row, starting as soon after 'next_to'
+ * as there are.  If no run ahead of it is long enough, take the one
+ * behind it that ends closest to it.
+ */
+static int find_run(decb_drive *d, int count, int next_to, int *start)
+{
+	int target = next_to + 1;
+	int behind = -1;
+	int a = 0, b;
+
+
+	while (a < DECB_MAX_GRANULES)
+	{
+		/* 1. Find the next run of free granules, a through b - 1. */
+
+		if (!is_free(d, a))
+		{
+			a++;
+
+			continue;
+		}
+
+		for (b = a; b < DECB_MAX_GRANULES && is_free(d, b); b++)
+			;
+
+
+		/* 2. The first run at or after the target that is long enough
+		 *    is the one.
+		 */
+
+		{
+			int s = a > target ? a : target;
+
+			if (s + count <= b)
+			{
+				*start = s;
+
+				return 0;
+			}
+		}
+
+
+		/* 3. Runs are found in order, so the last one before the target
+		 *    that is long enough is the closest behind it.
+		 */
+
+		{
+			int e = b < target ? b : target;
+
+			if (e - count >= a)
+			{
+				behind = e - count;
+			}
+		}
+
+		a = b;
+	}
+
+	if (behind < 0)
+	{
+		return -1;
+	}
+
+	*start = behind;
+
+
+	return 0;
+}
+
+
+
+/* Length of the longest run of free granules */
+
+static int longest_run(decb_drive *d)
+{
+	int i, length = 0, longest = 0;
+
+
+	for (i = 0; i < DECB_MAX_GRANULES; i++)
+	{
+		if (is_free(d, i))
+		{
+			if (++length > longest)
+			{
+				longest = length;
+			}
+		}
+		else
+		{
+			length = 0;
+		}
+	}
+
+
+	return longest;
+}
@@ -89,15 +89,17 @@ error_code _decb_gs_size(decb_path_id path, u_int *size)
 
 	/* 1. The following code is for DECB paths. */
 	
-	curr_granule = path->dir_entry.first_granule;
+	ec = _decb_chain_load(path);
 
-	while (path->FAT[curr_granule] < 0xC0)
+	if (ec != 0)
 	{
-		curr_granule = path->FAT[curr_granule];
-		
-		*size += 2304;
+		return ec;
 	}
 
+	curr_granule = path->chain[path->chain_length - 1];
+
+	*size = (path->chain_length - 1) * 2304;
+
 	sectors_in_last_granule = (path->FAT[curr_granule] & 0x3f) - 1;
 	sectors_in_last_granule = sectors_in_last_granule < 0 ? 0 : sectors_in_last_granule;
 	
@@ -149,22 +151,16 @@ error_code _decb_gs_pos(decb_path_id path, u_int *pos)
 error_code _decb_gs_sector(decb_path_id path, int track, int sector, char *buffer)
 {
 	error_code	ec = 0;
-//	size_t		size;
-
-
-	/* 1. Seek to the track and sector. */
-
-	_decb_seeksector(path, track, sector);
 
 
-	/* 2. Get the sector into the buffer. */
+	/* 1. Get the sector into the buffer, leaving the image's position
+	 *    alone for the other paths on it.
+	 */
 
-//	size = fread(buffer, 1, 256, path->fd);
-	fread(buffer, 1, 256, path->fd);
+	_image_read_at(path->image, _decb_sector_offset(path, track, sector), buffer, 256);
 
-//	assert( size == 256 );
 
-	/* 3. Return status. */
+	/* 2. Return status. */
 	
 	return ec;
 }
@@ -174,14 +170,10 @@ error_code _decb_gs_sector(decb_path_id path, int track, int sector, char *buffe
 error_code _decb_gs_granule(decb_path_id path, int granule, char *buffer)
 {
 	error_code	ec = 0;
+	long		offset = _decb_granule_offset(path, granule);
 
 
-	/* 1. Seek to granule. */
-	
-	_decb_seekgranule(path, granule);
-	
-
-	/* 2. Read granule into buffer. */
+	/* 1. Read granule into buffer. */
 
 	if(path->hdbdos_offset)
 	{
@@ -189,18 +181,85 @@ error_code _decb_gs_granule(decb_path_id path, int granule, char *buffer)
 
 		for(count = 0; count < 2304; count += 256)
 		{
-			fread(&buffer[count], 1, 256, path->fd);
 			/* skip unused 1/2 of sector */
-			fseek(path->fd, 256, SEEK_CUR);
+			_image_read_at(path->image, offset + count * 2, &buffer[count], 256);
 		}
 	}
 	else
 	{
-		fread(buffer, 1, 2304, path->fd);
+		_image_read_at(path->image, offset, buffer, 2304);
 	}
 	
 
-	/* 3. Return status. */
+	/* 2. Return status. */
 	
 	return ec;
 }
+
+
+
+/*
+ * _decb_gs_extent()
+ *
+ * Return the host file descriptor of the image, the image offset of the
+ * byte at the path's file position, and how many bytes of the file lie
+ * contiguously from there.  That is the rest of the granule, or the rest
+ * of the sector on an HDB-DOS image, whose sectors are only half used.
+ */
+error_code _decb_gs_extent(decb_path_id path, int *fd, u_int *offset, u_int *length)
+{
+	error_code	ec = 0;
+	u_int		filesize, offset_in_granule;
+	int		curr_granule;
+
+
+	/* 1. Raw paths are not files. */
+
+	if (path->israw == 1)
+	{
+		return EOS_BMODE;
+	}
+
+	ec = _decb_gs_size(path, &filesize);
+
+	if (ec != 0)
+	{
+		return ec;
+	}
+
+	if (path->filepos >= filesize)
+	{
+		return EOS_EOF;
+	}
+
+
+	/* 2. Find the granule holding the file position. */
+
+	curr_granule = path->chain[path->filepos / 2304];
+
+	offset_in_granule = path->filepos % 2304;
+
+
+	/* 3. Locate it in the image. */
+
+	if (path->hdbdos_offset)
+	{
+		*offset = _decb_granule_offset(path, curr_granule) + (offset_in_granule / 256) * 512 + offset_in_granule % 256;
+		*length = 256 - offset_in_granule % 256;
+	}
+	else
+	{
+		*offset = _decb_granule_offset(path, curr_granule) + offset_in_granule;
+		*length = 2304 - offset_in_granule;
+	}
+
+	if (*length > filesize - path->filepos)
+	{
+		*length = filesize - path->filepos;
+	}
+
+	*fd = _image_fileno(path->image);
+
+
+	return ec;
+}
@@ -52,12 +52,12 @@ error_code _decb_kill(char *pathlist)
 
 			next_granule = path->FAT[curr_granule];
 
-			path->FAT[curr_granule] = 0xFF;
+			_decb_fat_release(path, curr_granule);
 			
 			curr_granule = next_granule;
 	}
 
-	path->FAT[curr_granule] = 0xFF;
+	_decb_fat_release(path, curr_granule);
 	
 	
 	/* 4. Close the path. */
@@ -18,11 +18,11 @@
 
 static int init_pd(decb_path_id *path, int mode);
 static int term_pd(decb_path_id path);
+static int open_image(decb_path_id path, int mode);
+static error_code close_image(decb_path_id path);
 static int validate_pathlist(decb_path_id *path, char *pathlist);
 static int _decb_cmp(decb_dir_entry *entry, char *name);
 
-extern error_code find_free_granule(decb_path_id path, int *granule, int next_to);
-
 
 /*
  * _decb_create()
@@ -34,7 +34,6 @@ error_code _decb_create(decb_path_id *path, char *pathlist, int mode, int file_t
 {
 	error_code		ec = EOS_BPNAM;
 	int				empty_entry = -1;
-	char			*open_mode;
 	
 
     /* 1. Allocate & initialize path descriptor. */
@@ -59,37 +58,21 @@ error_code _decb_create(decb_path_id *path, char *pathlist, int mode, int file_t
     }
 
 	
-	/* 3. Open a path to the image file. */
+	/* 3. Open a path to the image file.  Sector and granule functions
+	 *    will work after this, and the FAT is the drive's.
+	 */
 	
-	if (mode & FAM_WRITE)
-	{
-		open_mode = "rb+";
-	}
-	else
-	{
-		open_mode = "rb";
-	}
+	ec = open_image(*path, mode);
 	
-	(*path)->fd = fopen((*path)->imgfile, open_mode);
-	
-	if ((*path)->fd == NULL)
+	if (ec != 0)
 	{
 		term_pd(*path);
 		
-		return(EOS_BPNAM);
+		return ec;
 	}
 	
 	
-	(*path)->disk_offset = 161280 * (*path)->drive;
-	(*path)->disk_offset += (*path)->hdbdos_offset;
-	
-	
-	/* 4. At this point, sector and granule function will work - Load FAT */
-	
-	_decb_gs_sector(*path, 17, 2, (char *)(*path)->FAT);
-	
-	
-	/* 5. Determine if there is enough space. */
+	/* 4. Determine if there is enough space. */
 
 	{
 		int			i, free_granules = 0;
@@ -107,7 +90,7 @@ error_code _decb_create(decb_path_id *path, char *pathlist, int mode, int file_t
 		
 		if (free_granules == 0)
 		{
-			fclose((*path)->fd);
+			close_image(*path);
 			
 			term_pd(*path);
 
@@ -116,7 +99,7 @@ error_code _decb_create(decb_path_id *path, char *pathlist, int mode, int file_t
 	}
 	
 
-	/* 6. Construct a directory entry. */
+	/* 5. Construct a directory entry. */
 	
 	{
 		char *p = strchr((*path)->filename, '.');
@@ -167,7 +150,7 @@ error_code _decb_create(decb_path_id *path, char *pathlist, int mode, int file_t
 	}
 
 	
-	/* 7. Determine if file already exists. */
+	/* 6. Determine if file already exists. */
 
 	{
 		decb_dir_entry		de;
@@ -197,13 +180,13 @@ error_code _decb_create(decb_path_id *path, char *pathlist, int mode, int file_t
 					/* Error if we are not to create it */
 					if( mode & FAM_NOCREATE )
 					{
-						fclose((*path)->fd);
+						close_image(*path);
 						term_pd(*path);
 						return EOS_FAE;
 					}
 					else
 					{
-						fclose((*path)->fd);
+						close_image(*path);
 						term_pd(*path);
 						_decb_kill(pathlist);
 						return _decb_create( path, pathlist, mode, file_type, data_type );
@@ -217,7 +200,7 @@ error_code _decb_create(decb_path_id *path, char *pathlist, int mode, int file_t
 		{
 			/* 1. There are no more directory entries left. */
 			
-			fclose((*path)->fd);
+			close_image(*path);
 			
 			term_pd(*path);
 			
@@ -226,28 +209,32 @@ error_code _decb_create(decb_path_id *path, char *pathlist, int mode, int file_t
 	}
 
 	
-	/* 8. Allocate a granule for this file. */
+	/* 7. Allocate a granule for this file. */
 	
 	{
 		error_code  ec;
-		int			new_granule;
+		u_char		new_granule;
 		
 		
-		ec = find_free_granule(*path, &new_granule, 34);
+		ec = _decb_fat_allocate(*path, 1, 34, &new_granule);
 		
 		if (ec != 0)
 		{
+			close_image(*path);
+			
+			term_pd(*path);
+			
 			return ec;
 		}
 		
-		(*path)->FAT[new_granule] = 0xC1;
+		_decb_fat_set(*path, new_granule, 0xC1);
 		(*path)->dir_entry.first_granule = new_granule;
 		
 		_int2(0, (*path)->dir_entry.last_sector_size);
 	}
 	
 
-	/* 9. Write the new directory entry. */	
+	/* 8. Write the new directory entry. */	
 	
 	_decb_seekdir(*path, empty_entry, SEEK_SET);
 	
@@ -276,7 +263,6 @@ error_code _decb_create(decb_path_id *path, char *pathlist, int mode, int file_t
 error_code _decb_open(decb_path_id *path, char *pathlist, int mode)
 {
 	error_code	ec = 0;
-	char *open_mode;
 
 
 	/* 1. Strip off FAM_NOCREATE if passed -- irrelavent to _decb_open */
@@ -326,37 +312,21 @@ error_code _decb_open(decb_path_id *path, char *pathlist, int mode)
 	}
 
 
-	/* 5. Open a path to the image file. */
-	
-	if (mode & FAM_WRITE)
-	{
-		open_mode = "rb+";
-	}
-	else
-	{
-		open_mode = "rb";
-	}
+	/* 5. Open a path to the image file.  Sector and granule functions
+	 *    will work after this, and the FAT is the drive's.
+	 */
 
-	(*path)->fd = fopen((*path)->imgfile, open_mode);
+	ec = open_image(*path, mode);
 
-	if ((*path)->fd == NULL)
+	if (ec != 0)
 	{
 		term_pd(*path);
 
-		return(EOS_BPNAM);
+		return ec;
 	}
 
 
-	(*path)->disk_offset = 161280 * (*path)->drive;
-	(*path)->disk_offset += (*path)->hdbdos_offset;
-	
-	
-	/* 6. At this point, sector and granule function will work - Load FAT */
-
-	_decb_gs_sector(*path, 17, 2, (char *)(*path)->FAT);
-
-
-	/* 7. If path is raw, just return now. */
+	/* 6. If path is raw, just return now. */
 	
 	if ((*path)->israw == 1)
 	{
@@ -364,7 +334,7 @@ error_code _decb_open(decb_path_id *path, char *pathlist, int mode)
 	}
 	
 
-	/* 8. Find directory entry matching filename. */
+	/* 7. Find directory entry matching filename. */
 
 	{
 		/* 1. Seek to the first directory entry. */
@@ -395,7 +365,7 @@ error_code _decb_open(decb_path_id *path, char *pathlist, int mode)
 	}
 	
 
-	/* 9. Return status. */
+	/* 8. Return status. */
 	
 	return(ec);
 }
@@ -412,19 +382,32 @@ error_code _decb_close(decb_path_id path)
 	error_code	ec = 0;
 	
 
-	/* 1. Write out FAT sector. */
+	/* 1. Write out anything held back, and the FAT sector if this path
+	 *    changed it.
+	 */
 	
-	_decb_ss_sector(path, 17, 2, (char *)path->FAT);
+	if (path->cache_dirty)
+	{
+		_decb_ss_granule(path, path->cache_granule, path->granule_cache);
+	}
+
+	if (path->dir_dirty)
+	{
+		_decb_seekdir(path, path->this_directory_entry_index, SEEK_SET);
+		_decb_writedir(path, &path->dir_entry);
+	}
+
+	_decb_fat_write(path);
 	
 	
 	/* 2. Close path. */
 
-	fclose(path->fd);
+	ec = close_image(path);
 
 
 	/* 3. Terminate path descriptor */
 	
-	ec = term_pd(path);
+	term_pd(path);
 	
 	
 	/* 4. Return status. */
@@ -543,6 +526,7 @@ static int init_pd(decb_path_id *path, int mode)
 	memset(*path, 0, sizeof(struct _decb_path_id));
 	
 	(*path)->mode = mode;
+	(*path)->cache_granule = -1;
 
 
 	/* 3. Return. */
@@ -552,6 +536,80 @@ static int init_pd(decb_path_id *path, int mode)
 
 
 
+/*
+ * open_image()
+ *
+ * Point the path at its image and drive, sharing the image and the
+ * drive's FAT with every other path open on them.  A path that may
+ * write holds the drive's lock exclusively until it is closed.
+ */
+static int open_image(decb_path_id path, int mode)
+{
+	error_code ec;
+
+
+	/* 1. Open the image, or find it open already. */
+
+	ec = _decb_volume_acquire(&path->volume, path->imgfile, path->hdbdos_offset, mode);
+
+	if (ec != 0)
+	{
+		return ec;
+	}
+
+	path->image = path->volume->image;
+
+	path->disk_offset = 161280 * path->drive;
+	path->disk_offset += path->hdbdos_offset;
+
+
+	/* 2. Lock the drive if we may write to it. */
+
+	if ((path->mode & FAM_WRITE) && (ec = _decb_volume_lock(path->volume, path->drive, 1)) != 0)
+	{
+		_decb_volume_release(path->volume);
+
+		return ec;
+	}
+
+
+	/* 3. Find the drive's FAT. */
+
+	ec = _decb_volume_drive(path->volume, path->drive, &path->view);
+
+	if (ec != 0)
+	{
+		close_image(path);
+
+		return ec;
+	}
+
+	path->FAT = path->view->FAT;
+
+
+	return 0;
+}
+
+
+
+/*
+ * close_image()
+ *
+ * Undo open_image.
+ */
+static error_code close_image(decb_path_id path)
+{
+	if (path->mode & FAM_WRITE)
+	{
+		_decb_volume_unlock(path->volume, path->drive);
+	}
+
+
+	return _decb_volume_release(path->volume);
+}
+
+
+
 static int term_pd(decb_path_id path)
 {
 	/* 1. Deallocate path structure. */
@@ -14,8 +14,6 @@
 error_code _decb_read(decb_path_id path, void *buffer, u_int *size)
 {
 	error_code		ec = 0;
-    int				curr_granule, last_granule;
-	u_int 			accum_size = 0;
     int				bytes_left;
 	u_int			filesize;
 
@@ -43,8 +41,7 @@ error_code _decb_read(decb_path_id path, void *buffer, u_int *size)
         }
 		else
 		{
-			fseek(path->fd, path->filepos, SEEK_SET);
-			fread(buffer, 1, *size, path->fd);
+			_image_read_at(path->image, path->filepos, buffer, *size);
 			path->filepos += *size;
 		}
 
@@ -84,60 +81,26 @@ error_code _decb_read(decb_path_id path, void *buffer, u_int *size)
     }
 
 
-    /* 6. Determine which granule the offset starts by looping
-     *    through each entry until we reach the end.
-     */
-	 
-    accum_size = 0;
-
-	curr_granule = path->dir_entry.first_granule;
-	last_granule = curr_granule;
-	
-	while (path->FAT[curr_granule] < 0xC0)
-	{
-		last_granule = curr_granule;
-		curr_granule = path->FAT[curr_granule];
-		
-		accum_size += 2304;
-
-        if (accum_size > path->filepos)
-        {
-            /* this is the granule! */
-            accum_size -= 2304;
-			curr_granule = last_granule;
-			
-            break;
-        }
-	}
-
-
-    /* 7. Start copying data into the user supplied buffer for 'bytes_left' bytes. */
+    /* 6. Copy the data out of each granule it lies in. */
 
     bytes_left = *size;
 
     while (bytes_left > 0)
     {
-		char granule_buffer[2304];
+		char *granule_data = _decb_chain_granule(path, path->filepos / 2304);
 		int read_size, offset_in_granule;
-		int bytes_in_last_granule = 2304;
-			
-		
-		_decb_gs_granule(path, curr_granule, granule_buffer);
-		
-		if (path->FAT[curr_granule] >= 0xC0)
-		{
-			bytes_in_last_granule = (((path->FAT[curr_granule] & 0x3F) - 1) * 256) + int2(path->dir_entry.last_sector_size);
-		}
-		else
+
+
+		if (granule_data == NULL)
 		{
-			curr_granule = path->FAT[curr_granule];
+			*size -= bytes_left;
+
+			return EOS_SE;
 		}
-		
 
 		offset_in_granule = path->filepos % 2304;
 
-		
-		read_size = bytes_in_last_granule - offset_in_granule;
+		read_size = 2304 - offset_in_granule;
 
 		if (read_size > bytes_left)
 		{
@@ -145,7 +108,7 @@ error_code _decb_read(decb_path_id path, void *buffer, u_int *size)
 		}
 
 
-		memcpy(buffer, granule_buffer + offset_in_granule, read_size);
+		memcpy(buffer, granule_data + offset_in_granule, read_size);
 
 		bytes_left -= read_size;
 		path->filepos += read_size;
@@ -161,8 +124,6 @@ error_code _decb_read(decb_path_id path, void *buffer, u_int *size)
 error_code _decb_readln(decb_path_id path, void *buffer, u_int *size)
 {
 	error_code		ec = 0;
-	int				curr_granule, last_granule;
-	u_int			accum_size = 0;
 	u_int			bytes_left;
 	u_int			filesize;
 	
@@ -190,8 +151,7 @@ error_code _decb_readln(decb_path_id path, void *buffer, u_int *size)
         }
 		else
 		{
-			fseek(path->fd, path->filepos, SEEK_SET);
-			fread(buffer, 1, *size, path->fd);
+			_image_read_at(path->image, path->filepos, buffer, *size);
 			path->filepos += *size;
 		}
 		
@@ -231,60 +191,29 @@ error_code _decb_readln(decb_path_id path, void *buffer, u_int *size)
     }
 	
 	
-    /* 6. Determine which granule the offset starts by looping
-	 *    through each entry until we reach the end.
+    /* 6. Copy the data out of each granule it lies in, stopping after
+	 *    the first line terminator.
 	 */
 	
-    accum_size = 0;
-	
-	curr_granule = path->dir_entry.first_granule;
-	last_granule = curr_granule;
-	
-	while (path->FAT[curr_granule] < 0xC0)
-	{
-		last_granule = curr_granule;
-		curr_granule = path->FAT[curr_granule];
-		
-		accum_size += 4608 / 2;
-		
-        if (accum_size > path->filepos)
-        {
-            /* this is the granule! */
-            accum_size -= 4608 / 2;
-			curr_granule = last_granule;
-			
-            break;
-        }
-	}
-	
-	
-    /* 7. Start copying data into the user supplied buffer for 'bytes_left' bytes. */
-	
     bytes_left = *size;
 	
     while (bytes_left > 0)
     {
-		char *buf_ptr = buffer;
-		char granule_buffer[2304], *z;
+		char *granule_data = _decb_chain_granule(path, path->filepos / 2304);
+		char *z;
 		u_int read_size, offset_in_granule;
-		int bytes_in_last_granule = 2304;
 		
 		
-		_decb_gs_granule(path, curr_granule, granule_buffer);
-		
-		if (path->FAT[curr_granule] >= 0xC0)
+		if (granule_data == NULL)
 		{
-			bytes_in_last_granule = ((path->FAT[curr_granule] & 0x3F) * 256) + int2(path->dir_entry.last_sector_size);
-		}
-		else
-		{
-			curr_granule = path->FAT[curr_granule];
+			*size -= bytes_left;
+
+			return EOS_SE;
 		}
-		
-		
+
 		offset_in_granule = path->filepos % 2304;
 		
-		read_size = bytes_in_last_granule - offset_in_granule;
+		read_size = 2304 - offset_in_granule;
 		
 		if (read_size > bytes_left)
 		{
@@ -292,22 +221,18 @@ error_code _decb_readln(decb_path_id path, void *buffer, u_int *size)
 		}
 		
 		
-		memcpy(buffer, granule_buffer + offset_in_granule, read_size);
-
-		
-		/* 4. Look for line terminator in this fresh buffer. */
+		/* 1. Look for line terminator in this piece. */
 		
-        for (z = buf_ptr; z < buf_ptr + read_size; z++)
-        {
-            if (*z == 0x0D)
-            {
-                read_size = (int)(z - buf_ptr) + 1;
-				*size = read_size;
-                bytes_left = read_size;
-                break;
-            }
-        }
+		z = memchr(granule_data + offset_in_granule, 0x0D, read_size);
+
+		if (z != NULL)
+		{
+			read_size = (u_int)(z - (granule_data + offset_in_granule)) + 1;
+			*size -= bytes_left - read_size;
+			bytes_left = read_size;
+		}
 		
+		memcpy(buffer, granule_data + offset_in_granule, read_size);
 		
 		bytes_left -= read_size;
 		path->filepos += read_size;
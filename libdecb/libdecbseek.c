@@ -18,7 +18,22 @@ error_code _decb_seek(decb_path_id path, int pos, int mode)
 
 	if (path->israw == 1)
 	{
-		fseek(path->fd, pos, mode);
+		/* A raw path's position is in the image, which other paths share. */
+
+		switch(mode)
+		{
+			case SEEK_SET:
+				path->filepos = pos;
+				break;
+
+			case SEEK_CUR:
+				path->filepos = path->filepos + pos;
+				break;
+
+			case SEEK_END:
+				path->filepos = _image_size(path->image) + pos;
+				break;
+		}
 	}
 	else
 	{
@@ -78,6 +93,29 @@ error_code _decb_seekdir(decb_path_id path, int entry, int mode)
 
 
 error_code _decb_seeksector(decb_path_id path, int track, int sector)
+{
+	_image_seek(path->image, _decb_sector_offset(path, track, sector), SEEK_SET);
+
+	
+	return 0;
+}
+
+error_code _decb_seekgranule(decb_path_id path, int granule)
+{
+	_image_seek(path->image, _decb_granule_offset(path, granule), SEEK_SET);
+	
+	
+	return 0;
+}
+
+
+
+/*
+ * _decb_sector_offset()
+ *
+ * Return where a track and sector of the path's drive are in the image.
+ */
+long _decb_sector_offset(decb_path_id path, int track, int sector)
 {
 	long	offset;
 
@@ -91,15 +129,17 @@ error_code _decb_seeksector(decb_path_id path, int track, int sector)
 	offset += path->disk_offset;
 
 
-	/* 2. Seek to offset. */
+	return offset;
+}
 
-	fseek(path->fd, offset, SEEK_SET);
 
-	
-	return 0;
-}
 
-error_code _decb_seekgranule(decb_path_id path, int granule)
+/*
+ * _decb_granule_offset()
+ *
+ * Return where a granule of the path's drive starts in the image.
+ */
+long _decb_granule_offset(decb_path_id path, int granule)
 {
 	long	offset;
 	
@@ -122,11 +162,6 @@ error_code _decb_seekgranule(decb_path_id path, int granule)
 	
 	offset += path->disk_offset;
 	
-
-	/* 4. Seek to granule. */
-	
-	fseek(path->fd, offset, SEEK_SET);
 	
-	
-	return 0;
+	return offset;
 }
@@ -82,17 +82,14 @@ error_code _decb_ss_sector(decb_path_id path, int track, int sector, char *buffe
 	error_code ec = 0;
 
 
-	/* 1. Seek to the track and sector. */
+	/* 1. Write the buffer to the sector, leaving the image's position
+	 *    alone for the other paths on it.
+	 */
 	
-	_decb_seeksector(path, track, sector);
-
-
-	/* 2. Write the buffer to the sector. */
+	_image_write_at(path->image, _decb_sector_offset(path, track, sector), buffer, 256);
 	
-	fwrite(buffer, 1, 256, path->fd);
 	
-	
-	/* 3. Return status. */
+	/* 2. Return status. */
 	
 	return ec;
 }
@@ -102,14 +99,10 @@ error_code _decb_ss_sector(decb_path_id path, int track, int sector, char *buffe
 error_code _decb_ss_granule(decb_path_id path, int granule, char *buffer)
 {
 	error_code ec = 0;
+	long offset = _decb_granule_offset(path, granule);
 
 
-	/* 1. Seek to granule. */
-	
-	_decb_seekgranule(path, granule);
-
-
-	/* 2. Write buffer to granule. */
+	/* 1. Write buffer to granule. */
 	
 	if(path->hdbdos_offset)
 	{
@@ -117,14 +110,26 @@ error_code _decb_ss_granule(decb_path_id path, int granule, char *buffer)
 
 		for(count = 0; count < 2304; count += 256)
 		{
-			fwrite(&buffer[count], 1, 256, path->fd);
 			/* skip unused 1/2 of sector */
-			fseek(path->fd, 256, SEEK_CUR);
+			_image_write_at(path->image, offset + count * 2, &buffer[count], 256);
 		}
 	}
 	else
 	{
-		fwrite(buffer, 1, 2304, path->fd);
+		_image_write_at(path->image, offset, buffer, 2304);
+	}
+
+
+	/* 2. Keep the path's copy of the granule current. */
+
+	if (granule == path->cache_granule && buffer != path->granule_cache)
+	{
+		memcpy(path->granule_cache, buffer, 2304);
+	}
+
+	if (granule == path->cache_granule)
+	{
+		path->cache_dirty = 0;
 	}
 	
 
@@ -133,3 +138,56 @@ error_code _decb_ss_granule(decb_path_id path, int granule, char *buffer)
 	return ec;
 }
 
+
+
+/*
+ * _decb_ss_writeback()
+ *
+ * With 'enable' set, the path's writes leave the file's current
+ * granule, its directory entry and the FAT in memory until
+ * _decb_ss_sync or _decb_close.
+ */
+error_code _decb_ss_writeback(decb_path_id path, int enable)
+{
+	if (enable == 0)
+	{
+		_decb_ss_sync(path);
+	}
+
+	path->write_back = enable;
+
+
+	return 0;
+}
+
+
+
+/*
+ * _decb_ss_sync()
+ *
+ * Write out whatever a write-back path is holding: the cached granule,
+ * the directory entry and, if this path changed the FAT, the FAT
+ * sector.  A path that hasn't changed the FAT leaves it alone, as its
+ * copy is the drive's and other paths write their own changes.
+ */
+error_code _decb_ss_sync(decb_path_id path)
+{
+	if ((path->mode & FAM_WRITE) == 0)
+	{
+		return 0;
+	}
+
+	if (path->cache_dirty)
+	{
+		_decb_ss_granule(path, path->cache_granule, path->granule_cache);
+	}
+
+	if (path->dir_dirty)
+	{
+		_decb_seekdir(path, path->this_directory_entry_index, SEEK_SET);
+		_decb_writedir(path, &path->dir_entry);
+		path->dir_dirty = 0;
+	}
+
+	return _decb_fat_write(path);
+}
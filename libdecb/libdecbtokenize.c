@@ -79,8 +79,35 @@ const char* d_commands[128] = {"FOR", "GO", "REM", "'", "ELSE", "IF", "DATA", "P
 							  "VERIFY", "FROM", "FLREAD", "SWAP",  NULL };
 
 //size_t malloc_size(void *ptr);
-error_code append_zero( u_int *position, char **str, size_t *buffer_size );
-int tok_strcmp( const char *str1, char *str2 );
+
+/* The keywords are matched through a trie built from commands[] and
+   functions[] the first time a program is tokenized.  Each node is one
+   character of a keyword; 'token' is set on the node that ends one.
+   Node 0 is the root, so 0 also means "no node". */
+
+#define TRIE_SIZE	1024
+
+typedef struct
+{
+	unsigned char	character;
+	short			child;		/* first node that can follow this one */
+	short			sibling;	/* next node that can follow this one's parent */
+	int				token;		/* 0x80-0xFF command, 0xFF80-0xFFFF function, 0 none */
+} trie_node;
+
+static trie_node trie[TRIE_SIZE];
+static int trie_nodes = 0;
+
+/* Text of each token for de-tokenizing: commands, then functions */
+static const char *token_text[256];
+static u_char token_length[256];
+
+static int tables_built = 0;
+
+static void build_tables( void );
+static void trie_add( const char *keyword, int token );
+static int trie_match( unsigned char *in_buffer, int in_size, int *token );
+static u_int detoken_lines( unsigned char *in_buffer, u_int in_pos, char *out_buffer );
 
 /* _decb_detoken()
 
@@ -92,11 +119,8 @@ int tok_strcmp( const char *str1, char *str2 );
 
 error_code _decb_detoken(unsigned char *in_buffer, int in_size, char **out_buffer, u_int *out_size)
 {
-	u_int in_pos = 0, out_pos = 0;
-	int file_size, value, line_number;
-	unsigned char character;
-	error_code ec;
-	size_t	buffer_size;
+	u_int in_pos = 0, size;
+	int file_size;
 	
 	*out_size = 0;
 
@@ -114,8 +138,13 @@ error_code _decb_detoken(unsigned char *in_buffer, int in_size, char **out_buffe
 		}
 	}
 	
-	*out_buffer = malloc( BLOCK_QUANTUM );
-	buffer_size = BLOCK_QUANTUM;
+	if( tables_built == 0 )
+		build_tables();
+	
+	/* Measure the text first, so it can be written in one buffer */
+	size = detoken_lines( in_buffer, in_pos, NULL );
+	
+	*out_buffer = malloc( size + 1 );
 	
 	if( *out_buffer == NULL )
 	{
@@ -123,6 +152,31 @@ error_code _decb_detoken(unsigned char *in_buffer, int in_size, char **out_buffe
 		return EOS_OM;
 	}
 	
+	detoken_lines( in_buffer, in_pos, *out_buffer );
+	
+	(*out_buffer)[size] = 0x00;
+	
+	*out_size = size + 1;
+		
+	return 0;
+}
+
+/* detoken_lines()
+
+   De-token the lines of the program starting at in_pos into out_buffer,
+   or just count the characters if out_buffer is NULL.
+   
+   Returns the number of characters.
+*/
+
+static u_int detoken_lines( unsigned char *in_buffer, u_int in_pos, char *out_buffer )
+{
+	u_int out_pos = 0;
+	int value, line_number, length;
+	unsigned char character;
+	const char *text;
+	char number[16];
+	
 	/* Value will be where the next line starts in the CoCo's memory map */
 	value = in_buffer[in_pos++] << 8;
 	value += in_buffer[in_pos++];
@@ -133,8 +187,12 @@ error_code _decb_detoken(unsigned char *in_buffer, int in_size, char **out_buffe
 		line_number = in_buffer[in_pos++] << 8;
 		line_number += in_buffer[in_pos++];
 		
-		if ((ec = _decb_buffer_sprintf(&out_pos, out_buffer, &buffer_size, "%d ", line_number)) != 0)
-			return ec;
+		length = sprintf( number, "%d ", line_number );
+		
+		if( out_buffer != NULL )
+			memcpy( out_buffer + out_pos, number, length );
+		
+		out_pos += length;
 		
 		while( (character = in_buffer[in_pos++]) != 0 )
 		{
@@ -143,55 +201,47 @@ error_code _decb_detoken(unsigned char *in_buffer, int in_size, char **out_buffe
 				/* A Function call */
 				character = in_buffer[in_pos++];
 				
-				if( functions[character - 0x80] != NULL )
-				{
-					if ((ec = _decb_buffer_sprintf( &out_pos, out_buffer, &buffer_size, "%s", functions[character - 0x80])) != 0)
-						return ec;
-				}
-				else
-				{
-					if ((ec = _decb_buffer_sprintf( &out_pos, out_buffer, &buffer_size, "!" )) != 0 )
-						return ec;
-				}
+				text = token_text[character];
+				length = token_length[character];
 			}
 			else if( character >= 0x80 )
 			{
 				/* A Command call */
-				if( commands[character - 0x80] != NULL )
-				{
-					if ((ec = _decb_buffer_sprintf( &out_pos, out_buffer, &buffer_size, "%s", commands[character - 0x80])) != 0)
-						return ec;
-				}
-				else
-				{
-					if ((ec = _decb_buffer_sprintf( &out_pos, out_buffer, &buffer_size, "!" )) != 0)
-						return ec;
-				}
+				text = token_text[character - 0x80];
+				length = token_length[character - 0x80];
 			}
 			else if( character == ':' && (in_buffer[in_pos] == 0x83 || in_buffer[in_pos] == 0x84) )
 			{
 				/* When colon-apostrophe is encountered, the colon is dropped. */
 				/* When colon-ELSE is encountered, the colon is dropped. */
+				continue;
 			}
 			else
 			{
-				if ((ec = _decb_buffer_sprintf( &out_pos, out_buffer, &buffer_size, "%c", character)) != 0)
-					return ec;
+				if( out_buffer != NULL )
+					out_buffer[out_pos] = character;
+				
+				out_pos++;
+				
+				continue;
 			}
+			
+			if( out_buffer != NULL )
+				memcpy( out_buffer + out_pos, text, length );
+			
+			out_pos += length;
 		}
 		
 		value = in_buffer[in_pos++] << 8;
 		value += in_buffer[in_pos++];
 
-		if ((ec = _decb_buffer_sprintf( &out_pos, out_buffer, &buffer_size, "\n")) != 0)
-			return ec;
+		if( out_buffer != NULL )
+			out_buffer[out_pos] = '\n';
+		
+		out_pos++;
 	}
 	
-	append_zero( &out_pos, out_buffer, &buffer_size );
-	
-	*out_size = out_pos;
-		
-	return 0;
+	return out_pos;
 }
 
 /* _decb_entoken()
@@ -208,6 +258,9 @@ error_code _decb_entoken(unsigned char *in_buffer, int in_size, unsigned char **
 	
 	*out_size = 0;
 	
+	if( tables_built == 0 )
+		build_tables();
+	
 	/* The tokenized form of the BASIC program should be smaller than the untokenized form,
 	   but you never know. */
 	*out_buffer = malloc( in_size + 64 );
@@ -288,41 +341,28 @@ error_code _decb_entoken(unsigned char *in_buffer, int in_size, unsigned char **
 				}
 				else
 				{
-					/* Tokenize a command */
-					for( i=0; i<0x80; i++ )
-					{
-						if( tok_strcmp( commands[i], (char *)&(in_buffer[in_pos]) ) == 0 )
-						{
-							if( i==3 ) /* Preface ' with a colon */
-								(*out_buffer)[out_pos++] = ':';
-							
-							if( i==4 ) /* Preface ELSE with a colon */
-								(*out_buffer)[out_pos++] = ':';
-							
-							(*out_buffer)[out_pos++] = i + 0x80;
-							in_pos += strlen( commands[i] );
-							
-							if( i==6 ) data_literal = 1;
-							
-							if( i==2 || i==3 ) rem_literal = 1;
-							
-							break;
-						}
-					}
-
-					if( i == 0x80 )
+					/* Tokenize the longest command or function here */
+					int token, length = trie_match( &in_buffer[in_pos], in_size - in_pos, &token );
+					
+					if( length > 0 )
 					{
-						/* Tokenize a function*/
-						for( i=0; i<0x80; i++ )
-						{
-							if( tok_strcmp( functions[i], (char *)&(in_buffer[in_pos]) ) == 0 )
-							{
-								(*out_buffer)[out_pos++] = 0xff; /* Function marker */
-								(*out_buffer)[out_pos++] = i + 0x80;
-								in_pos += strlen( functions[i] );
-								break;
-							}
-						}
+						if( token == 0x83 ) /* Preface ' with a colon */
+							(*out_buffer)[out_pos++] = ':';
+						
+						if( token == 0x84 ) /* Preface ELSE with a colon */
+							(*out_buffer)[out_pos++] = ':';
+						
+						if( token > 0xff )
+							(*out_buffer)[out_pos++] = 0xff; /* Function marker */
+						
+						(*out_buffer)[out_pos++] = token & 0xff;
+						in_pos += length;
+						
+						if( token == 0x86 ) data_literal = 1;
+						
+						if( token == 0x82 || token == 0x83 ) rem_literal = 1;
+						
+						i = 0;
 					}
 				}
 			}
@@ -414,8 +454,11 @@ error_code _decb_detect_tokenized( unsigned char *in_buffer, u_int in_size )
 	return 0;
 }
 
-error_code append_zero( u_int *position, char **str, size_t *buffer_size )
+/* This sprintf will use realloc to make the buffer larger if needed */
+error_code _decb_buffer_sprintf(u_int *position, char **str, size_t *buffer_size, const char *format, ...)
 {
+	va_list	ap;
+
 	if( *position > ((*buffer_size) - 20) )
 	{
 		char *buffer;
@@ -436,65 +479,96 @@ error_code append_zero( u_int *position, char **str, size_t *buffer_size )
 		}
 	}
 
-	*((*str)+*position) = 0x00;
-	(*position) += 1;
+	va_start(ap, format);
+	*position += vsprintf( (*str)+*position, format, ap );
+	va_end(ap);
 	
 	return 0;
 }
 
-/* This sprintf will use realloc to make the buffer larger if needed */
-error_code _decb_buffer_sprintf(u_int *position, char **str, size_t *buffer_size, const char *format, ...)
+/* Build the keyword trie and the de-tokenizing tables */
+static void build_tables( void )
 {
-	va_list	ap;
+	int i;
+	
+	/* Commands go in first, so a command wins over a function spelled the same */
+	for( i = 0; i < 0x80; i++ )
+		trie_add( commands[i], 0x80 + i );
+	
+	for( i = 0; i < 0x80; i++ )
+		trie_add( functions[i], 0xff80 + i );
+	
+	/* Unknown tokens de-tokenize as '!' */
+	for( i = 0; i < 0x80; i++ )
+	{
+		token_text[i] = commands[i] != NULL ? commands[i] : "!";
+		token_text[0x80 + i] = functions[i] != NULL ? functions[i] : "!";
+	}
+	
+	for( i = 0; i < 256; i++ )
+		token_length[i] = strlen( token_text[i] );
+	
+	tables_built = 1;
+}
 
-	if( *position > ((*buffer_size) - 20) )
+static void trie_add( const char *keyword, int token )
+{
+	int node = 0, next;
+	
+	if( keyword == NULL || keyword[0] == '\0' )
+		return;
+	
+	for( ; *keyword != '\0'; keyword++ )
 	{
-		char *buffer;
-		
-		buffer = realloc( *str, (*buffer_size) + BLOCK_QUANTUM );
-		
-		if( buffer == NULL )
+		for( next = trie[node].child; next != 0; next = trie[next].sibling )
 		{
-			/* error */
-			return EOS_OM;
+			if( trie[next].character == (unsigned char)*keyword )
+				break;
 		}
 		
-		*buffer_size = *buffer_size + BLOCK_QUANTUM;
-		
-		if( *str != buffer )
+		if( next == 0 )
 		{
-			*str = buffer;
+			if( trie_nodes + 1 >= TRIE_SIZE )
+				return;
+			
+			next = ++trie_nodes;
+			trie[next].character = *keyword;
+			trie[next].sibling = trie[node].child;
+			trie[node].child = next;
 		}
+		
+		node = next;
 	}
-
-	va_start(ap, format);
-	*position += vsprintf( (*str)+*position, format, ap );
-	va_end(ap);
 	
-	return 0;
+	if( trie[node].token == 0 )
+		trie[node].token = token;
 }
 
-int tok_strcmp( const char *str1, char *str2 )
+/* Returns the length of the longest keyword at the start of in_buffer,
+   and its token, or 0 if none is there. */
+static int trie_match( unsigned char *in_buffer, int in_size, int *token )
 {
-	/* Compares a NULL terminated string in str1 to a buffer in str2
-	   Returns 0 if str1 is at the start of str2
-	   Returnes -1 is str1 is not at the start of str2 */
-	   
-	int i=0;
-	
-	if( str1 == NULL )
-		return -1;
-		
-	if( str1[i] == 0x00 )
-		return -1;
+	int node = 0, next, i, length = 0;
 	
-	while( str1[i] != '\0' )
+	for( i = 0; i < in_size; i++ )
 	{
-		if( str1[i] != str2[i] )
-			return -1;
+		for( next = trie[node].child; next != 0; next = trie[next].sibling )
+		{
+			if( trie[next].character == in_buffer[i] )
+				break;
+		}
+		
+		if( next == 0 )
+			break;
+		
+		node = next;
 		
-		i++;
+		if( trie[node].token != 0 )
+		{
+			*token = trie[node].token;
+			length = i + 1;
+		}
 	}
 	
-	return 0;
+	return length;
 }
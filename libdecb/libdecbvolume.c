@@ -0,0 +1,633 @@
+/********************************************************************
+ * volume.c - Disk BASIC multi-drive image routines
+ *
+ * An HDB-DOS image holds many Disk BASIC drives end to end.  A volume
+ * opens such an image once and reads each drive's FAT, directory and
+ * disk name the first time it is asked for, keeping them as a view of
+ * that drive.  Volumes are reference counted, so every user of an
+ * image in one process shares it; every path open on a drive works
+ * from the drive's view of the FAT, so a granule taken or given back
+ * through one path is seen at once by the others.
+ *
+ * Each drive can be locked on its own, so that processes working on
+ * different drives of one image don't wait on each other.  A path open
+ * for writing holds its drive's lock exclusively until it is closed,
+ * and scans hold it shared.  The locks are fcntl() record locks over
+ * the drive's bytes, counted within the process; as with any such
+ * lock, closing another handle on the same image file in the same
+ * process drops them.  Once a drive's lock is taken its view is read
+ * again, as another process may have changed the drive meanwhile, and
+ * it is read again when the last exclusive holder lets go, as paths
+ * write the directory around the view.
+ *
+ * _decb_volume_scan runs a function over every drive, handing the
+ * drives out to worker processes that share the volume opened here.
+ *
+ * $Id$
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <errno.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "cocotypes.h"
+#include "decbpath.h"
+#include "cococonv.h"
+#include "util.h"
+
+
+static decb_volume_id volume_list = NULL;
+
+static decb_volume_id scan_volume;
+static int (*scan_func)(decb_volume_id, int, void *);
+static void *scan_arg;
+
+static decb_volume_id find_volume(char *imgfile, struct stat *statbuf, long hdbdos_offset);
+static long drive_offset(decb_volume_id vol, int drive);
+static error_code find_drive(decb_volume_id vol, int drive, decb_drive **view);
+static error_code load_drive(decb_volume_id vol, int drive, decb_drive *d);
+static int scan_drives(int argc, char **argv);
+
+
+
+/*
+ * _decb_volume_acquire()
+ *
+ * Return the volume for an image file, opening it if it isn't open
+ * already.  If 'mode' asks for write access and the volume was opened
+ * read-only, the image is reopened for update.
+ */
+error_code _decb_volume_acquire(decb_volume_id *volume, char *imgfile, long hdbdos_offset, int mode)
+{
+	struct stat statbuf;
+	decb_volume_id vol;
+	long size;
+
+
+	/* 1. Is the image already open, under this name or another? */
+
+	if (stat(imgfile, &statbuf) != 0)
+	{
+		return EOS_BPNAM;
+	}
+
+	vol = find_volume(imgfile, &statbuf, hdbdos_offset);
+
+	if (vol != NULL)
+	{
+		if ((mode & FAM_WRITE) && vol->writable == 0)
+		{
+			if (_image_reopen(vol->image, vol->imgfile, 1) != 0)
+			{
+				return UnixToCoCoError(errno);
+			}
+
+			vol->writable = 1;
+		}
+
+		vol->refcount++;
+		*volume = vol;
+
+		return 0;
+	}
+
+
+	/* 2. Allocate a new volume and open the image. */
+
+	vol = malloc(sizeof(struct _decb_volume_id));
+
+	if (vol == NULL)
+	{
+		return EOS_OM;
+	}
+
+	memset(vol, 0, sizeof(*vol));
+
+	strncpy(vol->imgfile, imgfile, sizeof(vol->imgfile) - 1);
+	vol->st_dev = statbuf.st_dev;
+	vol->st_ino = statbuf.st_ino;
+	vol->hdbdos_offset = hdbdos_offset;
+	vol->writable = (mode & FAM_WRITE) ? 1 : 0;
+
+	vol->image = _image_open(imgfile, vol->writable, IMAGE_AUTO);
+
+	if (vol->image == NULL)
+	{
+		free(vol);
+
+		return EOS_BPNAM;
+	}
+
+
+	/* 3. An image that is a whole number of drives is an HDB-DOS
+	 *    image; anything else is a single disk of its own size.
+	 */
+
+	size = _image_size(vol->image) - hdbdos_offset;
+
+	if (size >= DECB_DRIVE_SIZE && size % DECB_DRIVE_SIZE == 0)
+	{
+		vol->drives = size / DECB_DRIVE_SIZE;
+	}
+	else
+	{
+		vol->drives = 1;
+	}
+
+	if (vol->drives == 1)
+	{
+		/* Two granules a track, less track 17; dskini stops an 80 track
+		 * disk's FAT at 156.
+		 */
+
+		vol->disk_granules = (size / 4608 - 1) * 2;
+
+		if (vol->disk_granules > 156)
+		{
+			vol->disk_granules = 156;
+		}
+	}
+
+
+	/* 4. Add it to the list of open volumes. */
+
+	vol->refcount = 1;
+	vol->next = volume_list;
+	volume_list = vol;
+
+	*volume = vol;
+
+
+	return 0;
+}
+
+
+
+/*
+ * _decb_volume_pathlist()
+ *
+ * Acquire the volume named by a pathlist such as "foo", "foo,",
+ * "foo,:3", "foo:3" or "foo,:0+12345", returning the drive it names,
+ * or -1 if it names none.
+ */
+error_code _decb_volume_pathlist(decb_volume_id *volume, char *pathlist, int mode, int *drive)
+{
+	char imgfile[512], *p;
+	long hdbdos_offset = 0;
+	size_t length;
+
+
+	/* 1. The image name runs up to the first ',' or ':'. */
+
+	length = strcspn(pathlist, ",:");
+
+	if (length == 0 || length >= sizeof(imgfile))
+	{
+		return EOS_BPNAM;
+	}
+
+	memcpy(imgfile, pathlist, length);
+	imgfile[length] = '\0';
+
+
+	/* 2. Pick out the drive and offset. */
+
+	*drive = -1;
+
+	if ((p = strchr(pathlist + length, ':')) != NULL)
+	{
+		*drive = atoi(p + 1);
+
+		if ((p = strchr(p, '+')) != NULL)
+		{
+			if (strncmp(p + 1, "0x", 2) == 0 || strncmp(p + 1, "0X", 2) == 0)
+				hdbdos_offset = strtol(p + 3, (char **) NULL, 16) * 256;
+			else
+				hdbdos_offset = atoi(p + 1) * 256;
+		}
+	}
+
+
+	return _decb_volume_acquire(volume, imgfile, hdbdos_offset, mode);
+}
+
+
+
+/*
+ * _decb_volume_release()
+ *
+ * Drop a reference to a volume, closing it when the last one goes.
+ * Returns EOS_WRITE if the image could not be written out.
+ */
+error_code _decb_volume_release(decb_volume_id vol)
+{
+	decb_volume_id *p;
+	error_code ec;
+	int i;
+
+
+	if (--vol->refcount > 0)
+	{
+		return 0;
+	}
+
+	for (p = &volume_list; *p != NULL; p = &(*p)->next)
+	{
+		if (*p == vol)
+		{
+			*p = vol->next;
+			break;
+		}
+	}
+
+	ec = _image_close(vol->image) != 0 ? EOS_WRITE : 0;
+
+	for (i = 0; i < vol->views; i++)
+	{
+		free(vol->drive[i]);
+	}
+
+	free(vol->drive);
+	free(vol);
+
+
+	return ec;
+}
+
+
+
+/*
+ * _decb_volume_drive()
+ *
+ * Return the view of a drive, reading it from the image if need be.
+ * Any drive may be named, not only those the image's size suggests,
+ * as a path on a drive past the last is allowed to look.
+ */
+error_code _decb_volume_drive(decb_volume_id vol, int drive, decb_drive **view)
+{
+	decb_drive *d;
+	error_code ec;
+
+
+	/* 1. Find or make the drive's view. */
+
+	if ((ec = find_drive(vol, drive, &d)) != 0)
+	{
+		return ec;
+	}
+
+
+	/* 2. Read it in. */
+
+	if (d->loaded == 0 && (ec = load_drive(vol, drive, d)) != 0)
+	{
+		return ec;
+	}
+
+	*view = d;
+
+
+	return 0;
+}
+
+
+
+/*
+ * _decb_volume_forget()
+ *
+ * Read a drive's view again after the drive may have been written
+ * some other way.  A FAT holding changes not yet written is kept.
+ */
+void _decb_volume_forget(decb_volume_id vol, int drive)
+{
+	if (drive >= 0 && drive < vol->views && vol->drive[drive] != NULL && vol->drive[drive]->loaded)
+	{
+		load_drive(vol, drive, vol->drive[drive]);
+	}
+}
+
+
+
+/*
+ * _decb_volume_lock()
+ *
+ * Lock one drive of the image, shared or exclusive, waiting for any
+ * other process that holds it.  Locks taken in one process nest; an
+ * exclusive request turns a shared lock exclusive.
+ */
+error_code _decb_volume_lock(decb_volume_id vol, int drive, int exclusive)
+{
+	decb_drive *d;
+	error_code ec;
+
+
+	/* 1. Already held closely enough? */
+
+	if ((ec = find_drive(vol, drive, &d)) != 0)
+	{
+		return ec;
+	}
+
+	if (d->locks > 0 && (d->lock_exclusive || !exclusive))
+	{
+		d->locks++;
+
+		return 0;
+	}
+
+
+	/* 2. Ask for it. */
+
+#ifndef WIN32
+	{
+		struct flock lock;
+
+
+		memset(&lock, 0, sizeof(lock));
+
+		lock.l_type = exclusive ? F_WRLCK : F_RDLCK;
+		lock.l_whence = SEEK_SET;
+		lock.l_start = drive_offset(vol, drive);
+		lock.l_len = DECB_DRIVE_SIZE;
+
+		if (fcntl(_image_fileno(vol->image), F_SETLKW, &lock) != 0)
+		{
+			return UnixToCoCoError(errno);
+		}
+	}
+#endif
+
+
+	/* 3. The drive may have changed while we didn't hold it. */
+
+	if (d->locks++ == 0)
+	{
+		_decb_volume_forget(vol, drive);
+	}
+
+	d->lock_exclusive |= exclusive;
+
+
+	return 0;
+}
+
+
+
+error_code _decb_volume_unlock(decb_volume_id vol, int drive)
+{
+	decb_drive *d;
+	error_code ec;
+
+
+	if ((ec = find_drive(vol, drive, &d)) != 0 || d->locks == 0)
+	{
+		return ec;
+	}
+
+	if (--d->locks > 0)
+	{
+		return 0;
+	}
+
+
+	/* 1. Paths have written the directory past the view. */
+
+	if (d->lock_exclusive)
+	{
+		_decb_volume_forget(vol, drive);
+
+		d->lock_exclusive = 0;
+	}
+
+
+	/* 2. Let it go. */
+
+#ifndef WIN32
+	{
+		struct flock lock;
+
+
+		memset(&lock, 0, sizeof(lock));
+
+		lock.l_type = F_UNLCK;
+		lock.l_whence = SEEK_SET;
+		lock.l_start = drive_offset(vol, drive);
+		lock.l_len = DECB_DRIVE_SIZE;
+
+		if (fcntl(_image_fileno(vol->image), F_SETLK, &lock) != 0)
+		{
+			return UnixToCoCoError(errno);
+		}
+	}
+#endif
+
+
+	return 0;
+}
+
+
+
+/*
+ * _decb_volume_scan()
+ *
+ * Call 'func' on every drive of a volume, holding a shared lock on the
+ * drive for the call.  Up to 'jobs' drives are done at once, each by a
+ * worker process working from this process's open image; output comes
+ * out in drive order.  A drive that can't be locked is skipped.  Returns
+ * the first non-zero result or lock error.
+ */
+int _decb_volume_scan(decb_volume_id vol, int (*func)(decb_volume_id, int, void *), void *arg, int jobs)
+{
+	char **argv, *numbers;
+	int i, ec;
+
+
+	/* 1. Name each drive as an argument, for run_jobs to hand out. */
+
+	argv = malloc((vol->drives + 2) * sizeof(char *));
+	numbers = malloc(vol->drives * 8);
+
+	if (argv == NULL || numbers == NULL)
+	{
+		free(argv);
+		free(numbers);
+
+		return EOS_OM;
+	}
+
+	argv[0] = "scan";
+
+	for (i = 0; i < vol->drives; i++)
+	{
+		argv[i + 1] = numbers + i * 8;
+		sprintf(argv[i + 1], "%d", i);
+	}
+
+	argv[vol->drives + 1] = NULL;
+
+
+	/* 2. Run them. */
+
+	scan_volume = vol;
+	scan_func = func;
+	scan_arg = arg;
+
+	ec = run_jobs(scan_drives, vol->drives + 1, argv, jobs);
+
+	free(argv);
+	free(numbers);
+
+
+	return ec;
+}
+
+
+
+/* Find an open volume on the same file and drive offset */
+
+static decb_volume_id find_volume(char *imgfile, struct stat *statbuf, long hdbdos_offset)
+{
+	decb_volume_id vol;
+
+
+	for (vol = volume_list; vol != NULL; vol = vol->next)
+	{
+		if (vol->hdbdos_offset != hdbdos_offset)
+		{
+			continue;
+		}
+
+		if (statbuf->st_ino != 0)
+		{
+			if (vol->st_dev == statbuf->st_dev && vol->st_ino == statbuf->st_ino)
+			{
+				return vol;
+			}
+		}
+		else if (strcmp(vol->imgfile, imgfile) == 0)
+		{
+			return vol;
+		}
+	}
+
+
+	return NULL;
+}
+
+
+
+/* Where a drive starts in the image */
+
+static long drive_offset(decb_volume_id vol, int drive)
+{
+	return vol->hdbdos_offset + (long)drive * DECB_DRIVE_SIZE;
+}
+
+
+
+/* Find a drive's view, making an empty one if there is none yet */
+
+static error_code find_drive(decb_volume_id vol, int drive, decb_drive **view)
+{
+	decb_drive *d;
+
+
+	if (drive < 0)
+	{
+		return EOS_BPNAM;
+	}
+
+	if (drive >= vol->views)
+	{
+		decb_drive **p = realloc(vol->drive, (drive + 1) * sizeof(decb_drive *));
+
+		if (p == NULL)
+		{
+			return EOS_OM;
+		}
+
+		memset(p + vol->views, 0, (drive + 1 - vol->views) * sizeof(decb_drive *));
+
+		vol->drive = p;
+		vol->views = drive + 1;
+	}
+
+	if ((d = vol->drive[drive]) == NULL)
+	{
+		if ((d = calloc(1, sizeof(decb_drive))) == NULL)
+		{
+			return EOS_OM;
+		}
+
+		d->granules = vol->drives == 1 && drive == 0 ? vol->disk_granules : 68;
+
+		vol->drive[drive] = d;
+	}
+
+	*view = d;
+
+
+	return 0;
+}
+
+
+
+/* Read a drive's FAT, directory and name, all of which are on track 17 */
+
+static error_code load_drive(decb_volume_id vol, int drive, decb_drive *d)
+{
+	long offset = drive_offset(vol, drive) + 17 * 18 * 256;
+
+
+	if ((d->fat_dirty == 0 && _image_read_at(vol->image, offset + 1 * 256, d->FAT, 256) != 256) ||
+		_image_read_at(vol->image, offset + 2 * 256, d->dir, sizeof(d->dir)) != sizeof(d->dir) ||
+		_image_read_at(vol->image, offset + 16 * 256, d->name, 256) != 256)
+	{
+		d->loaded = 0;
+
+		return EOS_SE;
+	}
+
+	d->free_map_loaded = d->free_map_loaded && d->fat_dirty;
+	d->loaded = 1;
+
+
+	return 0;
+}
+
+
+
+/* Do the drives named in 'argv'; run once per worker by run_jobs */
+
+static int scan_drives(int argc, char **argv)
+{
+	int i, drive, ec = 0, ec2;
+
+
+	for (i = 1; i < argc; i++)
+	{
+		drive = atoi(argv[i]);
+
+		/* A drive we can't lock is skipped, its error kept. */
+
+		if ((ec2 = _decb_volume_lock(scan_volume, drive, 0)) == 0)
+		{
+			ec2 = scan_func(scan_volume, drive, scan_arg);
+
+			_decb_volume_unlock(scan_volume, drive);
+		}
+
+		if (ec == 0)
+		{
+			ec = ec2;
+		}
+	}
+
+
+	return ec;
+}
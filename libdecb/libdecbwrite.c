@@ -12,13 +12,13 @@
 
 static error_code _raw_write(decb_path_id path, void *buffer, u_int *size);
 static error_code extend_fat_chain(decb_path_id path, int current_size, int new_size);
-error_code find_free_granule(decb_path_id path, int *granule, int next_to);
+static error_code restart_chain(decb_path_id path, int count);
 
 
 error_code _decb_write(decb_path_id path, void *buffer, u_int *size)
 {
     error_code	ec = EOS_WRITE;
-	u_int current_size = 0, accum_size = 0, curr_granule, bytes_left;
+	u_int current_size = 0, bytes_left;
 		
 
 	/* 1. Check the mode. */
@@ -35,7 +35,7 @@ error_code _decb_write(decb_path_id path, void *buffer, u_int *size)
 	
     if (path->israw == 1)
     {
-        ec = _raw_write(path, buffer, size);
+        return _raw_write(path, buffer, size);
     }
 
 
@@ -72,52 +72,26 @@ error_code _decb_write(decb_path_id path, void *buffer, u_int *size)
 	}
 	
 
-	/* 6. Determine which granule the offset is in. */
-
-	accum_size = 0;
-	
-	curr_granule = path->dir_entry.first_granule;
-		
-	while (path->FAT[curr_granule] < 0xC0)
-	{
-		accum_size += 2304;
-		
-		if (accum_size > path->filepos)
-		{
-			/* 1. This is the granule we begin at. */
-
-			accum_size -= 2304;
-			
-			break;
-		}
-
-		curr_granule = path->FAT[curr_granule];
-	}
-	
-	
-	/* 7. Copy user supplied data into the file for 'bytes_left' bytes. */
-
-	bytes_left = (path->filepos + *size) - current_size;
+	/* 6. Copy user supplied data into the file for 'bytes_left' bytes,
+	 *    one granule at a time.
+	 */
 
+	bytes_left = *size;
 
     while (bytes_left > 0)
     {
-		char granule_buffer[2304];
+		char *granule_data = _decb_chain_granule(path, path->filepos / 2304);
 		u_int write_size, offset_in_granule;
-		int bytes_in_last_granule = 2304;
 		
 
-		_decb_gs_granule(path, curr_granule, granule_buffer);
-		
-		if (path->FAT[curr_granule] >= 0xC0)
+		if (granule_data == NULL)
 		{
-			bytes_in_last_granule = (((path->FAT[curr_granule] & 0x3F) - 1) * 256) + int2(path->dir_entry.last_sector_size);
+			return EOS_SE;
 		}
-		
-		
+
 		offset_in_granule = path->filepos % 2304;
 		
-		write_size = bytes_in_last_granule - offset_in_granule;
+		write_size = 2304 - offset_in_granule;
 		
 		if (write_size > bytes_left)
 		{
@@ -125,25 +99,40 @@ error_code _decb_write(decb_path_id path, void *buffer, u_int *size)
 		}
 		
 		
-		memcpy(granule_buffer + offset_in_granule, buffer, write_size);
-		_decb_ss_granule(path, curr_granule, granule_buffer);
+		memcpy(granule_data + offset_in_granule, buffer, write_size);
+
+		if (path->write_back)
+		{
+			path->cache_dirty = 1;
+		}
+		else
+		{
+			_decb_ss_granule(path, path->chain[path->filepos / 2304], granule_data);
+		}
 
 		
 		bytes_left -= write_size;
 		path->filepos += write_size;
 		buffer += write_size;
-		
-		/* Point to next granule for next pass. */
-		
-		curr_granule = path->FAT[curr_granule];
 	}
+
+	ec = 0;
 	
 	
-	/* 9. Write updated file descriptor back to image file. */
+	/* 9. Write updated file descriptor back to image file, or leave it
+	 *    for _decb_ss_sync if the path writes back.
+	 */
 
-	_decb_seekdir(path, path->this_directory_entry_index, SEEK_SET);
+	if (path->write_back)
+	{
+		path->dir_dirty = 1;
+	}
+	else
+	{
+		_decb_seekdir(path, path->this_directory_entry_index, SEEK_SET);
 
-	_decb_writedir(path, &path->dir_entry);
+		_decb_writedir(path, &path->dir_entry);
+	}
 	
 	
     return ec;
@@ -157,8 +146,9 @@ static error_code _raw_write(decb_path_id path, void *buffer, u_int *size)
     size_t ret_size;
 
 
-    ret_size = fwrite(buffer, 1, *size, path->fd);
+    ret_size = _image_write_at(path->image, path->filepos, buffer, *size);
     *size = ret_size;
+    path->filepos += ret_size;
 
 
     return ec;
@@ -212,78 +202,80 @@ error_code _decb_writedir(decb_path_id path, decb_dir_entry *dirent)
 
 
 
+/*
+ * extend_fat_chain: grow a file's FAT chain to hold 'new_size' bytes.
+ *
+ * The granules it needs are reserved in one call, right after the
+ * file's last granule, and appended to the path's chain.  An empty file
+ * is placed afresh, so that its first run is sized by what is written.
+ */
+
 static error_code extend_fat_chain(decb_path_id path, int current_size, int new_size)
 {
-	int curr_granule = path->dir_entry.first_granule;
-	int max_size_with_curr_granules_allocated = 0;
-	unsigned char tmp_FAT[256];
-	
+	error_code ec;
+	u_char granules[DECB_MAX_GRANULES];
+	int last_granule, needed, expand_size, i;
 	
-	/* 1. Save a copy in case we run out of disk space. */
 	
-	memcpy(tmp_FAT, path->FAT, 256);
+	/* 1. Find the file's last granule. */
 	
-	
-	/* 1. Compute maximum size of file with current granules allocated. */
-	
-	while (path->FAT[curr_granule] < 0xC0)
-	{
-		curr_granule = path->FAT[curr_granule];
+	ec = _decb_chain_load(path);
 
-		max_size_with_curr_granules_allocated += 2304;
+	if (ec != 0)
+	{
+		return ec;
 	}
-	
-	max_size_with_curr_granules_allocated += 2304;
+
+	last_granule = path->chain[path->chain_length - 1];
 
 	
-	if (new_size > max_size_with_curr_granules_allocated)
+	/* 2. Reserve and link whatever granules the new size needs. */
+	
+	needed = (new_size + 2303) / 2304 - path->chain_length;
+
+	if (needed > 0 && current_size == 0 && path->chain_length == 1)
 	{
-		int new_granule;
+		ec = restart_chain(path, needed + 1);
 
-		
-		do
+		if (ec != 0)
 		{
-			/* 1. We're gonna have to find a free granule. */
-	
-			if (find_free_granule(path, &new_granule, curr_granule) != 0)
-			{
-				/* 1. Could not find any free granules. */
-		
-				memcpy(path->FAT, tmp_FAT, 256);
-
-				return EOS_DF;
-			}
-		
-			path->FAT[curr_granule] = new_granule;
-			curr_granule = new_granule;
-			path->FAT[curr_granule] = 0xC0;
-			max_size_with_curr_granules_allocated += 2304;
+			return ec;
 		}
-		while (new_size > max_size_with_curr_granules_allocated);
-		
-	}
 
+		last_granule = path->chain[path->chain_length - 1];
+	}
+	else if (needed > 0)
 	{
-		/* 1. The new size will fit in the currently allocated granules,
-		 *    so we'll just extend the last granule entry.
-		 */
+		ec = _decb_fat_allocate(path, needed, last_granule, granules);
 
-		int expand_size = new_size - (max_size_with_curr_granules_allocated - 2304);
-		
-		
-		/* 2. Reset the last granule's sector size. */
-	
-		if (expand_size % 256 == 0)
+		if (ec != 0)
 		{
-			path->FAT[curr_granule] = 0xC0 + (expand_size / 256);
-			_int2(256, path->dir_entry.last_sector_size);
+			return ec;
 		}
-		else
+
+		for (i = 0; i < needed; i++)
 		{
-			path->FAT[curr_granule] = 0xC1 + (expand_size / 256);
-			_int2(expand_size % 256, path->dir_entry.last_sector_size);
+			_decb_fat_set(path, last_granule, granules[i]);
+			last_granule = granules[i];
+			path->chain[path->chain_length++] = last_granule;
 		}
 	}
+
+
+	/* 3. Reset the last granule's sector count. */
+
+	expand_size = new_size - (path->chain_length - 1) * 2304;
+	
+	if (expand_size % 256 == 0)
+	{
+		_decb_fat_set(path, last_granule, 0xC0 + (expand_size / 256));
+		_int2(256, path->dir_entry.last_sector_size);
+	}
+	else
+	{
+		_decb_fat_set(path, last_granule, 0xC1 + (expand_size / 256));
+		_int2(expand_size % 256, path->dir_entry.last_sector_size);
+	}
 	
 	
 	return 0;
@@ -292,69 +284,55 @@ static error_code extend_fat_chain(decb_path_id path, int current_size, int new_
 
 
 /*
- * find_free_granule: find a free granule.
- *
- * The 'next_to' parameter lets this function attempt to find a granule
- * either ahead of or behind the next_to.
+ * restart_chain: give back the lone granule _decb_create reserved for an
+ * empty file and take 'count' granules for it in one go, from where
+ * _decb_create starts looking.
  */
 
-error_code find_free_granule(decb_path_id path, int *granule, int next_to)
+static error_code restart_chain(decb_path_id path, int count)
 {
-	int		t_next_to = next_to + 1;
-	
-	
-	*granule = 0;
-	
-	/* 1. Validate next_to. */
-	
-	if (t_next_to > 255)
-	{
-		return EOS_DF;
-	}
+	u_char granules[DECB_MAX_GRANULES];
+	int first = path->dir_entry.first_granule, i;
 
 
-	/* 2. Start search from next_to to last_granule. */
-	
-	while (path->FAT[t_next_to] != 0x00)
+	/* 1. Trade the old granule for the new run. */
+
+	_decb_fat_release(path, first);
+
+	if (_decb_fat_allocate(path, count, 34, granules) != 0)
 	{
-		if (path->FAT[t_next_to] == 0xFF)
-		{
-			/* 1. Found one!  Return it. */
-			
-			*granule = t_next_to;
-			
-			return 0;
-		}
-		
-		t_next_to++;
+		/* 1. No room; take the old granule back, which being free is
+		 *    the first one found after the granule before it.
+		 */
+
+		_decb_fat_allocate(path, 1, first - 1, granules);
+		_decb_fat_set(path, first, 0xC1);
+
+		return EOS_DF;
 	}
 
 
-	/* 3. Now try searching from t_nexto - 1 to 0. */
+	/* 2. Link it and make it the path's chain. */
 
-	if (next_to > 0)
-	{
-		t_next_to = next_to - 1;
-		
+	path->dir_entry.first_granule = granules[0];
+	path->chain_length = 0;
 
-		while (t_next_to >= 0)
+	for (i = 0; i < count; i++)
+	{
+		if (i > 0)
 		{
-			if (path->FAT[t_next_to] == 0xFF)
-			{
-				/* 1. Found one!  Return it. */
-			
-				*granule = t_next_to;
-			
-				return 0;
-			}
-		
-			t_next_to--;
+			_decb_fat_set(path, granules[i - 1], granules[i]);
 		}
-	}
 
-	
-	return EOS_DF;
-}
+		path->chain[path->chain_length++] = granules[i];
+	}
 
+	if (path->cache_granule == first)
+	{
+		path->cache_granule = -1;
+		path->cache_dirty = 0;
+	}
 
 
+	return 0;
+}
@@ -262,6 +262,7 @@ error_code UnixToCoCoError(int ec)
             return(EOS_PNNF);
 
         case EBADF:
+        case ENODEV:
             return(EOS_BMODE);
 
         case EEXIST:
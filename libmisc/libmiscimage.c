@@ -0,0 +1,607 @@
+/********************************************************************
+ * image.c - Disk image I/O routines
+ *
+ * librbf and libdecb do all of their image I/O through these calls.
+ * Regular files are mapped into memory, so that reading or writing a
+ * sector is a memcpy; pipes, devices and other files that can't be
+ * mapped go through stdio as before.  The calls follow stdio's
+ * semantics: reads past the end of the image come up short, writes
+ * past it extend the image, and writes to an image opened read-only
+ * are dropped.
+ *
+ * _image_read_at and _image_write_at never use or move the file
+ * position, so several threads may call them on one image at once.
+ *
+ * Setting TOOLSHED_IMAGE to "stdio" or "mmap" in the environment makes
+ * images opened with IMAGE_AUTO use that backend only.
+ *
+ * $Id$
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "cocoimage.h"
+
+
+#ifndef WIN32
+static int map_image(coco_image image, char *filename, int writable);
+static long map_length(long size, int writable);
+static int grow_image(coco_image image, long size);
+static int unmap_image(coco_image image);
+#endif
+
+
+
+/*
+ * _image_open()
+ *
+ * Open an image file for reading, or for update if 'writable' is set.
+ */
+coco_image _image_open(char *filename, int writable, int backend)
+{
+	coco_image image;
+	char *choice;
+
+
+	/* 1. Let the environment pick the backend, then allocate the image. */
+
+	if (backend == IMAGE_AUTO && (choice = getenv("TOOLSHED_IMAGE")) != NULL)
+	{
+		if (strcmp(choice, "stdio") == 0)
+		{
+			backend = IMAGE_STDIO;
+		}
+		else if (strcmp(choice, "mmap") == 0)
+		{
+			backend = IMAGE_MMAP;
+		}
+	}
+
+	image = malloc(sizeof(struct _coco_image));
+
+	if (image == NULL)
+	{
+		return NULL;
+	}
+
+	memset(image, 0, sizeof(*image));
+
+	image->fd = -1;
+	image->writable = writable;
+
+
+	/* 2. Map the image if we can. */
+
+#ifndef WIN32
+	if (backend != IMAGE_STDIO && map_image(image, filename, writable) == 0)
+	{
+		return image;
+	}
+
+	if (backend == IMAGE_MMAP)
+	{
+		free(image);
+
+		return NULL;
+	}
+#endif
+
+
+	/* 3. Otherwise fall back to stdio. */
+
+	image->fp = fopen(filename, writable ? "rb+" : "rb");
+
+	if (image->fp == NULL)
+	{
+		free(image);
+
+		return NULL;
+	}
+
+
+	return image;
+}
+
+
+
+/*
+ * _image_reopen()
+ *
+ * Reopen an image with different access, keeping the file position.
+ */
+int _image_reopen(coco_image image, char *filename, int writable)
+{
+#ifndef WIN32
+	if (image->map != NULL)
+	{
+		struct _coco_image copy = *image;
+
+		if (map_image(image, filename, writable) != 0)
+		{
+			*image = copy;
+
+			return -1;
+		}
+
+		munmap(copy.map, copy.map_size);
+		close(copy.fd);
+
+		image->pos = copy.pos;
+		image->writable = writable;
+
+		return 0;
+	}
+#endif
+
+	if (freopen(filename, writable ? "rb+" : "rb", image->fp) == NULL)
+	{
+		return -1;
+	}
+
+	image->writable = writable;
+
+
+	return 0;
+}
+
+
+
+/*
+ * _image_close()
+ *
+ * Flush and close an image, returning -1 if the image could not be
+ * written out.
+ */
+int _image_close(coco_image image)
+{
+	int result = 0;
+
+
+#ifndef WIN32
+	if (image->map != NULL)
+	{
+		if (image->writable && msync(image->map, image->size, MS_SYNC) != 0)
+		{
+			result = -1;
+		}
+
+		munmap(image->map, image->map_size);
+
+		if (close(image->fd) != 0)
+		{
+			result = -1;
+		}
+	}
+	else
+#endif
+	{
+		result = fclose(image->fp);
+	}
+
+	free(image);
+
+
+	return result;
+}
+
+
+
+int _image_seek(coco_image image, long offset, int whence)
+{
+	if (image->map == NULL)
+	{
+		return fseek(image->fp, offset, whence);
+	}
+
+	switch (whence)
+	{
+		case SEEK_CUR:
+			offset += image->pos;
+			break;
+
+		case SEEK_END:
+			offset += image->size;
+			break;
+	}
+
+	if (offset < 0)
+	{
+		return -1;
+	}
+
+	image->pos = offset;
+
+
+	return 0;
+}
+
+
+
+long _image_tell(coco_image image)
+{
+	if (image->map == NULL)
+	{
+		return ftell(image->fp);
+	}
+
+
+	return image->pos;
+}
+
+
+
+size_t _image_read(coco_image image, void *buffer, size_t size)
+{
+	size_t count;
+
+
+	if (image->map == NULL)
+	{
+		return fread(buffer, 1, size, image->fp);
+	}
+
+	count = _image_read_at(image, image->pos, buffer, size);
+	image->pos += count;
+
+
+	return count;
+}
+
+
+
+size_t _image_write(coco_image image, void *buffer, size_t size)
+{
+	size_t count;
+
+
+	if (image->map == NULL)
+	{
+		return fwrite(buffer, 1, size, image->fp);
+	}
+
+	count = _image_write_at(image, image->pos, buffer, size);
+	image->pos += count;
+
+
+	return count;
+}
+
+
+
+/*
+ * _image_read_at()
+ *
+ * Read 'size' bytes at 'offset' without moving the file position.
+ */
+size_t _image_read_at(coco_image image, long offset, void *buffer, size_t size)
+{
+	if (image->map == NULL)
+	{
+#ifndef WIN32
+		ssize_t count;
+
+		/* 1. Write out anything stdio holds, then read the file directly. */
+
+		fflush(image->fp);
+
+		count = pread(fileno(image->fp), buffer, size, offset);
+
+		return count < 0 ? 0 : count;
+#else
+		fseek(image->fp, offset, SEEK_SET);
+
+		return fread(buffer, 1, size, image->fp);
+#endif
+	}
+
+	if (offset >= image->size)
+	{
+		return 0;
+	}
+
+	if ((long)size > image->size - offset)
+	{
+		size = image->size - offset;
+	}
+
+	memcpy(buffer, image->map + offset, size);
+
+
+	return size;
+}
+
+
+
+/*
+ * _image_write_at()
+ *
+ * Write 'size' bytes at 'offset', extending the image if need be,
+ * without moving the file position.
+ */
+size_t _image_write_at(coco_image image, long offset, void *buffer, size_t size)
+{
+	if (image->map == NULL)
+	{
+#ifndef WIN32
+		ssize_t count;
+
+		if (image->writable == 0)
+		{
+			return 0;
+		}
+
+		fflush(image->fp);
+
+		count = pwrite(fileno(image->fp), buffer, size, offset);
+
+		return count < 0 ? 0 : count;
+#else
+		fseek(image->fp, offset, SEEK_SET);
+
+		return fwrite(buffer, 1, size, image->fp);
+#endif
+	}
+
+	if (image->writable == 0)
+	{
+		return 0;
+	}
+
+#ifndef WIN32
+	if (offset + (long)size > image->size && grow_image(image, offset + size) != 0)
+	{
+		/* Too big to stay mapped; carry on through the file instead. */
+
+		if (unmap_image(image) != 0)
+		{
+			return 0;
+		}
+
+		return _image_write_at(image, offset, buffer, size);
+	}
+#endif
+
+	memcpy(image->map + offset, buffer, size);
+
+
+	return size;
+}
+
+
+
+int _image_flush(coco_image image)
+{
+	if (image->map == NULL)
+	{
+		return fflush(image->fp);
+	}
+
+	/* Stores to a shared mapping are already in the page cache. */
+
+	return 0;
+}
+
+
+
+/*
+ * _image_size()
+ *
+ * Return the length of the image file.
+ */
+long _image_size(coco_image image)
+{
+	struct stat statbuf;
+
+
+	if (image->map != NULL)
+	{
+		return image->size;
+	}
+
+	fflush(image->fp);
+
+	if (fstat(fileno(image->fp), &statbuf) != 0)
+	{
+		return 0;
+	}
+
+
+	return statbuf.st_size;
+}
+
+
+
+/*
+ * _image_fileno()
+ *
+ * Return the descriptor behind an image, with any buffered writes
+ * flushed, so that the file can be read with pread and the like.
+ */
+int _image_fileno(coco_image image)
+{
+	if (image->map == NULL)
+	{
+		fflush(image->fp);
+
+		return fileno(image->fp);
+	}
+
+
+	return image->fd;
+}
+
+
+
+#ifndef WIN32
+/*
+ * map_image()
+ *
+ * Open and map a regular file, filling in 'image' on success.
+ */
+static int map_image(coco_image image, char *filename, int writable)
+{
+	struct stat statbuf;
+	int fd;
+	void *map;
+
+
+	/* 1. Only regular, non-empty files small enough to map. */
+
+	fd = open(filename, writable ? O_RDWR : O_RDONLY);
+
+	if (fd < 0)
+	{
+		return -1;
+	}
+
+	if (fstat(fd, &statbuf) != 0 || !S_ISREG(statbuf.st_mode) ||
+		statbuf.st_size == 0 || statbuf.st_size > IMAGE_MMAP_LIMIT)
+	{
+		close(fd);
+		errno = ENODEV;
+
+		return -1;
+	}
+
+
+	/* 2. Map it shared so that writes land in the file, leaving room
+	 * for a writable image to grow without being remapped.
+	 */
+
+	map = mmap(NULL, map_length(statbuf.st_size, writable), writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+
+	if (map == MAP_FAILED)
+	{
+		close(fd);
+
+		return -1;
+	}
+
+	image->map = map;
+	image->fd = fd;
+	image->size = statbuf.st_size;
+	image->map_size = map_length(statbuf.st_size, writable);
+	image->pos = 0;
+	image->fp = NULL;
+
+
+	return 0;
+}
+
+
+
+/*
+ * map_length()
+ *
+ * Length to map for a file of 'size' bytes.  Pages past the end of the
+ * file are never touched until the file has been extended over them.
+ */
+static long map_length(long size, int writable)
+{
+	long length = size;
+
+
+	if (writable)
+	{
+		length = size < 1024L * 1024 ? 2L * 1024 * 1024 : size * 2;
+
+		if (length > IMAGE_MMAP_LIMIT)
+		{
+			length = IMAGE_MMAP_LIMIT;
+		}
+	}
+
+
+	return length;
+}
+
+
+
+/*
+ * grow_image()
+ *
+ * Extend a mapped image to 'size' bytes, remapping it only when the
+ * file outgrows the mapping.
+ */
+static int grow_image(coco_image image, long size)
+{
+	void *map;
+	long length;
+
+
+	if (size > IMAGE_MMAP_LIMIT)
+	{
+		return -1;
+	}
+
+	if (ftruncate(image->fd, size) != 0)
+	{
+		return -1;
+	}
+
+	if (size > image->map_size)
+	{
+		/* 1. Map the new length before letting go of the old mapping. */
+
+		length = map_length(size, 1);
+
+		map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, image->fd, 0);
+
+		if (map == MAP_FAILED)
+		{
+			return -1;
+		}
+
+		munmap(image->map, image->map_size);
+
+		image->map = map;
+		image->map_size = length;
+	}
+
+	image->size = size;
+
+
+	return 0;
+}
+
+
+
+/*
+ * unmap_image()
+ *
+ * Drop the mapping of an image and go through stdio on the same
+ * descriptor from now on, keeping the file position.
+ */
+static int unmap_image(coco_image image)
+{
+	FILE *fp;
+
+
+	fp = fdopen(image->fd, image->writable ? "rb+" : "rb");
+
+	if (fp == NULL)
+	{
+		return -1;
+	}
+
+	munmap(image->map, image->map_size);
+
+	fseek(fp, image->pos, SEEK_SET);
+
+	image->fp = fp;
+	image->map = NULL;
+	image->map_size = 0;
+
+
+	return 0;
+}
+#endif
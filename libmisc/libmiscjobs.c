@@ -0,0 +1,297 @@
+/********************************************************************
+ * jobs.c - Run a command over several images at once
+ *
+ * A command such as dcheck or dir that takes a list of images is run
+ * once per image, up to 'jobs' at a time, each in its own process so
+ * that the libraries' per-process state (open volumes, caches and the
+ * commands' own globals) is never shared.  Each run's output is held
+ * in temporary files and written out in command line order, so the
+ * result reads just as it would from a single run.
+ *
+ * $Id$
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+#include <util.h>
+
+
+#ifndef WIN32
+typedef struct
+{
+	pid_t	pid;
+	FILE	*out;		/* the job's standard output */
+	FILE	*err;		/* the job's standard error */
+	int	status;
+	int	state;
+} job;
+
+#define JOB_WAITING	0
+#define JOB_RUNNING	1
+#define JOB_DONE	2
+#define JOB_EMITTED	3
+
+static void emit_file(FILE *fp, FILE *to);
+#endif
+
+
+
+/*
+ * run_jobs()
+ *
+ * Run 'func' once for each non-option argument in 'argv', passing it
+ * all of the options and that one argument.  Returns the first non-zero
+ * result in argument order.
+ */
+int run_jobs(int (*func)(int, char **), int argc, char **argv, int jobs)
+{
+#ifdef WIN32
+	return func(argc, argv);
+#else
+	int ec = 0;
+	int i, count = 0, options = 0;
+	int next = 0, emit = 0, running = 0;
+	char **operand, **job_argv;
+	job *list;
+
+
+	/* 1. Sort the arguments into options and images. */
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			options++;
+		}
+		else
+		{
+			count++;
+		}
+	}
+
+	if (jobs <= 1 || count < 2)
+	{
+		return func(argc, argv);
+	}
+
+	operand = malloc(count * sizeof(char *));
+	job_argv = malloc((options + 3) * sizeof(char *));
+	list = calloc(count, sizeof(job));
+
+	if (operand == NULL || job_argv == NULL || list == NULL)
+	{
+		free(operand);
+		free(job_argv);
+		free(list);
+
+		return func(argc, argv);
+	}
+
+	job_argv[0] = argv[0];
+	options = 1;
+	count = 0;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			job_argv[options++] = argv[i];
+		}
+		else
+		{
+			operand[count++] = argv[i];
+		}
+	}
+
+	job_argv[options + 1] = NULL;
+
+	fflush(stdout);
+	fflush(stderr);
+
+
+	/* 2. Keep up to 'jobs' workers busy until every image is done. */
+
+	while (emit < count)
+	{
+		/* 1. Start workers. */
+
+		while (running < jobs && next < count)
+		{
+			job *j = &list[next];
+
+			j->out = tmpfile();
+			j->err = tmpfile();
+			j->pid = -1;
+
+			if (j->out != NULL && j->err != NULL)
+			{
+				j->pid = fork();
+			}
+
+			if (j->pid == 0)
+			{
+				int status;
+
+				dup2(fileno(j->out), fileno(stdout));
+				dup2(fileno(j->err), fileno(stderr));
+
+				job_argv[options] = operand[next];
+				status = func(options + 1, job_argv);
+
+				fflush(stdout);
+				fflush(stderr);
+
+				_exit(status == 0 ? 0 : (status & 0xFF) != 0 ? (status & 0xFF) : 1);
+			}
+
+			if (j->pid < 0)
+			{
+				/* 1. Can't fork; let a worker finish, or run it here. */
+
+				if (j->out != NULL)
+				{
+					fclose(j->out);
+				}
+
+				if (j->err != NULL)
+				{
+					fclose(j->err);
+				}
+
+				if (running > 0)
+				{
+					break;
+				}
+
+				job_argv[options] = operand[next];
+				j->status = func(options + 1, job_argv);
+				j->state = JOB_EMITTED;
+
+				fflush(stdout);
+				fflush(stderr);
+
+				if (ec == 0)
+				{
+					ec = j->status;
+				}
+
+				emit++;
+				next++;
+
+				continue;
+			}
+
+			j->state = JOB_RUNNING;
+			running++;
+			next++;
+		}
+
+
+		/* 2. Reap a worker. */
+
+		if (running > 0)
+		{
+			int status;
+			pid_t pid = wait(&status);
+
+			for (i = emit; i < next; i++)
+			{
+				if (list[i].state == JOB_RUNNING && list[i].pid == pid)
+				{
+					list[i].status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+					list[i].state = JOB_DONE;
+					running--;
+
+					break;
+				}
+			}
+		}
+
+
+		/* 3. Write out the finished jobs that are next in order. */
+
+		while (emit < next && list[emit].state != JOB_RUNNING)
+		{
+			job *j = &list[emit];
+
+			if (j->state == JOB_DONE)
+			{
+				emit_file(j->out, stdout);
+				emit_file(j->err, stderr);
+
+				if (ec == 0)
+				{
+					ec = j->status;
+				}
+
+				j->state = JOB_EMITTED;
+			}
+
+			emit++;
+		}
+	}
+
+	free(operand);
+	free(job_argv);
+	free(list);
+
+
+	return ec;
+#endif
+}
+
+
+
+/*
+ * parse_jobs()
+ *
+ * Return the job count given to a -j option, or the number of CPUs for
+ * a bare -j ('arg' NULL or empty) or a count below one.
+ */
+int parse_jobs(const char *arg)
+{
+	int jobs = arg != NULL ? atoi(arg) : 0;
+
+
+	if (jobs < 1)
+	{
+#ifdef _SC_NPROCESSORS_ONLN
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+		jobs = 1;
+#endif
+	}
+
+
+	return jobs;
+}
+
+
+
+#ifndef WIN32
+/* Copy a job's output file to 'to' and close it */
+
+static void emit_file(FILE *fp, FILE *to)
+{
+	char buffer[4096];
+	size_t count;
+
+
+	rewind(fp);
+
+	while ((count = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+	{
+		fwrite(buffer, 1, count, to);
+	}
+
+	fflush(to);
+	fclose(fp);
+}
+#endif
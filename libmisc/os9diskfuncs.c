@@ -26,8 +26,8 @@ int read_lsn(os9_path_id path, int lsn, void *buffer )
 {
     int	result;
 
-    fseek(path->fd, lsn * path->bps, SEEK_SET);
-    result = fread(buffer, 1, path->bps, path->fd);
+    _image_seek(path->image, lsn * path->bps, SEEK_SET);
+    result = _image_read(path->image, buffer, path->bps);
 
     return result;
 }
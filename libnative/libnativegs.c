@@ -194,3 +194,39 @@ error_code _native_gs_pos(native_path_id path, u_int *pos)
 	
 	return ec;
 }
+
+
+
+/*
+ * _native_gs_extent()
+ *
+ * Return the descriptor behind the path, the file position and the
+ * number of bytes from there to the end of the file.
+ */
+error_code _native_gs_extent(native_path_id path, int *fd, u_int *offset, u_int *length)
+{
+	error_code	ec = 0;
+	u_int		size;
+
+
+	if (path->mode & FAM_DIR)
+	{
+		return EOS_BMODE;
+	}
+
+	ec = _native_gs_size(path, &size);
+
+	if (ec != 0)
+	{
+		return ec;
+	}
+
+	fflush(path->fd);
+
+	*fd = fileno(path->fd);
+	*offset = ftell(path->fd);
+	*length = size > *offset ? size - *offset : 0;
+
+
+	return ec;
+}
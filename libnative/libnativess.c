@@ -11,6 +11,7 @@
 #include <utime.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <errno.h>
 
 #include "cocotypes.h"
 #include "cococonv.h"
@@ -81,3 +82,56 @@ error_code _native_ss_size(native_path_id path, int size)
 #endif
 	return ec;
 }
+
+
+
+/*
+ * _native_ss_fill()
+ *
+ * Extend a file with zeros from the current position to 'length' bytes.
+ * Normally the file is just made longer, leaving the zeros as a hole on
+ * file systems that can; if 'physical' is set they are written out.
+ */
+error_code _native_ss_fill(native_path_id path, off_t length, int physical)
+{
+    error_code	ec = 0;
+    char	*zeros;
+    off_t	pos;
+    size_t	size;
+
+
+    fflush(path->fd);
+
+    if (physical == 0)
+    {
+        if (ftruncate(fileno(path->fd), length) != 0)
+        {
+            ec = UnixToCoCoError(errno);
+        }
+
+        return ec;
+    }
+
+    zeros = calloc(65536, 1);
+
+    if (zeros == NULL)
+    {
+        return UnixToCoCoError(ENOMEM);
+    }
+
+    for (pos = ftello(path->fd); pos < length; pos += size)
+    {
+        size = length - pos < 65536 ? length - pos : 65536;
+
+        if (fwrite(zeros, 1, size, path->fd) != size)
+        {
+            ec = UnixToCoCoError(errno);
+            break;
+        }
+    }
+
+    free(zeros);
+
+
+    return ec;
+}
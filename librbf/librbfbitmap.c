@@ -1,6 +1,12 @@
 /********************************************************************
  * bitmap.c - OS-9 Bitmap routines
  *
+ * The allocation map is scanned and updated a 64-bit word at a time.
+ * Bitmaps belonging to an open volume also carry a summary holding
+ * the number of free bits in each block of OS9_BITMAP_BLOCK_BITS
+ * bits, which lets searches step over full (and entirely free)
+ * blocks without looking at them.
+ *
  * $Id$
  ********************************************************************/
 
@@ -11,6 +17,110 @@
 #include "os9path.h"
 
 
+typedef unsigned long long bitmap_word;
+
+static int find_run(u_char *bitmap, int *summary, int start, int end, int need);
+
+
+
+/* Fetch 64 bits of the map; bit 0 of the map is the MSB of byte 0 */
+
+static bitmap_word load_word(u_char *p)
+{
+    return ((bitmap_word)p[0] << 56) | ((bitmap_word)p[1] << 48) |
+        ((bitmap_word)p[2] << 40) | ((bitmap_word)p[3] << 32) |
+        ((bitmap_word)p[4] << 24) | ((bitmap_word)p[5] << 16) |
+        ((bitmap_word)p[6] << 8) | (bitmap_word)p[7];
+}
+
+
+
+/* Count leading zero bits of a non-zero word */
+
+static int clz_word(bitmap_word w)
+{
+#if defined(__GNUC__)
+    return __builtin_clzll(w);
+#else
+    int n = 0;
+
+    while ((w & ((bitmap_word)1 << 63)) == 0)
+    {
+        w <<= 1;
+        n++;
+    }
+
+    return n;
+#endif
+}
+
+
+
+/* Set or clear numbits bits starting at firstbit, whole bytes at a time */
+
+static void fill_bits(u_char *bitmap, int firstbit, int numbits, int set)
+{
+    int startbyte = firstbit / 8;
+    int startbit = firstbit % 8;
+
+
+    /* 1. Leading partial byte. */
+
+    if (startbit != 0 && numbits > 0)
+    {
+        int count = 8 - startbit;
+        u_char mask;
+
+        if (count > numbits)
+        {
+            count = numbits;
+        }
+
+        mask = (u_char)(((0xFF >> startbit) & (0xFF << (8 - startbit - count))));
+
+        if (set)
+        {
+            bitmap[startbyte] |= mask;
+        }
+        else
+        {
+            bitmap[startbyte] &= ~mask;
+        }
+
+        startbyte++;
+        numbits -= count;
+    }
+
+
+    /* 2. Whole bytes. */
+
+    if (numbits >= 8)
+    {
+        memset(bitmap + startbyte, set ? 0xFF : 0x00, numbits / 8);
+        startbyte += numbits / 8;
+        numbits %= 8;
+    }
+
+
+    /* 3. Trailing partial byte. */
+
+    if (numbits > 0)
+    {
+        u_char mask = (u_char)(0xFF << (8 - numbits));
+
+        if (set)
+        {
+            bitmap[startbyte] |= mask;
+        }
+        else
+        {
+            bitmap[startbyte] &= ~mask;
+        }
+    }
+}
+
+
+
 /* Allocate a bit from the bitmap for numbits, starting at firstbit
  *
  * Note: range checking isn't done here; it is assumed that the caller
@@ -20,21 +130,14 @@
 int _os9_allbit(u_char *bitmap, int firstbit, int numbits)
 {
     error_code ec = 0;
-    int i, startbyte, startbit;
+    os9_volume_id vol;
 
 
-    startbyte = firstbit / 8;	/* compute start byte */
-    startbit = firstbit % 8;	/* and start bit */
+    fill_bits(bitmap, firstbit, numbits, 1);
 
-    for (i = 0; i < numbits; i++)
+    if ((vol = _os9_volume_for_bitmap(bitmap)) != NULL)
     {
-        if (startbit > 7)
-        {
-            startbit = 0;	/* reset bit counter */
-            startbyte++;	/* and increase byte counter */
-        }
-
-        bitmap[startbyte] |= (1 << (7 - startbit++));
+        _os9_volume_summarize(vol, firstbit, numbits);
     }
 
     return(ec);
@@ -51,21 +154,14 @@ int _os9_allbit(u_char *bitmap, int firstbit, int numbits)
 int _os9_delbit(u_char *bitmap, int firstbit, int numbits)
 {
     error_code ec = 0;
-    int i, startbyte, startbit;
+    os9_volume_id vol;
 
-	
-    startbyte = firstbit / 8;	/* compute start byte */
-    startbit = firstbit % 8;	/* and start bit */
 
-    for (i = 0; i < numbits; i++)
+    fill_bits(bitmap, firstbit, numbits, 0);
+
+    if ((vol = _os9_volume_for_bitmap(bitmap)) != NULL)
     {
-        if (startbit > 7)
-        {
-            startbit = 0;	/* reset bit counter */
-            startbyte++;	/* and increase byte counter */
-        }
-        
-        bitmap[startbyte] &= ~(1 << (7 - startbit++));
+        _os9_volume_summarize(vol, firstbit, numbits);
     }
 
 	
@@ -99,20 +195,33 @@ int _os9_ckbit(u_char *bitmap, int bitnumber)
 int _os9_getfreebit(u_char *bitmap, int total_sectors)
 {
     int i;
+    int *summary = NULL;
+    os9_volume_id vol;
 
-	
-    for (i = 2; i < total_sectors; i++)
+
+    /* 1. Use the block summary (and stay inside the map) for volume bitmaps. */
+
+    if ((vol = _os9_volume_for_bitmap(bitmap)) != NULL)
     {
-        if (!_os9_ckbit(bitmap, i))
-        {
-            /* bit is clear, cluster is free */
-            
-			_os9_allbit(bitmap, i, 1);	/* allocate cluster */
+        summary = vol->bitmap_summary;
 
-            return i;			/* return offset */
+        if (total_sectors > vol->bitmap_bits)
+        {
+            total_sectors = vol->bitmap_bits;
         }
     }
 
+    i = find_run(bitmap, summary, 2, total_sectors, 1);
+
+    if (i >= 0)
+    {
+        /* bit is clear, cluster is free */
+
+        _os9_allbit(bitmap, i, 1);	/* allocate cluster */
+
+        return i;			/* return offset */
+    }
+
     return -1;
 }
 
@@ -131,7 +240,7 @@ error_code _os9_getSASSegment(os9_path_id path, int *cluster, int *size)
 {
     unsigned int	pd_sas = int1(path->lsn0->pd_sas);
     unsigned int	pd_tot = int3(path->lsn0->dd_tot);
-	u_int			i, count;
+    int			first, count, end;
 
 	
     /* Sanity check pd_sas */
@@ -153,38 +262,26 @@ error_code _os9_getSASSegment(os9_path_id path, int *cluster, int *size)
 	
     /* Now go and find pd_sas number of contiguous clusters */
 
-    i = count = 0;
+    count = pd_sas / path->spc;
+    end = pd_tot / path->spc;
 
-    while (count < (pd_sas / path->spc))
+    if (end > path->vol->bitmap_bits)
     {
-		if (i > pd_tot)
-		{
-			return -1;
-		}
-			
-        if (!_os9_ckbit(path->bitmap, i++))
-        {
-            /* Bit is clear */
-			
-            count += 1;
-        }
-        else
-        {
-            count = 0;
-        }
+        end = path->vol->bitmap_bits;
     }
 
-	
-    if (i > pd_tot)
+    first = find_run(path->bitmap, path->vol->bitmap_summary, 0, end, count);
+
+    if (first < 0)
     {
-        return 1;		/* none found */
+        return -1;		/* none found */
     }
 
 	
-    *cluster = (i - count) * path->spc;
+    *cluster = first * path->spc;
     *size = count * path->spc;
 	
-    _os9_allbit(path->bitmap, i - count, count);
+    _os9_allbit(path->bitmap, first, count);
 	
 	
     return 0;
@@ -192,6 +289,197 @@ error_code _os9_getSASSegment(os9_path_id path, int *cluster, int *size)
 
 
 
+/* Get the largest segment of up to 'want' clusters
+ *
+ * The first run of 'want' free clusters is taken if there is one, and
+ * otherwise the longest free run there is.
+ *
+ * cluster = LSN of the first sector of the segment
+ * size    = number of sectors allocated
+ */
+
+error_code _os9_getBestSegment(os9_path_id path, int want, int *cluster, int *size)
+{
+    int		end = int3(path->lsn0->dd_tot) / path->spc;
+    int		first, count = want;
+
+
+    if (end > path->vol->bitmap_bits)
+    {
+        end = path->vol->bitmap_bits;
+    }
+
+    first = find_run(path->bitmap, path->vol->bitmap_summary, 0, end, count);
+
+
+    /* No room for all of it; binary search for the longest run. */
+
+    if (first < 0)
+    {
+        int lo = 1, hi = want - 1;
+
+        count = 0;
+
+        while (lo <= hi)
+        {
+            int mid = lo + (hi - lo) / 2;
+            int at = find_run(path->bitmap, path->vol->bitmap_summary, 0, end, mid);
+
+            if (at >= 0)
+            {
+                first = at;
+                count = mid;
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid - 1;
+            }
+        }
+
+        if (count == 0)
+        {
+            return -1;		/* disk full */
+        }
+    }
+
+    *cluster = first * path->spc;
+    *size = count * path->spc;
+
+    _os9_allbit(path->bitmap, first, count);
+
+
+    return 0;
+}
+
+
+
+/*
+ * find_run()
+ *
+ * Return the first bit number in [start, end) that begins a run of
+ * 'need' clear bits, or -1 if there is none.  If summary is not NULL it
+ * holds the number of clear bits in each OS9_BITMAP_BLOCK_BITS block.
+ */
+
+static int find_run(u_char *bitmap, int *summary, int start, int end, int need)
+{
+    int pos = start, run = 0, run_start = 0;
+
+
+    while (pos < end)
+    {
+        /* 1. Whole summary blocks that are either full or entirely free. */
+
+        if (summary != NULL && pos % OS9_BITMAP_BLOCK_BITS == 0 && pos + OS9_BITMAP_BLOCK_BITS <= end)
+        {
+            int free_bits = summary[pos / OS9_BITMAP_BLOCK_BITS];
+
+            if (free_bits == 0)
+            {
+                run = 0;
+                pos += OS9_BITMAP_BLOCK_BITS;
+                continue;
+            }
+
+            if (free_bits == OS9_BITMAP_BLOCK_BITS)
+            {
+                if (run == 0)
+                {
+                    run_start = pos;
+                }
+
+                if (run + OS9_BITMAP_BLOCK_BITS >= need)
+                {
+                    return run_start;
+                }
+
+                run += OS9_BITMAP_BLOCK_BITS;
+                pos += OS9_BITMAP_BLOCK_BITS;
+                continue;
+            }
+        }
+
+
+        /* 2. Whole words: walk alternating runs of clear and set bits. */
+
+        if (pos % 64 == 0 && pos + 64 <= end)
+        {
+            bitmap_word w = load_word(bitmap + pos / 8);
+            int b = 0;
+
+            while (b < 64)
+            {
+                bitmap_word x = w << b;
+                int n;
+
+                /* 1. Clear bits. */
+
+                n = (x == 0) ? 64 - b : clz_word(x);
+
+                if (n > 0)
+                {
+                    if (run == 0)
+                    {
+                        run_start = pos + b;
+                    }
+
+                    if (run + n >= need)
+                    {
+                        return run_start;
+                    }
+
+                    run += n;
+                    b += n;
+
+                    if (b >= 64)
+                    {
+                        break;
+                    }
+
+                    x = w << b;
+                }
+
+                /* 2. Set bits. */
+
+                n = (~x == 0) ? 64 - b : clz_word(~x);
+                run = 0;
+                b += n;
+            }
+
+            pos += 64;
+            continue;
+        }
+
+
+        /* 3. Single bits at the ragged edges. */
+
+        if ((bitmap[pos / 8] & (0x80 >> (pos % 8))) == 0)
+        {
+            if (run == 0)
+            {
+                run_start = pos;
+            }
+
+            if (++run >= need)
+            {
+                return run_start;
+            }
+        }
+        else
+        {
+            run = 0;
+        }
+
+        pos++;
+    }
+
+
+    return -1;
+}
+
+
+
 /* Round up value to the next highest multiple of multiple */
 
 unsigned int NextHighestMultiple(unsigned int value, unsigned int multiple)
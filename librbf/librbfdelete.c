@@ -199,6 +199,10 @@ error_code _os9_delete(char *pathlist)
                 /* Deallocate the bit used for the file descriptor */
 				
                 _os9_delbit( parent_path->bitmap, int3(dentry.lsn) / parent_path->spc, 1 );
+
+                /* Forget any cached entries if the file was a directory */
+
+                _os9_dircache_invalidate( parent_path->vol, int3(dentry.lsn) );
             }
 
 			
@@ -245,13 +249,12 @@ u_char DecrementLinkCount(os9_path_id path, int fd_lsn)
     u_char		result;
 
 	
-    fseek(path->fd, fd_lsn * path->bps, SEEK_SET);	
-    fread(&fdbuf, 1, sizeof(fd_stats), path->fd);
+    _image_read_at(path->image, fd_lsn * path->bps, &fdbuf, sizeof(fd_stats));
 	
     result = fdbuf.fd_lnk = fdbuf.fd_lnk - 1;
 	
-    fseek(path->fd, fd_lsn * path->bps, SEEK_SET);	
-    fwrite(&fdbuf, 1, sizeof(fd_stats), path->fd);
+    _image_write_at(path->image, fd_lsn * path->bps, &fdbuf, sizeof(fd_stats));
+    path->vol->fd_generation++;
 
 	
     return result;
@@ -266,10 +269,18 @@ static int _os9_freefile( char *filePath, u_char *bitmap )
     Fd_seg	seg;
     int i;
     int	ec = 0;
+    unsigned int spc;
 
 	
     ec = _os9_open(&path, filePath, FAM_READ);
+
+    if (ec != 0)
+    {
+        return ec;
+    }
+
     ec = _os9_gs_fd(path, sizeof(fd_stats), &fdbuf);
+    spc = path->spc;
     ec = _os9_close(path);
 	
     seg = fdbuf.fd_seg;
@@ -281,7 +292,7 @@ static int _os9_freefile( char *filePath, u_char *bitmap )
             break;
 		}
 
-        ec = _os9_delbit(bitmap, int3(seg[i].lsn) / path->spc, int2(seg[i].num) / path->spc);
+        ec = _os9_delbit(bitmap, int3(seg[i].lsn) / spc, int2(seg[i].num) / spc);
 		
         if (ec != 0)
 		{
@@ -0,0 +1,464 @@
+/********************************************************************
+ * dircache.c - OS-9 directory lookup cache
+ *
+ * Each volume keeps a hash table mapping (directory FD LSN, name) to
+ * the LSN of the entry's FD.  A directory is read into the table in
+ * one pass the first time a name is looked up in it; after that
+ * _os9_writedir keeps the table in step with the directory's entries.
+ * Names are compared without regard to case, as _os9_open always has.
+ *
+ * $Id$
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "cocotypes.h"
+#include "os9path.h"
+#include "cococonv.h"
+
+
+#define DIRCACHE_BUCKETS	1024
+
+
+typedef struct _dircache_entry
+{
+	struct _dircache_entry	*next;
+	unsigned int	dir_lsn;	/* FD LSN of the directory */
+	unsigned int	slot;		/* entry number within the directory */
+	unsigned int	lsn;		/* FD LSN of the entry */
+	char		name[D_NAMELEN + 4];	/* lower case name */
+} dircache_entry;
+
+typedef struct _dircache_dir
+{
+	struct _dircache_dir	*next;
+	unsigned int	dir_lsn;
+} dircache_dir;
+
+struct _os9_dircache
+{
+	dircache_entry	*bucket[DIRCACHE_BUCKETS];
+	dircache_dir	*loaded;	/* directories read into the table */
+};
+
+
+static unsigned int hash_name(unsigned int dir_lsn, char *name);
+static void entry_name(os9_dir_entry *dirent, char *name);
+static int is_loaded(struct _os9_dircache *cache, unsigned int dir_lsn);
+static error_code add_entry(struct _os9_dircache *cache, unsigned int dir_lsn, unsigned int slot, os9_dir_entry *dirent);
+static void remove_slot(struct _os9_dircache *cache, unsigned int dir_lsn, unsigned int slot);
+static error_code load_directory(os9_path_id path, u_char **buffer, u_int *size);
+
+
+
+/*
+ * _os9_dircache_lookup()
+ *
+ * Look up 'name' in the directory whose FD is at path->pl_fd_lsn and
+ * return the LSN of its FD in 'lsn'.  Returns EOS_EOF if the directory
+ * has no such entry, just as reading the directory to its end would.
+ */
+error_code _os9_dircache_lookup(os9_path_id path, char *name, unsigned int *lsn)
+{
+	error_code ec = 0;
+	struct _os9_dircache *cache;
+	dircache_entry *e, *found = NULL;
+	char folded[D_NAMELEN + 4];
+	unsigned int dir_lsn = path->pl_fd_lsn;
+	int i;
+
+
+	/* 1. Fold the name; anything longer than an entry name can't match. */
+
+	if (strlen(name) >= sizeof(folded))
+	{
+		return EOS_EOF;
+	}
+
+	for (i = 0; name[i] != '\0'; i++)
+	{
+		folded[i] = tolower((u_char)name[i]);
+	}
+
+	folded[i] = '\0';
+
+
+	/* 2. Create the volume's table on first use. */
+
+	if (path->vol->dircache == NULL)
+	{
+		path->vol->dircache = calloc(1, sizeof(struct _os9_dircache));
+
+		if (path->vol->dircache == NULL)
+		{
+			return 1;
+		}
+	}
+
+	cache = path->vol->dircache;
+
+
+	/* 3. Read the whole directory into the table if it isn't there yet. */
+
+	if (!is_loaded(cache, dir_lsn))
+	{
+		u_char *buffer;
+		u_int size, slot;
+		dircache_dir *d;
+
+		ec = load_directory(path, &buffer, &size);
+
+		if (ec != 0)
+		{
+			return ec;
+		}
+
+		/* 1. Files that are not directories are searched but not cached. */
+
+		if ((path->fdcache.fd_att & FAP_DIR) == 0)
+		{
+			ec = EOS_EOF;
+
+			for (slot = 0; slot < size / sizeof(os9_dir_entry); slot++)
+			{
+				char q[D_NAMELEN + 4];
+
+				entry_name((os9_dir_entry *)buffer + slot, q);
+
+				if (strcasecmp(name, q) == 0)
+				{
+					*lsn = int3(((os9_dir_entry *)buffer + slot)->lsn);
+					ec = 0;
+
+					break;
+				}
+			}
+
+			free(buffer);
+
+			return ec;
+		}
+
+		d = malloc(sizeof(dircache_dir));
+
+		if (d == NULL)
+		{
+			free(buffer);
+
+			return 1;
+		}
+
+		d->dir_lsn = dir_lsn;
+		d->next = cache->loaded;
+		cache->loaded = d;
+
+		for (slot = 0; slot < size / sizeof(os9_dir_entry) && ec == 0; slot++)
+		{
+			ec = add_entry(cache, dir_lsn, slot, (os9_dir_entry *)buffer + slot);
+		}
+
+		free(buffer);
+
+		if (ec != 0)
+		{
+			_os9_dircache_invalidate(path->vol, dir_lsn);
+
+			return ec;
+		}
+	}
+
+
+	/* 4. Find the first entry in directory order with this name. */
+
+	for (e = cache->bucket[hash_name(dir_lsn, folded)]; e != NULL; e = e->next)
+	{
+		if (e->dir_lsn == dir_lsn && strcmp(e->name, folded) == 0)
+		{
+			if (found == NULL || e->slot < found->slot)
+			{
+				found = e;
+			}
+		}
+	}
+
+	if (found == NULL)
+	{
+		return EOS_EOF;
+	}
+
+	*lsn = found->lsn;
+
+
+	return 0;
+}
+
+
+
+/*
+ * _os9_dircache_update()
+ *
+ * Note that directory entry 'slot' of the directory whose FD is at
+ * 'dir_lsn' was overwritten with 'dirent'.
+ */
+void _os9_dircache_update(os9_volume_id vol, unsigned int dir_lsn, unsigned int slot, os9_dir_entry *dirent)
+{
+	struct _os9_dircache *cache = vol->dircache;
+
+
+	if (cache == NULL || !is_loaded(cache, dir_lsn))
+	{
+		return;
+	}
+
+	remove_slot(cache, dir_lsn, slot);
+
+	if (add_entry(cache, dir_lsn, slot, dirent) != 0)
+	{
+		_os9_dircache_invalidate(vol, dir_lsn);
+	}
+}
+
+
+
+/*
+ * _os9_dircache_invalidate()
+ *
+ * Forget the entries of the directory whose FD is at 'dir_lsn', or of
+ * every directory if 'dir_lsn' is 0.
+ */
+void _os9_dircache_invalidate(os9_volume_id vol, unsigned int dir_lsn)
+{
+	struct _os9_dircache *cache = vol->dircache;
+	dircache_dir **d;
+	int i;
+
+
+	if (cache == NULL)
+	{
+		return;
+	}
+
+
+	/* 1. Drop the directory from the loaded list. */
+
+	for (d = &cache->loaded; *d != NULL;)
+	{
+		if (dir_lsn == 0 || (*d)->dir_lsn == dir_lsn)
+		{
+			dircache_dir *dead = *d;
+
+			*d = dead->next;
+			free(dead);
+		}
+		else
+		{
+			d = &(*d)->next;
+		}
+	}
+
+
+	/* 2. Drop its entries. */
+
+	for (i = 0; i < DIRCACHE_BUCKETS; i++)
+	{
+		dircache_entry **e;
+
+		for (e = &cache->bucket[i]; *e != NULL;)
+		{
+			if (dir_lsn == 0 || (*e)->dir_lsn == dir_lsn)
+			{
+				dircache_entry *dead = *e;
+
+				*e = dead->next;
+				free(dead);
+			}
+			else
+			{
+				e = &(*e)->next;
+			}
+		}
+	}
+}
+
+
+
+/*
+ * _os9_dircache_free()
+ *
+ * Release a volume's directory cache.
+ */
+void _os9_dircache_free(os9_volume_id vol)
+{
+	_os9_dircache_invalidate(vol, 0);
+
+	free(vol->dircache);
+	vol->dircache = NULL;
+}
+
+
+
+static unsigned int hash_name(unsigned int dir_lsn, char *name)
+{
+	unsigned int h = 2166136261u ^ dir_lsn;
+
+
+	while (*name != '\0')
+	{
+		h = (h ^ (u_char)*name++) * 16777619u;
+	}
+
+
+	return h % DIRCACHE_BUCKETS;
+}
+
+
+
+/* Copy a directory entry's name out as a C string */
+
+static void entry_name(os9_dir_entry *dirent, char *name)
+{
+	memcpy(name, dirent, sizeof(os9_dir_entry));
+	name[sizeof(os9_dir_entry)] = '\0';
+
+	OS9StringToCString((u_char *)name);
+}
+
+
+
+static int is_loaded(struct _os9_dircache *cache, unsigned int dir_lsn)
+{
+	dircache_dir *d;
+
+
+	for (d = cache->loaded; d != NULL; d = d->next)
+	{
+		if (d->dir_lsn == dir_lsn)
+		{
+			return 1;
+		}
+	}
+
+
+	return 0;
+}
+
+
+
+static error_code add_entry(struct _os9_dircache *cache, unsigned int dir_lsn, unsigned int slot, os9_dir_entry *dirent)
+{
+	dircache_entry *e;
+	char q[D_NAMELEN + 4];
+	unsigned int h;
+	int i;
+
+
+	/* 1. Deleted entries have no name and are never matched. */
+
+	entry_name(dirent, q);
+
+	if (q[0] == '\0')
+	{
+		return 0;
+	}
+
+	e = malloc(sizeof(dircache_entry));
+
+	if (e == NULL)
+	{
+		return 1;
+	}
+
+	for (i = 0; q[i] != '\0'; i++)
+	{
+		e->name[i] = tolower((u_char)q[i]);
+	}
+
+	e->name[i] = '\0';
+	e->dir_lsn = dir_lsn;
+	e->slot = slot;
+	e->lsn = int3(dirent->lsn);
+
+	h = hash_name(dir_lsn, e->name);
+	e->next = cache->bucket[h];
+	cache->bucket[h] = e;
+
+
+	return 0;
+}
+
+
+
+static void remove_slot(struct _os9_dircache *cache, unsigned int dir_lsn, unsigned int slot)
+{
+	int i;
+
+
+	for (i = 0; i < DIRCACHE_BUCKETS; i++)
+	{
+		dircache_entry **e;
+
+		for (e = &cache->bucket[i]; *e != NULL; e = &(*e)->next)
+		{
+			if ((*e)->dir_lsn == dir_lsn && (*e)->slot == slot)
+			{
+				dircache_entry *dead = *e;
+
+				*e = dead->next;
+				free(dead);
+
+				return;
+			}
+		}
+	}
+}
+
+
+
+/* Read the whole of the file at path->pl_fd_lsn into a new buffer */
+
+static error_code load_directory(os9_path_id path, u_char **buffer, u_int *size)
+{
+	error_code ec;
+	int mode = path->mode;
+	unsigned int filepos = path->filepos;
+
+
+	ec = _os9_fd_load(path);
+
+	if (ec != 0)
+	{
+		return ec;
+	}
+
+	*size = int4(path->fdcache.fd_siz);
+	*buffer = malloc(*size + 1);
+
+	if (*buffer == NULL)
+	{
+		return 1;
+	}
+
+	if (*size == 0)
+	{
+		return 0;
+	}
+
+	path->mode &= ~FAM_DIR;
+	path->mode |= FAM_READ;
+	path->filepos = 0;
+
+	ec = _os9_read(path, *buffer, size);
+
+	path->mode = mode;
+	path->filepos = filepos;
+
+	if (ec != 0)
+	{
+		free(*buffer);
+	}
+
+
+	return ec;
+}
@@ -0,0 +1,153 @@
+/********************************************************************
+ * fd.c - OS-9 file descriptor cache routines
+ *
+ * Each non-raw path keeps a copy of its file's FD sector along with
+ * a table of the byte offset at which every segment starts, so that
+ * read and write only touch the image for file data.  Any FD write on
+ * the volume bumps its generation count, which makes other paths'
+ * copies stale.  A write-back path's copy may be ahead of the image
+ * (fd_dirty) until it is flushed, and is kept regardless.
+ *
+ * $Id$
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cocotypes.h"
+#include "os9path.h"
+
+
+/*
+ * _os9_fd_load()
+ *
+ * Make sure the path's FD cache holds the FD sector at pl_fd_lsn.
+ */
+error_code _os9_fd_load(os9_path_id path)
+{
+	/* 1. Already cached for this LSN, and no FD written since? */
+
+	if (path->fdcache_lsn == path->pl_fd_lsn && path->pl_fd_lsn != 0 &&
+		(path->fdcache_gen == path->vol->fd_generation || path->fd_dirty))
+	{
+		return 0;
+	}
+
+
+	/* 2. Read the file descriptor sector. */
+
+	if (_image_read_at(path->image, path->pl_fd_lsn * path->bps, &path->fdcache, sizeof(fd_stats)) != sizeof(fd_stats))
+	{
+		path->fdcache_lsn = 0;
+
+		return EOS_SE;
+	}
+
+	path->fdcache_lsn = path->pl_fd_lsn;
+	path->fdcache_gen = path->vol->fd_generation;
+
+
+	/* 3. Build the segment offset table. */
+
+	_os9_fd_reindex(path);
+
+
+	return 0;
+}
+
+
+
+/*
+ * _os9_fd_flush()
+ *
+ * Write the cached FD sector back to the image.
+ */
+error_code _os9_fd_flush(os9_path_id path)
+{
+	if (path->fdcache_lsn == 0)
+	{
+		return 0;
+	}
+
+	_image_write_at(path->image, path->fdcache_lsn * path->bps, &path->fdcache, sizeof(fd_stats));
+
+	path->fdcache_gen = ++path->vol->fd_generation;
+	path->fd_dirty = 0;
+
+
+	return 0;
+}
+
+
+
+/*
+ * _os9_fd_invalidate()
+ *
+ * Forget the cached FD sector; the next access will re-read it.
+ */
+void _os9_fd_invalidate(os9_path_id path)
+{
+	path->fdcache_lsn = 0;
+}
+
+
+
+/*
+ * _os9_fd_reindex()
+ *
+ * Recompute the segment offset table after the segment list changes.
+ * seg_offset[i] is the file offset of the first byte of segment i,
+ * and seg_offset[seg_count] is the capacity of the segment list.
+ */
+void _os9_fd_reindex(os9_path_id path)
+{
+	Fd_seg segptr = path->fdcache.fd_seg;
+	unsigned int accum_size = 0;
+	int i;
+
+
+	for (i = 0; i < NUM_SEGS && int3(segptr[i].lsn) != 0; i++)
+	{
+		path->seg_offset[i] = accum_size;
+		accum_size += int2(segptr[i].num) * path->bps;
+	}
+
+	path->seg_offset[i] = accum_size;
+	path->seg_count = i;
+}
+
+
+
+/*
+ * _os9_fd_findseg()
+ *
+ * Return the index of the segment holding file offset 'pos', or -1
+ * if the segment list does not reach that far.
+ */
+int _os9_fd_findseg(os9_path_id path, unsigned int pos)
+{
+	int lo = 0, hi = path->seg_count - 1;
+
+
+	if (path->seg_count == 0 || pos >= path->seg_offset[path->seg_count])
+	{
+		return -1;
+	}
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+
+		if (path->seg_offset[mid] <= pos)
+		{
+			lo = mid;
+		}
+		else
+		{
+			hi = mid - 1;
+		}
+	}
+
+
+	return lo;
+}
@@ -60,12 +60,17 @@ error_code _os9_gs_fd(os9_path_id path, int count, fd_stats *fdbuf)
     int size;
 
 
-	/* Seek to FD LSN of pathlist */
+	/* Get the (cached) file descriptor sector */
 
-	fseek(path->fd, path->pl_fd_lsn * path->bps, SEEK_SET);	
+	ec = _os9_fd_load(path);
 
+	if (ec != 0)
+	{
+		return ec;
+	}
 
-	/* Read the file descriptor sector */
+
+	/* Copy it out */
 
 	size = sizeof(fd_stats);
 
@@ -74,7 +79,7 @@ error_code _os9_gs_fd(os9_path_id path, int count, fd_stats *fdbuf)
 		size = count;
 	}
 
-	fread(fdbuf, 1, size, path->fd);
+	memcpy(fdbuf, &path->fdcache, size);
 
 
     return ec;
@@ -152,3 +157,65 @@ error_code _os9_gs_pos(os9_path_id path, u_int *pos)
 
     return ec;
 }
+
+
+
+/*
+ * _os9_gs_extent()
+ *
+ * Return the host file descriptor of the image, the image offset of the
+ * byte at the path's file position, and how many bytes of the file lie
+ * contiguously from there, so that a caller can move file data without
+ * reading it through a buffer.
+ */
+error_code _os9_gs_extent(os9_path_id path, int *fd, u_int *offset, u_int *length)
+{
+	error_code	ec = 0;
+	u_int		filesize;
+	int		i;
+
+
+	/* 1. Raw paths and directories are not files. */
+
+	if (path->israw == 1 || (path->mode & FAM_DIR) != 0)
+	{
+		return EOS_BMODE;
+	}
+
+	ec = _os9_fd_load(path);
+
+	if (ec != 0)
+	{
+		return ec;
+	}
+
+	filesize = int4(path->fdcache.fd_siz);
+
+	if (path->filepos >= filesize)
+	{
+		return EOS_EOF;
+	}
+
+
+	/* 2. Find the segment holding the file position. */
+
+	i = _os9_fd_findseg(path, path->filepos);
+
+	if (i < 0)
+	{
+		return EOS_EOF;
+	}
+
+	*offset = int3(path->fdcache.fd_seg[i].lsn) * path->bps + (path->filepos - path->seg_offset[i]);
+	*length = path->seg_offset[i + 1] - path->filepos;
+
+	if (*length > filesize - path->filepos)
+	{
+		*length = filesize - path->filepos;
+	}
+
+	*fd = _image_fileno(path->image);
+
+
+	return ec;
+}
@@ -23,10 +23,6 @@
 
 static int init_pd(os9_path_id *path, int mode);
 static int term_pd(os9_path_id path);
-static int init_bitmap(os9_path_id path);
-static int term_bitmap(os9_path_id path);
-static int init_lsn0(os9_path_id path);
-static int term_lsn0(os9_path_id path);
 static void _os9_truncate_seg_list( os9_path_id path );
 error_code _os9_file_exists( os9_path_id folder_path, char *filename );
 int validate_pathlist(os9_path_id *path, char *pathlist);
@@ -182,8 +178,8 @@ aa:
 
         /* 6. Write file descriptor to image file. */
 		
-        fseek(parent_path->fd, newLSN * parent_path->bps, SEEK_SET);	
-        fwrite(&newFD, 1, sizeof(fd_stats), parent_path->fd);
+        _image_write_at(parent_path->image, newLSN * parent_path->bps, &newFD, sizeof(fd_stats));
+        parent_path->vol->fd_generation++;
 		
         memset( &newDEntry, 0, sizeof( os9_dir_entry ) );
         strcpy( (char *)&(newDEntry.name), filename );
@@ -308,59 +304,30 @@ error_code _os9_open(os9_path_id *path, char *pathlist, int mode)
         (*path)->israw = 0;
     }
 
-    {
-        /* 1. Open a path to the image file. */
-		
-        char *open_mode;
-
-        if (mode & FAM_WRITE)
-        {
-            open_mode = "rb+";
-        }
-        else
-        {
-            open_mode = "rb";
-        }
-
-        (*path)->fd = fopen((*path)->imgfile, open_mode);
-
-        if ((*path)->fd == NULL)
-        {
-        	ec = UnixToCoCoError(errno);
-            term_pd(*path);
-
-            return ec;
-        }
-    }
-
+    /* 5. Attach to the image's volume (opening the image, reading LSN0
+     * and the bitmap if no other path has it open).
+     */
 
-    /* 6. Read LSN0. */
-	
-    ec = init_lsn0(*path);
+    ec = _os9_volume_acquire(&(*path)->vol, (*path)->imgfile, mode);
 
     if (ec != 0)
     {
         term_pd(*path);
-        fclose((*path)->fd);
 
         return ec;
     }
 
-
-	/* 7. Read bitmap. */
-	
-    ec = init_bitmap(*path);
-
-    if (ec != 0)
-    {
-        term_pd(*path);
-        fclose((*path)->fd);
-
-        return ec;
-    }
+    (*path)->image = (*path)->vol->image;
+    (*path)->lsn0 = (*path)->vol->lsn0;
+    (*path)->bitmap = (*path)->vol->bitmap;
+    (*path)->bitmap_bytes = (*path)->vol->bitmap_bytes;
+    (*path)->bps = (*path)->vol->bps;
+    (*path)->ss = (*path)->vol->bps;
+    (*path)->spc = (*path)->vol->spc;
+    (*path)->cs = (*path)->vol->cs;
 
 
-    /* 8. If path is raw, just return now. */
+    /* 6. If path is raw, just return now. */
 
     if ((*path)->israw == 1)
     {
@@ -368,7 +335,7 @@ error_code _os9_open(os9_path_id *path, char *pathlist, int mode)
     }
 
 
-    /* 9. Walk the pathlist to find the FD LSN of the last element
+    /* 7. Walk the pathlist to find the FD LSN of the last element
      * in the pathlist.
      */
 	 
@@ -382,50 +349,28 @@ error_code _os9_open(os9_path_id *path, char *pathlist, int mode)
 	}
     do
     {
-        os9_dir_entry diskent;
+        unsigned int lsn;
 
 
-        for (;;)
-        {
-            char q[64];
-			int mode = (*path)->mode;
-			
-			
-			/* 1. Set up path temporarily as a directory so _os9_readdir won't fail. */
-			
-			(*path)->mode |= FAM_DIR | FAM_READ;
-	
-            ec = _os9_readdir(*path, &diskent);
-			
-			(*path)->mode = mode;
-
-            if (ec != 0)
-            {
-                break;
-            }
-
+        /* 1. Look the element up in the volume's directory cache. */
 
-            /* 2. Try to match up the pathlist element to this entry. */
-			
-            strcpy(q, (char *)diskent.name);
+        ec = _os9_dircache_lookup(*path, p, &lsn);
 
-			if (strcasecmp((char *)p, (char *)OS9StringToCString((u_char *)q)) == 0)
-            {
-                (*path)->pl_fd_lsn = int3(diskent.lsn);
-                (*path)->filepos = 0;
-                break;
-            }
+        if (ec == 0)
+        {
+            (*path)->pl_fd_lsn = lsn;
+            (*path)->filepos = 0;
         }
     } while (ec == 0 && (p = strtok(NULL, "/")) != 0);
 
 
-    /* 10. If error encountered, return. */
+    /* 8. If error encountered, return. */
 	
     if (ec != 0)
     {
         free(tmppathlist);
 
-        fclose((*path)->fd);
+        _os9_volume_release((*path)->vol);
 
         term_pd(*path);
 
@@ -438,7 +383,7 @@ error_code _os9_open(os9_path_id *path, char *pathlist, int mode)
     }
 	
 	
-    /* 11. Obtain fd sector and check file permissions against
+    /* 9. Obtain fd sector and check file permissions against
      * passed permissions.
      *
      * Note that we only check for owner read/write/dir permissions
@@ -447,22 +392,21 @@ error_code _os9_open(os9_path_id *path, char *pathlist, int mode)
      */
 
     {
-        fd_stats fd_sector;
+        fd_stats *fd_sector = &(*path)->fdcache;
         int andresult;
 
 
-        fseek((*path)->fd, (*path)->pl_fd_lsn * (*path)->bps, SEEK_SET);
-        fread(&fd_sector, 1, sizeof(fd_stats), (*path)->fd);
+        ec = _os9_fd_load(*path);
 
         /* 1. Check permissions to determine if we can access the file. */
 		
-        andresult = mode & (fd_sector.fd_att & (FAM_DIR | FAM_READ | FAM_WRITE));
+        andresult = mode & (fd_sector->fd_att & (FAM_DIR | FAM_READ | FAM_WRITE));
 
-		if (andresult != mode || ((fd_sector.fd_att & FAM_DIR) != (mode & FAM_DIR)))
+		if (ec != 0 || andresult != mode || ((fd_sector->fd_att & FAM_DIR) != (mode & FAM_DIR)))
 		{
             free(tmppathlist);
 
-            fclose((*path)->fd);
+            _os9_volume_release((*path)->vol);
 
             term_pd(*path);
 
@@ -514,83 +458,61 @@ error_code _os9_open_parent_directory(os9_path_id *path, char *pathlist, int mod
  */
 error_code _os9_close(os9_path_id path)
 {
-    int		pad_size, i;
-    char	pad = 0xff;
-	
-    if (path->fd != NULL)
+    error_code	ec = 0;
+
+
+    if (path->vol != NULL)
     {
         /* 1. This is a valid path. */
 		
+        if (path->fd_dirty)
         {
-            if (path->israw == 0)
-            {
-                _os9_truncate_seg_list( path );
-            }
-
-            term_bitmap(path);
-            term_lsn0(path);
+            _os9_fd_flush(path);
+        }
 
-            /* 1. Make sure file length is an exact multiple of 256. */
-            /* Extend file length if not */
-			
-            fseek(path->fd, 0, SEEK_END);
-            pad_size = 256 - (ftell(path->fd) % 256);
-            if (pad_size == 256)
-			{
-				pad_size = 0;
-			}
-
-            for (i = 0; i < pad_size; i++)
-			{
-                fwrite( &pad, 1, 1, path->fd );
-			}
-			
-            fclose(path->fd);
+        if (path->israw == 0 && (path->mode & FAM_WRITE))
+        {
+            _os9_truncate_seg_list( path );
         }
-#if 0
-        else
+
+
+        /* 2. Write back any bitmap changes made through a writable path. */
+
+        if (path->mode & FAM_WRITE)
         {
-            if (path->mode & FAM_DIR)
-            {
-#if defined(WIN32)
-                path->dirhandle = 0;
-#else
-                closedir(path->dirhandle);
-#endif
-            }
-            else
-            {
-                fclose(path->fd);
-            }
+            _os9_volume_flush(path->vol);
         }
-#endif
+
+        ec = _os9_volume_release(path->vol);
 
         term_pd(path);
     }
 
 
-    return 0;
+    return ec;
 }
 
 
 
 static void _os9_truncate_seg_list(os9_path_id path)
 {
-    fd_stats	fd_sector;
+    fd_stats	*fd_sector = &path->fdcache;
     int		i;
     unsigned int	file_size, rounded_size, max_size, truncation;
     unsigned int	clusters_to_truncate = 0;
 	
 	
-    /* 1. Seek to file descriptor sector for this file and get it in memory. */
+    /* 1. Get the file descriptor sector for this file in memory. */
 	
-    fseek(path->fd, path->pl_fd_lsn * path->bps, SEEK_SET);
-    fread(&fd_sector, 1, sizeof(fd_stats), path->fd);
+    if (_os9_fd_load(path) != 0)
+    {
+        return;
+    }
 
 
     /* 2. If this file is a directory, then abort. */
 	
-    if ((fd_sector.fd_att & FAP_DIR) == FAP_DIR)
+    if ((fd_sector->fd_att & FAP_DIR) == FAP_DIR)
     {
         return;
     }
@@ -598,7 +520,7 @@ static void _os9_truncate_seg_list(os9_path_id path)
 	
     /* 3. Get size of file. */
 	
-    file_size = int4(fd_sector.fd_siz);
+    file_size = int4(fd_sector->fd_siz);
 
 
     /* 4. Get number of bytes when rounded to next cluster. */
@@ -608,7 +530,7 @@ static void _os9_truncate_seg_list(os9_path_id path)
 
     /* 5. Get number of bytes as currently represented by segment list. */
 	
-    max_size = _os9_maximum_file_size(fd_sector, path->bps);
+    max_size = path->seg_offset[path->seg_count];
 
 
     /* 6. If the size that the segment list conveys is larger than our round size,
@@ -617,34 +539,41 @@ static void _os9_truncate_seg_list(os9_path_id path)
 	 
     if (max_size > rounded_size)
     {
-        truncation = _os9_maximum_file_size(fd_sector, path->bps) - rounded_size;
+        truncation = max_size - rounded_size;
         clusters_to_truncate = truncation / path->cs;
     }
 
 
+    /* 7. Nothing to cut means the FD on disk is already correct. */
+
+    if (clusters_to_truncate == 0)
+    {
+        return;
+    }
+
+
     while (clusters_to_truncate--)
     {
         /* 1. Remove one cluster from end of segement list. */
 		
         for (i = NUM_SEGS - 1; i >= 0; i--)
         {
-            if (int3(fd_sector.fd_seg[i].lsn) != 0)
+            if (int3(fd_sector->fd_seg[i].lsn) != 0)
             {
-                _os9_delbit(path->bitmap, (int3(fd_sector.fd_seg[i].lsn) + int2(fd_sector.fd_seg[i].num) - 1) / path->spc, 1);
-                _int2(int2(fd_sector.fd_seg[i].num) - path->spc, fd_sector.fd_seg[i].num);
+                _os9_delbit(path->bitmap, (int3(fd_sector->fd_seg[i].lsn) + int2(fd_sector->fd_seg[i].num) - 1) / path->spc, 1);
+                _int2(int2(fd_sector->fd_seg[i].num) - path->spc, fd_sector->fd_seg[i].num);
 				
-                if (int2(fd_sector.fd_seg[i].num) == 0)
+                if (int2(fd_sector->fd_seg[i].num) == 0)
                 {
-                    _int3(0, fd_sector.fd_seg[i].lsn);
+                    _int3(0, fd_sector->fd_seg[i].lsn);
                 }
                 break;
             }
         }
     }
 
-
-    fseek(path->fd, path->pl_fd_lsn * path->bps, SEEK_SET);
-    fwrite(&fd_sector, 1, sizeof(fd_stats), path->fd);
+    _os9_fd_reindex(path);
+    _os9_fd_flush(path);
 
 
     return;
@@ -744,30 +673,20 @@ int validate_pathlist(os9_path_id *path, char *pathlist)
 
 error_code _os9_file_exists( os9_path_id folder_path, char *filename )
 {
-    error_code	ec = 0;
-    os9_dir_entry	dentry;
+    error_code	ec;
+    unsigned int	lsn;
 	
 
-    _os9_seek(folder_path, 0, SEEK_SET);
-	
-    while (_os9_gs_eof(folder_path) == 0)
-    {
-		int mode = folder_path->mode;
+    ec = _os9_dircache_lookup(folder_path, filename, &lsn);
 
-		folder_path->mode |= FAM_DIR | FAM_READ;		
-        ec = _os9_readdir(folder_path, &dentry);
-		folder_path->mode = mode;
-		
-        if (ec != 0)
-		{
-            return ec;
-		}
-		
+    if (ec == 0)
+    {
+        return EOS_FAE;
+    }
 
-        if (strcasecmp(filename, (char *)OS9StringToCString(dentry.name)) == 0)
-		{
-            return EOS_FAE;
-		}
+    if (ec == EOS_EOF)
+    {
+        return 0;
     }
 
 
@@ -809,124 +728,3 @@ static int term_pd(os9_path_id path)
 
     return 0;
 }
-
-
-
-/*
- * init_bitmap()
- *
- * read the bitmap sectors
- */
-static int init_bitmap(os9_path_id path)
-{
-    int bitmap_sectors;
-
-
-    bitmap_sectors = (int2(path->lsn0->dd_map) / path->bps) +
-        (int2(path->lsn0->dd_map) % path->bps != 0);
-    path->bitmap_bytes = int2(path->lsn0->dd_map);
-    path->ss = path->bps;
-    path->spc = int2(path->lsn0->dd_bit);
-    path->cs = path->spc * path->ss;	/* compute cluster size */
-
-    path->bitmap = (u_char *)malloc(bitmap_sectors * path->bps);
-
-    if (path->bitmap == NULL)
-    {
-        return 1;
-    }
-	
-    fseek(path->fd, 1 * path->bps, SEEK_SET);
-
-    if (fread(path->bitmap, 1, bitmap_sectors * path->bps, path->fd) == 0)
-    {
-        return EOS_EOF;
-    }
-
-
-    return 0;
-}
-
-
-/*
- * term_bitmap()
- *
- * free the bitmap sectors
- */
-static int term_bitmap(os9_path_id path)
-{
-    /* 1. Write back out bitmap. */
-	
-    fseek(path->fd, path->bps, SEEK_SET);
-    fwrite(path->bitmap, 1, path->bitmap_bytes, path->fd);
-
-    free(path->bitmap);
-
-
-    return 0;
-}
-
-
-/*
- * init_lsn0()
- *
- * Read LSN0, the first sector of an OS-9 disk
- */
-static int init_lsn0(os9_path_id path)
-{
-    /* 1. Allocate 256 bytes for LSN0. */
-	
-    path->lsn0 = (lsn0_sect *)malloc(1 * 256);
-
-    if (path->lsn0 == NULL)
-    {
-        return 1;
-    }
-
-
-    /* 2. Compute bytes per sector from value at LSN0. */
-	
-    fseek(path->fd, 0, SEEK_SET);
-
-
-    /* 3. Read 256 byte LSN0. */
-
-    fread(path->lsn0, 1, 256, path->fd);
-
-
-    /* 4. Compute bytes per sector from LSN0's lsnsize field. */
-	
-    if (int1(path->lsn0->dd_lsnsize) == 0)
-    {
-        /* 1. OS-9/6809 and some OS-9/68K formats have this field as 0,
-         * which means 256 bytes/sector.
-         */
-		 
-        path->bps = 256;
-    }
-    else
-    {
-        /* 1. In this case, OS-9/68K has the proper value in
-         * the field (1 = 256 bps, 2 = 512 bps, etc.).
-         */
-		 
-        path->bps = int1(path->lsn0->dd_lsnsize) * 256;
-    }
-
-
-    return 0;
-}
-
-
-
-/*
- * term_lsn0()
- *
- * Terminate LSN0 buffer
- */
-static int term_lsn0(os9_path_id path)
-{
-    free(path->lsn0);
-
-    return 0;
-}
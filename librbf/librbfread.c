@@ -16,22 +16,19 @@
  */
 int read_lsn(os9_path_id path, int lsn, void *buffer)
 {
-	fseek(path->fd, lsn * path->bps, SEEK_SET);
-
-	return fread(buffer, 1, path->bps, path->fd);
+	return _image_read_at(path->image, lsn * path->bps, buffer, path->bps);
 }
 
 
 error_code _os9_read(os9_path_id path, void *buffer, u_int *size)
 {
 	error_code		ec = 0;
-    fd_stats		fd_sector;
     Fd_seg			segptr;
     int				i;
-	u_int				accum_size = 0;
 	int				bytes_left;
 	char			*buf_ptr = buffer;
-	int				seg_size_bytes, read_size;
+	int				read_size;
+	long			offset;
 	u_int			filesize;
 
 
@@ -57,8 +54,7 @@ error_code _os9_read(os9_path_id path, void *buffer, u_int *size)
             return EOS_EOF;
         }
 
-        fseek(path->fd, path->filepos, SEEK_SET);
-        fread(buffer, 1, *size, path->fd);
+        _image_read_at(path->image, path->filepos, buffer, *size);
         path->filepos += *size;
 
 
@@ -66,24 +62,26 @@ error_code _os9_read(os9_path_id path, void *buffer, u_int *size)
     }
 
 
-    /* 2. Seek to FD LSN of pathlist */
-
-    fseek(path->fd, path->pl_fd_lsn * path->bps, SEEK_SET);
+    /* 3. Get the (cached) file descriptor sector. */
 
+    ec = _os9_fd_load(path);
 
-    /* 3. Read the file descriptor sector */
+    if (ec != 0)
+    {
+        *size = 0;
 
-    fread(&fd_sector, 1, sizeof(fd_stats), path->fd);
+        return ec;
+    }
 
 
     /* 4. Point to segment list */
 
-    segptr = (Fd_seg)&(fd_sector.fd_seg);
+    segptr = (Fd_seg)&(path->fdcache.fd_seg);
 
 
     /* 5. Extract file size from FD */
 
-    filesize = int4(fd_sector.fd_siz);
+    filesize = int4(path->fdcache.fd_siz);
 
 
     /* 6. If our file position is greater than the file size, return error */
@@ -107,32 +105,11 @@ error_code _os9_read(os9_path_id path, void *buffer, u_int *size)
     }
 
 
-    /* 8. Determine which segment the offset starts by looping
-     *    through each segptr entry until we reach the end
-     */
-
-    accum_size = 0;
-
-    for (i = 0; i < NUM_SEGS || int3(segptr[i].lsn) != 0; i++)
-    {
-        accum_size += int2(segptr[i].num) * path->bps;
-
-        if (accum_size > path->filepos)
-        {
-            /* 1. This is the sector! */
-
-            accum_size -= int2(segptr[i].num) * path->bps;
-            break;
-        }
-    }
+    /* 8. Find the segment holding the file position. */
 
+    i = _os9_fd_findseg(path, path->filepos);
 
-    /* 9. make out-of-loop check to insure we exited from the for()
-     *    loop due to finding the proper sector, and not because we
-     *    ran out of sectors in the segment list to search.
-     */
-
-    if (int3(segptr[i].lsn) == 0 || i == NUM_SEGS)
+    if (i < 0)
     {
         /* 1. Apparently, the file position in the path was too
          *    large, because we couldn't find a sector.
@@ -143,39 +120,30 @@ error_code _os9_read(os9_path_id path, void *buffer, u_int *size)
     }
 
 
-    /* 10. Start copying data into the user supplied buffer for 'bytes_left' bytes.
+    /* 9. Start copying data into the user supplied buffer for 'bytes_left' bytes.
      *
      * i == segment entry to start
      */
 
     bytes_left = *size;
 
-    while (bytes_left > 0 && i != NUM_SEGS && int3(segptr[i].lsn) != 0)
+    while (bytes_left > 0 && i < path->seg_count)
     {
-        accum_size += int2(segptr[i].num) * path->bps;
-
-
-        /* 1. Seek to sector where segment starts and compute the segment size. */
-
-        fseek(path->fd, int3(segptr[i].lsn) * path->bps, SEEK_SET);
-        seg_size_bytes = int2(segptr[i].num) * path->bps;
-
-
-        /* 2. Seek within segment to offset. */
+        /* 1. Find the file position within this segment. */
 
-        fseek(path->fd, path->filepos - (accum_size - seg_size_bytes), SEEK_CUR);
+        offset = int3(segptr[i].lsn) * path->bps + (path->filepos - path->seg_offset[i]);
 
 
-        /* 3. Compute read size for this segment. */
+        /* 2. Compute read size for this segment. */
 
-        read_size = accum_size - path->filepos;
+        read_size = path->seg_offset[i + 1] - path->filepos;
 
         if (read_size > bytes_left)
         {
             read_size = bytes_left;
         }
 
-        fread(buf_ptr, 1, read_size, path->fd);
+        _image_read_at(path->image, offset, buf_ptr, read_size);
         buf_ptr += read_size;
         path->filepos += read_size;
         bytes_left -= read_size;
@@ -14,13 +14,12 @@
 error_code _os9_readln(os9_path_id path, void *buffer, u_int *size)
 {
 	error_code		ec = 0;
-    fd_stats		fd_sector;
     Fd_seg			segptr;
     int				i;
-    u_int 			accum_size = 0;
     int				bytes_left;
     char			*buf_ptr = buffer;
-    int				seg_size_bytes, read_size;
+    int				read_size;
+    long			offset;
 	u_int 			filesize;
 
 
@@ -34,27 +33,27 @@ error_code _os9_readln(os9_path_id path, void *buffer, u_int *size)
     }
 
 
-    /* 2. Seek to FD LSN of pathlist */
+    /* 2. Get the (cached) file descriptor sector. */
 
-    fseek(path->fd, path->pl_fd_lsn * path->bps, SEEK_SET);	
+    ec = _os9_fd_load(path);
 
-
-    /* 3. Read the file descriptor sector */
-
-    fread(&fd_sector, 1, sizeof(fd_stats), path->fd);
+    if (ec != 0)
+    {
+        return ec;
+    }
 
 
-    /* 4. Point to segment list */
+    /* 3. Point to segment list */
 
-    segptr = (Fd_seg)&(fd_sector.fd_seg);
+    segptr = (Fd_seg)&(path->fdcache.fd_seg);
 
 
-    /* 5. Extract file size from FD */
+    /* 4. Extract file size from FD */
 
-    filesize = int4(fd_sector.fd_siz);
+    filesize = int4(path->fdcache.fd_siz);
 
 
-    /* 6. If our file position is greater than the file size, return error */
+    /* 5. If our file position is greater than the file size, return error */
 
     if (path->filepos >= filesize)
     {
@@ -63,7 +62,7 @@ error_code _os9_readln(os9_path_id path, void *buffer, u_int *size)
     }
 
 
-    /* 7. If the passed size is greater than the length of the file minus
+    /* 6. If the passed size is greater than the length of the file minus
      *    the file position, then reset the size
      */
 
@@ -73,31 +72,11 @@ error_code _os9_readln(os9_path_id path, void *buffer, u_int *size)
     }
 
 
-    /* 8. Determine which segment the offset starts by looping
-     *    through each segptr entry until we reach the end
-     */
-
-    accum_size = 0;
-
-    for (i = 0; i < NUM_SEGS || int3(segptr[i].lsn) != 0; i++)
-    {
-        accum_size += int2(segptr[i].num) * path->bps;
-
-		if (accum_size > path->filepos)
-        {
-            /* 1. This is the sector! */
-
-            accum_size -= int2(segptr[i].num) * path->bps;
-            break;
-        }
-    }
+    /* 7. Find the segment holding the file position. */
 
+    i = _os9_fd_findseg(path, path->filepos);
 
-    /* 9. Make out-of-loop check to insure we exited from the for()
-     *    loop due to finding the proper sector, and not because we
-     *    ran out of sectors in the segment list to search.
-     */
-    if (int3(segptr[i].lsn) == 0 || i == NUM_SEGS)
+    if (i < 0)
     {
         /* 1. Apparently, the file position in the path was too
          * large, because we couldn't find a sector.
@@ -107,44 +86,36 @@ error_code _os9_readln(os9_path_id path, void *buffer, u_int *size)
     }
 
 
-    /* 10. Start copying data into the user supplied buffer for 'bytes_left' bytes.
+    /* 8. Start copying data into the user supplied buffer for 'bytes_left' bytes.
      *
      * i == segment entry to start
      */
 
     bytes_left = *size;
     
-    while (bytes_left > 0 && i != NUM_SEGS && int3(segptr[i].lsn) != 0)
+    while (bytes_left > 0 && i < path->seg_count)
     {
         char *z;
 
-        accum_size += int2(segptr[i].num) * path->bps;
-
-
-        /* 1. Seek to sector where segment starts and compute the segment size. */
-		
-        fseek(path->fd, int3(segptr[i].lsn) * path->bps, SEEK_SET);
-        seg_size_bytes = int2(segptr[i].num) * path->bps;
-
 
-        /* 2. Seek within segment to offset. */
+        /* 1. Find the file position within this segment. */
 		
-        fseek(path->fd, path->filepos - (accum_size - seg_size_bytes), SEEK_CUR);
+        offset = int3(segptr[i].lsn) * path->bps + (path->filepos - path->seg_offset[i]);
 
 
-        /* 3. Compute read size for this segment. */
+        /* 2. Compute read size for this segment. */
 		
-        read_size = accum_size - path->filepos;
+        read_size = path->seg_offset[i + 1] - path->filepos;
 
         if (read_size > bytes_left)
         {
             read_size = bytes_left;
         }
 
-        fread(buf_ptr, 1, read_size, path->fd);
+        _image_read_at(path->image, offset, buf_ptr, read_size);
 
 
-        /* 4. Look for line terminator in this fresh buffer. */
+        /* 3. Look for line terminator in this fresh buffer. */
 		
         for (z = buf_ptr; z < buf_ptr + read_size; z++)
         {
@@ -18,7 +18,24 @@ error_code _os9_seek(os9_path_id path, int pos, int mode)
 
     if (path->israw == 1)
     {
-        fseek(path->fd, pos, mode);
+        /* The image file handle is shared by all paths on the volume,
+         * so raw paths keep their own position too.
+         */
+
+        switch (mode)
+        {
+            case SEEK_SET:
+                path->filepos = pos;
+                break;
+
+            case SEEK_CUR:
+                path->filepos = path->filepos + pos;
+                break;
+
+            case SEEK_END:
+                path->filepos = _image_size(path->image) + pos;
+                break;
+        }
     }
     else
     {
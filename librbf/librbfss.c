@@ -38,17 +38,24 @@ error_code _os9_ss_fd(os9_path_id path, int count, fd_stats *fdbuf)
     error_code	ec = 0;
     int size;
 
+    /* only writable paths may change the image */
+    if ((path->mode & FAM_WRITE) == 0)
     {
-        /* seek to FD LSN of pathlist */
-        fseek(path->fd, path->pl_fd_lsn * path->bps, SEEK_SET);	
+        return EOS_BMODE;
+    }
 
-        /* write the file descriptor sector */
+    {
+        /* write the file descriptor sector at the FD LSN of pathlist */
         size = sizeof(fd_stats);
         if (count < size)
         {
             size = count;
         }
-        fwrite(fdbuf, 1, size, path->fd);
+        _image_write_at(path->image, path->pl_fd_lsn * path->bps, fdbuf, size);
+
+        /* the cached copies are now stale, this path's included */
+        path->vol->fd_generation++;
+        path->fd_dirty = 0;
     }
 
 
@@ -80,3 +87,192 @@ error_code _os9_ss_size(os9_path_id path, int size)
 
     return(ec);
 }
+
+
+
+/*
+ * _os9_ss_prealloc()
+ *
+ * Reserve room for 'size' bytes of file in one allocation, so that
+ * writing the file won't have to grow it a cluster at a time.  The last
+ * segment is first extended into any free clusters that follow it; the
+ * rest is taken as the fewest, largest free runs there are.  The file
+ * size is not changed.
+ */
+error_code _os9_ss_prealloc(os9_path_id path, u_int size)
+{
+    error_code	ec = 0;
+    fd_stats	saved;
+    Fd_seg	segptr;
+    int		need, i, total_clusters, old_count, old_num = 0;
+
+
+    /* 1. Only files open for writing can be extended. */
+
+    if (path->israw == 1)
+    {
+        return 0;
+    }
+
+    if ((path->mode & FAM_DIR) != 0 || (path->mode & FAM_WRITE) == 0)
+    {
+        return EOS_BMODE;
+    }
+
+    ec = _os9_fd_load(path);
+
+    if (ec != 0)
+    {
+        return ec;
+    }
+
+    if (size <= path->seg_offset[path->seg_count])
+    {
+        return 0;
+    }
+
+    need = (size - path->seg_offset[path->seg_count] + path->cs - 1) / path->cs;
+
+    total_clusters = int3(path->lsn0->dd_tot) / path->spc;
+
+    if (total_clusters > path->vol->bitmap_bits)
+    {
+        total_clusters = path->vol->bitmap_bits;
+    }
+
+    saved = path->fdcache;
+    segptr = path->fdcache.fd_seg;
+    i = old_count = path->seg_count;
+
+
+    /* 2. Grow the last segment into the free clusters that follow it. */
+
+    if (i > 0)
+    {
+        int num = old_num = int2(segptr[i - 1].num);
+        int next = (int3(segptr[i - 1].lsn) + num + path->spc - 1) / path->spc;
+        int count = 0;
+
+        while (count < need && num + (count + 1) * (int)path->spc < 0x10000 &&
+            next + count < total_clusters && !_os9_ckbit(path->bitmap, next + count))
+        {
+            count++;
+        }
+
+        if (count > 0)
+        {
+            _os9_allbit(path->bitmap, next, count);
+            _int2(num + count * path->spc, segptr[i - 1].num);
+            need -= count;
+        }
+    }
+
+
+    /* 3. Add segments for the rest. */
+
+    while (need > 0)
+    {
+        int want = need, cluster, sectors;
+
+        if (i == NUM_SEGS)
+        {
+            ec = EOS_SF;
+            break;
+        }
+
+        if (want > 0xFFFF / (int)path->spc)
+        {
+            want = 0xFFFF / path->spc;
+        }
+
+        if (_os9_getBestSegment(path, want, &cluster, &sectors) != 0)
+        {
+            ec = EOS_DF;
+            break;
+        }
+
+        _int3(cluster, segptr[i].lsn);
+        _int2(sectors, segptr[i].num);
+        need -= sectors / path->spc;
+        i++;
+    }
+
+
+    /* 4. If it won't fit, give back what was taken. */
+
+    if (ec != 0)
+    {
+        int j;
+
+        if (old_count > 0 && int2(segptr[old_count - 1].num) > old_num)
+        {
+            int first = (int3(segptr[old_count - 1].lsn) + old_num + path->spc - 1) / path->spc;
+
+            _os9_delbit(path->bitmap, first, (int2(segptr[old_count - 1].num) - old_num) / path->spc);
+        }
+
+        for (j = old_count; j < i; j++)
+        {
+            _os9_delbit(path->bitmap, int3(segptr[j].lsn) / path->spc, int2(segptr[j].num) / path->spc);
+        }
+
+        path->fdcache = saved;
+
+        return ec;
+    }
+
+
+    /* 5. Write the new segment list. */
+
+    _os9_fd_reindex(path);
+    _os9_fd_flush(path);
+
+
+    return ec;
+}
+
+
+
+/*
+ * _os9_ss_writeback()
+ *
+ * With 'enable' set, the path's writes leave the FD sector in memory
+ * until _os9_ss_sync or _os9_close, instead of writing it each time
+ * the file grows.  Other paths see the old FD until then.
+ */
+error_code _os9_ss_writeback(os9_path_id path, int enable)
+{
+    if (enable == 0)
+    {
+        _os9_ss_sync(path);
+    }
+
+    path->write_back = enable;
+
+
+    return 0;
+}
+
+
+
+/*
+ * _os9_ss_sync()
+ *
+ * Write out the path's FD sector and the volume's bitmap if they have
+ * changed.
+ */
+error_code _os9_ss_sync(os9_path_id path)
+{
+    if (path->fd_dirty)
+    {
+        _os9_fd_flush(path);
+    }
+
+    if (path->mode & FAM_WRITE)
+    {
+        _os9_volume_flush(path->vol);
+    }
+
+
+    return 0;
+}
@@ -0,0 +1,543 @@
+/********************************************************************
+ * volume.c - OS-9 image volume routines
+ *
+ * All paths open on the same image file share one volume: a single
+ * file handle, one copy of LSN0 and one copy of the allocation
+ * bitmap.  The volume is reference counted and torn down when the
+ * last path on the image is closed.
+ *
+ * $Id$
+ ********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+#include "cocotypes.h"
+#include "os9path.h"
+#include "cococonv.h"
+
+
+static os9_volume_id volume_list = NULL;
+
+static u_char bits_set[256];
+
+static os9_volume_id find_volume(char *imgfile, struct stat *statbuf);
+static error_code load_volume(os9_volume_id vol);
+static void free_volume(os9_volume_id vol);
+
+
+
+/*
+ * _os9_volume_acquire()
+ *
+ * Return the volume for an image file, opening it if no other path
+ * has it open.  If 'mode' asks for write access and the volume was
+ * opened read-only, the image is reopened for update.
+ */
+error_code _os9_volume_acquire(os9_volume_id *volume, char *imgfile, int mode)
+{
+	error_code ec = 0;
+	struct stat statbuf;
+	os9_volume_id vol;
+
+
+	/* 1. Is the image already open? */
+
+	if (stat(imgfile, &statbuf) != 0)
+	{
+		return UnixToCoCoError(errno);
+	}
+
+	vol = find_volume(imgfile, &statbuf);
+
+	if (vol != NULL)
+	{
+		/* 1. Upgrade a read-only volume if write access is wanted. */
+
+		if ((mode & FAM_WRITE) && vol->writable == 0)
+		{
+			FILE *test = fopen(imgfile, "rb+");
+
+			if (test == NULL)
+			{
+				return UnixToCoCoError(errno);
+			}
+
+			fclose(test);
+
+			if (_image_reopen(vol->image, vol->imgfile, 1) != 0)
+			{
+				return UnixToCoCoError(errno);
+			}
+
+			vol->writable = 1;
+		}
+
+		vol->refcount++;
+		*volume = vol;
+
+		return 0;
+	}
+
+
+	/* 2. Allocate a new volume. */
+
+	vol = malloc(sizeof(struct _os9_volume_id));
+
+	if (vol == NULL)
+	{
+		return 1;
+	}
+
+	memset(vol, 0, sizeof(*vol));
+
+	strncpy(vol->imgfile, imgfile, sizeof(vol->imgfile) - 1);
+	vol->st_dev = statbuf.st_dev;
+	vol->st_ino = statbuf.st_ino;
+	vol->writable = (mode & FAM_WRITE) ? 1 : 0;
+
+
+	/* 3. Open a path to the image file. */
+
+	vol->image = _image_open(imgfile, vol->writable, IMAGE_AUTO);
+
+	if (vol->image == NULL)
+	{
+		ec = UnixToCoCoError(errno);
+		free(vol);
+
+		return ec;
+	}
+
+
+	/* 4. Read LSN0 and the bitmap. */
+
+	ec = load_volume(vol);
+
+	if (ec != 0)
+	{
+		_image_close(vol->image);
+		free_volume(vol);
+
+		return ec;
+	}
+
+
+	/* 5. Add it to the list of open volumes. */
+
+	vol->refcount = 1;
+	vol->next = volume_list;
+	volume_list = vol;
+
+	*volume = vol;
+
+
+	return 0;
+}
+
+
+
+/*
+ * _os9_volume_release()
+ *
+ * Drop a reference to a volume, flushing and closing it when the
+ * last reference goes away.  Returns EOS_WRITE if the image could not
+ * be written out.
+ */
+error_code _os9_volume_release(os9_volume_id vol)
+{
+	error_code ec = 0;
+	os9_volume_id *p;
+
+
+	if (--vol->refcount > 0)
+	{
+		return 0;
+	}
+
+
+	/* 1. Unlink from the list of open volumes. */
+
+	for (p = &volume_list; *p != NULL; p = &(*p)->next)
+	{
+		if (*p == vol)
+		{
+			*p = vol->next;
+			break;
+		}
+	}
+
+
+	/* 2. Write back the bitmap and close the image. */
+
+	if (vol->writable)
+	{
+		_os9_volume_flush(vol);
+	}
+
+	if (_image_close(vol->image) != 0)
+	{
+		ec = EOS_WRITE;
+	}
+
+	free_volume(vol);
+
+
+	return ec;
+}
+
+
+
+/*
+ * _os9_volume_flush()
+ *
+ * Write the bitmap sectors that changed since they were last read or
+ * written, and make sure the image length is a multiple of 256.
+ */
+error_code _os9_volume_flush(os9_volume_id vol)
+{
+	int i, pad_size;
+	long image_size;
+	char pad = 0xff;
+
+
+	if (vol->writable == 0)
+	{
+		return 0;
+	}
+
+
+	/* 1. Write back only the bitmap sectors that differ from the image. */
+
+	for (i = 0; i < vol->bitmap_sectors; i++)
+	{
+		int offset = i * vol->bps;
+		int length = vol->bitmap_bytes - offset;
+
+		if (length > (int)vol->bps)
+		{
+			length = vol->bps;
+		}
+
+		if (length <= 0)
+		{
+			break;
+		}
+
+		if (memcmp(vol->bitmap + offset, vol->bitmap_clean + offset, length) != 0)
+		{
+			_image_write_at(vol->image, vol->bps + offset, vol->bitmap + offset, length);
+			memcpy(vol->bitmap_clean + offset, vol->bitmap + offset, length);
+		}
+	}
+
+
+	/* 2. Make sure file length is an exact multiple of 256. */
+	/* Extend file length if not */
+
+	image_size = _image_size(vol->image);
+	pad_size = 256 - (image_size % 256);
+
+	if (pad_size == 256)
+	{
+		pad_size = 0;
+	}
+
+	for (i = 0; i < pad_size; i++)
+	{
+		_image_write_at(vol->image, image_size + i, &pad, 1);
+	}
+
+	_image_flush(vol->image);
+
+
+	return 0;
+}
+
+
+
+/*
+ * _os9_volume_raw_written()
+ *
+ * Keep the cached LSN0 and bitmap coherent after a raw write of
+ * 'size' bytes at image offset 'offset'.
+ */
+void _os9_volume_raw_written(os9_volume_id vol, unsigned int offset, void *buffer, unsigned int size)
+{
+	unsigned int end = offset + size;
+	unsigned int bm_start = vol->bps;
+	unsigned int bm_end = vol->bps + vol->bitmap_bytes;
+	u_char *data = buffer;
+
+
+	/* 0. The write may have landed on an FD sector or a directory. */
+
+	vol->fd_generation++;
+	_os9_dircache_invalidate(vol, 0);
+
+
+	/* 1. LSN0 */
+
+	if (offset < 256)
+	{
+		unsigned int length = (end < 256 ? end : 256) - offset;
+
+		memcpy((u_char *)vol->lsn0 + offset, data, length);
+	}
+
+
+	/* 2. Bitmap sectors; the image now matches what was written. */
+
+	if (offset < bm_end && end > bm_start)
+	{
+		unsigned int from = offset > bm_start ? offset : bm_start;
+		unsigned int to = end < bm_end ? end : bm_end;
+
+		memcpy(vol->bitmap + (from - bm_start), data + (from - offset), to - from);
+		memcpy(vol->bitmap_clean + (from - bm_start), data + (from - offset), to - from);
+
+		_os9_volume_summarize(vol, (from - bm_start) * 8, (to - from) * 8);
+	}
+}
+
+
+
+/*
+ * _os9_volume_for_bitmap()
+ *
+ * Return the open volume whose in-memory bitmap is 'bitmap', or NULL
+ * if the bitmap is not a volume's (e.g. one built by dcheck).
+ */
+os9_volume_id _os9_volume_for_bitmap(u_char *bitmap)
+{
+	os9_volume_id vol;
+
+
+	for (vol = volume_list; vol != NULL; vol = vol->next)
+	{
+		if (vol->bitmap == bitmap)
+		{
+			return vol;
+		}
+	}
+
+
+	return NULL;
+}
+
+
+
+/*
+ * _os9_volume_summarize()
+ *
+ * Recount the free bits of every summary block touched by the
+ * 'numbits' bits starting at 'firstbit'.
+ */
+void _os9_volume_summarize(os9_volume_id vol, int firstbit, int numbits)
+{
+	int block, last;
+
+
+	if (numbits <= 0)
+	{
+		return;
+	}
+
+	block = firstbit / OS9_BITMAP_BLOCK_BITS;
+	last = (firstbit + numbits - 1) / OS9_BITMAP_BLOCK_BITS;
+
+	for (; block <= last && block * OS9_BITMAP_BLOCK_BITS < vol->bitmap_bits; block++)
+	{
+		u_char *p = vol->bitmap + block * (OS9_BITMAP_BLOCK_BITS / 8);
+		int length = vol->bitmap_bits / 8 - block * (OS9_BITMAP_BLOCK_BITS / 8);
+		int i, free_bits = 0;
+
+		if (length > OS9_BITMAP_BLOCK_BITS / 8)
+		{
+			length = OS9_BITMAP_BLOCK_BITS / 8;
+		}
+
+		for (i = 0; i < length; i++)
+		{
+			free_bits += 8 - bits_set[p[i]];
+		}
+
+		vol->free_bits += free_bits - vol->bitmap_summary[block];
+		vol->bitmap_summary[block] = free_bits;
+	}
+}
+
+
+
+/*
+ * _os9_volume_free()
+ *
+ * Return the number of free clusters on the volume, counting only the
+ * clusters that LSN0 says the disk has, as 'os9 free' does.
+ */
+unsigned int _os9_volume_free(os9_volume_id vol)
+{
+	int i, clusters;
+	unsigned int free_bits = vol->free_bits;
+
+
+	clusters = vol->spc == 0 ? 0 : int3(vol->lsn0->dd_tot) / vol->spc;
+
+	if (clusters > vol->bitmap_bytes * 8)
+	{
+		clusters = vol->bitmap_bytes * 8;
+	}
+
+	/* 1. Take off the free bits past the end of the disk. */
+
+	for (i = clusters; i < vol->bitmap_bits; i++)
+	{
+		if (!_os9_ckbit(vol->bitmap, i))
+		{
+			free_bits--;
+		}
+	}
+
+
+	return free_bits;
+}
+
+
+
+static os9_volume_id find_volume(char *imgfile, struct stat *statbuf)
+{
+	os9_volume_id vol;
+
+
+	for (vol = volume_list; vol != NULL; vol = vol->next)
+	{
+		if (statbuf->st_ino != 0)
+		{
+			if (vol->st_dev == statbuf->st_dev && vol->st_ino == statbuf->st_ino)
+			{
+				return vol;
+			}
+		}
+		else if (strcmp(vol->imgfile, imgfile) == 0)
+		{
+			return vol;
+		}
+	}
+
+
+	return NULL;
+}
+
+
+
+/*
+ * load_volume()
+ *
+ * Read LSN0 and the bitmap sectors of a newly opened image.
+ */
+static error_code load_volume(os9_volume_id vol)
+{
+	/* 1. Allocate 256 bytes for LSN0. */
+
+	vol->lsn0 = (lsn0_sect *)malloc(1 * 256);
+
+	if (vol->lsn0 == NULL)
+	{
+		return 1;
+	}
+
+
+	/* 2. Read 256 byte LSN0. */
+
+	_image_read_at(vol->image, 0, vol->lsn0, 256);
+
+
+	/* 3. Compute bytes per sector from LSN0's lsnsize field. */
+
+	if (int1(vol->lsn0->dd_lsnsize) == 0)
+	{
+		/* 1. OS-9/6809 and some OS-9/68K formats have this field as 0,
+		 * which means 256 bytes/sector.
+		 */
+
+		vol->bps = 256;
+	}
+	else
+	{
+		/* 1. In this case, OS-9/68K has the proper value in
+		 * the field (1 = 256 bps, 2 = 512 bps, etc.).
+		 */
+
+		vol->bps = int1(vol->lsn0->dd_lsnsize) * 256;
+	}
+
+
+	/* 4. Compute bitmap geometry. */
+
+	vol->bitmap_sectors = (int2(vol->lsn0->dd_map) / vol->bps) +
+		(int2(vol->lsn0->dd_map) % vol->bps != 0);
+	vol->bitmap_bytes = int2(vol->lsn0->dd_map);
+	vol->spc = int2(vol->lsn0->dd_bit);
+	vol->cs = vol->spc * vol->bps;	/* compute cluster size */
+
+
+	/* 5. Read the bitmap sectors and keep a copy of them as read. */
+
+	vol->bitmap = (u_char *)malloc(vol->bitmap_sectors * vol->bps);
+	vol->bitmap_clean = (u_char *)malloc(vol->bitmap_sectors * vol->bps);
+
+	if (vol->bitmap == NULL || vol->bitmap_clean == NULL)
+	{
+		return 1;
+	}
+
+	if (_image_read_at(vol->image, 1 * vol->bps, vol->bitmap, vol->bitmap_sectors * vol->bps) == 0)
+	{
+		return EOS_EOF;
+	}
+
+	memcpy(vol->bitmap_clean, vol->bitmap, vol->bitmap_sectors * vol->bps);
+
+
+	/* 6. Count the free bits in each block of the bitmap. */
+
+	vol->bitmap_bits = vol->bitmap_sectors * vol->bps * 8;
+	vol->bitmap_summary = (int *)malloc(((vol->bitmap_bits + OS9_BITMAP_BLOCK_BITS - 1) / OS9_BITMAP_BLOCK_BITS + 1) * sizeof(int));
+
+	if (vol->bitmap_summary == NULL)
+	{
+		return 1;
+	}
+
+	memset(vol->bitmap_summary, 0, ((vol->bitmap_bits + OS9_BITMAP_BLOCK_BITS - 1) / OS9_BITMAP_BLOCK_BITS + 1) * sizeof(int));
+	vol->free_bits = 0;
+
+	if (bits_set[255] == 0)
+	{
+		int i;
+
+		for (i = 1; i < 256; i++)
+		{
+			bits_set[i] = (i & 1) + bits_set[i / 2];
+		}
+	}
+
+	_os9_volume_summarize(vol, 0, vol->bitmap_bits);
+
+
+	return 0;
+}
+
+
+
+static void free_volume(os9_volume_id vol)
+{
+	_os9_dircache_free(vol);
+	free(vol->lsn0);
+	free(vol->bitmap);
+	free(vol->bitmap_clean);
+	free(vol->bitmap_summary);
+	free(vol);
+}
@@ -12,6 +12,7 @@
 
 
 static int _os9_extendSegList(os9_path_id path, Fd_seg segptr, int *delta);
+static void _os9_undoExtend(os9_path_id path, fd_stats *saved);
 
 
 error_code _os9_write(os9_path_id path, void *buffer, u_int *size)
@@ -31,42 +32,43 @@ error_code _os9_write(os9_path_id path, void *buffer, u_int *size)
 	
     if (path->israw == 1)
     {
-		*size = fwrite(buffer, 1, *size, path->fd);
+		*size = _image_write_at(path->image, path->filepos, buffer, *size);
+
+        /* 1. Raw writes may land on LSN0 or the bitmap; keep the volume's copies current. */
+
+        _os9_volume_raw_written(path->vol, path->filepos, buffer, *size);
+        path->filepos += *size;
     }
     else
     {
-        fd_stats fd_sector;
         Fd_seg segptr;
         int i;
 		u_int accum_size = 0;
         int bytes_left;
         char *buf_ptr = buffer;
-        int seg_size_bytes, write_size;
-        u_int filesize;
+        int write_size;
+        long offset;
+        int fd_changed = 0;
+        fd_stats saved_fd;
 
-        /* 1. Seek to FD LSN of pathlist */
-
-        fseek(path->fd, path->pl_fd_lsn * path->bps, SEEK_SET);	
-	
+        /* 1. Get the (cached) file descriptor sector. */
 
-        /* 2. Read the file descriptor sector */
+        ec = _os9_fd_load(path);
 
-        fread(&fd_sector, 1, sizeof(fd_stats), path->fd);
+        if (ec != 0)
+        {
+            return ec;
+        }
 
 	
-        /* 3. Point to segment list */
+        /* 2. Point to segment list */
 
-        segptr = (Fd_seg)&(fd_sector.fd_seg);
+        segptr = (Fd_seg)&(path->fdcache.fd_seg);
 	
 
-        /* 4. Extract file size from FD */
-
-        filesize = int4(fd_sector.fd_siz);
-
+        /* 3. If our file position is greater than the file size, return error */
 
-        /* 5. If our file position is greater than the file size, return error */
-
-        if (path->filepos > filesize)
+        if (path->filepos > int4(path->fdcache.fd_siz))
         {
             /* 1. End of file. */
 			
@@ -74,12 +76,19 @@ error_code _os9_write(os9_path_id path, void *buffer, u_int *size)
         }
 
 
-        /* 6a. Determine maximum file size by adding up the segment list */
+        /* 4a. Determine maximum file size from the segment list */
 
-        accum_size = _os9_maximum_file_size( fd_sector, path->bps );
+        accum_size = path->seg_offset[path->seg_count];
 
 
-        /* 6b. If there is not enough room, we need to extend the segment list */
+        /* 4b. If there is not enough room, we need to extend the segment list.
+         *     Keep the FD as it was, to put back if the disk fills.
+         */
+
+        if (accum_size < path->filepos + *size)
+        {
+            saved_fd = path->fdcache;
+        }
 
         while (accum_size < path->filepos + *size)
         {
@@ -95,37 +104,31 @@ error_code _os9_write(os9_path_id path, void *buffer, u_int *size)
 			
             if (ec != 0)
             {
+                /* 2. Give back what was added.  The cached FD stays, as
+                 *    a write-back path's copy may hold changes the image
+                 *    doesn't have yet.
+                 */
+
+                _os9_undoExtend(path, &saved_fd);
+
                 return(ec);
             }
 			
             accum_size += delta;
+            fd_changed = 1;
         }
 
-
-        /* 7. Determine which segment the offset starts by looping
-         *    through each segptr entry until we reach the end
-         */
-
-        accum_size = 0;
-
-        for (i = 0; i < NUM_SEGS && int3(segptr[i].lsn) != 0; i++)
+        if (fd_changed)
         {
-            accum_size += int2(segptr[i].num) * path->bps;
-			if (accum_size > path->filepos)
-            {
-                /* this is the sector! */
-                accum_size -= int2(segptr[i].num) * path->bps;
-                break;
-            }
+            _os9_fd_reindex(path);
         }
-	
 
-        /* 8. make out-of-loop check to insure we exited from the for()
-         *    loop due to finding the proper sector, and not because we
-         *    ran out of sectors in the segment list to search.
-         */
 
-        if (int3(segptr[i].lsn) == 0 || i == NUM_SEGS)
+        /* 5. Find the segment holding the file position. */
+
+        i = _os9_fd_findseg(path, path->filepos);
+
+        if (i < 0)
         {
             /* 1. Apparently, the file position in the path was too
              * large, because we couldn't find a sector.
@@ -135,38 +138,30 @@ error_code _os9_write(os9_path_id path, void *buffer, u_int *size)
         }
 
 
-        /* 9. Start copying the user supplied data into the file for 'bytes_left' bytes.
+        /* 6. Start copying the user supplied data into the file for 'bytes_left' bytes.
          *
          * i == segment entry to start
          */
 
         bytes_left = *size;
 
-        while (bytes_left > 0 && i != NUM_SEGS && int3(segptr[i].lsn) != 0)
+        while (bytes_left > 0 && i < path->seg_count)
         {
-            accum_size += int2(segptr[i].num) * path->bps;
-	
-            /* 1. Seek to sector where segment starts and compute the segment size. */
-			
-            fseek(path->fd, int3(segptr[i].lsn) * path->bps, SEEK_SET);
-            seg_size_bytes = int2(segptr[i].num) * path->bps;
-	
-	
-            /* 2. Seek within segment to offset. */
+            /* 1. Find the file position within this segment. */
 			
-            fseek(path->fd, path->filepos - (accum_size - seg_size_bytes), SEEK_CUR);
+            offset = int3(segptr[i].lsn) * path->bps + (path->filepos - path->seg_offset[i]);
 	
 	
-            /* 3. Compute write size for this segment. */
+            /* 2. Compute write size for this segment. */
 			
-            write_size = accum_size - path->filepos;
+            write_size = path->seg_offset[i + 1] - path->filepos;
 
             if (write_size > bytes_left)
             {
                 write_size = bytes_left;
             }
 
-            fwrite(buf_ptr, 1, write_size, path->fd);
+            _image_write_at(path->image, offset, buf_ptr, write_size);
             buf_ptr += write_size;
             path->filepos += write_size;
             bytes_left -= write_size;
@@ -174,23 +169,35 @@ error_code _os9_write(os9_path_id path, void *buffer, u_int *size)
         }
 
 
-        /* 10. Update fd_siz if necessary. */
+        /* 7. Update fd_siz if necessary. */
 
-        if( path->filepos > int4(fd_sector.fd_siz) )
+        if( path->filepos > int4(path->fdcache.fd_siz) )
         {
             /* 1. Update file size. */
 			
-            _int4( path->filepos, fd_sector.fd_siz );
+            _int4( path->filepos, path->fdcache.fd_siz );
+            fd_changed = 1;
         }
 	
 	
-        /* 11. TODO - Update modification date/time */
+        /* 8. TODO - Update modification date/time */
 		
 			
-        /* 12. Write updated file descriptor back to image file */
+        /* 9. Write updated file descriptor back to image file only if it changed,
+         *    or leave it for _os9_ss_sync if the path writes back.
+         */
 
-        fseek(path->fd, path->pl_fd_lsn * path->bps, SEEK_SET);	
-        fwrite(&fd_sector, 1, sizeof(fd_stats), path->fd);
+        if (fd_changed)
+        {
+            if (path->write_back)
+            {
+                path->fd_dirty = 1;
+            }
+            else
+            {
+                _os9_fd_flush(path);
+            }
+        }
     }
 
     return ec;
@@ -275,6 +282,44 @@ static int _os9_extendSegList(os9_path_id path, Fd_seg segptr, int *delta)
 
 
 
+/*
+ * _os9_undoExtend()
+ *
+ * Put the segment list back as it was in 'saved', freeing the clusters
+ * added to it since.  Segments only grow at their ends, or are added
+ * after the last one.
+ */
+
+static void _os9_undoExtend(os9_path_id path, fd_stats *saved)
+{
+    Fd_seg segptr = path->fdcache.fd_seg, oldptr = saved->fd_seg;
+    int i, lsn, num, old_num;
+
+
+    /* 1. Free each segment's new sectors. */
+
+    for (i = 0; i < NUM_SEGS && int3(segptr[i].lsn) != 0; i++)
+    {
+        lsn = int3(segptr[i].lsn);
+        num = int2(segptr[i].num);
+        old_num = int3(oldptr[i].lsn) == lsn ? int2(oldptr[i].num) : 0;
+
+        if (num > old_num)
+        {
+            _os9_delbit(path->bitmap, (lsn + old_num + path->spc - 1) / path->spc, (num - old_num) / path->spc);
+        }
+    }
+
+
+    /* 2. Restore the list. */
+
+    path->fdcache = *saved;
+
+    _os9_fd_reindex(path);
+}
+
+
+
 error_code _os9_writedir(os9_path_id path, os9_dir_entry *dirent)
 {
     error_code	ec = 0;
@@ -287,11 +332,18 @@ error_code _os9_writedir(os9_path_id path, os9_dir_entry *dirent)
 	else
     {
         u_int size = sizeof(os9_dir_entry);
+		unsigned int slot = path->filepos / sizeof(os9_dir_entry);
 
 		/* 1. Temporarily turn off FAM_DIR so that read won't fail. */
 		path->mode &= ~FAM_DIR;
 		ec = _os9_write(path, dirent, &size);
 		path->mode |= FAM_DIR;
+
+		/* 2. Keep the directory lookup cache in step. */
+		if (ec == 0)
+		{
+			_os9_dircache_update(path->vol, path->pl_fd_lsn, slot, dirent);
+		}
     }
 
     return ec;
@@ -10,34 +10,72 @@
 #include <os9module.h>
 
 
+/*
+ * The OS-9 module CRC is a 24 bit CRC fed a byte at a time, high bit
+ * first, so it can be run from tables.  crc_table[0][a] is what one
+ * byte 'a' does to a zero CRC; crc_table[k][a] is that followed by k
+ * zero bytes.  With them the CRC takes eight bytes at a time: the CRC
+ * itself is folded into the first three, and each of the eight bytes
+ * is then looked up in the table for the distance left to go.  The
+ * tables are built from the shift and xor step the CRC is defined by,
+ * so both ways give the same CRC.
+ */
+
+#define CRC_SLICES	8
+
+static u_int crc_table[CRC_SLICES][256];
+static int crc_table_built = 0;
+
+static u_int crc_step(u_int crc, u_char a);
+static void build_crc_table(void);
+
+
+
 error_code _os9_crc_compute(u_char *ptr, u_int sz, u_char *crc)
 {
 	error_code	ec = 0;
-	u_char  a;
-	u_int   i;
+	u_int	c;
 
-	for (i = 0; i < sz; i++)
+
+	if (crc_table_built == 0)
 	{
-		a = *(ptr++);
-
-		a ^= crc[0];
-		crc[0] = crc[1];
-		crc[1] = crc[2];
-		crc[1] ^= (a >> 7);
-		crc[2] = (a << 1);
-		crc[1] ^= (a >> 2);
-		crc[2] ^= (a << 6);
-		a ^= (a << 1);
-		a ^= (a << 2);
-		a ^= (a << 4);
-
-		if (a & 0x80)
-		{
-			crc[0] ^= 0x80;
-			crc[2] ^= 0x21;
-		}
+		build_crc_table();
+	}
+
+	c = (crc[0] << 16) | (crc[1] << 8) | crc[2];
+
+
+	/* 1. Eight bytes at a time. */
+
+	while (sz >= CRC_SLICES)
+	{
+		u_int x = c ^ ((ptr[0] << 16) | (ptr[1] << 8) | ptr[2]);
+
+		c = crc_table[7][x >> 16] ^
+			crc_table[6][(x >> 8) & 0xFF] ^
+			crc_table[5][x & 0xFF] ^
+			crc_table[4][ptr[3]] ^
+			crc_table[3][ptr[4]] ^
+			crc_table[2][ptr[5]] ^
+			crc_table[1][ptr[6]] ^
+			crc_table[0][ptr[7]];
+
+		ptr += CRC_SLICES;
+		sz -= CRC_SLICES;
 	}
 
+
+	/* 2. Then a byte at a time. */
+
+	while (sz-- > 0)
+	{
+		c = ((c << 8) & 0xFFFFFF) ^ crc_table[0][(c >> 16) ^ *(ptr++)];
+	}
+
+	crc[0] = c >> 16;
+	crc[1] = c >> 8;
+	crc[2] = c;
+
 	if ((crc[0] == OS9_CRC0) &&
 		(crc[1] == OS9_CRC1) &&
 		(crc[2] == OS9_CRC2))
@@ -50,6 +88,54 @@ error_code _os9_crc_compute(u_char *ptr, u_int sz, u_char *crc)
 
 
 
+/* One byte of the CRC, as OS-9 defines it */
+
+static u_int crc_step(u_int crc, u_char a)
+{
+	u_char	c0 = crc >> 16, c1 = crc >> 8, c2 = crc;
+
+	a ^= c0;
+	c0 = c1;
+	c1 = c2;
+	c1 ^= (a >> 7);
+	c2 = (a << 1);
+	c1 ^= (a >> 2);
+	c2 ^= (a << 6);
+	a ^= (a << 1);
+	a ^= (a << 2);
+	a ^= (a << 4);
+
+	if (a & 0x80)
+	{
+		c0 ^= 0x80;
+		c2 ^= 0x21;
+	}
+
+	return (c0 << 16) | (c1 << 8) | c2;
+}
+
+
+
+static void build_crc_table(void)
+{
+	int	i, k;
+
+
+	for (i = 0; i < 256; i++)
+	{
+		crc_table[0][i] = crc_step(0, i);
+
+		for (k = 1; k < CRC_SLICES; k++)
+		{
+			crc_table[k][i] = crc_step(crc_table[k - 1][i], 0);
+		}
+	}
+
+	crc_table_built = 1;
+}
+
+
+
 /* Calculate the OS-9/6809 module CRC, returning 0 == !OK, 1 == OK */
 
 error_code _os9_crc(OS9_MODULE_t *mod)
@@ -0,0 +1,216 @@
+/********************************************************************
+ * $Id$
+ *
+ * OS-9 module scanner
+ *
+ * Walks a buffer holding OS-9 modules, such as a boot file or a ROM
+ * image read or mapped into memory, and returns a table of the modules
+ * in it with their header parity and CRC checked.  By default the
+ * modules must follow one another from the start of the buffer, and
+ * both OS-9/6809 and OS-9/68K modules are recognised; the scan stops
+ * at the first thing that isn't a good module header.  With
+ * MODSCAN_SEARCH every $87CD with a good header parity is taken to be
+ * an OS-9/6809 module, wherever it is, and anything between modules is
+ * skipped.
+ ********************************************************************/
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include <cocopath.h>
+#include <cocotypes.h>
+#include <os9module.h>
+
+
+static int check_module(u_char *buffer, u_int length, u_int offset, OS9_MODSCAN_t *entry);
+static error_code add_entry(OS9_MODSCAN_t **table, int *count, int *size, OS9_MODSCAN_t *entry);
+
+
+
+/*
+ * _os9_modscan()
+ *
+ * Fill in '*table' with the modules in 'buffer', and '*count' with how
+ * many there are.  The table is allocated with malloc; the caller frees
+ * it.  A back to back scan that stops early ends with an entry saying
+ * why: MODSCAN_BADPARITY, MODSCAN_SHORT or MODSCAN_NONE.
+ */
+error_code _os9_modscan(u_char *buffer, u_int length, int flags, OS9_MODSCAN_t **table, int *count)
+{
+	error_code	ec = 0;
+	OS9_MODSCAN_t	entry;
+	u_int	offset = 0;
+	int		size = 0;
+
+
+	*table = NULL;
+	*count = 0;
+
+	while (offset < length && ec == 0)
+	{
+		/* 1. Searching, skip to the next $87CD. */
+
+		if (flags & MODSCAN_SEARCH)
+		{
+			while (offset + 1 < length &&
+				(buffer[offset] != OS9_ID0 || buffer[offset + 1] != OS9_ID1))
+			{
+				offset++;
+			}
+
+			if (offset + 1 >= length)
+			{
+				break;
+			}
+		}
+
+
+		/* 2. Check the module there. */
+
+		check_module(buffer, length, offset, &entry);
+
+		if ((flags & MODSCAN_SEARCH) && (entry.status == MODSCAN_BADPARITY || entry.status == MODSCAN_NONE))
+		{
+			/* Not a module after all */
+
+			offset++;
+
+			continue;
+		}
+
+		ec = add_entry(table, count, &size, &entry);
+
+		if (entry.status != MODSCAN_GOOD && entry.status != MODSCAN_BADCRC)
+		{
+			break;
+		}
+
+		offset += entry.size;
+	}
+
+	if (ec != 0)
+	{
+		free(*table);
+		*table = NULL;
+		*count = 0;
+	}
+
+
+	return ec;
+}
+
+
+
+/* Check the header, size and CRC of the module at 'offset' */
+
+static int check_module(u_char *buffer, u_int length, u_int offset, OS9_MODSCAN_t *entry)
+{
+	u_char	*mod = buffer + offset;
+	u_int	left = length - offset;
+	u_int	header_size;
+
+
+	entry->offset = offset;
+	entry->size = 0;
+	entry->osk = 0;
+	entry->parity = 0;
+
+
+	/* 1. Which kind of module is it? */
+
+	if (left >= 2 && mod[0] == OS9_ID0 && mod[1] == OS9_ID1)
+	{
+		header_size = OS9_HEADER_SIZE;
+	}
+	else if (left >= 2 && mod[0] == OSK_ID0 && mod[1] == OSK_ID1)
+	{
+		header_size = OSK_HEADER_SIZE;
+		entry->osk = 1;
+	}
+	else
+	{
+		return entry->status = MODSCAN_NONE;
+	}
+
+	if (left < header_size)
+	{
+		entry->size = header_size;
+
+		return entry->status = MODSCAN_SHORT;
+	}
+
+
+	/* 2. The header parity must be good. */
+
+	if (entry->osk)
+	{
+		entry->parity = _osk_header((OSK_MODULE_t *)mod);
+		entry->size = int4(((OSK_MODULE_t *)mod)->size);
+
+		if (entry->parity != 0xFFFF)
+		{
+			return entry->status = MODSCAN_BADPARITY;
+		}
+	}
+	else
+	{
+		entry->parity = _os9_header((OS9_MODULE_t *)mod);
+		entry->size = INT(((OS9_MODULE_t *)mod)->size);
+
+		if (entry->parity != 0xFF)
+		{
+			return entry->status = MODSCAN_BADPARITY;
+		}
+	}
+
+
+	/* 3. It must hold at least its header and CRC, and all of it must
+	 *    be in the buffer.
+	 */
+
+	if (entry->size < header_size + 3)
+	{
+		return entry->status = MODSCAN_NONE;
+	}
+
+	if (entry->size > left)
+	{
+		return entry->status = MODSCAN_SHORT;
+	}
+
+
+	/* 4. Check the CRC. */
+
+	{
+		u_char	crc[3] = {0xff, 0xff, 0xff};
+
+		entry->status = _os9_crc_compute(mod, entry->size, crc) ? MODSCAN_GOOD : MODSCAN_BADCRC;
+	}
+
+
+	return entry->status;
+}
+
+
+
+static error_code add_entry(OS9_MODSCAN_t **table, int *count, int *size, OS9_MODSCAN_t *entry)
+{
+	if (*count == *size)
+	{
+		OS9_MODSCAN_t *bigger;
+
+		*size = *size ? *size * 2 : 32;
+		bigger = realloc(*table, *size * sizeof(OS9_MODSCAN_t));
+
+		if (bigger == NULL)
+		{
+			return EOS_OM;
+		}
+
+		*table = bigger;
+	}
+
+	(*table)[(*count)++] = *entry;
+
+
+	return 0;
+}
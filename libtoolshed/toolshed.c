@@ -3,10 +3,23 @@
  ********************************************************************/
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 
 #include <toolshed.h>
 
 
+static error_code CopyBuffered(coco_path_id path, coco_path_id destpath, char *buffer, u_int buffer_size);
+static error_code CopyTranslated(coco_path_id path, coco_path_id destpath, char *buffer, u_int buffer_size);
+static error_code CopyExtents(coco_path_id path, coco_path_id destpath, char *buffer, u_int buffer_size);
+#ifndef WIN32
+static error_code CopyRange(int in_fd, off_t in_offset, coco_path_id destpath, int out_fd, off_t out_offset, u_int length, char *buffer, u_int buffer_size);
+#endif
+
+
 void TSReportError(error_code te, char *errorstr)
 {
 	switch (te)
@@ -338,10 +351,65 @@ error_code TSCopyFile(char *srcfile, char *dstfile, int eolTranslate, int rewrit
     }
 
 
+    /* 4. Copy the data, translating line endings between native and
+     *    CoCo files if asked to, and otherwise extent by extent when
+     *    both ends can be reached through a host file.
+     */
+
+    if (eolTranslate == 1 && (path->type == NATIVE) != (destpath->type == NATIVE))
+    {
+        ec = CopyTranslated(path, destpath, buffer, buffer_size);
+    }
+    else
+    {
+        u_int size;
+
+        /* Lay the whole file out on the destination before writing it. */
+
+        if (_coco_gs_size(path, &size) == 0)
+        {
+            _coco_ss_prealloc(destpath, size);
+        }
+
+        ec = CopyExtents(path, destpath, buffer, buffer_size);
+
+        if (ec == EOS_BMODE)
+        {
+            ec = CopyBuffered(path, destpath, buffer, buffer_size);
+        }
+    }
+
+
+    /* Copy meta data from file descriptor of source to destination */
+
+    _coco_gs_fd(path, &fdesc);
+
+	if ( (owner_set == 1) || (path->type == NATIVE) )
+	{
+		fdesc.user_id = owner % 65536;
+		fdesc.group_id = owner / 65536;
+	}
+
+    _coco_ss_fd(destpath, &fdesc);
+
+    _coco_close(path);
+    _coco_close(destpath);
+
+
+    return ec;
+}
+
+
+/*
+ * Copy a file through the caller's buffer.
+ */
+static error_code CopyBuffered(coco_path_id path, coco_path_id destpath, char *buffer, u_int buffer_size)
+{
+    error_code	ec = 0;
+
+
     while (_coco_gs_eof(path) == 0)
     {
-        char *newBuffer;
-        u_int newSize;
         u_int size = buffer_size;
 
         ec = _coco_read(path, buffer, &size);
@@ -351,38 +419,63 @@ error_code TSCopyFile(char *srcfile, char *dstfile, int eolTranslate, int rewrit
             break;
         }
 
-        if (eolTranslate == 1)
+        ec = _coco_write(destpath, buffer, &size);
+
+        if (ec != 0)
         {
-            if (path->type == NATIVE && destpath->type != NATIVE)
-            {
-                /* source is native, destination is OS-9 or DECB */
+            break;
+        }
+    }
 
-                NativeToCoCo(buffer, size, &newBuffer, &newSize);
 
-                ec = _coco_write(destpath, newBuffer, &newSize);
+    return ec;
+}
 
-                free(newBuffer);
-		newBuffer=NULL;
-            }
-            else if (path->type != NATIVE && destpath->type == NATIVE)
-            {
-                /* source is OS-9 or DECB, destination is native */
 
-                CoCoToNative(buffer, size, &newBuffer, &newSize);
+/*
+ * Copy a file through the caller's buffer, translating line endings in
+ * place.  On WIN32 an OS-9 EOL becomes two bytes, so only half a buffer
+ * is read at a time when copying out to a native file.
+ */
+static error_code CopyTranslated(coco_path_id path, coco_path_id destpath, char *buffer, u_int buffer_size)
+{
+    error_code	ec = 0;
+    u_int	read_size = buffer_size;
 
-                ec = _coco_write(destpath, newBuffer, &newSize);
 
-                free(newBuffer);
-		newBuffer=NULL;
-            }
+#ifdef WIN32
+    if (destpath->type == NATIVE)
+    {
+        read_size = buffer_size / 2;
+    }
+#endif
+
+    while (_coco_gs_eof(path) == 0)
+    {
+        u_int size = read_size;
+
+        ec = _coco_read(path, buffer, &size);
+
+        if (ec != 0)
+        {
+            break;
+        }
+
+        if (path->type == NATIVE)
+        {
+            /* source is native, destination is OS-9 or DECB */
+
+            size = NativeToCoCoInPlace(buffer, size);
         }
         else
         {
-            /* One-to-one writing of the data -- no translation needed. */
+            /* source is OS-9 or DECB, destination is native */
 
-            ec = _coco_write(destpath, buffer, &size);
+            size = CoCoToNativeInPlace(buffer, size);
         }
 
+        ec = _coco_write(destpath, buffer, &size);
+
         if (ec != 0)
         {
             break;
@@ -390,143 +483,335 @@ error_code TSCopyFile(char *srcfile, char *dstfile, int eolTranslate, int rewrit
     }
 
 
-    /* Copy meta data from file descriptor of source to destination */
+    return ec;
+}
 
-    _coco_gs_fd(path, &fdesc);
 
-	if ( (owner_set == 1) || (path->type == NATIVE) )
-	{
-		fdesc.user_id = owner % 65536;
-		fdesc.group_id = owner / 65536;
-	}
+/*
+ * Copy a file into a native file or an OS-9 image by moving each extent
+ * of the source straight from its host file to the destination's, with
+ * copy_file_range where the kernel has it and pread/pwrite otherwise.
+ * Data for an OS-9 destination is written through its image.
+ * An OS-9 destination is given the source's size up front, so that its
+ * segments, already laid out by _coco_ss_prealloc, can be found as
+ * extents too.  Returns EOS_BMODE, having copied nothing, if either end
+ * can't be reached that way.
+ */
+static error_code CopyExtents(coco_path_id path, coco_path_id destpath, char *buffer, u_int buffer_size)
+{
+#ifdef WIN32
+    return EOS_BMODE;
+#else
+    error_code	ec = 0;
+    int		in_fd, out_fd = -1;
+    u_int	in_offset, out_offset = 0, length, out_length, pos, size;
 
-    _coco_ss_fd(destpath, &fdesc);
 
-    _coco_close(path);
-    _coco_close(destpath);
+    /* 1. The source must be reachable through its host file. */
 
+    ec = _coco_gs_extent(path, &in_fd, &in_offset, &length);
 
-    return ec;
-}
+    if (ec == EOS_EOF)
+    {
+        return 0;
+    }
 
+    if (ec != 0)
+    {
+        return EOS_BMODE;
+    }
 
-/*
- * Converts a buffer containing native EOLs to one with OS-9 EOLs.
- *
- * The caller must free the returned buffer in 'newBuffer' once
- * finished with the buffer.
- */
-void NativeToCoCo(char *buffer, int size, char **newBuffer, u_int *newSize)
-{
-    EOL_Type	eolMethod;
-    int		i;
+    _coco_gs_pos(path, &pos);
 
 
-    eolMethod = DetermineEOLType(buffer, size);
+    /* 2. So must the destination: a native file takes the data where it
+     *    stands, and an OS-9 file is sized to hold all of it.
+     */
 
-    switch (eolMethod)
+    switch (destpath->type)
     {
-        case EOL_UNIX:
-            /* Change all occurences of 0x0A to 0x0D */
+        case NATIVE:
+            if (_coco_gs_extent(destpath, &out_fd, &out_offset, &out_length) != 0)
+            {
+                return EOS_BMODE;
+            }
+            break;
 
-            for(i = 0; i < size; i++)
+        case OS9:
+            if (_coco_gs_size(path, &size) != 0 || _coco_ss_size(destpath, size) != 0)
             {
-                if (buffer[i] == 0x0A)
+                return EOS_BMODE;
+            }
+
+            /* The segments laid out for the file must reach its end.
+             * Write the last byte through the path, so that the image
+             * is extended over the file by the image layer, which keeps
+             * track of its length.
+             */
+
+            if (size > 0)
+            {
+                char	last = 0;
+                u_int	one = 1;
+
+                _coco_seek(destpath, size - 1, SEEK_SET);
+
+                if (_coco_gs_extent(destpath, &out_fd, &out_offset, &out_length) != 0 ||
+                    _coco_write(destpath, &last, &one) != 0)
                 {
-                    buffer[i] = 0x0D;
+                    _coco_ss_size(destpath, 0);
+                    _coco_seek(destpath, 0, SEEK_SET);
+
+                    return EOS_BMODE;
                 }
             }
-            *newBuffer = (char *)malloc(size);
-            if (*newBuffer == NULL)
+
+            _coco_seek(destpath, pos, SEEK_SET);
+
+            if (_coco_gs_extent(destpath, &out_fd, &out_offset, &out_length) != 0)
             {
-                return;
+                _coco_ss_size(destpath, 0);
+                _coco_seek(destpath, 0, SEEK_SET);
+
+                return EOS_BMODE;
             }
+            break;
 
-            memcpy(*newBuffer, buffer, size);
+        default:
+            return EOS_BMODE;
+    }
 
-            *newSize = size;
 
-            break;
+    /* 3. Move one extent at a time, splitting it where the destination's
+     *    extents end.
+     */
 
-        case EOL_DOS:
-            /* Things are a bit more involved here. */
+    while (ec == 0 && length > 0)
+    {
+        if (destpath->type == OS9)
+        {
+            _coco_seek(destpath, pos, SEEK_SET);
 
-            /* We will strip all 0x0As out of the buffer, leaving the 0x0Ds. */
+            ec = _coco_gs_extent(destpath, &out_fd, &out_offset, &out_length);
 
+            if (ec != 0)
             {
-                int dosEOLCount = 0;
-                char *newP;
-                int i;
+                break;
+            }
 
+            if (length > out_length)
+            {
+                length = out_length;
+            }
+        }
 
-                /* 1. First we count up the number of 0x0A line endings. */
+        ec = CopyRange(in_fd, in_offset, destpath, out_fd, out_offset, length, buffer, buffer_size);
 
-                for (i = 0; i < size; i++)
-                {
-                    if (buffer[i] == 0x0A)
-                    {
-                        dosEOLCount++;
-                    }
-                }
+        if (ec != 0)
+        {
+            break;
+        }
 
+        out_offset += length;
+        pos += length;
 
-                /* 2. Now we allocate a buffer to hold the current size -
-                    'dosEOLCount' bytes.
-                */
+        _coco_seek(path, pos, SEEK_SET);
 
-                *newSize = size - dosEOLCount;
+        ec = _coco_gs_extent(path, &in_fd, &in_offset, &length);
+    }
 
-                *newBuffer = (char *)malloc(*newSize);
+    if (ec == EOS_EOF)
+    {
+        ec = 0;
+    }
 
-                if (*newBuffer == NULL)
-                {
-                    return;
-                }
 
-                newP = *newBuffer;
+    /* 4. Leave the destination positioned at the end of the data. */
 
-                for (i = 0; i < size; i++)
-                {
-                    if (buffer[i] != 0x0A)
-                    {
-                        *newP = buffer[i];
-                        newP++;
-                    }
-                }
-            }
+    _coco_seek(destpath, destpath->type == OS9 ? pos : out_offset, SEEK_SET);
+
+
+    return ec;
+#endif
+}
+
+
+#ifndef WIN32
+/*
+ * Copy 'length' bytes from a host file into the destination at the
+ * given offsets.  A native destination is written straight to its host
+ * file; an OS-9 one through its image, so that the volume's cached
+ * sectors stay coherent.
+ */
+static error_code CopyRange(int in_fd, off_t in_offset, coco_path_id destpath, int out_fd, off_t out_offset, u_int length, char *buffer, u_int buffer_size)
+{
+#ifdef __NR_copy_file_range
+    while (destpath->type == NATIVE && length > 0)
+    {
+        loff_t	in_off = in_offset, out_off = out_offset;
+        long	count = syscall(__NR_copy_file_range, in_fd, &in_off, out_fd, &out_off, (size_t)length, 0);
+
+        if (count <= 0)
+        {
+            /* ENOSYS, EXDEV and the like: do the rest by hand */
             break;
+        }
 
-        default:
-            /* No eols, binary copy */
+        in_offset += count;
+        out_offset += count;
+        length -= count;
+    }
+#endif
+
+    while (length > 0)
+    {
+        ssize_t count = pread(in_fd, buffer, length < buffer_size ? length : buffer_size, in_offset);
 
-            *newBuffer = (char *)malloc(size);
-            if (*newBuffer == NULL)
+        if (count <= 0)
+        {
+            return count == 0 ? EOS_EOF : UnixToCoCoError(errno);
+        }
+
+        if (destpath->type == OS9)
+        {
+            os9_path_id	os9 = destpath->path.os9;
+
+            if (_image_write_at(os9->image, out_offset, buffer, count) != (size_t)count)
             {
-                return;
+                return EOS_WRITE;
             }
 
-            memcpy(*newBuffer, buffer, size);
+            _os9_volume_raw_written(os9->vol, out_offset, buffer, count);
+        }
+        else if (pwrite(out_fd, buffer, count, out_offset) != count)
+        {
+            return UnixToCoCoError(errno);
+        }
+
+        in_offset += count;
+        out_offset += count;
+        length -= count;
+    }
+
 
-            *newSize = size;
+    return 0;
+}
+#endif
 
+
+/*
+ * Converts a buffer containing native EOLs to one with OS-9 EOLs.
+ *
+ * The caller must free the returned buffer in 'newBuffer' once
+ * finished with the buffer.
+ */
+void NativeToCoCo(char *buffer, int size, char **newBuffer, u_int *newSize)
+{
+    *newBuffer = (char *)malloc(size);
+    if (*newBuffer == NULL)
+    {
+        return;
     }
 
+    memcpy(*newBuffer, buffer, size);
+
+    *newSize = NativeToCoCoInPlace(*newBuffer, size);
+
 
     return;
 }
 
 
+/*
+ * Converts a buffer containing OS-9 EOLs to one with native EOLs.
+ *
+ * The caller must free the returned buffer in 'newBuffer' once
+ * finished with the buffer.
+ */
 void CoCoToNative(char *buffer, int size, char **newBuffer, u_int *newSize)
 {
 #ifdef WIN32
-    int dosEOLCount = 0;
-    char *newP;
-    int		i;
+    /* Make room for the translation to grow into. */
 
+    *newBuffer = (char *)malloc(size * 2);
+#else
+    *newBuffer = (char *)malloc(size);
+#endif
+    if (*newBuffer == NULL)
+    {
+        return;
+    }
 
-    /* Things are a bit more involved here. */
+    memcpy(*newBuffer, buffer, size);
 
-    /* We will add 0x0As after all 0x0Ds. */
+    *newSize = CoCoToNativeInPlace(*newBuffer, size);
+
+
+    return;
+}
+
+
+/*
+ * Converts native EOLs in a buffer to OS-9 EOLs, returning the new
+ * size of the data, which is never larger than 'size'.
+ */
+u_int NativeToCoCoInPlace(char *buffer, u_int size)
+{
+    EOL_Type	eolMethod;
+    u_int	i, newSize = size;
+
+
+    eolMethod = DetermineEOLType(buffer, size);
+
+    switch (eolMethod)
+    {
+        case EOL_UNIX:
+            /* Change all occurences of 0x0A to 0x0D */
+
+            for(i = 0; i < size; i++)
+            {
+                if (buffer[i] == 0x0A)
+                {
+                    buffer[i] = 0x0D;
+                }
+            }
+            break;
+
+        case EOL_DOS:
+            /* We will strip all 0x0As out of the buffer, leaving the 0x0Ds. */
+
+            newSize = 0;
+
+            for (i = 0; i < size; i++)
+            {
+                if (buffer[i] != 0x0A)
+                {
+                    buffer[newSize++] = buffer[i];
+                }
+            }
+            break;
+
+        default:
+            /* No eols, binary copy */
+            break;
+    }
+
+
+    return newSize;
+}
+
+
+/*
+ * Converts OS-9 EOLs in a buffer to native EOLs, returning the new size
+ * of the data.  On WIN32 each EOL grows to two bytes, so the buffer must
+ * have room for twice 'size' bytes.
+ */
+u_int CoCoToNativeInPlace(char *buffer, u_int size)
+{
+#ifdef WIN32
+    u_int	dosEOLCount = 0;
+    u_int	i, newSize;
+    char	*newP;
 
 
     /* 1. First we count up the number of 0x0D OS-9 line endings. */
@@ -540,33 +825,25 @@ void CoCoToNative(char *buffer, int size, char **newBuffer, u_int *newSize)
     }
 
 
-    /* 2. Now we allocate a buffer to hold the current size +
-        'dosEOLCount' bytes.
-    */
-
-    *newSize = size + dosEOLCount;
-    *newBuffer = (char *)malloc(*newSize);
-
-    if (*newBuffer == NULL)
-    {
-        return;
-    }
+    /* 2. Then we add 0x0As after all 0x0Ds, working from the end. */
 
-    newP = *newBuffer;
+    newSize = size + dosEOLCount;
+    newP = buffer + newSize;
 
-    for (i = 0; i < size; i++)
+    for (i = size; i > 0; i--)
     {
-        *newP = buffer[i];
-        newP++;
-
-        if (buffer[i] == 0x0D)
+        if (buffer[i - 1] == 0x0D)
         {
-            *newP = 0x0A;
-            newP++;
+            *--newP = 0x0A;
         }
+
+        *--newP = buffer[i - 1];
     }
+
+
+    return newSize;
 #else
-    int		i;
+    u_int	i;
 
 
     /* Change all occurences of 0x0D to 0x0A */
@@ -579,19 +856,9 @@ void CoCoToNative(char *buffer, int size, char **newBuffer, u_int *newSize)
         }
     }
 
-    *newBuffer = (char *)malloc(size);
-    if (*newBuffer == NULL)
-    {
-        return;
-    }
-
-    memcpy(*newBuffer, buffer, size);
 
-    *newSize = size;
+    return size;
 #endif
-
-
-    return;
 }
 
 
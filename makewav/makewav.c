@@ -63,6 +63,14 @@ unsigned char  *buffer_1200,
 int             buffer_1200_length,
                 buffer_2400_length;
 
+/* The waveform of every byte value, and audio waiting to be written */
+#define OUT_SIZE (256 * 1024)
+
+unsigned char  *byte_waves;
+int             byte_wave_offset[257];
+unsigned char   out_buffer[OUT_SIZE];
+int             out_length;
+
 #define VERIFY(COND, MSG) \
 	do { \
 	  if (!(COND)) { \
@@ -110,31 +118,38 @@ void            fwrite_le_short(unsigned short data, FILE * output)
 	fwrite(&use_data, 2, 1, output);
 }
 
+void            flush_audio(FILE * output)
+{
+	fwrite(out_buffer, out_length, 1, output);
+	out_length = 0;
+}
+
+void            queue_audio(unsigned char *data, int length, FILE * output)
+{
+	if (out_length + length > OUT_SIZE)
+		flush_audio(output);
+
+	memcpy(out_buffer + out_length, data, length);
+	out_length += length;
+}
+
 int             fwrite_audio_byte(int byte, FILE * output)
 {
-	int             result = 0,
-	                j;
+	int             result = 0;
+
+	byte &= 0xFF;
 
 	if (cas)
 	{
-		fputc(byte, output);
+		unsigned char   c = byte;
+
+		queue_audio(&c, 1, output);
 		result = 1;
 	}
 	else
 	{
-		for (j = 0; j < 8; j++)
-		{
-			if (((byte >> j) & 0x01) == 0)
-			{
-				fwrite(buffer_1200, buffer_1200_length, 1, output);
-				result += buffer_1200_length;
-			}
-			else
-			{
-				fwrite(buffer_2400, buffer_2400_length, 1, output);
-				result += buffer_2400_length;
-			}
-		}
+		result = byte_wave_offset[byte + 1] - byte_wave_offset[byte];
+		queue_audio(byte_waves + byte_wave_offset[byte], result, output);
 	}
 
 	return result;
@@ -155,11 +170,18 @@ int             fwrite_audio(char *buffer, int length, FILE * output)
 
 int             fwrite_repeat_byte(int length, unsigned char byte, FILE * output)
 {
-	int             i;
+	int             count,
+	                left = length;
 
-	for (i = 0; i < length; i++)
+	while (left > 0)
 	{
-		fputc(byte, output);
+		if (out_length == OUT_SIZE)
+			flush_audio(output);
+
+		count = OUT_SIZE - out_length < left ? OUT_SIZE - out_length : left;
+		memset(out_buffer + out_length, byte, count);
+		out_length += count;
+		left -= count;
 	}
 
 	return length;
@@ -199,6 +221,48 @@ unsigned char   Checksum_Buffer(unsigned char *buffer, int count)
 	return result;
 }
 
+/* Lay out each byte's waveform, least significant bit first */
+int             Build_Byte_Waves(void)
+{
+	int             byte,
+	                j,
+	                size = 0;
+	unsigned char  *p;
+
+	for (byte = 0; byte < 256; byte++)
+	{
+		byte_wave_offset[byte] = size;
+
+		for (j = 0; j < 8; j++)
+			size += ((byte >> j) & 0x01) ? buffer_2400_length : buffer_1200_length;
+	}
+
+	byte_wave_offset[256] = size;
+	byte_waves = malloc(size);
+
+	if (byte_waves == NULL)
+		return -1;
+
+	for (p = byte_waves, byte = 0; byte < 256; byte++)
+	{
+		for (j = 0; j < 8; j++)
+		{
+			if (((byte >> j) & 0x01) == 0)
+			{
+				memcpy(p, buffer_1200, buffer_1200_length);
+				p += buffer_1200_length;
+			}
+			else
+			{
+				memcpy(p, buffer_2400, buffer_2400_length);
+				p += buffer_2400_length;
+			}
+		}
+	}
+
+	return 0;
+}
+
 void            Build_Sinusoidal_Buffer(unsigned char *buffer, int length)
 {
 	double          increment = (PI * 2.0) / length;
@@ -566,6 +630,12 @@ int             main(int argc, char **argv)
 
 	Build_Sinusoidal_Buffer(buffer_2400, buffer_2400_length);
 
+	if (Build_Byte_Waves() != 0)
+	{
+		fprintf(stderr, "Could not allocate memory for byte waveforms\n");
+		return -1;
+	}
+
 	int             headers_size = 4 +	/* RIFF */
 							4 +			/* Data size */
 							4 +			/* RIFF type */
@@ -672,6 +742,7 @@ int             main(int argc, char **argv)
 	sample_count += fwrite_audio_silence((double)sample_rate * 0.003, output);	/* .003 seconds of silence */
 	sample_count += fwrite_audio("\x55\x3c\xff\x00\xff\x55", 6, output);
 	sample_count += fwrite_audio_silence(sample_rate * 2, output);			/* 2 seconds of silence */
+	flush_audio(output);
 
 	if (!cas)
 	{
@@ -686,6 +757,7 @@ int             main(int argc, char **argv)
 	fclose(srec);
 	free(buffer_1200);
 	free(buffer_2400);
+	free(byte_waves);
 	free(pbuffer);
 	
 	return 0;
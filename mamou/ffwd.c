@@ -6,35 +6,27 @@
 * The Mamou Assembler - A Hitachi 6309 assembler
 *
 * (C) 2004 Boisy G. Pitre
+*
+* Pass 1 appends the file and line of each forward reference to an
+* array in the assembler state, and pass 2 reads them back in the same
+* order, so no temporary file is needed and any number of assemblies
+* can run in one directory at once.
 ***************************************************************************/
 
 #include "mamou.h"
 
-coco_path_id	forward_path;		/* temp file's file descriptor	*/
-
-char	fwd_name[] = { "fwd_refs" } ;
 
 /*!
 	@function fwd_init
-	@discussion Initializes the forward reference file
+	@discussion Initializes the forward reference list
 	@param as The assembler state structure
  */
 void fwd_init(assembler *as)
 {
-	coco_file_stat fstat;
-	
-	fstat.perms = FAP_READ | FAP_WRITE;
-	if (_coco_create(&forward_path, fwd_name, FAM_READ | FAM_WRITE, &fstat) != 0)
-	{
-		fatal("Cannot create forward reference file.");
-	}
-
-	_coco_close(forward_path); /* close and reopen for reads and writes */
-
-	if (_coco_open(&forward_path, fwd_name, FAM_READ | FAM_WRITE) != 0)
-	{
-		fatal("Cannot open forward reference file.");
-	}
+	as->fwd_refs = NULL;
+	as->fwd_count = 0;
+	as->fwd_size = 0;
+	as->fwd_next_ref = 0;
 
 	return;
 }
@@ -42,14 +34,16 @@ void fwd_init(assembler *as)
 
 /*!
 	@function fwd_deinit
-	@discussion Deinitializes the forward reference file
+	@discussion Deinitializes the forward reference list
 	@param as The assembler state structure
  */
 void fwd_deinit(assembler *as)
 {
-	_coco_close(forward_path);
+	free(as->fwd_refs);
 
-	_coco_delete(fwd_name);
+	as->fwd_refs = NULL;
+	as->fwd_count = 0;
+	as->fwd_size = 0;
 
 	return;
 }
@@ -57,25 +51,21 @@ void fwd_deinit(assembler *as)
 
 /*!
 	@function fwd_reinit
-	@discussion Reinitializes the forward reference file
+	@discussion Rewinds the forward reference list for pass 2
 	@param as The assembler state structure
  */
 void fwd_reinit(assembler *as)
 {
-	u_int			size;
-	
 	as->F_ref   = 0;
 	as->Ffn     = 0;
+	as->fwd_next_ref = 0;
 
-	_coco_seek(forward_path, 0L, SEEK_SET);   /* rewind forward refs */
-
-	size = sizeof(as->Ffn);
-	
-	_coco_read(forward_path, (char *)&as->Ffn, &size);
-
-	size = sizeof(as->F_ref);
-	
-	_coco_read(forward_path, (char *)&as->F_ref, &size); /* read first forward ref into mem */
+	if (as->fwd_count > 0)		/* read first forward ref */
+	{
+		as->Ffn = as->fwd_refs[0].file;
+		as->F_ref = as->fwd_refs[0].line;
+		as->fwd_next_ref = 1;
+	}
 
 	if (as->o_debug)
 	{
@@ -93,13 +83,24 @@ void fwd_reinit(assembler *as)
  */
 void fwd_mark(assembler *as)
 {
-	u_int		size;
-	
-	size = sizeof(as->current_filename_index);	
-	_coco_write(forward_path, (char *)&as->current_filename_index, &size);
+	if (as->fwd_count == as->fwd_size)
+	{
+		struct fwd_ref *bigger;
 
-	size = sizeof(as->current_file->current_line);
-	_coco_write(forward_path, (char *)&(as->current_file->current_line), &size);
+		as->fwd_size = as->fwd_size ? as->fwd_size * 2 : 256;
+		bigger = (struct fwd_ref *)realloc(as->fwd_refs, as->fwd_size * sizeof(struct fwd_ref));
+
+		if (bigger == NULL)
+		{
+			fatal("Cannot allocate forward reference list.");
+		}
+
+		as->fwd_refs = bigger;
+	}
+
+	as->fwd_refs[as->fwd_count].file = as->current_filename_index;
+	as->fwd_refs[as->fwd_count].line = as->current_file->current_line;
+	as->fwd_count++;
 
 	return;
 }
@@ -112,25 +113,13 @@ void fwd_mark(assembler *as)
  */
 void fwd_next(assembler *as)
 {
-	u_int size;
-	
-	size = sizeof(as->Ffn);
-	_coco_read(forward_path, (char *)&as->Ffn, &size);
-
-	if (as->o_debug)
+	if (as->fwd_next_ref < as->fwd_count)
 	{
-		printf("Ffn stat=%d ", size);
+		as->Ffn = as->fwd_refs[as->fwd_next_ref].file;
+		as->F_ref = as->fwd_refs[as->fwd_next_ref].line;
+		as->fwd_next_ref++;
 	}
-
-	size = sizeof(as->F_ref);
-	 _coco_read(forward_path, (char *)&as->F_ref, &size);
-
-	if (as->o_debug)
-	{
-		printf("F_ref stat=%d  ", size);
-	}
-
-	if (size < 2)
+	else
 	{
 		as->F_ref = 0;
 		as->Ffn = 0;
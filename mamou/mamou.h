@@ -127,13 +127,21 @@ struct link
 };
 
 
+/* a line holding a forward reference */
+struct fwd_ref
+{
+	u_int			file;		/* file number */
+	u_int			line;		/* line number */
+};
+
+
 struct nlist
 {	/* basic symbol table entry */
 	char			*name;
 	int				def;
 	int				overridable;
-	struct nlist	*Lnext;		/* left node of the tree leaf */
-	struct nlist	*Rnext;		/* right node of the tree leaf */ 
+	char			*key;		/* name folded for lookups */
+	u_int			hash;		/* hash of the key */
 	struct link		*L_list;	/* pointer to linked list of line numbers */
 };
 
@@ -275,6 +283,10 @@ typedef struct _assembler
 	char			*includes[INCSIZE];	
 	u_int			Ffn;						/* forward ref file #           */
 	u_int			F_ref;						/* next line with forward ref   */
+	struct fwd_ref	*fwd_refs;					/* forward refs seen in pass 1  */
+	u_int			fwd_count;					/* number of forward refs       */
+	u_int			fwd_size;					/* room in fwd_refs             */
+	u_int			fwd_next_ref;				/* next one to read in pass 2   */
 	char			**arguments;				/* pointer to file names        */
 	u_int			E_total;					/* total # bytes for one line   */
 	char			E_bytes[E_LIMIT + MAXBUF];  /* Emitted held bytes           */
@@ -322,7 +334,11 @@ typedef struct _assembler
 #define TTLLEN NAMLEN
 	u_char			name_header[NAMLEN];
 	u_char			title_header[TTLLEN];
-	struct nlist	*bucket;					/* root node of the tree */
+	struct nlist	**symbols;					/* symbol hash table */
+	u_int			symbol_count;				/* number of symbols */
+	u_int			symbol_size;				/* size of the table, a power of 2 */
+	char			*name_arena;				/* room for symbol names */
+	u_int			name_arena_left;			/* bytes left in name_arena */
 	struct psect	psect[256];
 	int				current_psect;
 	int				code_segment_start;
@@ -366,8 +382,8 @@ void print_footer(assembler *as);
 struct nlist *symbol_add(assembler *as, char *str, int val, int override);
 struct nlist *symbol_find(assembler *as, char *name, int);
 int mne_look(assembler *as, char *str, mnemonic *m);
-void symbol_dump_bucket(struct nlist *ptr, int type);
-void symbol_cross_reference(struct nlist *ptr);
+void symbol_dump_bucket(assembler *as, int type);
+void symbol_cross_reference(assembler *as);
 
 /* util.c */
 char *extractfilename(char *pathlist);
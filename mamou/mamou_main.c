@@ -407,14 +407,14 @@ int mamou_assemble(assembler *as)
 		/* Do we show the symbol table? */		
         if (as->o_show_symbol_table != 0)
         {
-            symbol_dump_bucket(as->bucket, as->o_show_symbol_table);
+            symbol_dump_bucket(as, as->o_show_symbol_table);
         }
         
         if (as->o_show_cross_reference == 1)
         {
             printf("\f");
 			
-            symbol_cross_reference(as->bucket);
+            symbol_cross_reference(as);
         }
 
         finish_outfile(as);
@@ -6,6 +6,12 @@
 * The Mamou Assembler - A Hitachi 6309 assembler
 *
 * (C) 2004 Boisy G. Pitre
+*
+* Symbols are kept in an open addressing hash table keyed on the name
+* folded to lower case, which is worked out once per add or lookup.
+* Names and keys are copied into large blocks of memory that are never
+* given back.  The table has no order of its own, so the listings sort
+* the symbols first.
 ***************************************************************************/
 
 #include "mamou.h"
@@ -14,6 +20,19 @@
 #include "util.h"
 
 
+#define SYMBOL_TABLE_START	1024		/* first size of the hash table */
+#define NAME_ARENA_SIZE		65536		/* size of each block of names */
+#define KEYSIZE				(MAXBUF + 16)
+
+static char *symbol_temp_name(assembler *as, char *name, char *buffer);
+static u_int symbol_key(char *name, char *key);
+static struct nlist **symbol_slot(assembler *as, char *key, u_int hash);
+static int symbol_grow(assembler *as);
+static char *symbol_intern(assembler *as, char *string);
+static struct nlist **symbol_sorted(assembler *as);
+static int symbol_compare(const void *a, const void *b);
+
+
 /*!
 	@function symbol_add
 	@discussion Adds a symbol to the symbol bucket
@@ -25,9 +44,10 @@
 struct nlist *symbol_add(assembler *as, char *name, int val, int override)
 {
 	struct link		*lp;
-	struct nlist	*np, *p, *backp;
-	int				i;
-	char			tmp_label[MAXLAB];
+	struct nlist	*np;
+	char			tmp_label[KEYSIZE];
+	char			key[KEYSIZE];
+	u_int			hash;
 
 	/* 1. Does the symbol name meet our criteria? */	
 	if (!alpha(*name) && *name != '@')
@@ -40,16 +60,15 @@ struct nlist *symbol_add(assembler *as, char *name, int val, int override)
 	/* 2. If it's a temporary symbol, generate a unique symbol name based on
      *    current file index and number of blank lines.
 	 */
-//	if (name[strlen(name) - 1] == '@')
 	if (strchr(name, '@') != NULL)
 	{
-		sprintf(tmp_label, "_tmp%s%04X%04X", name, (int)as->use_depth, (int)as->current_file->num_blank_lines);
-		
-		name = tmp_label;
+		name = symbol_temp_name(as, name, tmp_label);
 	}
 	
+	hash = symbol_key(name, key);
+
 	/* See if the value is already defined. */
-	if ((np = symbol_find(as, name, 0)) != NULL)
+	if ((np = *symbol_slot(as, key, hash)) != NULL)
 	{
 		/* 1. Symbol has been defined already -- is this pass 2? */
 		if (as->pass == 2)
@@ -95,13 +114,28 @@ struct nlist *symbol_add(assembler *as, char *name, int val, int override)
 		}
 	}
 
-	/* 3. It's not an existing symbol, so we'll add it to the bucket. */
+	/* 3. It's not an existing symbol, so we'll add it to the bucket.  One
+	 *    first seen on pass 2 wasn't there on pass 1, as symbol_find reports.
+	 */
+	if (as->pass == 2)
+	{
+		error(as, "symbol undefined on pass 2");
+	}
+
 	if (as->o_debug)
 	{
 		 printf("Installing %s as $%x\n", name, val);
 	}
 
-	/* 4. Allocate memory for a symbol entry. */	
+	/* 4. Keep the table no more than half full. */
+	if ((as->symbol_count + 1) * 2 > as->symbol_size && symbol_grow(as) != 0)
+	{
+		error(as, "symbol table full");
+
+		return NULL;
+	}
+
+	/* 5. Allocate memory for a symbol entry. */	
 	np = (struct nlist *)malloc(sizeof(struct nlist));
 	if (np == NULL)
 	{
@@ -110,23 +144,26 @@ struct nlist *symbol_add(assembler *as, char *name, int val, int override)
 		return NULL;
 	}
 	
-	/* 5. Allocate memory for the symbol name. */
-	np->name = (char *)malloc(strlen(name) + 1);
-	if (np->name == NULL)
+	/* 6. Keep the symbol name and its key. */
+	np->name = symbol_intern(as, name);
+#ifdef CASE_SENSITIVE
+	np->key = np->name;
+#else
+	np->key = symbol_intern(as, key);
+#endif
+	if (np->name == NULL || np->key == NULL)
 	{
 		error(as, "symbol table full");
 
 		return NULL;
 	}
 
-	/* 6. Set up the symbol entry with the appropriate information. */
-	strcpy(np->name, name);
+	/* 7. Set up the symbol entry with the appropriate information. */
+	np->hash = hash;
 	np->def = val;
-	np->Lnext = NULL;  
-	np->Rnext = NULL;
 	np->overridable = override;
 
-	/* 7. Allocate a link. */
+	/* 8. Allocate a link. */
 	lp = (struct link *)malloc(sizeof(struct link));
 	if (lp == NULL)
 	{
@@ -146,46 +183,12 @@ struct nlist *symbol_add(assembler *as, char *name, int val, int override)
 	}
 	
 	lp->next = NULL;
-	p = as->bucket;
-	backp = NULL;
 
-	/* 8. Insert the symbol into the table in alphabetical order. */
-	while (p != NULL) 
-	{
-		backp = p;
-		
-#ifdef CASE_SENSITIVE
-		i = strcmp(name, p->name);
-#else
-		i = strcasecmp(name, p->name);
-#endif
-		if (i < 0)
-		{
-			p = p->Lnext;
-		}
-		else
-		{
-			p = p->Rnext;
-		}
-	}
-	if (backp == NULL)
-	{
-		as->bucket = np;
-	}
-#ifdef CASE_SENSITIVE
-	else if (strcmp(name, backp->name) < 0)
-#else
-	else if (strcasecmp(name, backp->name) < 0)
-#endif
-	{
-		backp->Lnext = np;
-	}
-	else
-	{
-		backp->Rnext = np;
-	}
+	/* 9. Put the symbol in its slot in the table. */
+	*symbol_slot(as, key, hash) = np;
+	as->symbol_count++;
 
-	/* 9. We're done, and we were successful. */	
+	/* 10. We're done, and we were successful. */	
 	return np;  
 }
 
@@ -200,9 +203,9 @@ struct nlist *symbol_add(assembler *as, char *name, int val, int override)
  */
 struct nlist *symbol_find(assembler *as, char *name, int ignoreUndefined)
 {
-	struct nlist *np;
-	int     i;
-	char			tmp_label[MAXLAB];
+	struct nlist	*np;
+	char			tmp_label[KEYSIZE];
+	char			key[KEYSIZE];
 	
 	/* 1. If it's a temporary symbol that hasn't had the _tmp tag prepended,
 	 *    then generate a unique symbol name based on the current use depth
@@ -210,40 +213,243 @@ struct nlist *symbol_find(assembler *as, char *name, int ignoreUndefined)
 	 */	
 	if (strchr(name, '@') != NULL && strncmp(name, "_tmp", 4) != 0)
 	{
-		sprintf(tmp_label, "_tmp%s%04X%04X", name, (int)as->use_depth, (int)as->current_file->num_blank_lines);
-		
-		name = tmp_label;
+		name = symbol_temp_name(as, name, tmp_label);
+	}
+	
+	if ((np = *symbol_slot(as, key, symbol_key(name, key))) != NULL)
+	{
+		return np;
+	}
+
+	if (as->pass == 2 && ignoreUndefined == 0)
+	{
+		error(as, "symbol undefined on pass 2");
 	}
 	
-	np = as->bucket;
+	return NULL;
+}
+
 
-	while (np != NULL)
+/*!
+	@function symbol_temp_name
+	@discussion Makes the name of a temporary symbol: "_tmp", the name, then
+	            the use depth and number of blank lines as at least four hex
+	            digits each, as sprintf's "_tmp%s%04X%04X" would
+	@param as The assembler state structure
+	@param name The name of the symbol
+	@param buffer Where the name goes, KEYSIZE bytes long
+	@result buffer
+ */
+static char *symbol_temp_name(assembler *as, char *name, char *buffer)
+{
+	static const char	hex[] = "0123456789ABCDEF";
+	u_int				numbers[2];
+	char				*p = buffer;
+	int					i, digits;
+
+	numbers[0] = as->use_depth;
+	numbers[1] = as->current_file->num_blank_lines;
+
+	memcpy(p, "_tmp", 4);
+	p += 4;
+
+	while (*name != EOS && p < buffer + KEYSIZE - 17)
+	{
+		*p++ = *name++;
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		for (digits = 4; digits < 8 && (numbers[i] >> (digits * 4)) != 0; digits++)
+			;
+
+		while (digits-- > 0)
+		{
+			*p++ = hex[(numbers[i] >> (digits * 4)) & 0xF];
+		}
+	}
+
+	*p = EOS;
+
+	return buffer;
+}
+
+
+/*!
+	@function symbol_key
+	@discussion Folds a symbol name into its key and hashes it
+	@param name The name of the symbol
+	@param key Where the key goes, KEYSIZE bytes long
+	@result The hash of the key
+ */
+static u_int symbol_key(char *name, char *key)
+{
+	u_int	hash = 2166136261u;		/* FNV-1a */
+	char	*p = key;
+
+	while (*name != EOS && p < key + KEYSIZE - 1)
 	{
 #ifdef CASE_SENSITIVE
-		i = strcmp(name, np->name);
+		*p = *name++;
 #else
-		i = strcasecmp(name, np->name);
+		*p = tolower((unsigned char)*name++);
 #endif
-		if (i == 0)
+		hash = (hash ^ (unsigned char)*p++) * 16777619u;
+	}
+
+	*p = EOS;
+
+	return hash;
+}
+
+
+/*!
+	@function symbol_slot
+	@discussion Finds the slot holding a key, or the empty slot where it
+	            would go
+	@param as The assembler state structure
+	@param key The key
+	@param hash The hash of the key
+	@result pointer to the slot
+ */
+static struct nlist **symbol_slot(assembler *as, char *key, u_int hash)
+{
+	static struct nlist	*empty = NULL;
+	u_int				mask = as->symbol_size - 1;
+	u_int				i;
+
+	if (as->symbol_size == 0)
+	{
+		empty = NULL;
+
+		return &empty;
+	}
+
+	for (i = hash & mask; as->symbols[i] != NULL; i = (i + 1) & mask)
+	{
+		if (as->symbols[i]->hash == hash && strcmp(as->symbols[i]->key, key) == 0)
 		{
-			return np;
+			break;
 		}
-		else if (i < 0)
+	}
+
+	return &as->symbols[i];
+}
+
+
+/*!
+	@function symbol_grow
+	@discussion Doubles the size of the hash table
+	@param as The assembler state structure
+	@result 0 if successful, else 1
+ */
+static int symbol_grow(assembler *as)
+{
+	struct nlist	**old = as->symbols;
+	u_int			old_size = as->symbol_size;
+	u_int			size = old_size ? old_size * 2 : SYMBOL_TABLE_START;
+	u_int			i, j;
+
+	as->symbols = (struct nlist **)calloc(size, sizeof(struct nlist *));
+	if (as->symbols == NULL)
+	{
+		as->symbols = old;
+
+		return 1;
+	}
+
+	as->symbol_size = size;
+
+	for (i = 0; i < old_size; i++)
+	{
+		if (old[i] != NULL)
 		{
-			np = np->Lnext;
+			for (j = old[i]->hash & (size - 1); as->symbols[j] != NULL; j = (j + 1) & (size - 1))
+				;
+
+			as->symbols[j] = old[i];
 		}
-		else
+	}
+
+	free(old);
+
+	return 0;
+}
+
+
+/*!
+	@function symbol_intern
+	@discussion Copies a string into the name arena
+	@param as The assembler state structure
+	@param string The string
+	@result pointer to the copy, or NULL if out of memory
+ */
+static char *symbol_intern(assembler *as, char *string)
+{
+	u_int	length = strlen(string) + 1;
+	char	*copy;
+
+	if (length > as->name_arena_left)
+	{
+		u_int size = length > NAME_ARENA_SIZE ? length : NAME_ARENA_SIZE;
+
+		as->name_arena = (char *)malloc(size);
+		if (as->name_arena == NULL)
 		{
-			np = np->Rnext;
+			as->name_arena_left = 0;
+
+			return NULL;
 		}
+
+		as->name_arena_left = size;
 	}
 
-	if (as->pass == 2 && ignoreUndefined == 0)
+	copy = as->name_arena;
+	memcpy(copy, string, length);
+
+	as->name_arena += length;
+	as->name_arena_left -= length;
+
+	return copy;
+}
+
+
+/*!
+	@function symbol_sorted
+	@discussion Lists the symbols in alphabetical order
+	@param as The assembler state structure
+	@result A NULL terminated array of the symbols, to be freed by the caller
+ */
+static struct nlist **symbol_sorted(assembler *as)
+{
+	struct nlist	**list;
+	u_int			i, n = 0;
+
+	list = (struct nlist **)malloc((as->symbol_count + 1) * sizeof(struct nlist *));
+	if (list == NULL)
 	{
-		error(as, "symbol undefined on pass 2");
+		return NULL;
 	}
-	
-	return NULL;
+
+	for (i = 0; i < as->symbol_size; i++)
+	{
+		if (as->symbols[i] != NULL)
+		{
+			list[n++] = as->symbols[i];
+		}
+	}
+
+	qsort(list, n, sizeof(struct nlist *), symbol_compare);
+
+	list[n] = NULL;
+
+	return list;
+}
+
+
+static int symbol_compare(const void *a, const void *b)
+{
+	return strcmp((*(struct nlist **)a)->key, (*(struct nlist **)b)->key);
 }
 
 
@@ -323,17 +529,18 @@ int mne_look(assembler *as, char *str, mnemonic *m)
 }
 
 
-static void symbol_dump_bucket_r(struct nlist *ptr, int type);
 static unsigned int	counter;
 
 /*!
-	@function symbol_bucket_dump
+	@function symbol_dump_bucket
 	@discussion Prints the symbol table in alphabetical order
-	@param ptr Pointer to the symbol bucket tree
+	@param as The assembler state structure
    @param type Type of output (1 = columnar, 2 = assembly listing)
  */
-void symbol_dump_bucket(struct nlist *ptr, int type)
+void symbol_dump_bucket(assembler *as, int type)
 {
+	struct nlist **list, **ptr;
+
    if (type == 1)
    {
       printf("\f");
@@ -350,20 +557,13 @@ void symbol_dump_bucket(struct nlist *ptr, int type)
    printf("Symbol table:\n");
 	
 	/* 3. Do the dump. */	
-	symbol_dump_bucket_r(ptr, type);
-   
-   printf("\n");
-}
+	list = symbol_sorted(as);
 
-static void symbol_dump_bucket_r(struct nlist *ptr, int type)
-{
-	if (ptr != NULL)
+	for (ptr = list; ptr != NULL && *ptr != NULL; ptr++)
 	{
-		symbol_dump_bucket_r(ptr->Lnext, type);
-		
       if (type == 1)
       {
-         printf("%-10s $%04X", ptr->name, (int)ptr->def);
+         printf("%-10s $%04X", (*ptr)->name, (int)(*ptr)->def);
          
          counter++;
          
@@ -380,45 +580,39 @@ static void symbol_dump_bucket_r(struct nlist *ptr, int type)
       }
       else
       {
-         printf("%-10s EQU  $%04X\n", ptr->name, (int)ptr->def);
+         printf("%-10s EQU  $%04X\n", (*ptr)->name, (int)(*ptr)->def);
       }
-		
-		symbol_dump_bucket_r(ptr->Rnext, type);
 	}
-		
-	return;
+
+	free(list);
+   
+   printf("\n");
 }
 
 
 /*!
 	@function symbol_cross_reference
 	@discussion Prints the cross reference table
-	@param ptr Pointer to the symbol table
+	@param as The assembler state structure
  */
-static void symbol_cross_reference_r(struct nlist *ptr);
-
-void symbol_cross_reference(struct nlist *ptr)
+void symbol_cross_reference(assembler *as)
 {
+	struct nlist **list, **ptr;
+	struct link *tp;
+	int i;
+
 	/* 1. Print the heading. */	
 	printf("Cross-Reference table:\n");
 	
 	/* 2. Do the cross reference. */	
-	symbol_cross_reference_r(ptr);
-}
-
+	list = symbol_sorted(as);
 
-static void symbol_cross_reference_r(struct nlist *ptr)
-{
-	struct link *tp;
-	int i = 1;
-		
-	if (ptr != NULL)
+	for (ptr = list; ptr != NULL && *ptr != NULL; ptr++)
 	{
-		symbol_cross_reference_r(ptr->Lnext);
-		
-		printf("%-10s ($%04X) referenced from lines ", ptr->name, (int)ptr->def);
+		printf("%-10s ($%04X) referenced from lines ", (*ptr)->name, (int)(*ptr)->def);
 		
-		tp = ptr->L_list;
+		tp = (*ptr)->L_list;
+		i = 1;
 		
 		while (tp != NULL)
 		{
@@ -435,9 +629,9 @@ static void symbol_cross_reference_r(struct nlist *ptr)
 		}
 		
 		printf("\n");
-		
-		symbol_cross_reference_r(ptr->Rnext);
 	}
+
+	free(list);
 		
 	return;
 }
@@ -208,7 +208,11 @@ void emit(assembler *as, int byte)
 			}
 		}
 
-		as->psect[as->current_psect].size++;
+		/* Only Disk BASIC mode keeps track of segments. */
+		if (as->current_psect >= 0)
+		{
+			as->psect[as->current_psect].size++;
+		}
 	}
 	else
 	{
@@ -5,6 +5,7 @@
  ********************************************************************/
 #include <util.h>
 #include <string.h>
+#include <ctype.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -14,7 +15,7 @@
 
 
 static void show_os9_help(char const * const *helpMessage);
-static int do_command(int argc, char **argv);
+static int do_command(int argc, char **argv, int jobs);
 
 /* Help message */
 static char const * const helpMessage[] =
@@ -23,6 +24,8 @@ static char const * const helpMessage[] =
     "Syntax: os9 {[<opts>]} <command> {[<opts>]}\n",
     "Usage:  OS-9 File Tools Executive\n",
     "Options:\n",
+    "     -j<n>   check, list or identify up to <n> images at a time\n",
+    "              (0 = one per processor)\n",
     NULL
 };
 
@@ -32,6 +35,7 @@ struct cmdtbl
     int(*func)(int, char **);
     char *keyword;
     char *synopsis;
+    int multi;		/* each image argument can be run on its own */
 };
 
 
@@ -40,19 +44,19 @@ static struct cmdtbl table[] =
     {os9attr,	"attr"},
     {os9cmp,	"cmp"},
     {os9copy,	"copy"},
-    {os9dcheck,	"dcheck"},
+    {os9dcheck,	"dcheck",	NULL, 1},
     {os9del,	"del"},
     {os9deldir,	"deldir"},
-    {os9dir,	"dir"},	
+    {os9dir,	"dir",		NULL, 1},	
     {os9dsave,	"dsave"},	
     {os9dump,	"dump"},
     {os9format,	"format"},
-    {os9free,	"free"},
-    {os9fstat,	"fstat"},
+    {os9free,	"free",		NULL, 1},
+    {os9fstat,	"fstat",	NULL, 1},
     {os9gen,	"gen"},
-    {os9id,	"id"},
-    {os9ident,	"ident"},
-    {os9list,	"list"},	
+    {os9id,	"id",		NULL, 1},
+    {os9ident,	"ident",	NULL, 1},
+    {os9list,	"list",		NULL, 1},	
     {os9makdir,	"makdir"},
     {os9modbust,"modbust"},
     {os9padrom,	"padrom"},
@@ -64,7 +68,7 @@ static struct cmdtbl table[] =
 int main(int argc, char *argv[])
 {
     error_code ec = 0;
-    int i;
+    int i, jobs = 1;
     char *p, *command = NULL;
 
     /* walk command line for options */
@@ -80,6 +84,22 @@ int main(int argc, char *argv[])
                     case '?':
                         show_os9_help(helpMessage);
                         return(0);
+
+                    case 'j':
+                        if (*(p + 1) != '\0')
+                        {
+                            jobs = parse_jobs(p + 1);
+                        }
+                        else if (i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+                        {
+                            jobs = parse_jobs(argv[++i]);
+                        }
+                        else
+                        {
+                            jobs = parse_jobs(NULL);
+                        }
+                        p += strlen(p) - 1;
+                        break;
                 }
             }
         }
@@ -96,14 +116,14 @@ int main(int argc, char *argv[])
     }
     else
     {
-        ec = do_command(argc - i, &argv[i]);
+        ec = do_command(argc - i, &argv[i], jobs);
     }
 
     return(ec);
 }
 
 
-static int do_command(int argc, char **argv)
+static int do_command(int argc, char **argv, int jobs)
 {
     struct cmdtbl *x = table;
 
@@ -111,6 +131,11 @@ static int do_command(int argc, char **argv)
     {
         if (strcmp(argv[0], x->keyword) == 0)
         {
+            if (x->multi && jobs > 1)
+            {
+                return(run_jobs(x->func, argc, argv, jobs));
+            }
+
             return(x->func(argc, argv));
         }
         x++;
@@ -1,6 +1,14 @@
 /********************************************************************
  * os9dcheck.c - Disk file structure utility for OS-9
  *
+ * The check is done in two passes.  The first walks the directory tree
+ * breadth first, reading each level's file descriptors in LSN order and
+ * each directory file a segment at a time, and keeps every descriptor
+ * it finds in one flat list of entries.  The second goes down that list
+ * building the secondary allocation map.  With -j the subtrees under
+ * the root directory are walked by separate processes and their entries
+ * are put back in the order a single walk would have found them.
+ *
  * $Id$
  ********************************************************************/
 #include <util.h>
@@ -8,16 +16,69 @@
 #include <cocopath.h>
 #include <string.h>
 #include <math.h>
+#include <errno.h>
+
+/* One file or directory found by the walk */
+typedef struct
+{
+	int			parent;		/* entry of the directory it is in, -1 for the top */
+	int			lsn;		/* LSN of its file descriptor */
+	int			flags;
+	int			bad;		/* bad segments found reading its directory file */
+	char		name[D_NAMELEN + 1];
+	fd_stats	fd;
+} dEntry_t;
+
+#define	DE_DIR		0x01	/* entry is a directory */
+#define	DE_LOOP		0x02	/* directory was already walked from somewhere else */
+#define	DE_BADLSN	0x04	/* directory entry points past the end of the disk */
+
+typedef struct
+{
+	dEntry_t	*entry;
+	int			count;
+	int			size;
+	char		*base;		/* pathlist of the top entry */
+} dList_t;
+
+/* A directory entry waiting for its file descriptor to be read */
+typedef struct
+{
+	int			parent;
+	int			lsn;
+	int			seq;
+	char		name[D_NAMELEN + 1];
+} dPending_t;
+
+typedef struct qCluster_t
+{
+	struct qCluster_t	*next;
+	int					lsn;
+} qCluster_t;
+
+typedef struct qOwner_t
+{
+	struct qOwner_t		*next;
+	int					lsn;
+	int					entry;
+} qOwner_t;
 
 static char *strcatdup( char *orig, char *cat1, char *cat2 );
-static error_code ParseFDSegList(fd_stats *fd, u_int dd_tot, char *path, unsigned char *secondaryBitmap );
-static error_code BuildSecondaryAllocationMap( os9_path_id os9_path, int dir_lsn, char *path, unsigned char *secondaryBitmap );
+static error_code WalkFileStructure( os9_path_id os9_path, char *path, int jobs );
+static error_code WalkTree( dList_t *list, int top, unsigned char *seen, int levels );
+static error_code ReadDirectory( dList_t *list, int dir, dPending_t **pending, int *count, int *size );
+static int WalkSubtrees( int argc, char **argv );
+static error_code MergeSubtree( FILE *fp, int top );
+static void DropRepeatedWalks( void );
+static int AddEntry( dList_t *list, int parent, int lsn, char *name );
+static char *EntryPath( dList_t *list, int entry, char *buffer, size_t size );
+static int ComparePending( const void *a, const void *b );
+static error_code ParseFDSegList(fd_stats *fd, u_int dd_tot, int entry, unsigned char *secondaryBitmap );
+static error_code BuildSecondaryAllocationMap( u_int dd_tot, unsigned char *secondaryBitmap );
 static error_code CompareAllocationMap( unsigned char *primaryAlloMap, unsigned char *secondaryBitmap, int dd_map, int cluster_size );
-static void PathlistsForQuestionableClusters();
-static void FreeQuestionableMemory();
 static void AddQuestionableCluster( int cluster );
-static void AddPathToBit( int lsn, char *path );
-static int do_dcheck(char **argv, char *p);
+static void AddPathToBit( int lsn, int entry );
+static int do_dcheck(char **argv, char *p, int jobs);
 static void PathlistsForQuestionableClusters(void);
 static void FreeQuestionableMemory(void);
 
@@ -33,7 +94,9 @@ static char const * const helpMessage[] =
 	"            the file descriptors for accuracy\n",
 	"     -b    suppress listing of unused clusters (clusters allocated\n",
 	"            but not in file structure)\n"
-	"     -p    print pathlists of questionable clusters\n",	
+	"     -p    print pathlists of questionable clusters\n",
+	"     -j<num>  walk up to <num> subtrees of the root directory at once\n",
+	"            (default: one per processor)\n",
 	NULL
 };
 
@@ -46,30 +109,26 @@ int	gFolderCount,
 
 int	sOption, bOption, pOption;	/* Flags for command line options */
 
-typedef struct qCluster_t
-{
-	struct qCluster_t	*next;
-	int					lsn;
-} qCluster_t;
-
-typedef struct qBitPath_t
-{
-	struct qBitPath_t	*next;
-	int					lsn;
-	char				*path;	
-} qBitPath_t;
-
 static qCluster_t	*qCluster;		/* This is an array of clusters that are reported unusual */
-static qBitPath_t	*gBitPaths;		/* Every allocated bit has its path (sometimes more that one) */
+static int			*gOwner;		/* With -p, the entry whose segment list first holds each LSN */
+static qOwner_t		*gOtherOwners;	/* ...and every other entry that holds it too */
+
+static dList_t		gEntries;		/* Everything the walk found, in walk order */
+static os9_path_id	gPath;
+static u_int		gTot;
+static unsigned char *gSeen;		/* The root and the directories in it */
+static int			gSeenSize;
+static int			*gTops;			/* Entries of the subtrees under the root */
+static FILE			**gTopFiles;	/* Where each subtree's worker leaves its entries */
 
 int os9dcheck(int argc, char *argv[])
 {
 	error_code	ec = 0;
 	char *p = NULL;
-	int i;
-	
+	int i, jobs = 1;
+
 	sOption = bOption = pOption = 0;
-	
+
 	/* walk command line for options */
 	for (i = 1; i < argc; i++)
 	{
@@ -88,11 +147,15 @@ int os9dcheck(int argc, char *argv[])
 					case 'p':
 						pOption = 1;
 						break;
+					case 'j':
+						jobs = parse_jobs(p + 1);
+						while (*(p + 1) != '\0') p++;
+						break;
 					case '?':
 					case 'h':
 						show_help(helpMessage);
 						return(0);
-	
+
 					default:
 						fprintf(stderr, "%s: unknown option '%c'\n", argv[0], *p);
 						return(0);
@@ -113,7 +176,7 @@ int os9dcheck(int argc, char *argv[])
 			p = argv[i];
 		}
 
-		ec = do_dcheck(argv, p);
+		ec = do_dcheck(argv, p, jobs);
 
 		if (ec != 0)
 		{
@@ -133,7 +196,7 @@ int os9dcheck(int argc, char *argv[])
 
 
 
-static int do_dcheck(char **argv, char *p)
+static int do_dcheck(char **argv, char *p, int jobs)
 {
 	error_code	ec = 0;
 	os9_path_id		os9_path;
@@ -142,19 +205,19 @@ static int do_dcheck(char **argv, char *p)
 	char		*newName;
 	char os9pathlist[256];
 	double		size;
-	
+
 	if( strchr(p, ',') != 0 )
 	{
 		fprintf( stderr, "Cannot disk check an OS-9 file, only OS-9 disks.\n" );
 		return 1;
 	}
-	
+
 	gFolderCount = 0;
 	gFileCount = 0;
 	gPreAllo = 0;
 	gFnotA = gAnotF = 0;
 	gBadFD = 0;
-	
+
 	strcpy(os9pathlist, p);
 
 	/* if the user forgot to add the ',', do it for them */
@@ -176,28 +239,28 @@ static int do_dcheck(char **argv, char *p)
 	OS9StringToCString( os9_path->lsn0->dd_nam );
 	printf("Volume - '%s' in file: %s\n", os9_path->lsn0->dd_nam, p );
 	printf("$%4.4X bytes in allocation map\n", int2(os9_path->lsn0->dd_map) );
-	
+
 	cluster_size = int2(os9_path->lsn0->dd_bit);
-	
+
 	if( cluster_size == 0 )
 	{
 		printf("Disk format error: Sectors per cluster cannot be zero.\n" );
 		return -1;
 	}
-	
+
 	if( cluster_size == 1 )
 		printf("%d sector per cluster\n", cluster_size );
 	else
 		printf("%d sectors per cluster\n", cluster_size );
-	
+
 	printf("$%6.6X total sectors on media\n", int3(os9_path->lsn0->dd_tot) );
 	printf("Sector $%6.6X is start of root directory file descriptor\n", int3(os9_path->lsn0->dd_dir) );
-	
+
 /* Secondary Allocation map is expanded to assume a cluster size of one.
    This allows us to track wether a partial cluster is (incorrectly) allocated.
    It also makes it easier to determine if sectors are allocated multiple times.
 */
-	secondaryBitmap = (unsigned char *)malloc( (int3(os9_path->lsn0->dd_tot)+1) / 8 );
+	secondaryBitmap = (unsigned char *)malloc( (int3(os9_path->lsn0->dd_tot)+1) / 8 + 1 );
 
 	if( secondaryBitmap == NULL )
 	{
@@ -205,29 +268,41 @@ static int do_dcheck(char **argv, char *p)
 		return -1;
 	}
 
-	memset(secondaryBitmap, 0, (int3(os9_path->lsn0->dd_tot) + 1) / 8);
+	memset(secondaryBitmap, 0, (int3(os9_path->lsn0->dd_tot) + 1) / 8 + 1);
 
 	/* Allocate LSN0 in secondary bitmap */
 	_os9_allbit(secondaryBitmap, 0, 1);
-	
+
 	/* Allocate primary bitmap sectors in secondary bitmap */
-	
+
 	size = (double)os9_path->bitmap_bytes / (double)os9_path->bps;
-	
+
 	_os9_allbit(secondaryBitmap, 1, ceil(size) );
 
-	/* Setup questionable cluster array */
+	/* Setup questionable cluster array, and the owner of each LSN if
+	   we will be asked for pathlists */
 	qCluster = NULL;
-	gBitPaths = NULL;
-	
+	gOtherOwners = NULL;
+	gOwner = NULL;
+
+	if (pOption == 1)
+	{
+		gOwner = (int *)calloc( int3(os9_path->lsn0->dd_tot) + 1, sizeof(int) );
+	}
+
 	printf("Building secondary allocation map...\n");
 	newName = strcatdup( p, ",.", "" );
-	BuildSecondaryAllocationMap( os9_path, int3(os9_path->lsn0->dd_dir), newName, secondaryBitmap );
-	
-	printf("Comparing primary and secondary allocation maps...\n" );
-	CompareAllocationMap( os9_path->bitmap, secondaryBitmap, int3(os9_path->lsn0->dd_tot), cluster_size );
-	
-	if (pOption == 1)
+	ec = WalkFileStructure( os9_path, newName, jobs );
+
+	if (ec == 0)
+	{
+		BuildSecondaryAllocationMap( int3(os9_path->lsn0->dd_tot), secondaryBitmap );
+
+		printf("Comparing primary and secondary allocation maps...\n" );
+		CompareAllocationMap( os9_path->bitmap, secondaryBitmap, int3(os9_path->lsn0->dd_tot), cluster_size );
+	}
+
+	if (pOption == 1 && ec == 0)
 	{
 		if (qCluster != NULL)
 		{
@@ -235,20 +310,27 @@ static int do_dcheck(char **argv, char *p)
 			PathlistsForQuestionableClusters();
 		}
 	}
-	else
+
+	FreeQuestionableMemory();
+
+	free(gEntries.entry);
+	memset(&gEntries, 0, sizeof(gEntries));
+	free(newName);
+	free(secondaryBitmap);
+
+	if (ec != 0)
 	{
-		FreeQuestionableMemory();
+		_os9_close(os9_path);
+		return(ec);
 	}
-	
-	free(secondaryBitmap);
-	
+
 	if (sOption == 0)
 	{
 		printf("\n%d previously allocated cluster found\n", gPreAllo);
 		printf("%d clusters in file structure but not in allocation map\n", gFnotA);
 		printf("%d clusters in allocation map but not in file structure\n", gAnotF);
 		printf("%d bad file decriptor sector\n", gBadFD);
-	
+
 		if (gPreAllo > 0 || gFnotA > 0 || gBadFD > 0)
 		{
 			printf("\n'%s' file structure is NOT intact\n", os9_path->lsn0->dd_nam);
@@ -260,7 +342,7 @@ static int do_dcheck(char **argv, char *p)
 	}
 
 	_os9_close(os9_path);
-	
+
 	if (gFolderCount == 1)
 	{
 		printf("1 directory\n");
@@ -269,228 +351,605 @@ static int do_dcheck(char **argv, char *p)
 	{
 		printf("%d directories\n", gFolderCount);
 	}
-	
+
 	printf("%d files\n", gFileCount);
-	
+
 	return(ec);
 }
 
 
-/* This function will drill down into a directory file and fillout a secondary allocation bitmap.
-   It is recursive, so whenever a directory is encoundered it will call itself. It will also compare
-   the map it creates with the map suppilied that represents the map on disk. */
-   
-static error_code BuildSecondaryAllocationMap( os9_path_id os9_path, int dir_lsn, char *path, unsigned char *secondaryBitmap )
+/* This function walks the whole directory tree into gEntries.  The root and the
+   directories in it are walked here; each directory under the root is then
+   walked on its own, by a worker process if there are jobs to spare. */
+
+static error_code WalkFileStructure( os9_path_id os9_path, char *path, int jobs )
 {
-	error_code 	ec = 0;
-	fd_stats	*dir_fd, *file_fd;
-	u_int		dd_tot,
-				fd_siz,
-				count,
-				i, j, k;
-	os9_dir_entry	*dEnt;  /* Each entry is 32 bytes long */
-	Fd_seg		theSeg;
-	char		*newPath;
-	int			bps = os9_path->bps;
+	error_code	ec = 0;
+	int			i, root, tops = 0;
+	char		**args, *numbers;
+	dEntry_t	*e;
 
-	/* Check if this directory has already been drilled into */
+	gPath = os9_path;
+	gTot = int3(os9_path->lsn0->dd_tot);
+	gSeenSize = (gTot + 1) / 8 + 1;
 
-	if ( _os9_ckbit( secondaryBitmap, dir_lsn ) != 0)
+	memset(&gEntries, 0, sizeof(gEntries));
+	gEntries.base = path;
+
+	gSeen = (unsigned char *)calloc( gSeenSize, 1 );
+	if( gSeen == NULL )
 	{
-		/* Whoops, it is already allocated! */
-		printf("Directory %s has a circular reference. Skipping\n", path);
-		AddQuestionableCluster(dir_lsn);
-		return(0);
+		printf("Out of memory, terminating (001).\n");
+		exit(-1);
 	}
-	
-	/* Allocate directory file descriptor LSN in secondary allocation map */
-	
-	_os9_allbit(secondaryBitmap, dir_lsn, 1);
-	gFolderCount++;
-	
-	dd_tot = int3(os9_path->lsn0->dd_tot);
-	
-	dir_fd = (fd_stats *)malloc( bps );
-	if( dir_fd == NULL )
+
+	/* Read the root directory's file descriptor */
+	root = AddEntry( &gEntries, -1, int3(os9_path->lsn0->dd_dir), "" );
+	e = &gEntries.entry[root];
+	e->flags = DE_DIR;
+
+	if (_image_read_at(os9_path->image, (long)e->lsn * os9_path->bps, &e->fd, sizeof(fd_stats)) != sizeof(fd_stats))
+	{
+		printf("Sector wrong size, terminating (001).\n");
+		printf("LSN: %d\n", e->lsn );
+		free(gSeen);
+		return(EOS_SE);
+	}
+
+	_os9_allbit(gSeen, e->lsn, 1);
+
+	/* Walk the root directory.  Every directory in it is the top of a subtree. */
+	ec = WalkTree( &gEntries, root, gSeen, 1 );
+
+	gTops = (int *)malloc( (gEntries.count + 1) * sizeof(int) );
+	if( gTops == NULL )
 	{
 		printf("Out of memory, terminating (001).\n");
 		exit(-1);
 	}
-	
-	if (read_lsn(os9_path, dir_lsn, dir_fd ) != bps)
+
+	for (i = 1; ec == 0 && i < gEntries.count; i++)
 	{
-		printf("Sector wrong size, terminating (001).\n" );
-		printf("LSN: %d\n", dir_lsn );
-		exit(-1);
+		if ((gEntries.entry[i].flags & (DE_DIR | DE_LOOP)) == DE_DIR)
+		{
+			gTops[tops++] = i;
+		}
 	}
 
-	/* Parse segment list of directory, report any problems */
-	ec = ParseFDSegList( dir_fd, dd_tot, path, secondaryBitmap );
-	
-	if (ec != 0)
+	if (ec != 0 || tops == 0)
+	{
+		/* Nothing more to walk */
+	}
+	else if (jobs <= 1 || tops < 2)
 	{
-		printf("File descriptor for directory %s is bad. Will not open directory file.\n", path);
-		ec = 0;
+		unsigned char *seen = (unsigned char *)malloc( gSeenSize );
+		if( seen == NULL )
+		{
+			printf("Out of memory, terminating (001).\n");
+			exit(-1);
+		}
+
+		for (i = 0; ec == 0 && i < tops; i++)
+		{
+			memcpy(seen, gSeen, gSeenSize);
+			ec = WalkTree( &gEntries, gTops[i], seen, 0 );
+		}
+
+		free(seen);
 	}
 	else
 	{
-		/* Now open directory file and parse contents */
-		fd_siz = int4(dir_fd->fd_siz);
-		count = 0;
-		i = 0;
-		
-		while (int3(dir_fd->fd_seg[i].lsn) != 0)
+		/* Name each subtree as an argument, for run_jobs to hand out */
+		args = (char **)malloc( (tops + 2) * sizeof(char *) );
+		numbers = (char *)malloc( tops * 12 );
+		gTopFiles = (FILE **)calloc( tops, sizeof(FILE *) );
+		if( args == NULL || numbers == NULL || gTopFiles == NULL )
 		{
-			theSeg = &(dir_fd->fd_seg[i]);
-			
-			if (i > NUM_SEGS)
+			printf("Out of memory, terminating (001).\n");
+			exit(-1);
+		}
+
+		args[0] = "dcheck";
+
+		for (i = 0; i < tops; i++)
+		{
+			args[i + 1] = numbers + i * 12;
+			sprintf(args[i + 1], "%d", i);
+
+			if ((gTopFiles[i] = tmpfile()) == NULL)
 			{
-				break;
+				ec = UnixToCoCoError(errno);
 			}
-				
-			if (count > fd_siz)
+		}
+
+		args[tops + 1] = NULL;
+
+		if (ec == 0)
+		{
+			ec = run_jobs( WalkSubtrees, tops + 1, args, jobs );
+		}
+
+		/* Put each subtree's entries back in order */
+		for (i = 0; i < tops; i++)
+		{
+			if (ec == 0)
 			{
-				break;
+				ec = MergeSubtree( gTopFiles[i], gTops[i] );
 			}
-			
-			if (int2(theSeg->num) > dd_tot)
+
+			if (gTopFiles[i] != NULL)
 			{
-				printf("File: %s contains a bad segment (%d > %d)\n", path, int2(theSeg->num), dd_tot );
-				gBadFD++;
+				fclose(gTopFiles[i]);
+			}
+		}
+
+		free(gTopFiles);
+		free(numbers);
+		free(args);
+	}
+
+	if (ec == 0)
+	{
+		DropRepeatedWalks();
+	}
+
+	free(gTops);
+	free(gSeen);
+
+	return(ec);
+}
+
+
+/* Walk the subtrees named in argv, leaving each one's entries in its file.
+   Run once per worker by run_jobs. */
+
+static int WalkSubtrees( int argc, char **argv )
+{
+	error_code	ec = 0;
+	int			i, n, top;
+	dList_t		list;
+	char		base[1024];
+	unsigned char *seen;
+
+	seen = (unsigned char *)malloc( gSeenSize );
+	if( seen == NULL )
+	{
+		printf("Out of memory, terminating (001).\n");
+		exit(-1);
+	}
+
+	for (i = 1; ec == 0 && i < argc; i++)
+	{
+		n = atoi(argv[i]);
+		top = gTops[n];
+
+		/* Start from a copy of the subtree's top, as entry 0 */
+		memset(&list, 0, sizeof(list));
+		list.base = EntryPath( &gEntries, top, base, sizeof(base) );
+
+		AddEntry( &list, -1, gEntries.entry[top].lsn, gEntries.entry[top].name );
+		list.entry[0] = gEntries.entry[top];
+		list.entry[0].parent = -1;
+
+		memcpy(seen, gSeen, gSeenSize);
+		ec = WalkTree( &list, 0, seen, 0 );
+
+		if (ec == 0)
+		{
+			if (fwrite(&list.count, sizeof(int), 1, gTopFiles[n]) != 1 ||
+				fwrite(list.entry, sizeof(dEntry_t), list.count, gTopFiles[n]) != (size_t)list.count ||
+				fflush(gTopFiles[n]) != 0)
+			{
+				ec = EOS_WRITE;
+			}
+		}
+
+		free(list.entry);
+	}
+
+	free(seen);
+
+	return(ec);
+}
+
+
+/* Append the entries a worker found under 'top' to gEntries */
+
+static error_code MergeSubtree( FILE *fp, int top )
+{
+	int			i, count, base;
+	dEntry_t	e;
+
+	rewind(fp);
+
+	if (fread(&count, sizeof(int), 1, fp) != 1 || fread(&e, sizeof(dEntry_t), 1, fp) != 1)
+	{
+		return(EOS_SE);
+	}
+
+	/* Entry 0 is the top itself, which may have picked up bad segments */
+	gEntries.entry[top].bad = e.bad;
+
+	base = gEntries.count - 1;
+
+	for (i = 1; i < count; i++)
+	{
+		int n;
+
+		if (fread(&e, sizeof(dEntry_t), 1, fp) != 1)
+		{
+			return(EOS_SE);
+		}
+
+		n = AddEntry( &gEntries, e.parent == 0 ? top : base + e.parent, e.lsn, e.name );
+		e.parent = gEntries.entry[n].parent;
+		gEntries.entry[n] = e;
+	}
+
+	return(0);
+}
+
+
+/* Each subtree was walked without knowing what the others had walked, so a
+   directory reached from two of them was walked twice.  Keep the first walk
+   of it and drop everything found under the rest. */
+
+static void DropRepeatedWalks( void )
+{
+	unsigned char *walked;
+	int			*index;
+	int			i, n = 0;
+
+	walked = (unsigned char *)calloc( gSeenSize, 1 );
+	index = (int *)malloc( (gEntries.count + 1) * sizeof(int) );
+	if( walked == NULL || index == NULL )
+	{
+		printf("Out of memory, terminating (001).\n");
+		exit(-1);
+	}
+
+	for (i = 0; i < gEntries.count; i++)
+	{
+		dEntry_t	*e = &gEntries.entry[i];
+
+		if (e->parent >= 0 && (index[e->parent] < 0 || (gEntries.entry[index[e->parent]].flags & DE_LOOP) != 0))
+		{
+			/* Under a repeated walk */
+			gBadFD += e->bad;
+			index[i] = -1;
+			continue;
+		}
+
+		if ((e->flags & (DE_DIR | DE_LOOP)) == DE_DIR)
+		{
+			if (_os9_ckbit(walked, e->lsn) != 0)
+			{
+				e->flags |= DE_LOOP;
+			}
+			else
+			{
+				_os9_allbit(walked, e->lsn, 1);
+			}
+		}
+
+		if (e->parent >= 0)
+		{
+			e->parent = index[e->parent];
+		}
+
+		gEntries.entry[n] = *e;
+		index[i] = n++;
+	}
+
+	gEntries.count = n;
+
+	free(index);
+	free(walked);
+}
+
+
+/* Walk the directory tree under entry 'top', breadth first, adding what is
+   found to 'list'.  Each level's file descriptors are read in LSN order.
+   'seen' marks the directories already walked; 'levels' limits how deep to
+   go, or 0 for no limit. */
+
+static error_code WalkTree( dList_t *list, int top, unsigned char *seen, int levels )
+{
+	error_code	ec = 0;
+	int			*frontier = NULL, nfront = 0, sfront = 0;
+	dPending_t	*pending = NULL;
+	int			npend, spend = 0;
+	int			i, level = 0;
+
+	frontier = (int *)malloc( sizeof(int) );
+	if( frontier == NULL )
+	{
+		printf("Out of memory, terminating (002).\n");
+		exit(-1);
+	}
+
+	frontier[nfront++] = top;
+	sfront = 1;
+
+	while (nfront > 0 && ec == 0 && (levels == 0 || level++ < levels))
+	{
+		/* Read every directory file on this level */
+		npend = 0;
+
+		for (i = 0; i < nfront && ec == 0; i++)
+		{
+			ec = ReadDirectory( list, frontier[i], &pending, &npend, &spend );
+		}
+
+		/* Read their entries' file descriptors in LSN order */
+		qsort(pending, npend, sizeof(dPending_t), ComparePending);
+
+		nfront = 0;
+
+		for (i = 0; i < npend && ec == 0; i++)
+		{
+			dPending_t	*p = &pending[i];
+			dEntry_t	*e;
+			int			n;
+
+			n = AddEntry( list, p->parent, p->lsn, p->name );
+			e = &list->entry[n];
+
+			if ((u_int)p->lsn > gTot)
+			{
+				e->flags |= DE_BADLSN;
+				continue;
+			}
+
+			if (_image_read_at(gPath->image, (long)p->lsn * gPath->bps, &e->fd, sizeof(fd_stats)) != sizeof(fd_stats))
+			{
+				printf("Sector wrong size, terminating (003).\n" );
+				printf("LSN: %d\n", p->lsn );
+				ec = EOS_SE;
 				break;
 			}
-			
-			for (j = 0; j < int2(theSeg->num); j++ )
+
+			if ((e->fd.fd_att & FAP_DIR) == 0)
 			{
-				if (count > fd_siz)
-					break;
-				
-				if (int3(theSeg->lsn) + j > dd_tot)
-				{
-					printf("File: %s, contains bad LSN (%d > %d)\n", path, int3(theSeg->lsn)+j, dd_tot);
-					count += 256;
-					gBadFD++;
-					break;
-				}
-				
-				dEnt = (os9_dir_entry *)malloc( bps );
-				if( dEnt == NULL )
+				continue;
+			}
+
+			e->flags |= DE_DIR;
+
+			if (_os9_ckbit(seen, p->lsn) != 0)
+			{
+				e->flags |= DE_LOOP;
+				continue;
+			}
+
+			_os9_allbit(seen, p->lsn, 1);
+
+			if (nfront == sfront)
+			{
+				sfront *= 2;
+				frontier = (int *)realloc( frontier, sfront * sizeof(int) );
+				if( frontier == NULL )
 				{
 					printf("Out of memory, terminating (002).\n");
 					exit(-1);
 				}
-				
-				if( read_lsn( os9_path, int3(theSeg->lsn)+j, dEnt ) != bps )
-				{
-					int	temp = int3(theSeg->lsn)+j;
-					
-					printf("Sector wrong size, terminating (002).\nLSN: %d\n", temp );
-					exit(-1);
-				}
+			}
 
-				for (k = 0; k < (bps / sizeof(os9_dir_entry)); k++)
-				{
-					count += sizeof(os9_dir_entry);
-					if (count > fd_siz)
-					{
-						break;
-					}
+			frontier[nfront++] = n;
+		}
+	}
 
-					if (dEnt[k].name[0] == 0)
-					{
-						continue;
-					}
+	free(pending);
+	free(frontier);
 
-					OS9StringToCString(dEnt[k].name);
-					
-					if (strcmp((char *)dEnt[k].name, ".") == 0)
-					{
-						continue;
-					}
-					if (strcmp((char *)dEnt[k].name, "..") == 0)
-					{
-						continue;
-					}
+	return(ec);
+}
 
-					newPath = strcatdup(path, "/", (char *)dEnt[k].name);
-					
-					if (int3(dEnt[k].lsn) > dd_tot)
-					{
-						printf("File: %s, contains bad LSN\n", newPath);
-						free(newPath);
-						continue;
-					}
 
-					file_fd = (fd_stats *)malloc( bps );
-					if( file_fd == NULL )
-					{
-						printf("Out of memory, terminating (003).\n");
-						exit(-1);
-					}
-					
-					if( read_lsn(os9_path, int3(dEnt[k].lsn), file_fd ) != bps )
+/* Read the directory file of entry 'dir', a segment at a time, adding its
+   entries to 'pending'. */
+
+static error_code ReadDirectory( dList_t *list, int dir, dPending_t **pending, int *count, int *size )
+{
+	fd_stats	fd = list->entry[dir].fd;
+	u_int		fd_siz = int4(fd.fd_siz);
+	u_int		bytes = 0, bps = gPath->bps;
+	u_int		lsn, num, need, good, j, k;
+	int			i;
+	char		path[1024];
+	unsigned char *buffer;
+
+	for (i = 0; i < NUM_SEGS && int3(fd.fd_seg[i].lsn) != 0; i++)
+	{
+		if (bytes > fd_siz)
+		{
+			break;
+		}
+
+		lsn = int3(fd.fd_seg[i].lsn);
+		num = int2(fd.fd_seg[i].num);
+
+		if (num > gTot)
+		{
+			printf("File: %s contains a bad segment (%d > %d)\n", EntryPath(list, dir, path, sizeof(path)), num, gTot );
+			list->entry[dir].bad++;
+			break;
+		}
+
+		/* Only the sectors that hold the rest of the directory, and only
+		   those that are on the disk */
+		need = (fd_siz - bytes) / bps + 1;
+
+		if (num > need)
+		{
+			num = need;
+		}
+
+		good = num;
+
+		if (num > 0 && lsn + num - 1 > gTot)
+		{
+			good = lsn > gTot ? 0 : gTot - lsn + 1;
+		}
+
+		buffer = (unsigned char *)malloc( good * bps + 1 );
+		if( buffer == NULL )
+		{
+			printf("Out of memory, terminating (002).\n");
+			exit(-1);
+		}
+
+		if (_image_read_at(gPath->image, (long)lsn * bps, buffer, good * bps) != good * bps)
+		{
+			printf("Sector wrong size, terminating (002).\nLSN: %d\n", lsn );
+			free(buffer);
+			return(EOS_SE);
+		}
+
+		for (j = 0; j < good && bytes <= fd_siz; j++)
+		{
+			os9_dir_entry *dEnt = (os9_dir_entry *)(buffer + j * bps);
+
+			for (k = 0; k < (bps / sizeof(os9_dir_entry)); k++)
+			{
+				dPending_t	*p;
+
+				bytes += sizeof(os9_dir_entry);
+				if (bytes > fd_siz)
+				{
+					break;
+				}
+
+				if (dEnt[k].name[0] == 0)
+				{
+					continue;
+				}
+
+				if (*count == *size)
+				{
+					*size = *size ? *size * 2 : 64;
+					*pending = (dPending_t *)realloc( *pending, *size * sizeof(dPending_t) );
+					if( *pending == NULL )
 					{
-						printf("Sector wrong size, terminating (003).\n" );
-						printf("LSN: %d\n", int3(dEnt[k].lsn) );
+						printf("Out of memory, terminating (002).\n");
 						exit(-1);
 					}
+				}
 
-					/* If actually a directory? */
-					if ((file_fd->fd_att & FAP_DIR) == 0)
-					{
-						/* No, file is a file */
-						_os9_allbit(secondaryBitmap, int3(dEnt[k].lsn), 1);
+				p = &(*pending)[*count];
+				memcpy(p->name, dEnt[k].name, D_NAMELEN);
+				p->name[D_NAMELEN] = '\0';
+				OS9StringToCString((u_char *)p->name);
 
-						gFileCount++;
-						ParseFDSegList(file_fd, dd_tot, newPath, secondaryBitmap);
-					}
-					else
-					{
-						/* Yes, go do directory */
-						ec = BuildSecondaryAllocationMap(os9_path, int3(dEnt[k].lsn), newPath, secondaryBitmap);
-						if (ec != 0)
-						{
-							return(ec);
-						}
-					}
-					
-					free(file_fd);
-					free(newPath);
+				if (strcmp(p->name, ".") == 0 || strcmp(p->name, "..") == 0)
+				{
+					continue;
 				}
-				
-				free(dEnt);
+
+				p->parent = dir;
+				p->lsn = int3(dEnt[k].lsn);
+				p->seq = *count;
+				(*count)++;
 			}
-			
-			i++;
+		}
+
+		free(buffer);
+
+		if (good < num)
+		{
+			printf("File: %s, contains bad LSN (%d > %d)\n", EntryPath(list, dir, path, sizeof(path)), lsn + good, gTot);
+			bytes += 256;
+			list->entry[dir].bad++;
 		}
 	}
-	
-	free(dir_fd);
-	
-	return(ec);
+
+	return(0);
+}
+
+
+/* Go down the list of entries in walk order, allocating each file
+   descriptor and the segments it lists in the secondary allocation map. */
+
+static error_code BuildSecondaryAllocationMap( u_int dd_tot, unsigned char *secondaryBitmap )
+{
+	char		*skipped;
+	char		path[1024];
+	int			i;
+
+	skipped = (char *)calloc( gEntries.count + 1, 1 );
+	if( skipped == NULL )
+	{
+		printf("Out of memory, terminating (001).\n");
+		exit(-1);
+	}
+
+	for (i = 0; i < gEntries.count; i++)
+	{
+		dEntry_t	*e = &gEntries.entry[i];
+
+		if (e->parent >= 0 && skipped[e->parent])
+		{
+			skipped[i] = 1;
+			continue;
+		}
+
+		if (e->flags & DE_BADLSN)
+		{
+			printf("File: %s, contains bad LSN\n", EntryPath(&gEntries, i, path, sizeof(path)));
+			continue;
+		}
+
+		if ((e->flags & DE_DIR) == 0)
+		{
+			_os9_allbit(secondaryBitmap, e->lsn, 1);
+
+			gFileCount++;
+			ParseFDSegList(&e->fd, dd_tot, i, secondaryBitmap);
+			continue;
+		}
+
+		gBadFD += e->bad;
+
+		/* Check if this directory has already been drilled into */
+
+		if ( _os9_ckbit( secondaryBitmap, e->lsn ) != 0)
+		{
+			/* Whoops, it is already allocated! */
+			printf("Directory %s has a circular reference. Skipping\n", EntryPath(&gEntries, i, path, sizeof(path)));
+			AddQuestionableCluster(e->lsn);
+			skipped[i] = 1;
+			continue;
+		}
+
+		/* Allocate directory file descriptor LSN in secondary allocation map */
+
+		_os9_allbit(secondaryBitmap, e->lsn, 1);
+		gFolderCount++;
+
+		ParseFDSegList( &e->fd, dd_tot, i, secondaryBitmap );
+	}
+
+	free(skipped);
+
+	return(0);
 }
 
-static error_code ParseFDSegList( fd_stats *fd, u_int dd_tot, char *path, unsigned char *secondaryBitmap )
+static error_code ParseFDSegList( fd_stats *fd, u_int dd_tot, int entry, unsigned char *secondaryBitmap )
 {
 	error_code	ec = 0;
 	u_int  		i = 0, j, once;
 	Fd_seg		theSeg;
 	u_int 		num, curLSN;
+	char		path[1024];
 
-	while( int3(fd->fd_seg[i].lsn) != 0 )
+	while( i < NUM_SEGS && int3(fd->fd_seg[i].lsn) != 0 )
 	{
-		if( i > NUM_SEGS )
-		{
-			i++;
-			break;
-		}
-
 		theSeg = &(fd->fd_seg[i]);
 		num = int2(theSeg->num);
 
 		if( (int3(theSeg->lsn) + num) > dd_tot )
 		{
-			printf("*** Bad FD segment ($%6.6X-$%6.6X) for file: %s (Segement index: %d)\n", int3(theSeg->lsn), int3(theSeg->lsn)+num, path, i );
+			printf("*** Bad FD segment ($%6.6X-$%6.6X) for file: %s (Segement index: %d)\n", int3(theSeg->lsn), int3(theSeg->lsn)+num, EntryPath(&gEntries, entry, path, sizeof(path)), i );
 			gBadFD++;
 			i++;
 			continue;
@@ -500,13 +959,13 @@ static error_code ParseFDSegList( fd_stats *fd, u_int dd_tot, char *path, unsign
 		{
 			once = 0;
 			curLSN = int3(theSeg->lsn)+j;
-			
+
 			/* check for segment elements out of bounds */
 			if( curLSN > dd_tot )
 			{
 				if( once == 0 )
 				{
-					printf("*** Bad FD segment ($%6.6X-$%6.6X) for file: %s (Segement index: %d)\n", int3(theSeg->lsn), int3(theSeg->lsn)+num, path, i );
+					printf("*** Bad FD segment ($%6.6X-$%6.6X) for file: %s (Segement index: %d)\n", int3(theSeg->lsn), int3(theSeg->lsn)+num, EntryPath(&gEntries, entry, path, sizeof(path)), i );
 					gBadFD++;
 					once = 1;
 					ec = 1;
@@ -515,7 +974,7 @@ static error_code ParseFDSegList( fd_stats *fd, u_int dd_tot, char *path, unsign
 			else
 			{
 				/* Record path to this bit */
-				AddPathToBit( curLSN, path );
+				AddPathToBit( curLSN, entry );
 
 				/* Check if bit is already allocated */
 				if ( _os9_ckbit( secondaryBitmap, curLSN ) != 0 )
@@ -532,10 +991,10 @@ static error_code ParseFDSegList( fd_stats *fd, u_int dd_tot, char *path, unsign
 				}
 			}
 		}
-		
+
 		i++;
 	}
-	
+
 	return ec;
 }
 
@@ -543,33 +1002,33 @@ static error_code CompareAllocationMap( unsigned char *primaryAlloMap, unsigned
 {
 	error_code ec = 0;
 	int i, j, LSN;
-	
+
 	for(i=0; i< (dd_map / cluster_size); i++ )
 	{
 		int p, s;
-		
+
 		p = _os9_ckbit( primaryAlloMap, i );
-		
+
 		for( j=0; j<cluster_size; j++ )
 		{
 			LSN = i*cluster_size+j;
-			
+
 			s = _os9_ckbit( secondaryBitmap, LSN );
-			
+
 			if( p != s )
 			{
 				if( p == 0 )
 				{
 					printf("Logical sector %d ($%6.6X) of cluster %d ($%6.6X) in file structure but not in allocation map\n", LSN, LSN, i, i );
-					AddQuestionableCluster( i );
+					AddQuestionableCluster( LSN );
 					gFnotA++;
 				}
-				
+
 				if( s == 0 )
 				{
 					if( bOption == 0 )
 						printf("Logical sector %d ($%6.6X) of cluster %d ($%6.6X) in allocation map but not in file structure\n", LSN, LSN, i, i );
-						
+
 					gAnotF++;
 				}
 			}
@@ -579,44 +1038,38 @@ static error_code CompareAllocationMap( unsigned char *primaryAlloMap, unsigned
 	return(ec);
 }
 
+/* Only the questionable clusters get pathlists, built from the entries
+   that hold them */
+
 static void PathlistsForQuestionableClusters(void)
 {
-	qCluster_t	*tmp;
-	qBitPath_t	*bitpath, *tmpBP;
-	
-	while( qCluster != NULL )
+	qCluster_t	*cluster;
+	qOwner_t	*owner;
+	char		path[1024];
+
+	if (gOwner == NULL)
 	{
-		bitpath = gBitPaths;
-		
-		while( bitpath != NULL )
+		return;
+	}
+
+	for (cluster = qCluster; cluster != NULL; cluster = cluster->next)
+	{
+		for (owner = gOtherOwners; owner != NULL; owner = owner->next)
 		{
-			if( qCluster->lsn == bitpath->lsn )
-				printf("Cluster $%6.6X in path: %s\n", qCluster->lsn, bitpath->path );
-			
-			bitpath = bitpath->next;
+			if( cluster->lsn == owner->lsn )
+				printf("LSN $%6.6X in path: %s\n", cluster->lsn, EntryPath(&gEntries, owner->entry, path, sizeof(path)) );
 		}
 
-		tmp = qCluster->next;
-		free( qCluster );
-		qCluster = tmp;
-	}
-	
-	bitpath = gBitPaths;
-		
-	while( bitpath != NULL )
-	{
-		free( bitpath->path );
-		tmpBP = bitpath->next;
-		free( bitpath );
-		bitpath = tmpBP;
+		if( gOwner[cluster->lsn] != 0 )
+			printf("LSN $%6.6X in path: %s\n", cluster->lsn, EntryPath(&gEntries, gOwner[cluster->lsn] - 1, path, sizeof(path)) );
 	}
 }
 
 static void FreeQuestionableMemory(void)
 {
 	qCluster_t	*tmp;
-	qBitPath_t	*tmpBP;
-	
+	qOwner_t	*tmpOwner;
+
 	while( qCluster != NULL )
 	{
 		tmp = qCluster->next;
@@ -624,24 +1077,26 @@ static void FreeQuestionableMemory(void)
 		qCluster = tmp;
 	}
 
-	while( gBitPaths != NULL )
+	while( gOtherOwners != NULL )
 	{
-		free( gBitPaths->path );
-		tmpBP = gBitPaths->next;
-		free( gBitPaths );
-		gBitPaths = tmpBP;
+		tmpOwner = gOtherOwners->next;
+		free( gOtherOwners );
+		gOtherOwners = tmpOwner;
 	}
+
+	free( gOwner );
+	gOwner = NULL;
 }
 
 static char *strcatdup( char *orig, char *cat1, char *cat2 )
 {
 	char	*result;
-	
+
 	if( cat2 == NULL )
 		result = (char *)malloc( strlen(orig) + strlen(cat1) + 1 );
 	else
 		result = (char *)malloc( strlen(orig) + strlen(cat1) + strlen(cat2) + 1 );
-		
+
 	if( result != NULL )
 	{
 		strcpy( result, orig );
@@ -649,33 +1104,100 @@ static char *strcatdup( char *orig, char *cat1, char *cat2 )
 		if( cat2 != NULL )
 			strcat( result, cat2 );
 	}
-	
+
 	return result;
 }
 
+/* Add an entry to a list, returning its index */
+
+static int AddEntry( dList_t *list, int parent, int lsn, char *name )
+{
+	dEntry_t	*e;
+
+	if (list->count == list->size)
+	{
+		list->size = list->size ? list->size * 2 : 256;
+		list->entry = (dEntry_t *)realloc( list->entry, list->size * sizeof(dEntry_t) );
+		if( list->entry == NULL )
+		{
+			printf("Out of memory, terminating (003).\n");
+			exit(-1);
+		}
+	}
+
+	e = &list->entry[list->count];
+	memset(e, 0, sizeof(dEntry_t));
+	e->parent = parent;
+	e->lsn = lsn;
+	snprintf(e->name, sizeof(e->name), "%s", name);
+
+	return list->count++;
+}
+
+/* Build the pathlist of an entry from the entries above it */
+
+static char *EntryPath( dList_t *list, int entry, char *buffer, size_t size )
+{
+	dEntry_t	*e = &list->entry[entry];
+
+	if (e->parent < 0)
+	{
+		snprintf(buffer, size, "%s", list->base);
+	}
+	else
+	{
+		size_t	length;
+
+		EntryPath( list, e->parent, buffer, size );
+		length = strlen(buffer);
+		snprintf(buffer + length, size - length, "/%s", e->name);
+	}
+
+	return buffer;
+}
+
+static int ComparePending( const void *a, const void *b )
+{
+	const dPending_t *pa = a, *pb = b;
+
+	if (pa->lsn != pb->lsn)
+		return pa->lsn < pb->lsn ? -1 : 1;
+
+	return pa->seq - pb->seq;
+}
+
 static void AddQuestionableCluster( int cluster )
 {
 	qCluster_t *curCluster;
-	
+
 	curCluster = (qCluster_t *)malloc( sizeof(qCluster_t) );
 	if( curCluster == NULL )
 		return;
-	
+
 	curCluster->lsn = cluster;
 	curCluster->next = qCluster;
 	qCluster = curCluster;
 }
 
-static void AddPathToBit( int lsn, char *path )
+static void AddPathToBit( int lsn, int entry )
 {
-	qBitPath_t	*bitPath;
-	
-	bitPath = (qBitPath_t *)malloc( sizeof (qBitPath_t) );
-	if( bitPath == NULL )
+	qOwner_t	*owner;
+
+	if( gOwner == NULL )
 		return;
-	
-	bitPath->lsn = lsn;
-	bitPath->path = (char *)strdup( path );
-	bitPath->next = gBitPaths;
-	gBitPaths = bitPath;
+
+	if( gOwner[lsn] == 0 )
+	{
+		gOwner[lsn] = entry + 1;
+		return;
+	}
+
+	owner = (qOwner_t *)malloc( sizeof (qOwner_t) );
+	if( owner == NULL )
+		return;
+
+	owner->lsn = lsn;
+	owner->entry = entry;
+	owner->next = gOtherOwners;
+	gOtherOwners = owner;
 }
@@ -11,11 +11,15 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <math.h>
+#include <sys/time.h>
+#include <toolshed.h>
 
 /* globals */
 u_int buffer_size = 32768;
 
 error_code do_dsave(char *pgmname, char *source, char *target, int execute, int buffsize, int rewrite, int eoltranslate);
+static error_code dsave_tree(char *pgmname, char *source, char *target, int execute, int buffsize, int rewrite, int eoltranslate);
+static coco_path_id hold_image(char *pathlist);
 static char *ShellEscapePath(char *source, char *src_path_seperator, u_char *direntry_name_buffer);
 static char *EscapePart( char *dest, char *src );
 
@@ -145,9 +149,119 @@ int os9dsave(int argc, char *argv[])
 }
 
 
+/* in-process copy state */
+static char	*copy_buffer = NULL;
+static u_int	files_copied = 0;
+static double	bytes_copied = 0;
+
+
+/*
+ * do_dsave()
+ *
+ * Print the commands that copy 'source' to 'target' and, if 'execute'
+ * is set, carry them out.  The copy is done in this process with
+ * TSMakeDirectory and TSCopyFile, keeping a path open on OS-9 source
+ * and target images so that each is opened and its bitmap read once.
+ */
 error_code do_dsave(char *pgmname, char *source, char *target, int execute, int buffer_size, int rewrite, int eoltranslate)
 {
 	error_code	ec = 0;
+	coco_path_id	sourceImage, targetImage;
+	struct timeval	start, stop;
+	double		elapsed;
+
+	if (execute == 0)
+	{
+		return dsave_tree(pgmname, source, target, execute, buffer_size, rewrite, eoltranslate);
+	}
+
+	if (buffer_size <= 0)
+	{
+		buffer_size = 32768;
+	}
+
+	copy_buffer = malloc(buffer_size);
+	if (copy_buffer == NULL)
+	{
+		return(EOS_OM);
+	}
+
+	/* hold the source and target images open for the whole tree */
+	sourceImage = hold_image(source);
+	targetImage = hold_image(target);
+
+	files_copied = 0;
+	bytes_copied = 0;
+	gettimeofday(&start, NULL);
+
+	ec = dsave_tree(pgmname, source, target, execute, buffer_size, rewrite, eoltranslate);
+
+	gettimeofday(&stop, NULL);
+
+	if (sourceImage != NULL)
+	{
+		_coco_close(sourceImage);
+	}
+
+	if (targetImage != NULL)
+	{
+		_coco_close(targetImage);
+	}
+
+	free(copy_buffer);
+	copy_buffer = NULL;
+
+	/* report throughput */
+	elapsed = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1000000.0;
+
+	printf("%u files, %.0f bytes copied in %.2f seconds", files_copied, bytes_copied, elapsed);
+	if (elapsed > 0)
+	{
+		printf(" (%.1f files/sec, %.0f bytes/sec)", files_copied / elapsed, bytes_copied / elapsed);
+	}
+	printf("\n");
+
+	return(ec);
+}
+
+
+/* Open the root of the OS-9 image named in 'pathlist', if it is one */
+
+static coco_path_id hold_image(char *pathlist)
+{
+	coco_path_id	path;
+	_path_type	type;
+	char		imagePathList[1024];
+	char		*comma;
+
+	if (_coco_identify_image(pathlist, &type) != 0 || type != OS9)
+	{
+		return NULL;
+	}
+
+	strncpy(imagePathList, pathlist, sizeof(imagePathList) - 2);
+	imagePathList[sizeof(imagePathList) - 2] = '\0';
+
+	comma = strchr(imagePathList, ',');
+	if (comma == NULL)
+	{
+		return NULL;
+	}
+
+	comma[1] = '\0';
+
+	if (_coco_open(&path, imagePathList, FAM_DIR | FAM_READ) != 0)
+	{
+		return NULL;
+	}
+
+	return path;
+}
+
+
+static error_code dsave_tree(char *pgmname, char *source, char *target, int execute, int buffer_size, int rewrite, int eoltranslate)
+{
+	error_code	ec = 0, first_error = 0;
 	static int	level = 0;
 	coco_dir_entry	dirent;
 	char		command[1024];
@@ -231,9 +345,10 @@ error_code do_dsave(char *pgmname, char *source, char *target, int execute, int
 				puts(command);
 				if (execute) 
 				{
-					ec = system(command);
+					ec = TSMakeDirectory(newTarget);
 					if (ec != 0)
 					{
+						fprintf(stderr, "%s: error %d creating '%s'\n", pgmname, ec, newTarget);
 						_coco_close(sourcePath);
 
 						return(ec);
@@ -241,7 +356,12 @@ error_code do_dsave(char *pgmname, char *source, char *target, int execute, int
 				}
 
 				/* 4. call this function again */
-				do_dsave(pgmname, sourcePathList, newTarget, execute, buffer_size, rewrite, eoltranslate);
+				ec = dsave_tree(pgmname, sourcePathList, newTarget, execute, buffer_size, rewrite, eoltranslate);
+				if (ec != 0 && first_error == 0)
+				{
+					first_error = ec;
+				}
+				ec = 0;
 
 				/* 5. decrement level indicator */
 				level--;
@@ -276,12 +396,30 @@ error_code do_dsave(char *pgmname, char *source, char *target, int execute, int
 				puts(command);
 				if (execute)
 				{
-					ec = system(command);
+					char destPathList[1024];
+					u_int size = 0;
+
+					snprintf(destPathList, sizeof(destPathList), "%s%s%s", target, dst_path_seperator, direntry_name_buffer);
+					_coco_gs_size_pathlist(sourcePathList, &size);
+
+					/* like copy, report a failed file and carry on, returning the first error at the end */
+					ec = TSCopyFile(sourcePathList, destPathList, eoltranslate, rewrite, 0, 0, copy_buffer, buffer_size);
 					if (ec != 0)
 					{
-						_coco_close(sourcePath);
+						char errorstr[TS_MAXSTR];
 
-						return(ec);
+						TSReportError(ec, errorstr);
+						fprintf(stderr, "%s: error %d on file '%s': %s\n", pgmname, ec, sourcePathList, errorstr);
+						if (first_error == 0)
+						{
+							first_error = ec;
+						}
+						ec = 0;
+					}
+					else
+					{
+						files_copied++;
+						bytes_copied += size;
 					}
 				}
 				
@@ -300,7 +438,7 @@ error_code do_dsave(char *pgmname, char *source, char *target, int execute, int
 
 	_coco_close(sourcePath);
 
-	return(ec);
+	return(ec != 0 ? ec : first_error);
 }
 
 static char *ShellEscapePath(char *source, char *src_path_seperator, u_char *direntry_name_buffer)
@@ -17,7 +17,7 @@
 
 #define DragonBootSize	16	/* Size of Dragon boot area in sectors */
 
-static int do_format(char **argv, char *vdisk, int os968k, int quiet, int tracks, int sectorsPerTrack, int heads, int sectorSize, int clusterSize, char *diskName, int sectorAllocationSize, int tpi, int density, int formatEntire, int isDragon, int isHDD);
+static int do_format(char **argv, char *vdisk, int os968k, int quiet, int tracks, int sectorsPerTrack, int heads, int sectorSize, int clusterSize, char *diskName, int sectorAllocationSize, int tpi, int density, int formatEntire, int zeroFill, int isDragon, int isHDD);
 
 /* Help message */
 static char const * const helpMessage[] =
@@ -28,6 +28,8 @@ static char const * const helpMessage[] =
 	"     -bsX = bytes per sector (default = 256)\n",
 	"     -cX  = cluster size\n",
 	"     -e   = format entire disk (make full sized image)\n",
+	"     -z   = with -e, write out the empty sectors rather than\n",
+	"            leaving them as a hole in the image file\n",
 	"     -k   = make OS-9/68K LSN0\n",
 	"     -nX  = disk name\n",
 	"     -q   = quiet; do not report format summary\n",
@@ -66,6 +68,7 @@ int os9format(int argc, char **argv)
 	int sectorAllocationSize = 8;	/* default */
 	int os968k = 0;		/* assume OS-9/6809 LSN0 */
 	int formatEntire = 0;	/* format entire disk image */
+	int zeroFill = 0;	/* write out the empty sectors of an entire image */
 	int isDragon = 0;		/* format disk as Dragon, with reserved boot sectors at begining */
 	int isHDD = 0; /* Is this image for a hard drive */
 	
@@ -111,6 +114,10 @@ int os9format(int argc, char **argv)
 						os968k = 1;
 						break;
 
+					case 'z':
+						zeroFill = 1;
+						break;
+
 					case 'q':
 						quiet = 1;
 						break;
@@ -256,7 +263,7 @@ int os9format(int argc, char **argv)
 		}
 		else
 		{
-			do_format(argv, argv[i], os968k, quiet, tracks, sectorsPerTrack, heads, bytesPerSector, clusterSize, diskName, sectorAllocationSize, tpi, density, formatEntire, isDragon, isHDD);
+			do_format(argv, argv[i], os968k, quiet, tracks, sectorsPerTrack, heads, bytesPerSector, clusterSize, diskName, sectorAllocationSize, tpi, density, formatEntire, zeroFill, isDragon, isHDD);
 		}
 	}
 
@@ -265,12 +272,12 @@ int os9format(int argc, char **argv)
 
 
 
-static int do_format(char **argv, char *vdisk, int os968k, int quiet, int tracks, int sectorsPerTrack, int heads, int sectorSize, int clusterSize, char *diskName, int sectorAllocationSize, int tpi, int density, int formatEntire, int isDragon, int isHDD)
+static int do_format(char **argv, char *vdisk, int os968k, int quiet, int tracks, int sectorsPerTrack, int heads, int sectorSize, int clusterSize, char *diskName, int sectorAllocationSize, int tpi, int density, int formatEntire, int zeroFill, int isDragon, int isHDD)
 {
 	error_code	ec = 0;
 	native_path_id path;
 	lsn0_sect s0;
-	unsigned int totalSectors, totalBytes, sectorsLeft;
+	unsigned int totalSectors, totalBytes;
 	int b;
 	unsigned int sectorsToAlloc = 0;
 	unsigned int bitmapSectors, bitmapBytes;
@@ -324,8 +331,6 @@ static int do_format(char **argv, char *vdisk, int os968k, int quiet, int tracks
 		return(1);
 	}
 
-	sectorsLeft = int3(s0.dd_tot);
-
 	_int1(sectorsPerTrack, s0.dd_tks);
 
 	bitmapBytes = int3(s0.dd_tot) / (8 * clusterSize) + (int3(s0.dd_tot) % (8 * clusterSize) != 0);
@@ -447,20 +452,20 @@ static int do_format(char **argv, char *vdisk, int os968k, int quiet, int tracks
 
 	/***** Write LSN0 *****/
 	{
-		u_int size = sizeof(s0);
-		u_int size2 = sectorSize - size;
-
-		/* write LSN0 structure */
-		_native_write(path, &s0, &size);
+		u_int size = sectorSize;
+		char *sector;
 
-		/* fill in rest of sector with zeros */
-		while (size2--)
+		/* write LSN0 structure, filling in rest of sector with zeros */
+		sector = (char *)calloc(sectorSize, 1);
+		if (sector == NULL)
 		{
-			u_int size = 1;
-			char nil = '\0';
-
-			_native_write(path, &nil, &size);
+			return(1);
 		}
+
+		memcpy(sector, &s0, sizeof(s0) < (size_t)sectorSize ? sizeof(s0) : (size_t)sectorSize);
+		_native_write(path, sector, &size);
+
+		free(sector);
 	}
 
 	/***** Write Bitmap Sector(s) *****/
@@ -516,8 +521,6 @@ static int do_format(char **argv, char *vdisk, int os968k, int quiet, int tracks
 
 			clusters = sectorsToAlloc / clusterSize;
 			_os9_allbit(bitmap, 0, clusters);
-
-			sectorsLeft -= sectorsToAlloc;
 		}
 
 		_native_write(path, bitmap, &size);
@@ -607,25 +610,15 @@ static int do_format(char **argv, char *vdisk, int os968k, int quiet, int tracks
 		free(allocedSectors);
 	}
 
-	/* Write Rest of disk as empty sectors */
+	/* Write Rest of disk as empty sectors, or just make the image long
+	   enough to hold them */
 	if (formatEntire == 1)
 	{
-		char *oneEmptySector;
-
-		oneEmptySector = (char *)malloc(sectorSize);
+		ec = _native_ss_fill(path, (off_t)int3(s0.dd_tot) * sectorSize, zeroFill);
 
-		if (oneEmptySector != NULL)
+		if (ec != 0)
 		{
-			memset(oneEmptySector, 0, sectorSize);
-
-			while (sectorsLeft--)
-			{
-				u_int size = sectorSize;
-
-				_native_write(path, oneEmptySector, &size);
-			}
-
-			free(oneEmptySector);
+			fprintf(stderr, "%s: error %d filling out virtual disk\n", argv[0], ec);
 		}
 	}
 
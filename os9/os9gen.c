@@ -11,6 +11,7 @@
 #include <sys/stat.h>
 #include <cocotypes.h>
 #include <cocopath.h>
+#include <os9module.h>
 
 
 struct personality
@@ -19,6 +20,7 @@ struct personality
 };
 
 static int do_os9gen(char **argv, char *device, char *bootfile, char *trackfile, struct personality *hwtype, int extended);
+static void check_bootfile(char **argv, char *bootfile, u_char *buffer, u_int size);
 
 static struct personality coco = { 18 * 34 };
 static struct personality dragon = { 2 };
@@ -309,6 +311,9 @@ static int do_os9gen(char **argv, char *device, char *bootfile, char *trackfile,
 		
 		_coco_close(cpath);	/* We're done with the path now */
 
+		/* 2.2.1. Make sure it holds good modules; OS-9 won't boot past a bad one */
+		check_bootfile(argv, bootfile, (u_char *)bootfileMem, size);
+
 		/* 2.3. Create a file called 'OS9Boot' in the root dir of device */
 		sprintf(buffer, "%s,OS9Boot", device);
 
@@ -377,3 +382,52 @@ static int do_os9gen(char **argv, char *device, char *bootfile, char *trackfile,
 
 	return(0);
 }
+
+
+
+/*
+ * check_bootfile()
+ *
+ * Warn about any module in the bootfile with a bad header or CRC, and
+ * about a bootfile that ends part way through a module or doesn't start
+ * with one at all.  Anything after the last good module is taken to be
+ * padding.
+ */
+static void check_bootfile(char **argv, char *bootfile, u_char *buffer, u_int size)
+{
+	OS9_MODSCAN_t *table;
+	int count, i;
+
+
+	if (_os9_modscan(buffer, size, 0, &table, &count) != 0)
+	{
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		switch (table[i].status)
+		{
+			case MODSCAN_BADCRC:
+				fprintf(stderr, "%s: warning: module at offset $%X in '%s' has a bad CRC\n", argv[0], table[i].offset, bootfile);
+				break;
+
+			case MODSCAN_BADPARITY:
+				fprintf(stderr, "%s: warning: module at offset $%X in '%s' has a bad header parity\n", argv[0], table[i].offset, bootfile);
+				break;
+
+			case MODSCAN_SHORT:
+				fprintf(stderr, "%s: warning: module at offset $%X in '%s' is short\n", argv[0], table[i].offset, bootfile);
+				break;
+
+			case MODSCAN_NONE:
+				if (table[i].offset == 0)
+				{
+					fprintf(stderr, "%s: warning: '%s' doesn't start with an OS-9 module\n", argv[0], bootfile);
+				}
+				break;
+		}
+	}
+
+	free(table);
+}
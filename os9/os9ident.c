@@ -4,6 +4,7 @@
  * $Id$
  ********************************************************************/
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "cocotypes.h"
@@ -25,7 +26,6 @@ static char const * const langs[16] = {
 };
 
 static int shortFlag = 0;
-static u_char *buffer;
 
 
 
@@ -69,7 +69,7 @@ static char *modPermission(int perm)
 }
 
 
-static void ident_osk(OSK_MODULE_t *mod)
+static void ident_osk(OSK_MODULE_t *mod, int crc_good)
 {
 	int    i;
 	char   *name;
@@ -85,7 +85,7 @@ static void ident_osk(OSK_MODULE_t *mod)
 	printf("Header for :      %s\n", name);
 	printf("Module size:      $%-8X     #%d\n", module_size, module_size);
 	printf("Owner:            %d.%d\n", mod->owner[0], mod->owner[1]);
-	printf("Module CRC :      $%02X%02X%02X       %s CRC\n", CRC[0], CRC[1], CRC[2], _osk_crc(mod) ? "Good" : "Bad" );
+	printf("Module CRC :      $%02X%02X%02X       %s CRC\n", CRC[0], CRC[1], CRC[2], crc_good ? "Good" : "Bad" );
     printf("Header Parity:    $%04X         Good parity\n", int2(mod->parity));
     printf("Edition:          $%-8X     #%d\n", int2(mod->edit), int2(mod->edit));
 	printf("Ty/La At/Rev      $%02X%02X         $%02X%02X\n", mod->type, mod->lang, mod->attr, mod->revs);
@@ -133,7 +133,7 @@ static void ident_osk(OSK_MODULE_t *mod)
 }
 
 
-static void ident_os9(OS9_MODULE_t *mod)
+static void ident_os9(OS9_MODULE_t *mod, int crc_good)
 {
 	int i;
 	char *name;
@@ -154,7 +154,7 @@ static void ident_os9(OS9_MODULE_t *mod)
 	if (shortFlag == 1)  {
 		char CRCindicator;
 
-		if (_os9_crc(mod) != 0)  {
+		if (crc_good)  {
 			CRCindicator = '.';
 		}
 		else  {
@@ -167,7 +167,7 @@ static void ident_os9(OS9_MODULE_t *mod)
 
 	printf("Header for : %s\n", name);
 	printf("Module size: $%X  #%d\n", module_size, module_size);
-	printf("Module CRC : $%02X%02X%02X (%s)\n", CRC[0], CRC[1], CRC[2], _os9_crc(mod) ? "Good" : "Bad" );
+	printf("Module CRC : $%02X%02X%02X (%s)\n", CRC[0], CRC[1], CRC[2], crc_good ? "Good" : "Bad" );
 	printf("Hdr parity : $%02X\n", hdrparity);
 
 	switch ((mod->tyla & TYPE_MASK) >> 4)  {
@@ -209,11 +209,14 @@ static void ident_os9(OS9_MODULE_t *mod)
 static int do_ident(char **argv, char *filename)
 {
     error_code	ec = 0;
-    int i;
     coco_path_id path;
-    OS9_MODULE_t *os9mod = (OS9_MODULE_t *)buffer;
-    OSK_MODULE_t *oskmod = (OSK_MODULE_t *)buffer;
+    u_char *buffer;
+    u_int size = 0;
+    OS9_MODSCAN_t *table;
+    int count, i;
+
 
+    /* 1. Read the whole file. */
 
     ec = _coco_open(&path, filename, FAM_READ);
 
@@ -222,82 +225,79 @@ static int do_ident(char **argv, char *filename)
         return(ec);
     }
 
+    _coco_gs_size(path, &size);
 
-    while (_coco_gs_eof(path) == 0)
+    buffer = malloc(size + 1);
+
+    if (buffer == NULL)
     {
-        u_int size = 2;
+        _coco_close(path);
+        fprintf(stderr, "%s: cannot allocate memory\n", argv[0]);
+        return(EOS_OM);
+    }
 
-        ec = _coco_read(path, buffer, &size);
+    if (size > 0 && (ec = _coco_read(path, buffer, &size)) != 0)
+    {
+        fprintf(stderr, "%s: error reading file %s\n", argv[0], filename);
+        free(buffer);
+        _coco_close(path);
+        return(ec);
+    }
 
-        if (ec != 0)
-        {
-            fprintf(stderr, "%s: error reading file %s\n", argv[0], filename);
-            return(ec);
-        }
-     
-        if ((os9mod->id[0] == OS9_ID0) && (os9mod->id[1] == OS9_ID1))
-        {
-            size = OS9_HEADER_SIZE - 2;
+    _coco_close(path);
 
-            if ((ec = _coco_read(path, buffer+2, &size)) != 0)
-            {
-                fprintf(stderr, "%s: error reading file %s\n", argv[0], filename);
-                return(ec);
-            }
 
-            if ((i = _os9_header(os9mod)) != 0xFF)
-            {
-                fprintf(stderr, "Bad header parity.  Expected 0xFF, got 0x%02X\n\n", i);
-                break;
-            }
+    /* 2. Find the modules in it, one after another. */
 
-            size = i = int2(os9mod->size) - OS9_HEADER_SIZE;
-            ec = _coco_read(path, buffer + OS9_HEADER_SIZE, &size);
+    ec = _os9_modscan(buffer, size, 0, &table, &count);
 
-            if (ec != 0)
-            {
-                printf("Module short.  Expected 0x%04X, got 0x%04X\n\n", i + OS9_HEADER_SIZE, size + OS9_HEADER_SIZE);
-                break;
-            }
+    if (ec != 0)
+    {
+        free(buffer);
+        return(ec);
+    }
 
-            ident_os9(os9mod);
-        }
-        else if ((os9mod->id[0] == OSK_ID0) && (os9mod->id[1] == OSK_ID1))
-        {
-            size = OSK_HEADER_SIZE-2;
-                
-            if ((ec = _coco_read(path, buffer+2, &size)) != 0)
-            {
-                fprintf(stderr, "%s: error reading file %s\n", argv[0], filename);
-                return(ec);
-            }
+    for (i = 0; i < count; i++)
+    {
+        OS9_MODSCAN_t *m = &table[i];
 
-            if ((i = _osk_header(oskmod)) != 0xFFFF)
-            {
-                fprintf(stderr, "Bad header parity.  Expected 0xFFFF, got 0x%04X\n\n", i);
+        switch (m->status)
+        {
+            case MODSCAN_GOOD:
+            case MODSCAN_BADCRC:
+                if (m->osk)
+                {
+                    ident_osk((OSK_MODULE_t *)(buffer + m->offset), m->status == MODSCAN_GOOD);
+                }
+                else
+                {
+                    ident_os9((OS9_MODULE_t *)(buffer + m->offset), m->status == MODSCAN_GOOD);
+                }
                 break;
-            }
 
-            size = i = int4(oskmod->size) - OSK_HEADER_SIZE;
-
-            ec = _coco_read(path, buffer + OSK_HEADER_SIZE, &size);
+            case MODSCAN_BADPARITY:
+                if (m->osk)
+                {
+                    fprintf(stderr, "Bad header parity.  Expected 0xFFFF, got 0x%04X\n\n", m->parity);
+                }
+                else
+                {
+                    fprintf(stderr, "Bad header parity.  Expected 0xFF, got 0x%02X\n\n", m->parity);
+                }
+                break;
 
-            if (ec != 0)
-            {
-                printf("Module short.  Expected 0x%04X, got 0x%04X\n\n", i + OSK_HEADER_SIZE, size + OSK_HEADER_SIZE);
+            case MODSCAN_SHORT:
+                printf("Module short.  Expected 0x%04X, got 0x%04X\n\n", m->size, size - m->offset);
                 break;
-            }
 
-            ident_osk(oskmod);
-        }
-        else 
-        {
-            fprintf(stderr,"Not OS9 module, skipping.\n\n");
-            break;
+            default:
+                fprintf(stderr,"Not OS9 module, skipping.\n\n");
+                break;
         }
     }
 
-    _coco_close(path);
+    free(table);
+    free(buffer);
 
 
     return(0);
@@ -318,17 +318,6 @@ int os9ident(int argc, char **argv)
     }
 
 
-    /* An OS-9 module can't be larger than this */
-    
-    buffer = malloc(65535);
-
-    if (buffer == 0)
-    {
-        fprintf(stderr, "%s: cannot allocate memory\n", argv[0]);
-        return(1);
-    }
-
-
     /* Walk command line for options */
     
     for (i = 1; i < argc; i++)
@@ -379,8 +368,5 @@ int os9ident(int argc, char **argv)
         }
     }
 
-    free(buffer);
-
-
     return(ec);
 }
@@ -96,86 +96,110 @@ int os9modbust(int argc, char **argv)
 static int do_modbust(char **argv, char *filename)
 {
 	error_code	ec = 0;
-	char buffer[256];
-	os9_path_id path;
-	u_char *module;
+	coco_path_id path;
+	u_char *buffer;
+	u_int size = 0;
+	OS9_MODSCAN_t *table;
+	int count, i;
 
 
-	ec = _os9_open(&path, filename, FAM_READ);
+	/* 1. Read the whole file. */
+
+	ec = _coco_open(&path, filename, FAM_READ);
 
 	if (ec != 0)
 	{
 		return ec;
 	}
-    
-	while (_os9_gs_eof(path) == 0)
+
+	_coco_gs_size(path, &size);
+
+	buffer = (u_char *)malloc(size + 1);
+
+	if (buffer == NULL)
 	{
-		u_int size = 1;
+		_coco_close(path);
+		printf("Memory allocation error\n");
+		return(1);
+	}
 
-		ec = _os9_read(path, buffer, &size);
-		if (ec != 0)
-		{
-			fprintf(stderr, "%s: error reading file %s\n", argv[0], filename);
+	if (size > 0 && (ec = _coco_read(path, buffer, &size)) != 0)
+	{
+		fprintf(stderr, "%s: error reading file %s\n", argv[0], filename);
+		free(buffer);
+		_coco_close(path);
 
-			return ec;
-		}
-     
-		if (buffer[0] == '\x87')
-		{
-			coco_file_stat fstat;
-			size = 1;
-			
-			ec = _os9_read(path, buffer, &size);
+		return ec;
+	}
 
-			if (buffer[0] == '\xCD')
-			{
-				coco_path_id path2;
-				char name[256];
-				int nameoffset;
+	_coco_close(path);
 
-				/* We have an OS-9 module - get size */
-				size = 2;
+	buffer[size] = 0x80;	/* so a module name can't run off the end */
 
-				ec = _os9_read(path, buffer, &size);
-				size = int2((u_char *)buffer);
-				module = (u_char *)malloc(size);
 
-				if (module == NULL)
-				{
-					printf("Memory allocation error\n");
-					return(1);
-				}
+	/* 2. Find every module in it, wherever it is. */
 
-				module[0] = 0x87;
-				module[1] = 0xCD;
-				module[2] = buffer[0];
-				module[3] = buffer[1];
-				size -= 4;
-				ec = _os9_read(path, &module[4], &size);
-				nameoffset = int2(&module[4]);
-				memcpy(name, &module[nameoffset], OS9Strlen(&module[nameoffset]));
-				OS9StringToCString((u_char *)name);
-				printf("Busting module %s...\n", name);
-				
-				fstat.perms = FAP_READ | FAP_WRITE;
-				ec = _coco_create(&path2, name, FAM_WRITE, &fstat);
-
-				if (ec != 0)
-				{
-					printf("Error creating file %s\n", name);
-					return(1);
-				}
+	ec = _os9_modscan(buffer, size, MODSCAN_SEARCH, &table, &count);
 
-				size += 4;
-				_coco_write(path2, module, &size);
-				_coco_close(path2);
+	if (ec != 0)
+	{
+		free(buffer);
 
-				free(module);
-			}
+		return ec;
+	}
+
+
+	/* 3. Write each one out to a file of its own name. */
+
+	for (i = 0; i < count; i++)
+	{
+		coco_file_stat fstat;
+		coco_path_id path2;
+		char name[256];
+		u_char *module = buffer + table[i].offset;
+		int nameoffset, length;
+
+		if (table[i].status != MODSCAN_GOOD && table[i].status != MODSCAN_BADCRC)
+		{
+			continue;
+		}
+
+		nameoffset = int2(&module[4]);
+		length = nameoffset < table[i].size ? OS9Strlen(&module[nameoffset]) : 0;
+
+		if (length == 0 || length > sizeof(name) - 1 || nameoffset + length > table[i].size)
+		{
+			fprintf(stderr, "%s: module at offset $%X has a bad name, skipping\n", argv[0], table[i].offset);
+			continue;
+		}
+
+		memcpy(name, &module[nameoffset], length);
+		OS9StringToCString((u_char *)name);
+		printf("Busting module %s...\n", name);
+
+		if (table[i].status == MODSCAN_BADCRC)
+		{
+			fprintf(stderr, "%s: module %s has a bad CRC\n", argv[0], name);
 		}
+
+		fstat.perms = FAP_READ | FAP_WRITE;
+		ec = _coco_create(&path2, name, FAM_WRITE, &fstat);
+
+		if (ec != 0)
+		{
+			printf("Error creating file %s\n", name);
+			free(table);
+			free(buffer);
+			return(1);
+		}
+
+		size = table[i].size;
+		_coco_write(path2, module, &size);
+		_coco_close(path2);
 	}
 
-	_os9_close(path);
+	free(table);
+	free(buffer);
 
 
 	return 0;
@@ -0,0 +1,99 @@
+/********************************************************************
+ * writeback-full.c - fill an OS-9 image through a write-back path
+ *
+ * Writes a file until the disk is full, then syncs and closes it and
+ * checks that it reads back at the size written.  Run by
+ * writeback-full.sh.
+ *
+ * $Id$
+ ********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cocotypes.h"
+#include "os9path.h"
+
+
+int main(int argc, char **argv)
+{
+	os9_path_id path;
+	char pathlist[512], buffer[4096], check[4096];
+	u_int size, total = 0, left, file_size = 0;
+	error_code ec;
+
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: writeback-full <image>\n");
+		return 1;
+	}
+
+	snprintf(pathlist, sizeof(pathlist), "%s,full", argv[1]);
+	memset(buffer, 0x5A, sizeof(buffer));
+
+
+	/* 1. Write until the disk fills, holding the FD back. */
+
+	if ((ec = _os9_create(&path, pathlist, FAM_READ | FAM_WRITE, FAP_READ | FAP_WRITE)) != 0)
+	{
+		fprintf(stderr, "create: error %d\n", ec);
+		return 1;
+	}
+
+	_os9_ss_writeback(path, 1);
+
+	do
+	{
+		size = sizeof(buffer);
+
+		if ((ec = _os9_write(path, buffer, &size)) == 0)
+		{
+			total += size;
+		}
+	}
+	while (ec == 0);
+
+	if (ec != EOS_DF)
+	{
+		fprintf(stderr, "write: error %d\n", ec);
+		return 1;
+	}
+
+	_os9_ss_sync(path);
+	_os9_close(path);
+
+
+	/* 2. It must read back at the size written. */
+
+	if ((ec = _os9_open(&path, pathlist, FAM_READ)) != 0)
+	{
+		fprintf(stderr, "open: error %d\n", ec);
+		return 1;
+	}
+
+	_os9_gs_size(path, &file_size);
+
+	printf("wrote %u bytes, file is %u bytes\n", total, file_size);
+
+	if (total == 0 || file_size != total)
+	{
+		return 1;
+	}
+
+	for (left = total; left > 0; left -= size)
+	{
+		size = sizeof(check);
+
+		if (_os9_read(path, check, &size) != 0 || memcmp(buffer, check, size) != 0)
+		{
+			fprintf(stderr, "read back: data differs\n");
+			return 1;
+		}
+	}
+
+	_os9_close(path);
+
+
+	return 0;
+}
@@ -0,0 +1,24 @@
+#!/bin/sh -e
+
+# Fill a small OS-9 image through a write-back path; the file must
+# keep what was written and no cluster may be left allocated outside it.
+
+OS9=$PWD/build/unix/os9/os9
+LIBS="$PWD/build/unix/librbf/librbf.a $PWD/build/unix/libmisc/libmisc.a $PWD/build/unix/libsys/libsys.a"
+SRC=$PWD/tests/writeback-full.c
+INC=$PWD/include
+
+TDIR=$(mktemp -d)
+cd $TDIR || exit 1
+
+${CC:-cc} -I$INC -o writeback-full $SRC $LIBS
+
+$OS9 format -q -l400 os9dsk
+./writeback-full os9dsk
+
+$OS9 dir -e os9dsk,
+$OS9 dcheck os9dsk | tee dcheck.out
+grep -q "^0 clusters in allocation map but not in file structure" dcheck.out
+
+cd ..
+rm -r $TDIR